@@ -198,4 +198,107 @@ const char *ast_to_str(ast_t *ast) {
     return CORD_to_char_star(c);
 }
 
+typedef void (*ast_visitor_t)(ast_t*, void*);
+
+static void visit_ast(ast_t *ast, ast_visitor_t visit, void *userdata)
+{
+    if (ast) visit(ast, userdata);
+}
+
+static void visit_ast_list(List(ast_t*) asts, ast_visitor_t visit, void *userdata)
+{
+    for (int64_t i = 0; asts && i < LIST_LEN(asts); i++)
+        visit_ast(LIST_ITEM(asts, i), visit, userdata);
+}
+
+static void visit_args(args_t args, ast_visitor_t visit, void *userdata)
+{
+    visit_ast_list(args.types, visit, userdata);
+    visit_ast_list(args.defaults, visit, userdata);
+}
+
+static void visit_args_list(List(args_t) args, ast_visitor_t visit, void *userdata)
+{
+    for (int64_t i = 0; args && i < LIST_LEN(args); i++)
+        visit_args(LIST_ITEM(args, i), visit, userdata);
+}
+
+void visit_ast_children(ast_t *ast, ast_visitor_t visit, void *userdata)
+{
+#define F(field) _Generic((data->field), \
+                          ast_t*: visit_ast, \
+                          List(ast_t*): visit_ast_list, \
+                          args_t: visit_args, \
+                          List(args_t): visit_args_list)(data->field, visit, userdata);
+#define T(t, ...) case t: { auto data = Match(ast, t); (void)data; __VA_ARGS__ break; }
+#define BINOP(b) T(b, F(lhs) F(rhs))
+#define UNOP(u) T(u, F(value))
+
+    switch (ast->tag) {
+        T(Nil, F(type))
+        T(Range, F(first) F(last) F(step))
+        T(StringJoin, F(children))
+        T(Interp, F(value))
+        T(Predeclare, F(var) F(type))
+        T(Declare, F(var) F(value))
+        T(Assign, F(targets) F(values))
+        BINOP(AddUpdate) BINOP(SubtractUpdate) BINOP(MultiplyUpdate) BINOP(DivideUpdate) BINOP(AndUpdate) BINOP(XorUpdate)
+        BINOP(OrUpdate) BINOP(Add) BINOP(Subtract) BINOP(Multiply) BINOP(Divide) BINOP(Power) BINOP(Modulus) BINOP(Modulus1)
+        BINOP(And) BINOP(Or) BINOP(Xor) BINOP(Equal) BINOP(NotEqual) BINOP(Greater) BINOP(GreaterEqual)
+        BINOP(Less) BINOP(LessEqual) BINOP(LeftShift) BINOP(RightShift)
+        T(In, F(member) F(container))
+        T(NotIn, F(member) F(container))
+        BINOP(Concatenate) BINOP(ConcatenateUpdate)
+        UNOP(Not) UNOP(Negative) UNOP(TypeOf) UNOP(SizeOf) UNOP(HeapAllocate) UNOP(StackReference)
+        T(Min, F(lhs) F(rhs) F(key))
+        T(Max, F(lhs) F(rhs) F(key))
+        T(Mix, F(lhs) F(rhs) F(key))
+        T(Array, F(type) F(items))
+        T(Table, F(key_type) F(value_type) F(fallback) F(default_value) F(entries))
+        T(TableEntry, F(key) F(value))
+        T(FunctionDef, F(args) F(ret_type) F(body) F(cache))
+        T(Lambda, F(args) F(body))
+        T(FunctionCall, F(fn) F(args) F(extern_return_type))
+        T(KeywordArg, F(arg))
+        T(Block, F(statements))
+        T(Do, F(body) F(else_body))
+        T(For, F(index) F(value) F(first) F(iter) F(body) F(between) F(empty))
+        T(While, F(condition) F(body) F(between))
+        T(Repeat, F(body) F(between))
+        T(If, F(subject) F(patterns) F(blocks))
+        UNOP(Return)
+        T(Fail, F(message))
+        T(Extern, F(type))
+        T(TypeArray, F(item_type))
+        T(TypeTable, F(key_type) F(value_type))
+        T(TypeDef, F(type) F(definitions))
+        T(TypeStruct, F(members))
+        T(TypeFunction, F(args) F(ret_type))
+        T(TypePointer, F(pointed))
+        T(TypeMeasure, F(type))
+        T(Variant, F(type) F(value))
+        T(TypeTypeAST, F(type))
+        T(Cast, F(value) F(type))
+        T(Bitcast, F(value) F(type))
+        T(Struct, F(type) F(members))
+        T(TypeTaggedUnion, F(tag_args))
+        T(TaggedUnionField, F(value))
+        T(Index, F(indexed) F(index))
+        T(FieldAccess, F(fielded))
+        T(UnitDef, F(derived) F(base))
+        T(ConvertDef, F(source_type) F(target_type) F(body))
+        T(Reduction, F(iter) F(combination) F(fallback))
+        T(DocTest, F(expr))
+        T(Defer, F(body))
+        T(With, F(var) F(expr) F(cleanup) F(body))
+        T(Extend, F(type) F(body))
+        T(Using, F(used) F(body))
+    default: break;
+#undef BINOP
+#undef UNOP
+#undef F
+#undef T
+    }
+}
+
 // vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -5,14 +5,16 @@
 #include <libgccjit.h>
 
 #include "files.h"
+#include "libsss/arena.h"
 #include "libsss/list.h"
 #include "compile/libgccjit_abbrev.h"
+#include "stats.h"
 #include "util.h"
 
-#define NewAST(_file, _start, _end, ast_tag, ...) (new(ast_t, .file=_file, .start=_start, .end=_end,\
+#define NewAST(_file, _start, _end, ast_tag, ...) (++compile_counts.ast_nodes, arena_new(ast_t, .file=_file, .start=_start, .end=_end,\
                                                      .tag=ast_tag, .__data.ast_tag={__VA_ARGS__}))
-#define FakeAST(ast_tag, ...) (new(ast_t, .tag=ast_tag, .__data.ast_tag={__VA_ARGS__}))
-#define WrapAST(ast, ast_tag, ...) (new(ast_t, .file=(ast)->file, .start=(ast)->start, .end=(ast)->end, .tag=ast_tag, .__data.ast_tag={__VA_ARGS__}))
+#define FakeAST(ast_tag, ...) (arena_new(ast_t, .tag=ast_tag, .__data.ast_tag={__VA_ARGS__}))
+#define WrapAST(ast, ast_tag, ...) (arena_new(ast_t, .file=(ast)->file, .start=(ast)->start, .end=(ast)->end, .tag=ast_tag, .__data.ast_tag={__VA_ARGS__}))
 #define StringAST(ast, _str) WrapAST(ast, StringLiteral, .str=heap_str(_str))
 
 typedef enum {
@@ -289,7 +291,7 @@ struct ast_s {
         struct {
             const char *path;
             sss_file_t *file;
-            bool main_program;
+            bool main_program, library;
         } Use;
         struct {
             ast_t *member, *container;
@@ -308,5 +310,7 @@ struct ast_s {
 };
 
 const char *ast_to_str(ast_t *ast);
+// Call `visit` on each of the AST's direct children
+void visit_ast_children(ast_t *ast, void (*visit)(ast_t*, void*), void *userdata);
 
 // vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -0,0 +1,173 @@
+//
+// cache.c - An on-disk cache of compiled programs.
+//
+// Compiled programs are stored as shared objects in $XDG_CACHE_HOME/sss/ (or
+// ~/.cache/sss/). Each program has two files:
+//   <base>.deps - a list of the absolute paths of all modules the program
+//                 transitively `use`s, where <base> is a hash of the main
+//                 file's source, the compiler version, and compiler flags.
+//   <key>.so    - the compiled program, where <key> is a hash of <base> and
+//                 the contents of every file listed in <base>.deps
+// A change to any of the source files (or the set of files used) produces a
+// different key, so stale entries are never loaded, only left behind.
+//
+
+#include <err.h>
+#include <errno.h>
+#include <gc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "util.h"
+#include "SipHash/halfsiphash.h"
+
+static const uint8_t cache_key_vector[8] = "sss-pgm";
+
+static bool mkdir_p(const char *path)
+{
+    char *dir = heap_str(path);
+    for (char *p = dir + 1; *p; p++) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+            return false;
+        *p = '/';
+    }
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+const char *get_cache_dir(void)
+{
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    const char *dir;
+    if (xdg_cache && xdg_cache[0] == '/')
+        dir = heap_strf("%s/sss", xdg_cache);
+    else if (getenv("HOME"))
+        dir = heap_strf("%s/.cache/sss", getenv("HOME"));
+    else
+        return NULL;
+    return mkdir_p(dir) ? dir : NULL;
+}
+
+static void write_chunk(FILE *out, const char *data, size_t len)
+{
+    // Length-prefix each chunk so that chunk boundaries can't be confused
+    fwrite(&len, sizeof(len), 1, out);
+    fwrite(data, 1, len, out);
+}
+
+static const char *hash_bytes(const char *data, size_t len)
+{
+    uint64_t hash;
+    halfsiphash(data, len, cache_key_vector, (uint8_t*)&hash, sizeof(hash));
+    return heap_strf("%016lx", hash);
+}
+
+static const char *base_key(sss_file_t *f, const char *flags)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&buf, &size);
+    write_chunk(out, SSS_VERSION, strlen(SSS_VERSION));
+    write_chunk(out, flags, strlen(flags));
+    const char *ssspath = getenv("SSSPATH");
+    write_chunk(out, ssspath ? ssspath : "", ssspath ? strlen(ssspath) : 0);
+    write_chunk(out, f->filename, strlen(f->filename));
+    write_chunk(out, f->text, f->len);
+    fclose(out);
+    const char *key = hash_bytes(buf, size);
+    free(buf);
+    return key;
+}
+
+// Compute the full key from the base key and the current contents of each dependency
+static const char *full_key(const char *base, List(const char*) deps)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&buf, &size);
+    write_chunk(out, base, strlen(base));
+    LIST_FOR (deps, path, _) {
+        sss_file_t *dep = sss_load_file(*path);
+        if (!dep) {
+            fclose(out);
+            free(buf);
+            return NULL;
+        }
+        write_chunk(out, *path, strlen(*path));
+        write_chunk(out, dep->text, dep->len);
+    }
+    fclose(out);
+    const char *key = hash_bytes(buf, size);
+    free(buf);
+    return key;
+}
+
+//
+// Return the path to a cached shared object for the given file and flags, if
+// one exists and is up-to-date with the source files, otherwise NULL.
+//
+const char *cache_lookup(sss_file_t *f, const char *flags)
+{
+    const char *dir = get_cache_dir();
+    if (!dir) return NULL;
+    const char *base = base_key(f, flags);
+    FILE *deps_file = fopen(heap_strf("%s/%s.deps", dir, base), "r");
+    if (!deps_file) return NULL;
+
+    NEW_LIST(const char*, deps);
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, deps_file)) > 0) {
+        if (line[len-1] == '\n') line[--len] = '\0';
+        if (len > 0) APPEND(deps, heap_str(line));
+    }
+    if (line) free(line);
+    fclose(deps_file);
+
+    const char *key = full_key(base, deps);
+    if (!key) return NULL;
+    const char *so_path = heap_strf("%s/%s.so", dir, key);
+    return access(so_path, R_OK) == 0 ? so_path : NULL;
+}
+
+//
+// Record the modules used by a program and return the path where its compiled
+// shared object should be stored (or NULL if the cache isn't writable).
+//
+const char *cache_store_path(sss_file_t *f, const char *flags, sss_hashmap_t *used_files)
+{
+    const char *dir = get_cache_dir();
+    if (!dir) return NULL;
+    const char *base = base_key(f, flags);
+
+    NEW_LIST(const char*, deps);
+    for (uint32_t i = 1; i <= used_files->count; i++) {
+        auto entry = hnth(used_files, i, const char*, sss_file_t*);
+        if (!streq(entry->key, f->filename))
+            APPEND(deps, entry->key);
+    }
+
+    const char *deps_path = heap_strf("%s/%s.deps", dir, base);
+    const char *tmp_path = heap_strf("%s.%d.tmp", deps_path, getpid());
+    FILE *deps_file = fopen(tmp_path, "w");
+    if (!deps_file) return NULL;
+    LIST_FOR (deps, path, _)
+        fprintf(deps_file, "%s\n", *path);
+    fclose(deps_file);
+    if (rename(tmp_path, deps_path) != 0) {
+        unlink(tmp_path);
+        return NULL;
+    }
+
+    const char *key = full_key(base, deps);
+    return key ? heap_strf("%s/%s.so", dir, key) : NULL;
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
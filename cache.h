@@ -0,0 +1,11 @@
+// cache.h - An on-disk cache of compiled programs, keyed by source content
+#pragma once
+
+#include "files.h"
+#include "libsss/hashmap.h"
+
+const char *get_cache_dir(void);
+const char *cache_lookup(sss_file_t *f, const char *flags);
+const char *cache_store_path(sss_file_t *f, const char *flags, sss_hashmap_t *used_files);
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
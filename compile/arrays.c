@@ -11,6 +11,7 @@
 #include "../ast.h"
 #include "compile.h"
 #include "libgccjit_abbrev.h"
+#include "../libsss/parallel.h"
 #include "../typecheck.h"
 #include "../types.h"
 #include "../util.h"
@@ -30,6 +31,18 @@ static inline sss_type_t *get_item_type(sss_type_t *t) {
     return t->tag == ArrayType ? Match(t, ArrayType)->item_type : NULL;
 }
 
+// array_reserve(array_ptr, count, item_size, atomic)
+static void reserve_array(env_t *env, gcc_block_t *block, sss_type_t *t, gcc_rvalue_t *array_ptr, gcc_rvalue_t *count)
+{
+    sss_type_t *item_t = get_item_type(t);
+    gcc_eval(block, NULL, gcc_callx(
+        env->ctx, NULL, get_function(env, "array_reserve"),
+        gcc_cast(env->ctx, NULL, array_ptr, gcc_type(env->ctx, VOID_PTR)),
+        count,
+        gcc_rvalue_size(env->ctx, gcc_sizeof(env, item_t)),
+        gcc_rvalue_bool(env->ctx, !has_heap_memory(item_t))));
+}
+
 static void add_array_item(env_t *env, gcc_block_t **block, ast_t *item, array_insert_info_t *info)
 {
     sss_type_t *item_type = get_item_type(info->array_type);
@@ -52,25 +65,27 @@ static void add_array_item(env_t *env, gcc_block_t **block, ast_t *item, array_i
     gcc_lvalue_t *data_field = gcc_lvalue_access_field(array, NULL, gcc_get_field(struct_t, ARRAY_DATA_FIELD));
     gcc_lvalue_t *length_field = gcc_lvalue_access_field(array, NULL, gcc_get_field(struct_t, ARRAY_LENGTH_FIELD));
 
-    // array.length += 1
-    gcc_type_t *i32 = gcc_type(env->ctx, INT32);
-    gcc_update(*block, NULL, length_field, GCC_BINOP_PLUS, gcc_one(env->ctx, i32));
-
     if (info->dynamic_size) {
-        // array.items = GC_realloc(array.items, item_size*array.length)
-        gcc_type_t *gcc_size_t = gcc_type(env->ctx, SIZE);
-        gcc_rvalue_t *new_size = gcc_binary_op(
-            env->ctx, NULL, GCC_BINOP_MULT, gcc_size_t, gcc_cast(env->ctx, NULL, gcc_rval(length_field), gcc_size_t),
-            gcc_rvalue_from_long(env->ctx, gcc_size_t, (long)gcc_sizeof(env, item_type)));
-        gcc_func_t *gc_realloc_func = get_function(env, "GC_realloc");
-        gcc_rvalue_t *new_data = gcc_callx(env->ctx, NULL, gc_realloc_func, 
-                                           gcc_rval(data_field), new_size);
-        gcc_assign(*block, NULL, data_field,
-                   gcc_cast(env->ctx, NULL, new_data, gcc_get_ptr_type(sss_type_to_gcc(env, item_type))));
+        // if (array.free < 1) array_reserve(&array, 1, ...), which grows the array geometrically
+        gcc_func_t *func = gcc_block_func(*block);
+        gcc_lvalue_t *free_field = gcc_lvalue_access_field(array, NULL, gcc_get_field(struct_t, ARRAY_CAPACITY_FIELD));
+        gcc_type_t *free_t = gcc_type(env->ctx, ARRAY_FREE);
+        gcc_block_t *grow = gcc_new_block(func, fresh("grow_array")),
+                    *has_room = gcc_new_block(func, fresh("has_room"));
+        gcc_jump_condition(*block, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(free_field), gcc_one(env->ctx, free_t)),
+                           grow, has_room);
+        reserve_array(env, grow, info->array_type, info->array_ptr, gcc_one(env->ctx, gcc_type(env->ctx, INT64)));
+        gcc_jump(grow, NULL, has_room);
+        *block = has_room;
+        gcc_update(*block, NULL, free_field, GCC_BINOP_MINUS, gcc_one(env->ctx, free_t));
     }
 
+    // array.length += 1
+    gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
+    gcc_update(*block, NULL, length_field, GCC_BINOP_PLUS, gcc_one(env->ctx, len_t));
+
     // array.items[array.length-1] = item
-    gcc_rvalue_t *index = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, i32, gcc_rval(length_field), gcc_one(env->ctx, i32));
+    gcc_rvalue_t *index = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, len_t, gcc_rval(length_field), gcc_one(env->ctx, len_t));
     // NOTE: This assumes stride == item_size
     gcc_lvalue_t *item_home = gcc_array_access(env->ctx, NULL, gcc_rval(data_field), index);
     if (!type_eq(t, item_type))
@@ -80,6 +95,22 @@ static void add_array_item(env_t *env, gcc_block_t **block, ast_t *item, array_i
     gcc_assign(*block, NULL, item_home, item_val);
 }
 
+// Comprehensions whose bodies produce one item per iteration can make room
+// for all of their items up front. (This is called before the loop variables
+// are bound, so it goes by the shape of the body instead of its type.)
+static void reserve_array_items(env_t *env, gcc_block_t **block, ast_t *loop, gcc_rvalue_t *count, array_insert_info_t *info)
+{
+    ast_t *body = Match(loop, For)->body;
+    if (!body || !info->dynamic_size) return;
+    switch (body->tag) {
+    case Block: case Do: case For: case While: case Repeat: case If: case With:
+    case Skip: case Stop: case Pass: case Return: case Fail:
+        return;
+    default:
+        reserve_array(env, *block, info->array_type, info->array_ptr, count);
+    }
+}
+
 gcc_rvalue_t *array_contains(env_t *env, gcc_block_t **block, ast_t *array, ast_t *member)
 {
     // TODO: support subsets like ("def" in "abcdefghi")
@@ -120,6 +151,29 @@ gcc_rvalue_t *array_contains(env_t *env, gcc_block_t **block, ast_t *array, ast_
     gcc_block_t *next = gcc_new_block(func, fresh("next_item")),
                 *end = gcc_new_block(func, fresh("done"));
 
+    // Long arrays are searched by the runtime, which splits them between
+    // threads, if there's more than one
+    gcc_block_t *search_in_parallel = gcc_new_block(func, fresh("search_in_parallel")),
+                *search_here = gcc_new_block(func, fresh("search_here"));
+    gcc_rvalue_t *many_threads = gcc_comparison(env->ctx, loc, GCC_COMPARISON_GT,
+                                                gcc_callx(env->ctx, loc, get_function(env, "sss_thread_count")),
+                                                gcc_one(env->ctx, gcc_type(env->ctx, INT)));
+    gcc_jump_condition(*block, loc,
+                       gcc_binary_op(env->ctx, loc, GCC_BINOP_LOGICAL_AND, gcc_type(env->ctx, BOOL),
+                                     gcc_comparison(env->ctx, loc, GCC_COMPARISON_GE, len64,
+                                                    gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, INT64), 2*SSS_PARALLEL_GRAIN)),
+                                     many_threads),
+                       search_in_parallel, search_here);
+    gcc_rvalue_t *index = gcc_callx(env->ctx, loc, get_function(env, "array_index_of"),
+                                    gcc_cast(env->ctx, loc, gcc_lvalue_address(array_var, loc), gcc_type(env->ctx, VOID_PTR)),
+                                    gcc_cast(env->ctx, loc, gcc_lvalue_address(member_var, loc), gcc_type(env->ctx, VOID_PTR)),
+                                    gcc_cast(env->ctx, loc, gcc_get_func_address(get_indirect_compare_func(env, item_type), loc),
+                                             gcc_type(env->ctx, VOID_PTR)));
+    gcc_assign(search_in_parallel, loc, contains_var,
+               gcc_comparison(env->ctx, loc, GCC_COMPARISON_NE, index, gcc_zero(env->ctx, gcc_type(env->ctx, INT64))));
+    gcc_jump(search_in_parallel, loc, end);
+    *block = search_here;
+
     // item_ptr = array.items
     gcc_type_t *gcc_item_t = sss_type_to_gcc(env, item_type);
     gcc_lvalue_t *item_ptr = gcc_local(func, loc, gcc_get_ptr_type(gcc_item_t), "_item_ptr");
@@ -165,7 +219,7 @@ gcc_lvalue_t *array_capacity(env_t *env, gcc_rvalue_t *arr_ptr)
 void mark_array_cow(env_t *env, gcc_block_t **block, gcc_rvalue_t *arr_ptr)
 {
     gcc_lvalue_t *capacity = array_capacity(env, arr_ptr);
-    gcc_assign(*block, NULL, capacity, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, INT16), -1));
+    gcc_assign(*block, NULL, capacity, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), -1));
 }
 
 void check_cow(env_t *env, gcc_block_t **block, sss_type_t *arr_t, gcc_rvalue_t *arr)
@@ -174,7 +228,7 @@ void check_cow(env_t *env, gcc_block_t **block, sss_type_t *arr_t, gcc_rvalue_t
     gcc_func_t *func = gcc_block_func(*block);
     gcc_block_t *needs_cow = gcc_new_block(func, "needs_cow"),
                 *done = gcc_new_block(func, "done_cow");
-    gcc_rvalue_t *should_cow = gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(array_capacity(env, arr)), gcc_zero(env->ctx, gcc_type(env->ctx, INT16)));
+    gcc_rvalue_t *should_cow = gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(array_capacity(env, arr)), gcc_zero(env->ctx, gcc_type(env->ctx, ARRAY_FREE)));
     gcc_jump_condition(*block, NULL, should_cow, needs_cow, done);
     *block = needs_cow;
     // Copy array contents:
@@ -182,7 +236,7 @@ void check_cow(env_t *env, gcc_block_t **block, sss_type_t *arr_t, gcc_rvalue_t
     gcc_eval(*block, NULL, gcc_callx(env->ctx, NULL, cow_fn,
                                      gcc_bitcast(env->ctx, NULL, arr, gcc_type(env->ctx, VOID_PTR)),
                                      gcc_rvalue_size(env->ctx, gcc_sizeof(env, get_item_type(arr_t))),
-                                     gcc_rvalue_bool(env->ctx, has_heap_memory(arr_t))));
+                                     gcc_rvalue_bool(env->ctx, !has_heap_memory(get_item_type(arr_t)))));
     gcc_jump(*block, NULL, done);
     *block = done;
 }
@@ -223,28 +277,28 @@ gcc_rvalue_t *array_slice(env_t *env, gcc_block_t **block, ast_t *arr_ast, ast_t
     if (index->tag == Range) {
         auto range = Match(index, Range);
         if (!range->step || (range->step->tag == Int && Match(range->step, Int)->i == 1)) {
-            gcc_type_t *i32_t = gcc_type(env->ctx, INT32);
-#define SUB(a,b) gcc_binary_op(env->ctx, loc, GCC_BINOP_MINUS, i32_t, a, b)
+            gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
+#define SUB(a,b) gcc_binary_op(env->ctx, loc, GCC_BINOP_MINUS, len_t, a, b)
             gcc_rvalue_t *old_items = gcc_rvalue_access_field(arr, loc, gcc_get_field(gcc_array_struct, ARRAY_DATA_FIELD));
             gcc_rvalue_t *offset;
             if (range->first)
-                offset = SUB(gcc_cast(env->ctx, loc, compile_expr(env, block, range->first), i32_t), gcc_one(env->ctx, i32_t));
+                offset = SUB(gcc_cast(env->ctx, loc, compile_expr(env, block, range->first), len_t), gcc_one(env->ctx, len_t));
             else
-                offset = gcc_zero(env->ctx, i32_t);
+                offset = gcc_zero(env->ctx, len_t);
 
-            gcc_lvalue_t *offset_var = gcc_local(func, loc, i32_t, "_offset");
+            gcc_lvalue_t *offset_var = gcc_local(func, loc, len_t, "_offset");
             gcc_assign(*block, loc, offset_var, offset);
             // Bit hack to branchlessly set offset to zero when it would otherwise be negative:
-            // offset &= ~(offset >> 31)
+            // offset &= ~(offset >> 63)
             gcc_update(*block, loc, offset_var, GCC_BINOP_BITWISE_AND,
-               gcc_unary_op(env->ctx, loc, GCC_UNOP_BITWISE_NEGATE, i32_t,
-                   gcc_binary_op(env->ctx, loc, GCC_BINOP_RSHIFT, i32_t, offset, gcc_rvalue_int32(env->ctx, 31))));
+               gcc_unary_op(env->ctx, loc, GCC_UNOP_BITWISE_NEGATE, len_t,
+                   gcc_binary_op(env->ctx, loc, GCC_BINOP_RSHIFT, len_t, offset, gcc_rvalue_int64(env->ctx, 63))));
             gcc_rvalue_t *old_stride = gcc_rvalue_access_field(arr, loc, gcc_get_field(gcc_array_struct, ARRAY_STRIDE_FIELD));
             offset = gcc_rval(offset_var);
 
             gcc_type_t *gcc_item_t = sss_type_to_gcc(env, get_item_type(arr_t));
             gcc_rvalue_t *items = pointer_offset(env, gcc_get_ptr_type(gcc_item_t), old_items,
-                                                 gcc_binary_op(env->ctx, loc, GCC_BINOP_MULT, i32_t, offset, gcc_cast(env->ctx, loc, old_stride, i32_t)));
+                                                 gcc_binary_op(env->ctx, loc, GCC_BINOP_MULT, len_t, offset, gcc_cast(env->ctx, loc, old_stride, len_t)));
 
             gcc_lvalue_t *slice = gcc_local(func, loc, array_gcc_t, "_slice");
             // assign slice.items and slice.stride
@@ -257,7 +311,7 @@ gcc_rvalue_t *array_slice(env_t *env, gcc_block_t **block, ast_t *arr_ast, ast_t
                 gcc_block_t *array_shorter = gcc_new_block(func, "array_shorter"),
                             *range_shorter = gcc_new_block(func, "range_shorter"),
                             *len_assigned = gcc_new_block(func, "len_assigned");
-                gcc_rvalue_t *range_len = gcc_cast(env->ctx, loc, compile_expr(env, block, range->last), i32_t);
+                gcc_rvalue_t *range_len = gcc_cast(env->ctx, loc, compile_expr(env, block, range->last), len_t);
 
                 gcc_jump_condition(*block, loc, gcc_comparison(env->ctx, loc, GCC_COMPARISON_LT, array_len, range_len), array_shorter, range_shorter);
 
@@ -277,7 +331,7 @@ gcc_rvalue_t *array_slice(env_t *env, gcc_block_t **block, ast_t *arr_ast, ast_t
             // Set COW flag:
             if (env->should_mark_cow) {
                 gcc_assign(*block, loc, gcc_lvalue_access_field(slice, loc, gcc_get_field(gcc_array_struct, ARRAY_CAPACITY_FIELD)),
-                           gcc_rvalue_int16(env->ctx, access == ACCESS_READ ? -1 : 0));
+                           gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), access == ACCESS_READ ? -1 : 0));
             }
 
             return gcc_rval(slice);
@@ -301,7 +355,7 @@ gcc_rvalue_t *array_slice(env_t *env, gcc_block_t **block, ast_t *arr_ast, ast_t
     // Set COW flag:
     if (env->should_mark_cow) {
         gcc_assign(*block, loc, gcc_lvalue_access_field(slice_var, loc, gcc_get_field(gcc_array_struct, ARRAY_CAPACITY_FIELD)),
-                   gcc_rvalue_int16(env->ctx, access == ACCESS_READ ? -1 : 0));
+                   gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), access == ACCESS_READ ? -1 : 0));
     }
     return gcc_rval(slice_var);
 }
@@ -376,7 +430,7 @@ gcc_rvalue_t *array_field_slice(env_t *env, gcc_block_t **block, ast_t *ast, con
             field_addr,
             len,
             stride,
-            gcc_rvalue_int16(env->ctx, access == ACCESS_READ ? -1 : 0),
+            gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), access == ACCESS_READ ? -1 : 0),
         };
 
         gcc_lvalue_t *result_var = gcc_local(func, loc, slice_gcc_t, "_slice");
@@ -508,14 +562,15 @@ gcc_rvalue_t *compile_array(env_t *env, gcc_block_t **block, ast_t *ast, bool ma
             },
             (gcc_rvalue_t*[]){
                 initial_items,
-                gcc_zero(env->ctx, gcc_type(env->ctx, INT32)),
-                gcc_rvalue_int16(env->ctx, gcc_sizeof(env, item_t)),
-                gcc_rvalue_int16(env->ctx, mark_cow ? -1 : 0),
+                gcc_zero(env->ctx, gcc_type(env->ctx, ARRAY_LENGTH)),
+                gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), gcc_sizeof(env, item_t)),
+                gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), 0),
             }));
 
     if (array->items) {
         env_t env2 = *env;
         env2.comprehension_callback = (void*)add_array_item;
+        env2.comprehension_reserve = (void*)reserve_array_items;
         array_insert_info_t info = {t, gcc_lvalue_address(array_var, loc), false};
         env2.comprehension_userdata = &info;
         env = &env2;
@@ -541,6 +596,10 @@ gcc_rvalue_t *compile_array(env_t *env, gcc_block_t **block, ast_t *ast, bool ma
             gcc_jump(*block, loc, array_done);
         *block = array_done;
     }
+    // The free count tracks spare room while the items are being added, so
+    // this has to come afterwards:
+    if (mark_cow)
+        mark_array_cow(env, block, gcc_lvalue_address(array_var, loc));
     return gcc_rval(array_var);
 }
 
@@ -735,6 +794,49 @@ static void define_array_insert_all(env_t *env, sss_type_t *t)
     set_in_namespace(env, t, "insert_all", b);
 }
 
+static void define_array_reserve(env_t *env, sss_type_t *t)
+{
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_t), fresh("array")),
+        gcc_new_param(env->ctx, NULL, gcc_type(env->ctx, INT64), fresh("count")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("reserve"), 2, params, 0);
+    gcc_block_t *block = gcc_new_block(func, fresh("reserve"));
+    reserve_array(env, block, t, gcc_param_as_rvalue(params[0]), gcc_param_as_rvalue(params[1]));
+    gcc_return_void(block, NULL);
+
+    binding_t *b = new(binding_t, .func=func,
+                       .type=Type(FunctionType, .arg_names=LIST(const char*, "array", "count"),
+                                  .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t, .is_stack=true), Type(IntType, .bits=64)),
+                                  .arg_defaults=LIST(ast_t*, NULL, NULL),
+                                  .ret=Type(VoidType)));
+    set_in_namespace(env, t, "reserve", b);
+}
+
+static void define_array_shrink_to_fit(env_t *env, sss_type_t *t)
+{
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    sss_type_t *item_t = get_item_type(t);
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_t), fresh("array")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("shrink_to_fit"), 1, params, 0);
+    gcc_block_t *block = gcc_new_block(func, fresh("shrink_to_fit"));
+    gcc_func_t *c_shrink_func = get_function(env, "array_shrink_to_fit");
+    gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, c_shrink_func,
+                                    AS_VOID_PTR(gcc_param_as_rvalue(params[0])),
+                                    gcc_rvalue_size(env->ctx, gcc_sizeof(env, item_t)),
+                                    gcc_rvalue_bool(env->ctx, !has_heap_memory(item_t))));
+    gcc_return_void(block, NULL);
+
+    binding_t *b = new(binding_t, .func=func,
+                       .type=Type(FunctionType, .arg_names=LIST(const char*, "array"),
+                                  .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t, .is_stack=true)),
+                                  .ret=Type(VoidType)));
+    set_in_namespace(env, t, "shrink_to_fit", b);
+}
+
 static void define_array_remove(env_t *env, sss_type_t *t)
 {
     gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
@@ -824,32 +926,348 @@ static void define_array_shuffle(env_t *env, sss_type_t *t)
     set_in_namespace(env, t, "shuffle", b);
 }
 
-static void define_array_sort(env_t *env, sss_type_t *t)
+// items[i], for a pointer to items
+static inline gcc_lvalue_t *item_at(env_t *env, gcc_rvalue_t *items, gcc_rvalue_t *i)
+{
+    return gcc_array_access(env->ctx, NULL, items, i);
+}
+
+// lhs < rhs, by the item type's comparison (inlined for simple types)
+static inline gcc_rvalue_t *item_less(env_t *env, sss_type_t *item_t, gcc_rvalue_t *lhs, gcc_rvalue_t *rhs)
+{
+    return gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, compare_values(env, item_t, lhs, rhs),
+                          gcc_zero(env->ctx, gcc_type(env->ctx, INT)));
+}
+
+// Sorting functions for arrays whose items can't be sorted as numbers. The
+// items are compared directly instead of through a comparison function
+// pointer, so the comparisons can be inlined. The runtime calls:
+//     merge_sort(items, n, buf)
+// to sort a block of `n` items, using `buf` as space for `n/2` items, and:
+//     merge(a, na, b, nb, out)
+// to merge two sorted blocks when sorting in parallel. Both are stable.
+static void get_array_sort_funcs(env_t *env, sss_type_t *t, gcc_func_t **sort_func, gcc_func_t **merge_func)
+{
+    binding_t *sort_b = get_from_namespace(env, t, "__merge_sort"),
+              *merge_b = get_from_namespace(env, t, "__merge");
+    if (sort_b && merge_b) {
+        *sort_func = sort_b->func;
+        *merge_func = merge_b->func;
+        return;
+    }
+
+    sss_type_t *item_t = get_item_type(t);
+    gcc_type_t *gcc_item_t = sss_type_to_gcc(env, item_t);
+    gcc_type_t *ptr_t = gcc_get_ptr_type(gcc_item_t);
+    gcc_type_t *i64_t = gcc_type(env->ctx, INT64);
+    gcc_rvalue_t *zero = gcc_zero(env->ctx, i64_t), *one = gcc_one(env->ctx, i64_t);
+    sss_type_t *item_ptr_t = Type(PointerType, .pointed=item_t);
+    sss_type_t *i64 = Type(IntType, .bits=64);
+
+    // merge_sort(items, n, buf):
+    //     if (n <= 16) {
+    //         for (i = 1; i < n; i++) {
+    //             tmp = items[i];
+    //             for (j = i; j > 0 && tmp < items[j-1]; j--) items[j] = items[j-1];
+    //             items[j] = tmp;
+    //         }
+    //         return;
+    //     }
+    //     half = n/2;
+    //     merge_sort(items, half, buf), merge_sort(&items[half], n - half, buf);
+    //     if (!(items[half] < items[half-1])) return;
+    //     buf[0:half] = items[0:half];
+    //     (merge buf[0:half] and items[half:n] into items, taking from buf on ties)
+    {
+        gcc_param_t *params[] = {
+            gcc_new_param(env->ctx, NULL, ptr_t, fresh("items")),
+            gcc_new_param(env->ctx, NULL, i64_t, fresh("n")),
+            gcc_new_param(env->ctx, NULL, ptr_t, fresh("buf")),
+        };
+        gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("merge_sort"), 3, params, 0);
+        gcc_rvalue_t *items = gcc_param_as_rvalue(params[0]), *n = gcc_param_as_rvalue(params[1]), *buf = gcc_param_as_rvalue(params[2]);
+        gcc_lvalue_t *i = gcc_local(func, NULL, i64_t, "_i"), *j = gcc_local(func, NULL, i64_t, "_j"),
+                     *dest = gcc_local(func, NULL, i64_t, "_dest"), *half = gcc_local(func, NULL, i64_t, "_half");
+        gcc_lvalue_t *tmp = gcc_local(func, NULL, gcc_item_t, "_tmp");
+
+        gcc_block_t *block = gcc_new_block(func, fresh("merge_sort")),
+                    *insertion_sort = gcc_new_block(func, fresh("insertion_sort")),
+                    *next_insert = gcc_new_block(func, fresh("next_insert")),
+                    *insert = gcc_new_block(func, fresh("insert")),
+                    *find_place = gcc_new_block(func, fresh("find_place")),
+                    *shift = gcc_new_block(func, fresh("shift")),
+                    *place = gcc_new_block(func, fresh("place")),
+                    *split = gcc_new_block(func, fresh("split")),
+                    *copy_left = gcc_new_block(func, fresh("copy_left")),
+                    *copy_next = gcc_new_block(func, fresh("copy_next")),
+                    *merge = gcc_new_block(func, fresh("merge")),
+                    *merge_next = gcc_new_block(func, fresh("merge_next")),
+                    *take_right = gcc_new_block(func, fresh("take_right")),
+                    *take_left = gcc_new_block(func, fresh("take_left")),
+                    *leftovers = gcc_new_block(func, fresh("leftovers")),
+                    *leftover_next = gcc_new_block(func, fresh("leftover_next")),
+                    *done = gcc_new_block(func, fresh("done"));
+
+        gcc_jump_condition(block, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LE, n, gcc_rvalue_int64(env->ctx, 16)),
+                           insertion_sort, split);
+
+        // Insertion sort only moves items past ones that are greater, so it's stable
+        gcc_assign(insertion_sort, NULL, i, one);
+        gcc_jump(insertion_sort, NULL, next_insert);
+
+        gcc_jump_condition(next_insert, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(i), n), insert, done);
+        gcc_assign(insert, NULL, tmp, gcc_rval(item_at(env, items, gcc_rval(i))));
+        gcc_assign(insert, NULL, j, gcc_rval(i));
+        gcc_jump(insert, NULL, find_place);
+
+        gcc_rvalue_t *j_minus_1 = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, i64_t, gcc_rval(j), one);
+        gcc_jump_condition(find_place, NULL,
+                           gcc_binary_op(env->ctx, NULL, GCC_BINOP_LOGICAL_AND, gcc_type(env->ctx, BOOL),
+                                         gcc_comparison(env->ctx, NULL, GCC_COMPARISON_GT, gcc_rval(j), zero),
+                                         item_less(env, item_t, gcc_rval(tmp), gcc_rval(item_at(env, items, j_minus_1)))),
+                           shift, place);
+
+        gcc_assign(shift, NULL, item_at(env, items, gcc_rval(j)), gcc_rval(item_at(env, items, j_minus_1)));
+        gcc_update(shift, NULL, j, GCC_BINOP_MINUS, one);
+        gcc_jump(shift, NULL, find_place);
+
+        gcc_assign(place, NULL, item_at(env, items, gcc_rval(j)), gcc_rval(tmp));
+        gcc_update(place, NULL, i, GCC_BINOP_PLUS, one);
+        gcc_jump(place, NULL, next_insert);
+
+        // Sort each half, then merge them unless they're already in order
+        gcc_assign(split, NULL, half, gcc_binary_op(env->ctx, NULL, GCC_BINOP_DIVIDE, i64_t, n, gcc_rvalue_int64(env->ctx, 2)));
+        gcc_eval(split, NULL, gcc_callx(env->ctx, NULL, func, items, gcc_rval(half), buf));
+        gcc_eval(split, NULL, gcc_callx(env->ctx, NULL, func, gcc_lvalue_address(item_at(env, items, gcc_rval(half)), NULL),
+                                        gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, i64_t, n, gcc_rval(half)), buf));
+        gcc_assign(split, NULL, i, zero);
+        gcc_jump_condition(split, NULL,
+                           item_less(env, item_t, gcc_rval(item_at(env, items, gcc_rval(half))),
+                                     gcc_rval(item_at(env, items, gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, i64_t, gcc_rval(half), one)))),
+                           copy_left, done);
+
+        // Move the left half out of the way, then merge it with the right half
+        gcc_jump_condition(copy_left, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(i), gcc_rval(half)), copy_next, merge);
+        gcc_assign(copy_next, NULL, item_at(env, buf, gcc_rval(i)), gcc_rval(item_at(env, items, gcc_rval(i))));
+        gcc_update(copy_next, NULL, i, GCC_BINOP_PLUS, one);
+        gcc_jump(copy_next, NULL, copy_left);
+
+        // i indexes the left half (in buf) and j indexes the right half
+        gcc_assign(merge, NULL, i, zero);
+        gcc_assign(merge, NULL, j, gcc_rval(half));
+        gcc_assign(merge, NULL, dest, zero);
+        gcc_jump(merge, NULL, merge_next);
+
+        gcc_block_t *compare_next = gcc_new_block(func, fresh("compare_next"));
+        gcc_jump_condition(merge_next, NULL,
+                           gcc_binary_op(env->ctx, NULL, GCC_BINOP_LOGICAL_AND, gcc_type(env->ctx, BOOL),
+                                         gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(i), gcc_rval(half)),
+                                         gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(j), n)),
+                           compare_next, leftovers);
+        gcc_jump_condition(compare_next, NULL,
+                           item_less(env, item_t, gcc_rval(item_at(env, items, gcc_rval(j))), gcc_rval(item_at(env, buf, gcc_rval(i)))),
+                           take_right, take_left);
+
+        gcc_assign(take_right, NULL, item_at(env, items, gcc_rval(dest)), gcc_rval(item_at(env, items, gcc_rval(j))));
+        gcc_update(take_right, NULL, j, GCC_BINOP_PLUS, one);
+        gcc_update(take_right, NULL, dest, GCC_BINOP_PLUS, one);
+        gcc_jump(take_right, NULL, merge_next);
+
+        gcc_assign(take_left, NULL, item_at(env, items, gcc_rval(dest)), gcc_rval(item_at(env, buf, gcc_rval(i))));
+        gcc_update(take_left, NULL, i, GCC_BINOP_PLUS, one);
+        gcc_update(take_left, NULL, dest, GCC_BINOP_PLUS, one);
+        gcc_jump(take_left, NULL, merge_next);
+
+        // Anything left over on the right is already in place
+        gcc_jump_condition(leftovers, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(i), gcc_rval(half)), leftover_next, done);
+        gcc_assign(leftover_next, NULL, item_at(env, items, gcc_rval(dest)), gcc_rval(item_at(env, buf, gcc_rval(i))));
+        gcc_update(leftover_next, NULL, i, GCC_BINOP_PLUS, one);
+        gcc_update(leftover_next, NULL, dest, GCC_BINOP_PLUS, one);
+        gcc_jump(leftover_next, NULL, leftovers);
+
+        gcc_return_void(done, NULL);
+
+        sort_b = new(binding_t, .func=func, .rval=gcc_get_func_address(func, NULL),
+                     .type=Type(FunctionType, .arg_names=LIST(const char*, "items", "n", "buf"),
+                                .arg_types=LIST(sss_type_t*, item_ptr_t, i64, item_ptr_t), .ret=Type(VoidType)));
+        set_in_namespace(env, t, "__merge_sort", sort_b);
+    }
+
+    // merge(a, na, b, nb, out):
+    //     (merge a[0:na] and b[0:nb] into out, taking from a on ties)
+    {
+        gcc_param_t *params[] = {
+            gcc_new_param(env->ctx, NULL, ptr_t, fresh("a")),
+            gcc_new_param(env->ctx, NULL, i64_t, fresh("na")),
+            gcc_new_param(env->ctx, NULL, ptr_t, fresh("b")),
+            gcc_new_param(env->ctx, NULL, i64_t, fresh("nb")),
+            gcc_new_param(env->ctx, NULL, ptr_t, fresh("out")),
+        };
+        gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("merge"), 5, params, 0);
+        gcc_rvalue_t *a = gcc_param_as_rvalue(params[0]), *na = gcc_param_as_rvalue(params[1]),
+                     *b = gcc_param_as_rvalue(params[2]), *nb = gcc_param_as_rvalue(params[3]),
+                     *out = gcc_param_as_rvalue(params[4]);
+        gcc_lvalue_t *i = gcc_local(func, NULL, i64_t, "_i"), *j = gcc_local(func, NULL, i64_t, "_j"),
+                     *k = gcc_local(func, NULL, i64_t, "_k");
+
+        gcc_block_t *block = gcc_new_block(func, fresh("merge")),
+                    *merge_next = gcc_new_block(func, fresh("merge_next")),
+                    *compare_next = gcc_new_block(func, fresh("compare_next")),
+                    *take_b = gcc_new_block(func, fresh("take_b")),
+                    *take_a = gcc_new_block(func, fresh("take_a")),
+                    *rest_of_a = gcc_new_block(func, fresh("rest_of_a")),
+                    *copy_a = gcc_new_block(func, fresh("copy_a")),
+                    *rest_of_b = gcc_new_block(func, fresh("rest_of_b")),
+                    *copy_b = gcc_new_block(func, fresh("copy_b")),
+                    *done = gcc_new_block(func, fresh("done"));
+
+        gcc_assign(block, NULL, i, zero);
+        gcc_assign(block, NULL, j, zero);
+        gcc_assign(block, NULL, k, zero);
+        gcc_jump(block, NULL, merge_next);
+
+        gcc_jump_condition(merge_next, NULL,
+                           gcc_binary_op(env->ctx, NULL, GCC_BINOP_LOGICAL_AND, gcc_type(env->ctx, BOOL),
+                                         gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(i), na),
+                                         gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(j), nb)),
+                           compare_next, rest_of_a);
+        gcc_jump_condition(compare_next, NULL,
+                           item_less(env, item_t, gcc_rval(item_at(env, b, gcc_rval(j))), gcc_rval(item_at(env, a, gcc_rval(i)))),
+                           take_b, take_a);
+
+        gcc_assign(take_b, NULL, item_at(env, out, gcc_rval(k)), gcc_rval(item_at(env, b, gcc_rval(j))));
+        gcc_update(take_b, NULL, j, GCC_BINOP_PLUS, one);
+        gcc_update(take_b, NULL, k, GCC_BINOP_PLUS, one);
+        gcc_jump(take_b, NULL, merge_next);
+
+        gcc_assign(take_a, NULL, item_at(env, out, gcc_rval(k)), gcc_rval(item_at(env, a, gcc_rval(i))));
+        gcc_update(take_a, NULL, i, GCC_BINOP_PLUS, one);
+        gcc_update(take_a, NULL, k, GCC_BINOP_PLUS, one);
+        gcc_jump(take_a, NULL, merge_next);
+
+        gcc_jump_condition(rest_of_a, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(i), na), copy_a, rest_of_b);
+        gcc_assign(copy_a, NULL, item_at(env, out, gcc_rval(k)), gcc_rval(item_at(env, a, gcc_rval(i))));
+        gcc_update(copy_a, NULL, i, GCC_BINOP_PLUS, one);
+        gcc_update(copy_a, NULL, k, GCC_BINOP_PLUS, one);
+        gcc_jump(copy_a, NULL, rest_of_a);
+
+        gcc_jump_condition(rest_of_b, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(j), nb), copy_b, done);
+        gcc_assign(copy_b, NULL, item_at(env, out, gcc_rval(k)), gcc_rval(item_at(env, b, gcc_rval(j))));
+        gcc_update(copy_b, NULL, j, GCC_BINOP_PLUS, one);
+        gcc_update(copy_b, NULL, k, GCC_BINOP_PLUS, one);
+        gcc_jump(copy_b, NULL, rest_of_b);
+
+        gcc_return_void(done, NULL);
+
+        merge_b = new(binding_t, .func=func, .rval=gcc_get_func_address(func, NULL),
+                      .type=Type(FunctionType, .arg_names=LIST(const char*, "a", "na", "b", "nb", "out"),
+                                 .arg_types=LIST(sss_type_t*, item_ptr_t, i64, item_ptr_t, i64, item_ptr_t), .ret=Type(VoidType)));
+        set_in_namespace(env, t, "__merge", merge_b);
+    }
+
+    *sort_func = sort_b->func;
+    *merge_func = merge_b->func;
+}
+
+// Arrays of integers or floating point numbers are sorted by the runtime
+// without a comparison function, other arrays are sorted by the runtime with
+// merge sort functions that are compiled for the item type
+static void define_array_sort(env_t *env, sss_type_t *t, bool stable)
 {
     gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
     sss_type_t *item_t = get_item_type(t);
+    const char *name = stable ? "stable_sort" : "sort";
     gcc_param_t *params[] = {
         gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_t), fresh("array")),
     };
-    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("sort"), 1, params, 0);
-    gcc_block_t *block = gcc_new_block(func, fresh("sort"));
-    gcc_func_t *c_sort_func = get_function(env, "array_sort");
-    sss_type_t *void_ptr_t = Type(PointerType, .pointed=Type(MemoryType));
-    sss_type_t *ptr_cmp_fn_t = Type(FunctionType, .arg_types=LIST(sss_type_t*, void_ptr_t, void_ptr_t), .ret=Type(IntType, .bits=32));
-    gcc_type_t *ptr_cmp_fn_gcc_t = sss_type_to_gcc(env, ptr_cmp_fn_t);
-    gcc_rvalue_t *cmp = gcc_get_func_address(get_indirect_compare_func(env, item_t), NULL);
-    gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, c_sort_func,
-                                    AS_VOID_PTR(gcc_param_as_rvalue(params[0])),
-                                    gcc_cast(env->ctx, NULL, cmp, ptr_cmp_fn_gcc_t),
-                                    gcc_rvalue_size(env->ctx, gcc_sizeof(env, item_t)),
-                                    gcc_rvalue_bool(env->ctx, !has_heap_memory(item_t))));
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh(name), 1, params, 0);
+    gcc_block_t *block = gcc_new_block(func, fresh(name));
+    gcc_rvalue_t *array = AS_VOID_PTR(gcc_param_as_rvalue(params[0]));
+    gcc_rvalue_t *item_size = gcc_rvalue_size(env->ctx, gcc_sizeof(env, item_t));
+
+    sss_type_t *base_t = item_t;
+    while (base_t->tag == VariantType) base_t = Match(base_t, VariantType)->variant_of;
+    // Integers that compare equal are identical, so the runtime's integer
+    // sorting is already stable. Floats are not: -0.0 and 0.0 compare equal,
+    // but the runtime sorts -0.0 first, so stable float sorts use a merge sort.
+    if (base_t->tag == IntType) {
+        gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, get_function(env, "array_sort_ints"), array, item_size,
+                                        gcc_rvalue_bool(env->ctx, !Match(base_t, IntType)->is_unsigned)));
+    } else if (base_t->tag == NumType && !stable) {
+        gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, get_function(env, "array_sort_nums"), array, item_size));
+    } else {
+        gcc_func_t *sort_func, *merge_func;
+        get_array_sort_funcs(env, t, &sort_func, &merge_func);
+        // The comparison function pointer is only used to split up merges
+        // when sorting in parallel
+        gcc_rvalue_t *cmp = gcc_get_func_address(get_indirect_compare_func(env, item_t), NULL);
+        gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, get_function(env, "array_sort_compiled"),
+                                        array,
+                                        AS_VOID_PTR(gcc_get_func_address(sort_func, NULL)),
+                                        AS_VOID_PTR(gcc_get_func_address(merge_func, NULL)),
+                                        AS_VOID_PTR(cmp),
+                                        item_size,
+                                        gcc_rvalue_bool(env->ctx, !has_heap_memory(item_t))));
+    }
     gcc_return_void(block, NULL);
 
     binding_t *b = new(binding_t, .func=func,
                        .type=Type(FunctionType, .arg_names=LIST(const char*, "array"),
                                   .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t, .is_stack=true)),
                                   .ret=Type(VoidType)));
-    set_in_namespace(env, t, "sort", b);
+    set_in_namespace(env, t, name, b);
+}
+
+// `sort_by()` is a different method for each type of key function, so instead
+// of being looked up by name, it's looked up with the key function's type
+binding_t *get_array_sort_by_method(env_t *env, sss_type_t *t, sss_type_t *key_fn_t)
+{
+    while (t->tag == PointerType)
+        t = Match(t, PointerType)->pointed;
+
+    const char *name = heap_strf("sort_by(%s)", type_to_string(key_fn_t));
+    binding_t *b = get_from_namespace(env, t, name);
+    if (b) return b;
+
+    sss_type_t *item_t = get_item_type(t);
+    sss_type_t *key_t = Match(key_fn_t, FunctionType)->ret;
+    gcc_type_t *key_fn_gcc_t = sss_type_to_gcc(env, key_fn_t);
+
+    // The runtime calls get_key(&item, &key, key_fn) once for each item
+    gcc_param_t *get_key_params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(sss_type_to_gcc(env, item_t)), fresh("item")),
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(sss_type_to_gcc(env, key_t)), fresh("key")),
+        gcc_new_param(env->ctx, NULL, key_fn_gcc_t, fresh("key_fn")),
+    };
+    gcc_func_t *get_key = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("get_key"), 3, get_key_params, 0);
+    gcc_block_t *block = gcc_new_block(get_key, fresh("get_key"));
+    gcc_assign(block, NULL, gcc_rvalue_dereference(gcc_param_as_rvalue(get_key_params[1]), NULL),
+               gcc_callx_ptr(env->ctx, NULL, gcc_param_as_rvalue(get_key_params[2]),
+                             gcc_rval(gcc_rvalue_dereference(gcc_param_as_rvalue(get_key_params[0]), NULL))));
+    gcc_return_void(block, NULL);
+
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(sss_type_to_gcc(env, t)), fresh("array")),
+        gcc_new_param(env->ctx, NULL, key_fn_gcc_t, fresh("key")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("sort_by"), 2, params, 0);
+    block = gcc_new_block(func, fresh("sort_by"));
+    gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, get_function(env, "array_sort_by"),
+                                    AS_VOID_PTR(gcc_param_as_rvalue(params[0])),
+                                    AS_VOID_PTR(gcc_get_func_address(get_key, NULL)),
+                                    AS_VOID_PTR(gcc_param_as_rvalue(params[1])),
+                                    AS_VOID_PTR(gcc_get_func_address(get_indirect_compare_func(env, key_t), NULL)),
+                                    gcc_rvalue_size(env->ctx, gcc_sizeof(env, key_t)),
+                                    gcc_rvalue_size(env->ctx, gcc_sizeof(env, item_t)),
+                                    gcc_rvalue_bool(env->ctx, !has_heap_memory(item_t))));
+    gcc_return_void(block, NULL);
+
+    b = new(binding_t, .func=func,
+            .type=Type(FunctionType, .arg_names=LIST(const char*, "array", "key"),
+                       .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t, .is_stack=true), key_fn_t),
+                       .ret=Type(VoidType)));
+    set_in_namespace(env, t, name, b);
+    return b;
 }
 
 static void define_array_join(env_t *env, sss_type_t *glue_t)
@@ -892,10 +1310,14 @@ binding_t *get_array_method(env_t *env, sss_type_t *t, const char *method_name)
         define_array_insert_all(env, t);
     else if (streq(method_name, "remove"))
         define_array_remove(env, t);
+    else if (streq(method_name, "reserve"))
+        define_array_reserve(env, t);
+    else if (streq(method_name, "shrink_to_fit"))
+        define_array_shrink_to_fit(env, t);
     else if (streq(method_name, "pop"))
         define_array_pop(env, t);
-    else if (streq(method_name, "sort"))
-        define_array_sort(env, t);
+    else if (streq(method_name, "sort") || streq(method_name, "stable_sort"))
+        define_array_sort(env, t, streq(method_name, "stable_sort"));
     else if (streq(method_name, "shuffle"))
         define_array_shuffle(env, t);
     else if (streq(method_name, "join"))
@@ -918,7 +1340,7 @@ void flatten_arrays(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_rvalue_t
     gcc_block_t *needs_flattening = gcc_new_block(func, fresh("needs_flattening")),
                 *already_flat = gcc_new_block(func, fresh("already_flat"));
     gcc_jump_condition(*block, NULL,
-                       gcc_comparison(env->ctx, NULL, GCC_COMPARISON_NE, stride_field, gcc_rvalue_int16(env->ctx, gcc_sizeof(env, item_type))),
+                       gcc_comparison(env->ctx, NULL, GCC_COMPARISON_NE, stride_field, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), gcc_sizeof(env, item_type))),
                        needs_flattening, already_flat);
     *block = needs_flattening;
     gcc_func_t *flatten = get_function(env, "array_flatten");
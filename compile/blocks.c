@@ -17,7 +17,7 @@
 #include "../parse.h"
 #include "../util.h"
 
-void compile_statement(env_t *env, gcc_block_t **block, ast_t *ast)
+static void _compile_statement(env_t *env, gcc_block_t **block, ast_t *ast)
 {
     if (is_discardable(env, ast)) {
         gcc_rvalue_t *val = compile_expr(env, block, ast);
@@ -39,46 +39,93 @@ void compile_statement(env_t *env, gcc_block_t **block, ast_t *ast)
     }
 }
 
+// Bind the top-level definitions of a separately compiled module to the
+// symbols exported by its shared object, without compiling any of its code
+static void declare_imported(env_t *env, ast_t *ast)
+{
+    switch (ast->tag) {
+    case Declare: {
+        auto decl = Match(ast, Declare);
+        sss_type_t *t = get_type(env, decl->value);
+        const char *name = Match(decl->var, Var)->name;
+        const char *sym_name = module_symbol(env, ast, name);
+        gcc_lvalue_t *lval = gcc_global(env->ctx, ast_loc(env, ast), GCC_GLOBAL_IMPORTED, sss_type_to_gcc(env, t), sym_name);
+        set_binding(env->bindings, name,
+             new(binding_t, .lval=lval, .rval=gcc_rval(lval), .type=t, .sym_name=sym_name, .visible_in_closures=true));
+        break;
+    }
+    case TypeDef: {
+        binding_t *b = get_binding(env, Match(ast, TypeDef)->name);
+        env_t *type_env = get_type_env(env, Match(b->type, TypeType)->type);
+        foreach (Match(ast, TypeDef)->definitions, member, _)
+            declare_imported(type_env, *member);
+        break;
+    }
+    case ConvertDef: {
+        // Conversions are registered in the target type's namespace when compiled:
+        gcc_block_t *no_block = NULL;
+        (void)compile_expr(env, &no_block, ast);
+        break;
+    }
+    default: break;
+    }
+}
+
+void compile_statement(env_t *env, gcc_block_t **block, ast_t *ast)
+{
+    compile_phase_t prev_phase = enter_phase(PHASE_LOWER);
+    _compile_statement(env, block, ast);
+    exit_phase(prev_phase);
+}
+
 gcc_func_t *prepare_use(env_t *env, ast_t *ast)
 {
     auto use = Match(ast, Use);
     sss_type_t *t = Type(ModuleType, .path=use->path);
-    sss_hashmap_t *namespace = hget(&env->global->type_namespaces, type_to_string(t), sss_hashmap_t*);
+    sss_hashmap_t *namespace = hget(&env->global->type_namespaces, canonical_type(t), sss_hashmap_t*);
     binding_t *b = NULL;
     if (namespace) {
         // Look up old value to avoid recompiling the same module if it's reimported:
         b = hget(namespace, "#load", binding_t*);
         if (b) return b->func;
     } else {
-        namespace = new(sss_hashmap_t, .fallback=&env->global->bindings);
-        hset(&env->global->type_namespaces, type_to_string(t), namespace);
+        namespace = new_bindings(&env->global->bindings);
+        ((bindings_t*)namespace)->is_namespace = true;
+        hset(&env->global->type_namespaces, canonical_type(t), namespace);
     }
 
+    compile_phase_t prev_phase = enter_phase(PHASE_LOAD);
+    sss_file_t *file = use->file ? use->file : sss_load_file(use->path);
+    exit_phase(prev_phase);
+    if (!file) compiler_err(env, ast, "The file %s doesn't exist", use->path);
+    hset(&env->global->used_files, file->filename, file);
+
     env_t module_env = *env;
+    module_env.file = file;
     module_env.file_bindings = namespace;
-    hset(module_env.file_bindings, "IS_MAIN_PROGRAM",
+    module_env.symbol_prefix = NULL;
+    module_env.importing_module = false;
+    set_binding(module_env.file_bindings, "IS_MAIN_PROGRAM",
          new(binding_t, .type=Type(BoolType), .rval=gcc_rvalue_bool(env->ctx, use->main_program), .visible_in_closures=true));
     module_env.bindings = namespace;
-    gcc_func_t *load_func = gcc_new_func(
-        env->ctx, NULL, GCC_FUNCTION_EXPORTED, sss_type_to_gcc(env, t), fresh("load_module"), 0, NULL, 0);
-    b = new(binding_t, .type=Type(FunctionType, .arg_types=LIST(sss_type_t*), .ret=t), .func=load_func);
-    hset(namespace, "#load", b);
 
-    gcc_block_t *enter_load = gcc_new_block(load_func, fresh("enter_load")),
-                *do_loading = gcc_new_block(load_func, fresh("do_loading")),
-                *finished_loading = gcc_new_block(load_func, fresh("finished_loading"));
+    const char *library = NULL;
+    if (use->library) {
+        module_env.symbol_prefix = module_symbol_prefix(file);
+    } else if (!use->main_program && !use->file) {
+        library = compile_module_library(env, file);
+        if (library) {
+            module_env.symbol_prefix = module_symbol_prefix(file);
+            module_env.importing_module = true;
+        }
+    }
 
-    // static is_loaded = false; if (is_loaded) return; is_loaded = true; load...
-    gcc_lvalue_t *is_loaded = gcc_global(env->ctx, NULL, GCC_GLOBAL_INTERNAL, gcc_type(env->ctx, BOOL), fresh("module_was_loaded"));
-    gcc_jit_global_set_initializer_rvalue(is_loaded, gcc_rvalue_bool(env->ctx, false));
-    gcc_jump_condition(enter_load, NULL, gcc_rval(is_loaded), finished_loading, do_loading);
-    gcc_lvalue_t *module_val = gcc_local(load_func, NULL, sss_type_to_gcc(env, t), "_module");
-    gcc_return(finished_loading, NULL, gcc_rval(module_val));
+    const char *load_name = module_env.symbol_prefix ? heap_strf("%sload", module_env.symbol_prefix) : fresh("load_module");
+    gcc_func_t *load_func = gcc_new_func(
+        env->ctx, NULL, library ? GCC_FUNCTION_IMPORTED : GCC_FUNCTION_EXPORTED, sss_type_to_gcc(env, t), load_name, 0, NULL, 0);
+    b = new(binding_t, .type=Type(FunctionType, .arg_types=LIST(sss_type_t*), .ret=t), .func=load_func);
+    set_binding(namespace, "#load", b);
 
-    gcc_assign(do_loading, NULL, is_loaded, gcc_rvalue_bool(env->ctx, true));
-    sss_file_t *file = use->file ? use->file : sss_load_file(use->path);
-    module_env.file = file;
-    if (!file) compiler_err(env, ast, "The file %s doesn't exist", use->path);
     ast_t *module_ast = parse_file(file, env->on_err);
     // Convert top-level declarations to global
     if (module_ast->tag == Block) {
@@ -94,6 +141,34 @@ gcc_func_t *prepare_use(env_t *env, ast_t *ast)
         }
         module_ast = WrapAST(module_ast, Block, statements);
     }
+
+    if (library) {
+        // The module's code lives in its shared object, so only its declarations are needed here:
+        List(ast_t*) statements = module_ast->tag == Block ? Match(module_ast, Block)->statements : LIST(ast_t*, module_ast);
+        foreach (statements, stmt, _) populate_uses(&module_env, *stmt);
+        foreach (statements, stmt, _) predeclare_def_types(&module_env, *stmt, true);
+        foreach (statements, stmt, _) populate_def_members(&module_env, *stmt);
+        foreach (statements, stmt, _) predeclare_def_funcs(&module_env, *stmt);
+        foreach (statements, stmt, _) declare_imported(&module_env, *stmt);
+        gcc_add_driver_opt(env->ctx, library);
+        env->derived_units = module_env.derived_units;
+        return load_func;
+    }
+
+    note_references(&module_env, module_ast);
+
+    gcc_block_t *enter_load = gcc_new_block(load_func, fresh("enter_load")),
+                *do_loading = gcc_new_block(load_func, fresh("do_loading")),
+                *finished_loading = gcc_new_block(load_func, fresh("finished_loading"));
+
+    // static is_loaded = false; if (is_loaded) return; is_loaded = true; load...
+    gcc_lvalue_t *is_loaded = gcc_global(env->ctx, NULL, GCC_GLOBAL_INTERNAL, gcc_type(env->ctx, BOOL), fresh("module_was_loaded"));
+    gcc_jit_global_set_initializer_rvalue(is_loaded, gcc_rvalue_bool(env->ctx, false));
+    gcc_jump_condition(enter_load, NULL, gcc_rval(is_loaded), finished_loading, do_loading);
+    gcc_lvalue_t *module_val = gcc_local(load_func, NULL, sss_type_to_gcc(env, t), "_module");
+    gcc_return(finished_loading, NULL, gcc_rval(module_val));
+
+    gcc_assign(do_loading, NULL, is_loaded, gcc_rvalue_bool(env->ctx, true));
     gcc_rvalue_t *exported = compile_block_expr(&module_env, &do_loading, module_ast);
     if (do_loading) {
         if (exported) gcc_eval(do_loading, NULL, exported);
@@ -109,13 +184,13 @@ void populate_uses(env_t *env, ast_t *ast)
         auto decl = Match(ast, Declare);
         auto use = Match(decl->value, Use);
         (void)prepare_use(env, Match(ast, Declare)->value);
-        hset(env->bindings, Match(Match(ast, Declare)->var, Var)->name,
+        set_binding(env->bindings, Match(Match(ast, Declare)->var, Var)->name,
              new(binding_t, .type=Type(TypeType, .type=Type(ModuleType, .path=use->path)), .visible_in_closures=decl->is_global));
     } else if (ast->tag == Use) {
         auto use = Match(ast, Use);
         (void)prepare_use(env, ast);
         sss_type_t *t = Type(ModuleType, .path=use->path);
-        sss_hashmap_t *namespace = hget(&env->global->type_namespaces, type_to_string(t), sss_hashmap_t*);
+        sss_hashmap_t *namespace = hget(&env->global->type_namespaces, canonical_type(t), sss_hashmap_t*);
         for (uint32_t i = 1; i <= namespace->count; i++) {
             auto entry = hnth(namespace, i, const char*, binding_t*);
             if (entry->value->func) continue;
@@ -124,7 +199,7 @@ void populate_uses(env_t *env, ast_t *ast)
                 compiler_err(env, ast, "This 'use' statement is importing '%s', which already exists in this namespace. "
                              "Please change the 'use' to declare a variable to hold the import namespace and avoid collisions.",
                              entry->key);
-            hset(env->bindings, entry->key, entry->value);
+            set_binding(env->bindings, entry->key, entry->value);
         }
     } else if (ast->tag == DocTest) {
         return populate_uses(env, Match(ast, DocTest)->expr);
@@ -145,19 +220,19 @@ void predeclare_def_types(env_t *env, ast_t *def, bool lazy)
         if (type_ast->tag == TypeStruct) {
             // This is a placeholder type, whose fields will be populated later.
             // This is necessary because of recursive/corecursive structs.
-            t = Type(StructType, .field_names=LIST(const char*),
+            t = MutableType(StructType, .field_names=LIST(const char*),
                      .field_types=LIST(sss_type_t*), .field_defaults=LIST(ast_t*));
         } else if (type_ast->tag == TypeTaggedUnion) {
             auto tu = Match(type_ast, TypeTaggedUnion);
-            t = Type(TaggedUnionType, .members=LIST(sss_tagged_union_member_t), .tag_bits=tu->tag_bits);
+            t = MutableType(TaggedUnionType, .members=LIST(sss_tagged_union_member_t), .tag_bits=tu->tag_bits);
         } else {
             t = parse_type_ast(env, type_ast);
         }
         t = Type(VariantType, .name=name, .filename=sss_get_file_pos(def->file, def->start), .variant_of=t);
         binding_t *b = new(binding_t, .type=Type(TypeType, .type=t), .visible_in_closures=true);
-        hset(env->bindings, name, b);
+        set_binding(env->bindings, name, b);
         env_t *type_env = get_type_env(env, t);
-        type_env->bindings->fallback = env->bindings;
+        set_fallback(type_env->bindings, env->bindings);
         foreach (definitions, def, _)
             predeclare_def_types(type_env, *def, lazy);
     } else if (def->tag == UnitDef) {
@@ -211,7 +286,7 @@ void populate_tagged_union_constructors(env_t *env, sss_type_t *t)
                         gcc_rvalue_from_long(env->ctx, tag_gcc_t, member.tag_value),
                         gcc_union_constructor(env->ctx, NULL, union_gcc_t, gcc_get_union_field(union_gcc_t, i), struct_val),
                     }));
-            hset(env->bindings, member.name,
+            set_binding(env->bindings, member.name,
                  new(binding_t, .type=Type(FunctionType, .arg_names=names, .arg_types=types, .arg_defaults=defaults, .ret=t),
                      .visible_in_closures=true,
                      .func=func, .rval=gcc_get_func_address(func, NULL)));
@@ -220,7 +295,7 @@ void populate_tagged_union_constructors(env_t *env, sss_type_t *t)
                 env->ctx, NULL, gcc_tagged_t, 1, &tag_field, (gcc_rvalue_t*[]){
                     gcc_rvalue_from_long(env->ctx, tag_gcc_t, member.tag_value),
                 });
-            hset(env->bindings, member.name, new(binding_t, .type=t, .rval=val, .visible_in_closures=true));
+            set_binding(env->bindings, member.name, new(binding_t, .type=t, .rval=val, .visible_in_closures=true));
         }
     }
 }
@@ -234,7 +309,7 @@ void populate_def_members(env_t *env, ast_t *def)
 
         sss_type_t *t = Match(binding->type, TypeType)->type;
         env_t *inner_env = get_type_env(env, t);
-        inner_env->bindings->fallback = env->bindings;
+        set_fallback(inner_env->bindings, env->bindings);
 
         ast_t *type_ast = Match(def, TypeDef)->type;
         if (type_ast->tag == TypeStruct) {
@@ -297,7 +372,7 @@ void predeclare_def_funcs(env_t *env, ast_t *def)
         binding_t *b =  new(binding_t, .type=get_type(env, def),
                             .func=func, .rval=gcc_get_func_address(func, NULL),
                             .visible_in_closures=true);
-        hset(env->file_bindings, fndef->name, b);
+        set_binding(env->file_bindings, fndef->name, b);
     } else if (def->tag == TypeDef) {
         binding_t *b = get_binding(env, Match(def, TypeDef)->name);
         sss_type_t *t = Match(b->type, TypeType)->type;
@@ -311,7 +386,7 @@ void predeclare_def_funcs(env_t *env, ast_t *def)
                 binding_t *b =  new(binding_t, .type=get_type(env, member),
                                     .func=func, .rval=gcc_get_func_address(func, NULL),
                                     .visible_in_closures=true);
-                hset(env->bindings, fndef->name, b);
+                set_binding(env->bindings, fndef->name, b);
             } else {
                 predeclare_def_funcs(env, member);
             }
@@ -375,6 +450,7 @@ gcc_rvalue_t *_compile_block(env_t *env, gcc_block_t **block, ast_t *ast, bool g
         } else {
             env_t tmp = *env;
             tmp.comprehension_callback = NULL;
+            tmp.comprehension_reserve = NULL;
             compile_statement(&tmp, block, *stmt);
             env->derived_units = tmp.derived_units;
             env->deferred = tmp.deferred;
@@ -42,7 +42,7 @@ gcc_func_t *get_compare_func(env_t *env, sss_type_t *t)
     sss_type_t *void_ptr_t = Type(PointerType, .pointed=Type(MemoryType), .is_optional=true);
     if (t->tag == PointerType && !type_eq(t, void_ptr_t)) {
         gcc_func_t *func = get_compare_func(env, void_ptr_t);
-        hset(get_namespace(env, t), "__compare", get_from_namespace(env, void_ptr_t, "__compare"));
+        set_binding(get_namespace(env, t), "__compare", get_from_namespace(env, void_ptr_t, "__compare"));
         return func;
     }
 
@@ -56,7 +56,7 @@ gcc_func_t *get_compare_func(env_t *env, sss_type_t *t)
     gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, int_t, fresh("compare"), 2, params, 0);
     sss_type_t *fn_t = Type(FunctionType, .arg_types=LIST(sss_type_t*, t, t), .arg_names=LIST(const char*, "lhs", "rhs"),
                            .arg_defaults=NULL, .ret=Type(IntType, .bits=32));
-    hset(get_namespace(env, t), "__compare",
+    set_binding(get_namespace(env, t), "__compare",
          new(binding_t, .func=func, .rval=gcc_get_func_address(func, NULL), .type=fn_t));
 
     gcc_block_t *block = gcc_new_block(func, fresh("compare"));
@@ -144,7 +144,7 @@ gcc_func_t *get_compare_func(env_t *env, sss_type_t *t)
         //     if (c != 0) return c;
         //   }
         // }
-        // return lhs.len - rhs.len
+        // return (lhs.len > rhs.len) - (lhs.len < rhs.len)
 
         gcc_struct_t *array_struct = gcc_type_if_struct(gcc_t);
         gcc_rvalue_t *lhs_data = gcc_rvalue_access_field(lhs, NULL, gcc_get_field(array_struct, ARRAY_DATA_FIELD)),
@@ -156,10 +156,10 @@ gcc_func_t *get_compare_func(env_t *env, sss_type_t *t)
                     *loop_body = gcc_new_block(func, fresh("loop_body")),
                     *loop_end = gcc_new_block(func, fresh("loop_end"));
 
-        gcc_type_t *int32 = gcc_type(env->ctx, INT32);
-        gcc_lvalue_t *index_var = gcc_local(func, NULL, int32, "_i");
+        gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
+        gcc_lvalue_t *index_var = gcc_local(func, NULL, len_t, "_i");
         gcc_rvalue_t *index_rval = gcc_rval(index_var);
-        gcc_assign(block, NULL, index_var, gcc_zero(env->ctx, int32));
+        gcc_assign(block, NULL, index_var, gcc_zero(env->ctx, len_t));
 
         gcc_jump_condition(block, NULL,
                            gcc_binary_op(env->ctx, NULL, GCC_BINOP_LOGICAL_AND, gcc_type(env->ctx, BOOL),
@@ -183,8 +183,8 @@ gcc_func_t *get_compare_func(env_t *env, sss_type_t *t)
 
         gcc_func_t *cmp_fn = get_compare_func(env, item_t);
         assert(cmp_fn);
-        gcc_rvalue_t *lhs_offset = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, int32, index_rval, gcc_cast(env->ctx, NULL, lhs_stride, int32));
-        gcc_rvalue_t *rhs_offset = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, int32, index_rval, gcc_cast(env->ctx, NULL, rhs_stride, int32));
+        gcc_rvalue_t *lhs_offset = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, len_t, index_rval, gcc_cast(env->ctx, NULL, lhs_stride, len_t));
+        gcc_rvalue_t *rhs_offset = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, len_t, index_rval, gcc_cast(env->ctx, NULL, rhs_stride, len_t));
         gcc_rvalue_t *difference = gcc_callx(env->ctx, NULL, cmp_fn,
             // lhs.data[i*lhs.stride], rhs.data[i*rhs.stride]
             gcc_rval(gcc_rvalue_dereference(pointer_offset(env, gcc_item_ptr_t, lhs_data, lhs_offset), NULL)),
@@ -199,11 +199,12 @@ gcc_func_t *get_compare_func(env_t *env, sss_type_t *t)
         gcc_return(early_return, NULL, difference);
 
         // keep_going:
-        gcc_update(keep_going, NULL, index_var, GCC_BINOP_PLUS, gcc_one(env->ctx, int32));
+        gcc_update(keep_going, NULL, index_var, GCC_BINOP_PLUS, gcc_one(env->ctx, len_t));
         gcc_jump(keep_going, NULL, loop_condition);
 
         // loop_end:
-        gcc_return(loop_end, NULL, gcc_cast(env->ctx, NULL, gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, int32, lhs_len, rhs_len), int_t));
+        // The lengths may differ by more than an int can hold, so compare them instead of subtracting
+        gcc_return(loop_end, NULL, compare_values(env, INT_TYPE, lhs_len, rhs_len));
         break;
     }
     case TableType: {
@@ -251,7 +252,7 @@ gcc_func_t *get_indirect_compare_func(env_t *env, sss_type_t *t)
     sss_type_t *void_ptr_t = Type(PointerType, .pointed=Type(MemoryType), .is_optional=true);
     if (t->tag == PointerType && !type_eq(t, void_ptr_t)) {
         gcc_func_t *func = get_indirect_compare_func(env, void_ptr_t);
-        hset(get_namespace(env, t), "__compare_indirect",
+        set_binding(get_namespace(env, t), "__compare_indirect",
              get_from_namespace(env, void_ptr_t, "__compare_indirect"));
         return func;
     }
@@ -266,7 +267,7 @@ gcc_func_t *get_indirect_compare_func(env_t *env, sss_type_t *t)
     gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, int_t, fresh("compare_indirect"), 2, params, 0);
     sss_type_t *fn_t = Type(FunctionType, .arg_types=LIST(sss_type_t*, t, t), .arg_names=LIST(const char*, "lhs", "rhs"),
                            .arg_defaults=NULL, .ret=Type(IntType, .bits=32));
-    hset(get_namespace(env, t), "__compare_indirect",
+    set_binding(get_namespace(env, t), "__compare_indirect",
          new(binding_t, .func=func, .rval=gcc_get_func_address(func, NULL), .type=fn_t));
 
     gcc_block_t *block = gcc_new_block(func, fresh("compare_indirect"));
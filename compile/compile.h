@@ -29,17 +29,28 @@
 #define TABLE_DEFAULT_FIELD 3
 #define TABLE_CAPACITY_FIELD 4
 #define TABLE_COUNT_FIELD 5
-#define TABLE_LASTFREE_FIELD 6
+#define TABLE_GROWTH_LEFT_FIELD 6
 #define TABLE_COW_FIELD 7
+#define TABLE_COW_COPIES_FIELD 8
+#define TABLE_STORES_HASHES_FIELD 9
+#define TABLE_KEY_FILTER_FIELD 10
 
 #define ARRAY_DATA_FIELD 0
 #define ARRAY_LENGTH_FIELD 1
 #define ARRAY_STRIDE_FIELD 2
 #define ARRAY_CAPACITY_FIELD 3
+// Arrays are laid out as {items, int64_t length, int32_t stride, int32_t free}
+// (see string_t in libsss/string.h), so use these with gcc_type():
+#define GCC_T_ARRAY_LENGTH GCC_T_INT64
+#define GCC_T_ARRAY_STRIDE GCC_T_INT32
+#define GCC_T_ARRAY_FREE GCC_T_INT32
 
 // ============================== helpers.c ==============================
 // Generate a fresh (unique) identifier
 const char *fresh(const char *name);
+// Generate a stable identifier for a module's top-level definition
+const char *module_symbol(env_t *env, ast_t *ast, const char *name);
+const char *module_symbol_prefix(sss_file_t *f);
 // Data layout information:
 ssize_t gcc_alignof(env_t *env, sss_type_t *sss_t);
 ssize_t gcc_sizeof(env_t *env, sss_type_t *sss_t);
@@ -49,6 +60,8 @@ gcc_type_t *get_tag_type(env_t *env, sss_type_t *t);
 gcc_type_t *get_union_type(env_t *env, sss_type_t *t);
 // Convert an SSS type to the GCC JIT representation
 gcc_type_t *sss_type_to_gcc(env_t *env, sss_type_t *t);
+// Release a context, along with the GCC types cached for it
+void release_context(gcc_ctx_t *ctx);
 // Check whether a value is truthy or not
 void check_truthiness(env_t *env, gcc_block_t **block, ast_t *obj, gcc_block_t *if_truthy, gcc_block_t *if_falsey);
 // Maybe append a string to a cord
@@ -57,6 +70,8 @@ void maybe_append_cord(env_t *env, gcc_block_t **block, gcc_lvalue_t *cord, gcc_
 gcc_func_t *get_cord_func(env_t *env, sss_type_t *t);
 // Get a hash function for a type
 gcc_func_t *get_hash_func(env_t *env, sss_type_t *t);
+// Whether a type's hash function is slow enough that tables should store key hashes
+bool has_expensive_hash(sss_type_t *t);
 // Compare two values (returns [-1,0,1])
 gcc_rvalue_t *compare_values(env_t *env, sss_type_t *t, gcc_rvalue_t *a, gcc_rvalue_t *b);
 // Get a function to compare two values of a type
@@ -82,6 +97,8 @@ gcc_rvalue_t *pointer_offset(env_t *env, gcc_type_t *ptr_type, gcc_rvalue_t *ptr
 
 // ============================== program.c =============================
 typedef void (*main_func_t)(int, char**);
+env_t *compile_program(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, ast_t *ast, bool tail_calls, module_options_t *module_options);
+const char *compile_module_library(env_t *env, sss_file_t *file);
 main_func_t compile_file(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, ast_t *ast, bool tail_calls, gcc_jit_result **result);
 
 // ============================== expr.c ================================
@@ -92,6 +109,9 @@ gcc_rvalue_t *compile_len(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_rv
 // ============================== functions.c ===========================
 void compile_function(env_t *env, gcc_func_t *func, ast_t *def);
 gcc_func_t *get_function_def(env_t *env, ast_t *def, const char *name);
+void note_references(env_t *env, ast_t *ast);
+bool is_function_referenced(env_t *env, ast_t *def);
+void compile_unreferenced_function(env_t *env, gcc_func_t *func);
 
 // ============================== blocks.c ==============================
 gcc_func_t *prepare_use(env_t *env, ast_t *ast);
@@ -128,10 +148,14 @@ gcc_rvalue_t *compile_array(env_t *env, gcc_block_t **block, ast_t *ast, bool ma
 void compile_array_cord_func(env_t *env, gcc_block_t **block, gcc_rvalue_t *obj, gcc_rvalue_t *rec, gcc_rvalue_t *color, sss_type_t *t);
 gcc_rvalue_t *array_contains(env_t *env, gcc_block_t **block, ast_t *array, ast_t *member);
 binding_t *get_array_method(env_t *env, sss_type_t *t, const char *method_name);
+binding_t *get_array_sort_by_method(env_t *env, sss_type_t *t, sss_type_t *key_fn_t);
 void flatten_arrays(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_rvalue_t *array);
 
 // ============================== tables.c ==============================
 gcc_rvalue_t *table_entry_value_offset(env_t *env, sss_type_t *t);
+gcc_func_t *get_table_lookup_func(env_t *env, sss_type_t *t);
+gcc_func_t *get_table_insert_func(env_t *env, sss_type_t *t);
+gcc_rvalue_t *table_entries(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_rvalue_t *table);
 gcc_rvalue_t *table_lookup_optional(env_t *env, gcc_block_t **block, ast_t *table_ast, ast_t *key_ast, gcc_rvalue_t **key_rval_out, bool raw);
 gcc_lvalue_t *table_lvalue(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_rvalue_t *table, ast_t *key_ast, bool autocreate);
 gcc_rvalue_t *compile_table(env_t *env, gcc_block_t **block, ast_t *ast, bool mark_cow);
@@ -265,7 +265,7 @@ static gcc_rvalue_t *compile_struct(env_t *env, gcc_block_t **block, ast_t *ast,
 
         field_rvals[arg->position] = rval;
         if (rval && arg->name)
-            hset(default_env->bindings, arg->name, new(binding_t, .type=arg->type, .rval=rval));
+            set_binding(default_env->bindings, arg->name, new(binding_t, .type=arg->type, .rval=rval));
     }
 
     // Filter for only the populated fields (those not uninitialized):
@@ -322,7 +322,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
         gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
         gcc_lvalue_t *lval;
         const char* name = Match(decl->var, Var)->name;
-        const char* sym_name = decl->is_global ? fresh(name) : name;
+        const char* sym_name = !decl->is_global ? name : (env->symbol_prefix ? module_symbol(env, ast, name) : fresh(name));
         if (decl->is_global) {
             lval = gcc_global(env->ctx, ast_loc(env, ast), GCC_GLOBAL_EXPORTED, gcc_t, sym_name);
         } else {
@@ -333,7 +333,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
         if (clobbered && clobbered->type->tag == TypeType && clobbered->rval)
             compiler_err(env, ast, "This name is already being used for the name of a type (struct or enum) in the same block, "
                   "and I get confused if you try to redeclare the name of a namespace.");
-        hset(env->bindings, name,
+        set_binding(env->bindings, name,
              new(binding_t, .lval=lval, .rval=gcc_rval(lval), .type=t, .sym_name=decl->is_global ? sym_name : NULL,
                  .visible_in_closures=decl->is_global));
         assert(rval);
@@ -455,29 +455,14 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
         for (int64_t i = 0; i < len; i++) {
             auto target = ith(lvals, i);
             if (target.is_table) {
-                sss_type_t *key_t = Match(target.table_type, TableType)->key_type;
                 sss_type_t *value_t = Match(target.table_type, TableType)->value_type;
-
-                size_t key_size = gcc_sizeof(env, key_t);
-                size_t value_align = gcc_alignof(env, value_t);
-                size_t value_offset = key_size;
-                if (value_align > 0 && value_offset % value_align != 0) value_offset = (value_offset - (value_offset % value_align) + value_align);
-                gcc_rvalue_t *entry_offset = gcc_rvalue_size(env->ctx, value_offset);
-
-                gcc_func_t *hashmap_set_fn = get_function(env, "sss_hashmap_set");
-                gcc_func_t *key_hash = get_hash_func(env, key_t);
-                gcc_func_t *key_cmp = get_indirect_compare_func(env, key_t);
                 gcc_lvalue_t *val_lval = gcc_local(func, loc, sss_type_to_gcc(env, value_t), "value");
                 gcc_assign(*block, loc, val_lval, ith(rvals, i));
                 gcc_rvalue_t *call = gcc_callx(
-                    env->ctx, loc, hashmap_set_fn,
-                    gcc_cast(env->ctx, loc, target.table, gcc_type(env->ctx, VOID_PTR)),
-                    gcc_cast(env->ctx, loc, gcc_get_func_address(key_hash, loc), gcc_type(env->ctx, VOID_PTR)),
-                    gcc_cast(env->ctx, loc, gcc_get_func_address(key_cmp, loc), gcc_type(env->ctx, VOID_PTR)),
-                    gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(target.table_type))),
-                    gcc_cast(env->ctx, loc, gcc_lvalue_address(target.key, loc), gcc_type(env->ctx, VOID_PTR)),
-                    entry_offset,
-                    gcc_cast(env->ctx, loc, gcc_lvalue_address(val_lval, loc), gcc_type(env->ctx, VOID_PTR)));
+                    env->ctx, loc, get_table_insert_func(env, target.table_type),
+                    gcc_cast(env->ctx, loc, target.table, gcc_get_ptr_type(sss_type_to_gcc(env, target.table_type))),
+                    gcc_lvalue_address(target.key, loc),
+                    gcc_lvalue_address(val_lval, loc));
                 gcc_eval(*block, loc, call);
             } else {
                 gcc_assign(*block, ast_loc(env, ast), target.lval, ith(rvals, i));
@@ -565,7 +550,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
             *cached_binding = *entry->value;
             cached_binding->lval = cached;
             cached_binding->rval = gcc_rval(cached);
-            hset(defer_env->bindings, entry->key, cached_binding);
+            set_binding(defer_env->bindings, entry->key, cached_binding);
         }
         defer_env->is_deferred = true;
         env->deferred = new(defer_t, .next=env->deferred, .body=Match(ast, Defer)->body, .environment=defer_env);
@@ -607,10 +592,10 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                 ast_t *shim = WrapAST(*used, FieldAccess, .fielded=*used, .field=*field);
                 if (can_be_lvalue(env, shim, false)) {
                     gcc_lvalue_t *lval = get_lvalue(env, block, shim, false);
-                    hset(env->bindings, *field, new(binding_t, .type=get_type(env, shim), .lval=lval, .rval=gcc_rval(lval)));
+                    set_binding(env->bindings, *field, new(binding_t, .type=get_type(env, shim), .lval=lval, .rval=gcc_rval(lval)));
                 } else {
                     gcc_rvalue_t *rval = compile_expr(env, block, shim);
-                    hset(env->bindings, *field, new(binding_t, .type=get_type(env, shim), .rval=rval));
+                    set_binding(env->bindings, *field, new(binding_t, .type=get_type(env, shim), .rval=rval));
                 }
             }
         }
@@ -708,15 +693,15 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                                           gcc_get_field(gcc_type_if_struct(gcc_t), ARRAY_CAPACITY_FIELD), \
                                       }, (gcc_rvalue_t*[]){ \
                                           str_rval, \
-                                          gcc_cast(env->ctx, loc, len_rval, gcc_type(env->ctx, INT32)), \
-                                          gcc_cast(env->ctx, loc, stride_rval, gcc_type(env->ctx, INT16)), \
-                                          gcc_rvalue_int16(env->ctx, -1), \
+                                          gcc_cast(env->ctx, loc, len_rval, gcc_type(env->ctx, ARRAY_LENGTH)), \
+                                          gcc_cast(env->ctx, loc, stride_rval, gcc_type(env->ctx, ARRAY_STRIDE)), \
+                                          gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), -1), \
                                       })
     case StringLiteral: {
         const char* str = Match(ast, StringLiteral)->str;
         gcc_rvalue_t *str_rval = gcc_str(env->ctx, str);
-        gcc_rvalue_t *len_rval = gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, INT32), strlen(str));
-        gcc_rvalue_t *stride_rval = gcc_one(env->ctx, gcc_type(env->ctx, INT16));
+        gcc_rvalue_t *len_rval = gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_LENGTH), strlen(str));
+        gcc_rvalue_t *stride_rval = gcc_one(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE));
         gcc_type_t *gcc_t = sss_type_to_gcc(env, Type(ArrayType, .item_type=Type(CharType)));
         return STRING_STRUCT(env, gcc_t, str_rval, len_rval, stride_rval);
     }
@@ -749,12 +734,12 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
 
         sss_type_t *string_t = variant_t ? variant_t : Type(ArrayType, .item_type=Type(CharType));
         gcc_type_t *gcc_t = sss_type_to_gcc(env, string_t);
-        gcc_type_t *i16_t = gcc_type(env->ctx, INT16);
-        gcc_type_t *i32_t = gcc_type(env->ctx, INT32);
+        gcc_type_t *stride_t = gcc_type(env->ctx, ARRAY_STRIDE);
+        gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
 
         // Optimize the case of empty strings
         if (length(chunks) == 0) {
-            return STRING_STRUCT(env, gcc_t, gcc_null(env->ctx, gcc_type(env->ctx, STRING)), gcc_zero(env->ctx, i32_t), gcc_one(env->ctx, i16_t));
+            return STRING_STRUCT(env, gcc_t, gcc_null(env->ctx, gcc_type(env->ctx, STRING)), gcc_zero(env->ctx, len_t), gcc_one(env->ctx, stride_t));
         } else if (length(chunks) == 1 && LIST_ITEM(chunks, 0)->tag == StringLiteral) {
             // Optimize the case of a single string literal
             return compile_expr(env, block, LIST_ITEM(chunks, 0));
@@ -807,13 +792,12 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
 
             if (!interp->quote_string && type_eq(t, string_t)) {
                 // i = 1
-                gcc_type_t *i32 = gcc_type(env->ctx, INT32);
-                gcc_lvalue_t *i = gcc_local(func, loc, i32, "_i");
-                gcc_assign(*block, loc, i, gcc_zero(env->ctx, i32));
+                gcc_lvalue_t *i = gcc_local(func, loc, len_t, "_i");
+                gcc_assign(*block, loc, i, gcc_zero(env->ctx, len_t));
                 gcc_struct_t *array_struct = gcc_type_if_struct(gcc_t);
                 gcc_rvalue_t *items = gcc_rvalue_access_field(obj, loc, gcc_get_field(array_struct, ARRAY_DATA_FIELD));
                 gcc_rvalue_t *len = gcc_rvalue_access_field(obj, loc, gcc_get_field(array_struct, ARRAY_LENGTH_FIELD));
-                gcc_rvalue_t *stride = gcc_cast(env->ctx, loc, gcc_rvalue_access_field(obj, loc, gcc_get_field(array_struct, ARRAY_STRIDE_FIELD)), i32_t);
+                gcc_rvalue_t *stride = gcc_cast(env->ctx, loc, gcc_rvalue_access_field(obj, loc, gcc_get_field(array_struct, ARRAY_STRIDE_FIELD)), len_t);
 
                 gcc_block_t *add_next_item = gcc_new_block(func, fresh("next_item")),
                             *done = gcc_new_block(func, fresh("done"));
@@ -830,10 +814,10 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                         env->ctx, loc, cord_cat_char_fn,
                         gcc_rval(cord_var),
                         gcc_rval(gcc_array_access(env->ctx, loc, items,
-                                                  gcc_binary_op(env->ctx, loc, GCC_BINOP_MULT, i32_t, gcc_rval(i), gcc_cast(env->ctx, loc, stride, i32_t))))));
+                                                  gcc_binary_op(env->ctx, loc, GCC_BINOP_MULT, len_t, gcc_rval(i), stride)))));
                 
                 // i += 1
-                gcc_update(add_next_item, loc, i, GCC_BINOP_PLUS, gcc_one(env->ctx, i32_t));
+                gcc_update(add_next_item, loc, i, GCC_BINOP_PLUS, gcc_one(env->ctx, len_t));
                 // if (i < len) goto add_next_item;
                 gcc_jump_condition(add_next_item, loc, 
                               gcc_comparison(env->ctx, loc, GCC_COMPARISON_LT, gcc_rval(i), len),
@@ -855,8 +839,8 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
         gcc_assign(*block, loc, char_star, gcc_callx(env->ctx, loc, cord_to_char_star_fn, gcc_rval(cord_var)));
         gcc_func_t *strlen_fn = get_function(env, "strlen");
         gcc_lvalue_t *str_struct_var = gcc_local(func, loc, gcc_t, "_str_final");
-        gcc_rvalue_t *len32 = gcc_cast(env->ctx, loc, gcc_callx(env->ctx, loc, strlen_fn, gcc_rval(char_star)), i32_t);
-        gcc_assign(*block, loc, str_struct_var, STRING_STRUCT(env, gcc_t, gcc_rval(char_star), len32, gcc_one(env->ctx, i16_t)));
+        gcc_rvalue_t *str_len = gcc_cast(env->ctx, loc, gcc_callx(env->ctx, loc, strlen_fn, gcc_rval(char_star)), len_t);
+        gcc_assign(*block, loc, str_struct_var, STRING_STRUCT(env, gcc_t, gcc_rval(char_star), str_len, gcc_one(env->ctx, stride_t)));
 #undef APPEND_CORD
         return gcc_rval(str_struct_var);
     }
@@ -889,7 +873,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
         // compile_function(env, func, def);
         const char *name = heap_strf("#convert-from:%s", type_to_string(src_t));
         sss_hashmap_t *ns = get_namespace(env, target_t);
-        hset(ns, name, new(binding_t, .type=Type(FunctionType, .arg_types=LIST(sss_type_t*, src_t), .ret=target_t),
+        set_binding(ns, name, new(binding_t, .type=Type(FunctionType, .arg_types=LIST(sss_type_t*, src_t), .ret=target_t),
                            .func=func, .rval=gcc_get_func_address(func, NULL), .visible_in_closures=true));
         return NULL;
     }
@@ -906,9 +890,10 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                 assert(t);
                 gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
                 const char* name = Match(decl->var, Var)->name;
-                const char* sym_name = fresh(name);
-                gcc_lvalue_t *lval = gcc_global(env->ctx, ast_loc(env, (*member)), GCC_GLOBAL_INTERNAL, gcc_t, sym_name);
-                hset(env->bindings, name,
+                const char* sym_name = env->symbol_prefix ? module_symbol(env, *member, name) : fresh(name);
+                gcc_lvalue_t *lval = gcc_global(env->ctx, ast_loc(env, (*member)), env->symbol_prefix ? GCC_GLOBAL_EXPORTED : GCC_GLOBAL_INTERNAL,
+                                                gcc_t, sym_name);
+                set_binding(env->bindings, name,
                      new(binding_t, .lval=lval, .rval=gcc_rval(lval), .type=t, .sym_name=sym_name, .visible_in_closures=true));
                 assert(rval);
                 gcc_assign(*block, ast_loc(env, (*member)), lval, rval);
@@ -1013,11 +998,28 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
             default: {
                 sss_type_t *base_t = value_type;
                 while (base_t->tag == VariantType) base_t = Match(base_t, VariantType)->variant_of;
-                binding_t *binding = (base_t->tag == ArrayType) ?
-                    get_array_method(env, value_type, access->field)
-                    : (base_t->tag == TableType ?
-                       get_table_method(env, value_type, access->field)
-                       : get_from_namespace(env, self_t, access->field));
+                binding_t *binding;
+                if (base_t->tag == ArrayType && streq(access->field, "sort_by")) {
+                    // Which method this is depends on the key function's type:
+                    if (!call->args || length(call->args) != 1)
+                        compiler_err(env, ast, "sort_by() takes one argument: a function that gets the key to sort each item by");
+                    ast_t *key_ast = ith(call->args, 0);
+                    if (key_ast->tag == KeywordArg) key_ast = Match(key_ast, KeywordArg)->arg;
+                    sss_type_t *key_fn_t = get_type(env, key_ast);
+                    sss_type_t *item_t = Match(base_t, ArrayType)->item_type;
+                    if (key_fn_t->tag != FunctionType || length(Match(key_fn_t, FunctionType)->arg_types) != 1
+                        || !type_eq(ith(Match(key_fn_t, FunctionType)->arg_types, 0), item_t)
+                        || Match(key_fn_t, FunctionType)->ret->tag == VoidType)
+                        compiler_err(env, key_ast, "I expected a function that takes a %T and returns a key to sort it by, but this is a %T",
+                                     item_t, key_fn_t);
+                    binding = get_array_sort_by_method(env, base_t, key_fn_t);
+                } else {
+                    binding = (base_t->tag == ArrayType) ?
+                        get_array_method(env, value_type, access->field)
+                        : (base_t->tag == TableType ?
+                           get_table_method(env, value_type, access->field)
+                           : get_from_namespace(env, self_t, access->field));
+                }
                 if (!binding)
                     binding = get_from_namespace(env, value_type, access->field);
                 if (!binding)
@@ -1035,6 +1037,13 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                     while (self_t->tag == PointerType && expected_self->tag != PointerType) {
                         if (Match(self_t, PointerType)->is_optional)
                             compiler_err(env, self_ast, "This value needs to be dereferenced to pass it as a method argument, but it might be null");
+                        if (Match(self_t, PointerType)->pointed->tag == TableType && env->should_mark_cow) {
+                            // Table methods like `union()` may share the copy's data with their result:
+                            gcc_lvalue_t *self_ptr = gcc_local(gcc_block_func(*block), loc, sss_type_to_gcc(env, self_t), "_self");
+                            gcc_assign(*block, loc, self_ptr, self_val);
+                            self_val = gcc_rval(self_ptr);
+                            mark_table_cow(env, block, self_val);
+                        }
                         self_t = Match(self_t, PointerType)->pointed;
                         self_val = gcc_rval(gcc_rvalue_dereference(self_val, loc));
                         if (type_eq(self_t, expected_self) || promote(env, self_t, &self_val, expected_self))
@@ -1073,7 +1082,10 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
 
         List(arg_info_t) arg_infos = bind_arguments(env, args, fn_t->arg_names, fn_t->arg_types, fn_t->arg_defaults);
         
+        // Default arguments are evaluated in the scope where the function was
+        // defined, but the code goes in the caller's context
         env_t *default_env = fn_t->env ? fresh_scope(fn_t->env) : file_scope(env);
+        default_env->ctx = env->ctx;
         gcc_func_t *func = gcc_block_func(*block);
         // Evaluate args in order and stash in temp variables:
         gcc_rvalue_t *arg_rvals[num_args] = {};
@@ -1105,7 +1117,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
 
             arg_rvals[arg->position] = rval;
             if (arg->name)
-                hset(default_env->bindings, arg->name, new(binding_t, .type=arg->type, .rval=rval));
+                set_binding(default_env->bindings, arg->name, new(binding_t, .type=arg->type, .rval=rval));
         }
 
         if (fn)
@@ -1293,12 +1305,12 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                         gcc_get_field(gcc_struct, ARRAY_CAPACITY_FIELD),
                     },
                     (gcc_rvalue_t*[]){
-                        gcc_cast(env->ctx, loc, gcc_rvalue_access_field(obj, loc, gcc_get_field(table_struct, TABLE_ENTRIES_FIELD)),
+                        gcc_cast(env->ctx, loc, table_entries(env, block, fielded_t, obj),
                                  gcc_get_ptr_type(sss_type_to_gcc(env, item_t))), // items
                         gcc_cast(env->ctx, loc, gcc_rvalue_access_field(obj, loc, gcc_get_field(table_struct, TABLE_COUNT_FIELD)),
-                                 gcc_type(env->ctx, INT32)), // len
-                        gcc_rvalue_int16(env->ctx, entry_size), // stride
-                        gcc_rvalue_int16(env->ctx, -1), // capacity
+                                 gcc_type(env->ctx, ARRAY_LENGTH)), // len
+                        gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), entry_size), // stride
+                        gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), -1), // capacity
                     });
             } else if (streq(access->field, "values")) {
                 sss_type_t *key_t = Match(fielded_t, TableType)->key_type;
@@ -1307,9 +1319,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                 gcc_struct_t *gcc_struct = gcc_type_if_struct(gcc_t);
                 gcc_struct_t *table_struct = gcc_type_if_struct(sss_type_to_gcc(env, fielded_t));
 
-                gcc_rvalue_t *items_ptr = gcc_cast(
-                    env->ctx, loc, gcc_rvalue_access_field(obj, loc, gcc_get_field(table_struct, TABLE_ENTRIES_FIELD)),
-                    gcc_type(env->ctx, STRING));
+                gcc_rvalue_t *items_ptr = gcc_cast(env->ctx, loc, table_entries(env, block, fielded_t, obj), gcc_type(env->ctx, STRING));
                 items_ptr = pointer_offset(env, gcc_get_ptr_type(sss_type_to_gcc(env, value_t)), items_ptr, gcc_rvalue_size(env->ctx, gcc_sizeof(env, key_t)));
                 size_t entry_size = gcc_sizeof(env, table_entry_type(fielded_t));
                 return gcc_struct_constructor(
@@ -1323,9 +1333,9 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
                     (gcc_rvalue_t*[]){
                         items_ptr, // items
                         gcc_cast(env->ctx, loc, gcc_rvalue_access_field(obj, loc, gcc_get_field(table_struct, TABLE_COUNT_FIELD)),
-                                 gcc_type(env->ctx, INT32)), // len
-                        gcc_rvalue_int16(env->ctx, entry_size), // stride
-                        gcc_rvalue_int16(env->ctx, -1), // capacity
+                                 gcc_type(env->ctx, ARRAY_LENGTH)), // len
+                        gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), entry_size), // stride
+                        gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_FREE), -1), // capacity
                     });
             }
             break;
@@ -1908,7 +1918,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
         gcc_assign(*block, loc, subject_var, subject);
         if (if_->subject->tag == Declare) {
             env = fresh_scope(env);
-            hset(env->bindings, Match(Match(if_->subject, Declare)->var, Var)->name,
+            set_binding(env->bindings, Match(Match(if_->subject, Declare)->var, Var)->name,
                  new(binding_t, .type=subject_t, .lval=subject_var, .rval=gcc_rval(subject_var)));
         }
         subject = gcc_rval(subject_var);
@@ -2058,8 +2068,8 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
             env_t *lhs_env = fresh_scope(env), *rhs_env = fresh_scope(env);
             const char *var_name = (ast->tag == Min) ? "_min_" : "_max_";
             // Note: These both use 't' because promotion has already occurred.
-            hset(lhs_env->bindings, var_name, new(binding_t, .type=t, .rval=lhs_val));
-            hset(rhs_env->bindings, var_name, new(binding_t, .type=t, .rval=rhs_val));
+            set_binding(lhs_env->bindings, var_name, new(binding_t, .type=t, .rval=lhs_val));
+            set_binding(rhs_env->bindings, var_name, new(binding_t, .type=t, .rval=rhs_val));
 
             sss_type_t *cmp_lhs_t = get_type(lhs_env, key);
             gcc_rvalue_t *lhs_cmp_val = compile_expr(lhs_env, block, key),
@@ -2122,7 +2132,7 @@ gcc_rvalue_t *compile_expr(env_t *env, gcc_block_t **block, ast_t *ast)
         env = fresh_scope(env);
 
         ast_t *accum_var = WrapAST(ast, Var, .name="x");
-        hset(env->bindings, Match(accum_var, Var)->name, new(binding_t, .lval=ret, .rval=gcc_rval(ret), .type=t));
+        set_binding(env->bindings, Match(accum_var, Var)->name, new(binding_t, .lval=ret, .rval=gcc_rval(ret), .type=t));
         ast_t *incoming_var = WrapAST(ast, Var, .name="y");
 
         ast_t *index, *value, *iter, *first, *between, *empty;
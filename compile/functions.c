@@ -55,7 +55,7 @@ static gcc_func_t *add_cache(env_t *env, gcc_loc_t *loc, sss_type_t *fn_t, gcc_f
         sss_type_t *argtype = ith(fn_info->arg_types, i);
         gcc_param_t *param = gcc_new_param(env->ctx, NULL, sss_type_to_gcc(env, argtype), ith(arg_names, i));
         append(params, param);
-        hset(env->bindings, ith(arg_names, i), new(binding_t, .type=argtype, .lval=gcc_param_as_lvalue(param), .rval=gcc_param_as_rvalue(param)));
+        set_binding(env->bindings, ith(arg_names, i), new(binding_t, .type=argtype, .lval=gcc_param_as_lvalue(param), .rval=gcc_param_as_rvalue(param)));
     }
 
     gcc_func_t *inner_func = gcc_new_func(
@@ -78,18 +78,11 @@ static gcc_func_t *add_cache(env_t *env, gcc_loc_t *loc, sss_type_t *fn_t, gcc_f
         append(arg_rvals, gcc_param_as_rvalue(gcc_func_get_param(func, i)));
     }
 
-    gcc_func_t *hashmap_get_fn = get_function(env, "sss_hashmap_get_raw");
     gcc_func_t *key_hash = get_hash_func(env, arg_tuple_t);
     gcc_func_t *key_cmp = get_indirect_compare_func(env, arg_tuple_t);
     gcc_lvalue_t *cached_ptr = gcc_local(func, loc, gcc_get_ptr_type(sss_type_to_gcc(env, fn_info->ret)), "_cached_ptr");
-    gcc_assign(block, loc, cached_ptr, gcc_cast(env->ctx, loc, gcc_callx(
-                env->ctx, loc, hashmap_get_fn,
-                gcc_cast(env->ctx, loc, gcc_lvalue_address(cache, loc), gcc_type(env->ctx, VOID_PTR)),
-                gcc_cast(env->ctx, loc, gcc_get_func_address(key_hash, loc), gcc_type(env->ctx, VOID_PTR)),
-                gcc_cast(env->ctx, loc, gcc_get_func_address(key_cmp, loc), gcc_type(env->ctx, VOID_PTR)),
-                gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(cache_t))),
-                gcc_lvalue_address(arg_tuple, loc),
-                table_entry_value_offset(env, cache_t)), gcc_get_ptr_type(sss_type_to_gcc(env, fn_info->ret))));
+    gcc_assign(block, loc, cached_ptr, gcc_callx(env->ctx, loc, get_table_lookup_func(env, cache_t),
+                                                 gcc_lvalue_address(cache, loc), gcc_lvalue_address(arg_tuple, loc)));
     gcc_block_t *if_cached = gcc_new_block(func, fresh("cached")),
                 *if_not_cached = gcc_new_block(func, fresh("not_cached"));
     gcc_jump_condition(block, loc,
@@ -126,22 +119,16 @@ static gcc_func_t *add_cache(env_t *env, gcc_loc_t *loc, sss_type_t *fn_t, gcc_f
 
     gcc_lvalue_t *cached_var = gcc_local(func, loc, sss_type_to_gcc(env, fn_info->ret), "_cached");
     gcc_assign(block, loc, cached_var, gcc_call(env->ctx, loc, inner_func, length(arg_rvals), arg_rvals[0]));
-    gcc_func_t *hashmap_set_fn = get_function(env, "sss_hashmap_set");
-    gcc_eval(block, loc, gcc_callx(
-            env->ctx, loc, hashmap_set_fn,
-            gcc_cast(env->ctx, loc, gcc_lvalue_address(cache, loc), gcc_type(env->ctx, VOID_PTR)),
-            gcc_cast(env->ctx, loc, gcc_get_func_address(key_hash, loc), gcc_type(env->ctx, VOID_PTR)),
-            gcc_cast(env->ctx, loc, gcc_get_func_address(key_cmp, loc), gcc_type(env->ctx, VOID_PTR)),
-            gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(cache_t))),
-            gcc_lvalue_address(arg_tuple, loc),
-            table_entry_value_offset(env, cache_t),
-            gcc_cast(env->ctx, loc, gcc_lvalue_address(cached_var, loc), gcc_type(env->ctx, VOID_PTR))));
+    gcc_eval(block, loc, gcc_callx(env->ctx, loc, get_table_insert_func(env, cache_t),
+                                   gcc_lvalue_address(cache, loc), gcc_lvalue_address(arg_tuple, loc), gcc_lvalue_address(cached_var, loc)));
     gcc_return(block, loc, gcc_rval(cached_var));
     return inner_func;
 }
 
 void compile_function(env_t *env, gcc_func_t *func, ast_t *def)
 {
+    ++compile_counts.functions;
+    compile_phase_t prev_phase = enter_phase(PHASE_LOWER);
     sss_type_t * fn_t = get_type(env, def);
     auto fn_info = Match(fn_t, FunctionType);
 
@@ -161,7 +148,7 @@ void compile_function(env_t *env, gcc_func_t *func, ast_t *def)
         gcc_param_t *param = gcc_func_get_param(func, i);
         gcc_lvalue_t *lv = gcc_param_as_lvalue(param);
         gcc_rvalue_t *rv = gcc_param_as_rvalue(param);
-        hset(env->bindings, argname, new(binding_t, .type=argtype, .lval=lv, .rval=rv));
+        set_binding(env->bindings, argname, new(binding_t, .type=argtype, .lval=lv, .rval=rv));
     }
 
     ast_t *max_cache_size = def->tag == FunctionDef ? Match(def, FunctionDef)->cache : NULL;
@@ -193,6 +180,7 @@ void compile_function(env_t *env, gcc_func_t *func, ast_t *def)
         }
         gcc_return_void(block, NULL);
     }
+    exit_phase(prev_phase);
 }
 
 gcc_func_t *get_function_def(env_t *env, ast_t *def, const char* name)
@@ -211,6 +199,14 @@ gcc_func_t *get_function_def(env_t *env, ast_t *def, const char* name)
     }
 
     bool is_inline = def->tag == FunctionDef && Match(def, FunctionDef)->is_inline;
+    if (env->symbol_prefix && !is_inline && def->tag == FunctionDef)
+        name = module_symbol(env, def, Match(def, FunctionDef)->name);
+
+    // Functions from separately compiled modules are linked in, not compiled:
+    if (env->importing_module && !is_inline)
+        return gcc_new_func(env->ctx, ast_loc(env, def), GCC_FUNCTION_IMPORTED,
+                            sss_type_to_gcc(env, t->ret), name, length(params), params[0], 0);
+
     gcc_func_t *func = gcc_new_func(
         env->ctx, ast_loc(env, def), is_inline ? GCC_FUNCTION_ALWAYS_INLINE : GCC_FUNCTION_EXPORTED,
         sss_type_to_gcc(env, t->ret), name, length(params), params[0], 0);
@@ -219,4 +215,52 @@ gcc_func_t *get_function_def(env_t *env, ast_t *def, const char* name)
     return func;
 }
 
+static void note_reference(ast_t *ast, void *userdata)
+{
+    env_t *env = userdata;
+    if (ast->tag == Var)
+        hset(&env->global->referenced_names, Match(ast, Var)->name, true);
+    else if (ast->tag == FieldAccess)
+        hset(&env->global->referenced_names, Match(ast, FieldAccess)->field, true);
+
+    // Nested function definitions are only visited once they're referenced
+    if (ast->tag != FunctionDef)
+        visit_ast_children(ast, note_reference, env);
+}
+
+// Record the names used by a piece of code that will be compiled (not
+// including the bodies of any functions it defines)
+void note_references(env_t *env, ast_t *ast)
+{
+    visit_ast_children(ast, note_reference, env);
+}
+
+// Whether a function might be called by compiled code. This is a
+// conservative check by name, since a method like `foo.bar()` could belong
+// to any type with a `bar` method.
+bool is_function_referenced(env_t *env, ast_t *def)
+{
+    if (def->tag != FunctionDef) return true;
+    auto fndef = Match(def, FunctionDef);
+    if (!fndef->name || fndef->is_inline) return true;
+    // Methods the compiler calls implicitly:
+    if (strncmp(fndef->name, "__", 2) == 0 || streq(fndef->name, "c_string")
+        || streq(fndef->name, "from_pointer") || streq(fndef->name, "new"))
+        return true;
+    return hget(&env->global->referenced_names, fndef->name, bool);
+}
+
+// Give an unreferenced function a trivial body instead of compiling it,
+// since it has already been declared.
+void compile_unreferenced_function(env_t *env, gcc_func_t *func)
+{
+    gcc_block_t *block = gcc_new_block(func, fresh("unreferenced"));
+    gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, gcc_builtin_func(env->ctx, "__builtin_trap")));
+    gcc_type_t *ret_t = gcc_func_return_type(func);
+    if (ret_t == gcc_type(env->ctx, VOID))
+        gcc_return_void(block, NULL);
+    else
+        gcc_return(block, NULL, gcc_rval(gcc_local(func, NULL, ret_t, "_unreachable")));
+}
+
 // vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
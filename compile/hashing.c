@@ -27,7 +27,7 @@ gcc_func_t *get_hash_func(env_t *env, sss_type_t *t)
     sss_type_t *void_ptr_t = Type(PointerType, .pointed=Type(MemoryType), .is_optional=true);
     if (t->tag == PointerType && !type_eq(t, void_ptr_t)) {
         gcc_func_t *func = get_hash_func(env, void_ptr_t);
-        hset(get_namespace(env, t), "__hash", get_from_namespace(env, void_ptr_t, "__hash"));
+        set_binding(get_namespace(env, t), "__hash", get_from_namespace(env, void_ptr_t, "__hash"));
         return func;
     }
 
@@ -39,15 +39,14 @@ gcc_func_t *get_hash_func(env_t *env, sss_type_t *t)
     gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, u32, sym_name, 1, params, 0);
     sss_type_t *fn_t = Type(FunctionType, .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t)),
                            .arg_names=LIST(const char*, "obj"), .arg_defaults=NULL, .ret=Type(IntType, .bits=32, .is_unsigned=true));
-    hset(get_namespace(env, t), "__hash",
+    set_binding(get_namespace(env, t), "__hash",
          new(binding_t, .func=func, .rval=gcc_get_func_address(func, NULL), .type=fn_t));
     gcc_block_t *block = gcc_new_block(func, fresh("hash"));
     gcc_comment(block, NULL, heap_strf("Implementation of hash(%s)", type_to_string(t)));
 
-    gcc_func_t *halfsiphash = get_function(env, "halfsiphash");
+    gcc_func_t *sss_hash = get_function(env, "sss_hash");
 
     gcc_type_t *t_void_ptr = gcc_get_type(env->ctx, GCC_T_VOID_PTR);
-    gcc_rvalue_t *k = gcc_cast(env->ctx, NULL, gcc_str(env->ctx, "My secret key!!!"), t_void_ptr);
 
     gcc_rvalue_t *obj_ptr = gcc_param_as_rvalue(params[0]);
     gcc_lvalue_t *hashval = gcc_local(func, NULL, gcc_type(env->ctx, UINT32), "_hashval");
@@ -146,11 +145,8 @@ gcc_func_t *get_hash_func(env_t *env, sss_type_t *t)
 
         size_t info_size = tagged->tag_bits == 64 ? 16 : 8;
         gcc_rvalue_t *inlen = gcc_rvalue_size(env->ctx, info_size);
-        gcc_rvalue_t *outlen = gcc_rvalue_size(env->ctx, sizeof(uint32_t));
-        gcc_rvalue_t *call = gcc_callx(
-            env->ctx, NULL, halfsiphash, gcc_lvalue_address(info, NULL), inlen, k,
-            gcc_cast(env->ctx, NULL, gcc_lvalue_address(hashval, NULL), t_void_ptr), outlen);
-        gcc_eval(block, NULL, call);
+        gcc_assign(block, NULL, hashval, gcc_callx(
+            env->ctx, NULL, sss_hash, gcc_cast(env->ctx, NULL, gcc_lvalue_address(info, NULL), t_void_ptr), inlen));
         break;
 
     }
@@ -158,11 +154,8 @@ gcc_func_t *get_hash_func(env_t *env, sss_type_t *t)
     case RangeType: case FunctionType: case TypeType: {
       memory_hash:;
         gcc_rvalue_t *inlen = gcc_rvalue_size(env->ctx, gcc_sizeof(env, t));
-        gcc_rvalue_t *outlen = gcc_rvalue_size(env->ctx, sizeof(uint32_t));
-        gcc_rvalue_t *call = gcc_callx(
-            env->ctx, NULL, halfsiphash, obj_ptr, inlen, k,
-            gcc_cast(env->ctx, NULL, gcc_lvalue_address(hashval, NULL), t_void_ptr), outlen);
-        gcc_eval(block, NULL, call);
+        gcc_assign(block, NULL, hashval, gcc_callx(
+            env->ctx, NULL, sss_hash, gcc_cast(env->ctx, NULL, obj_ptr, t_void_ptr), inlen));
         break;
     }
     case TableType: {
@@ -175,23 +168,21 @@ gcc_func_t *get_hash_func(env_t *env, sss_type_t *t)
         break;
     }
     case ArrayType: {
+        // Strided arrays are hashed in place, so hashing never allocates
         gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
         gcc_rvalue_t *array = obj_ptr;
-        // If necessary, flatten first:
-        flatten_arrays(env, &block, t, array);
         gcc_struct_t *struct_t = gcc_type_if_struct(gcc_t);
         gcc_rvalue_t *data_field = gcc_rval(gcc_rvalue_dereference_field(array, NULL, gcc_get_field(struct_t, ARRAY_DATA_FIELD)));
         gcc_rvalue_t *length_field = gcc_rval(gcc_rvalue_dereference_field(array, NULL, gcc_get_field(struct_t, ARRAY_LENGTH_FIELD)));
+        gcc_rvalue_t *stride_field = gcc_rval(gcc_rvalue_dereference_field(array, NULL, gcc_get_field(struct_t, ARRAY_STRIDE_FIELD)));
         sss_type_t *item_type = Match(t, ArrayType)->item_type;
-        gcc_rvalue_t *inlen = gcc_rvalue_size(env->ctx, gcc_sizeof(env, item_type));
-        gcc_type_t *t_size = gcc_type(env->ctx, SIZE);
-        inlen = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, t_size, inlen, gcc_cast(env->ctx, NULL, length_field, t_size));
-        gcc_rvalue_t *outlen = gcc_rvalue_size(env->ctx, sizeof(uint32_t));
-        gcc_rvalue_t *call = gcc_callx(
-            env->ctx, NULL, halfsiphash,
-            gcc_cast(env->ctx, NULL, data_field, t_void_ptr), inlen, k,
-            gcc_cast(env->ctx, NULL, gcc_lvalue_address(hashval, NULL), t_void_ptr), outlen);
-        gcc_eval(block, NULL, call);
+        gcc_type_t *t_int64 = gcc_type(env->ctx, INT64);
+        gcc_assign(block, NULL, hashval, gcc_callx(
+            env->ctx, NULL, get_function(env, "sss_hash_strided"),
+            gcc_cast(env->ctx, NULL, data_field, t_void_ptr),
+            gcc_cast(env->ctx, NULL, length_field, t_int64),
+            gcc_cast(env->ctx, NULL, stride_field, t_int64),
+            gcc_rvalue_size(env->ctx, gcc_sizeof(env, item_type))));
         break;
     }
     default:
@@ -201,3 +192,31 @@ gcc_func_t *get_hash_func(env_t *env, sss_type_t *t)
     gcc_return(block, NULL, gcc_rval(hashval));
     return func;
 }
+
+// Whether hashing a value of this type has to walk over memory outside of the
+// value itself (arrays and tables), which makes it worth storing the hashes of
+// table keys of this type instead of recomputing them.
+bool has_expensive_hash(sss_type_t *t)
+{
+    while (t->tag == VariantType) t = Match(t, VariantType)->variant_of;
+    switch (t->tag) {
+    case ArrayType: case TableType: return true;
+    case StructType: {
+        foreach (Match(t, StructType)->field_types, ftype, _) {
+            if (has_expensive_hash(*ftype))
+                return true;
+        }
+        return false;
+    }
+    case TaggedUnionType: {
+        auto tagged = Match(t, TaggedUnionType);
+        for (int64_t i = 0, len = length(tagged->members); i < len; i++) {
+            sss_type_t *member_t = ith(tagged->members, i).type;
+            if (member_t && has_expensive_hash(member_t))
+                return true;
+        }
+        return false;
+    }
+    default: return false;
+    }
+}
@@ -13,12 +13,42 @@
 #include "compile.h"
 #include "libgccjit_abbrev.h"
 #include "../libsss/hashmap.h"
+#include "../SipHash/halfsiphash.h"
 #include "../span.h"
 #include "../typecheck.h"
 #include "../types.h"
 #include "../util.h"
 
-static sss_hashmap_t opaque_structs = {0};
+// GCC types can only be used in the context that created them (or its
+// children), so type caches are kept separately for each context
+static sss_hashmap_t type_caches = {0}, union_caches = {0}, opaque_struct_caches = {0};
+// The last context sss_type_to_gcc() was used with, and its cache
+static gcc_ctx_t *last_ctx = NULL;
+static sss_hashmap_t *last_cache = NULL;
+
+static sss_hashmap_t *context_cache(sss_hashmap_t *caches, gcc_ctx_t *ctx)
+{
+    sss_hashmap_t *cache = hget(caches, ctx, sss_hashmap_t*);
+    if (!cache) {
+        cache = new(sss_hashmap_t);
+        hset(caches, ctx, cache);
+    }
+    return cache;
+}
+
+// Release a context and forget the types cached for it, so a context that is
+// created later at the same address doesn't get them
+void release_context(gcc_ctx_t *ctx)
+{
+    hremove(&type_caches, ctx, sss_hashmap_t*);
+    hremove(&union_caches, ctx, sss_hashmap_t*);
+    hremove(&opaque_struct_caches, ctx, sss_hashmap_t*);
+    if (ctx == last_ctx) {
+        last_ctx = NULL;
+        last_cache = NULL;
+    }
+    gcc_jit_context_release(ctx);
+}
 
 const char *fresh(const char *name)
 {
@@ -35,6 +65,30 @@ const char *fresh(const char *name)
     return ret;
 }
 
+// A symbol name for a module's top-level definition that is the same every time
+// the module is compiled, so other modules can link against it
+const char *module_symbol(env_t *env, ast_t *ast, const char *name)
+{
+    assert(env->symbol_prefix);
+    char *tmp = (char*)heap_str(name);
+    for (size_t i = 0; i < strlen(tmp); i++) {
+        if (!isalpha(name[i]) && !isdigit(name[i]) && name[i] != '_')
+            tmp[i] = '_';
+    }
+    return heap_strf("%s%s_%ld_%ld", env->symbol_prefix, tmp,
+                     sss_get_line_number(ast->file, ast->start), sss_get_line_column(ast->file, ast->start));
+}
+
+const char *module_symbol_prefix(sss_file_t *f)
+{
+    // This needs to be the same in every process, since cached modules are
+    // linked by symbol name, so it can't use the randomly seeded hash_str()
+    static const char key[] = "sss module names";
+    uint32_t hash;
+    halfsiphash(f->filename, strlen(f->filename), key, (uint8_t*)&hash, sizeof(hash));
+    return heap_strf("sss_%08x_", hash);
+}
+
 // Kinda janky, but libgccjit doesn't have this function built in
 ssize_t gcc_alignof(env_t *env, sss_type_t *sss_t)
 {
@@ -79,7 +133,7 @@ ssize_t gcc_sizeof(env_t *env, sss_type_t *sss_t)
         return gcc_type_size(gcc_t);
 
     switch (sss_t->tag) {
-    case ArrayType: return sizeof (struct {void* items; int32_t len; int16_t stride, free;});
+    case ArrayType: return sizeof (struct {void* items; int64_t len; int32_t stride, free;});
     case TableType: return sizeof (sss_hashmap_t);
     case RangeType: return sizeof (struct {int64_t first,step,last;});
     case BoolType: return sizeof(bool);
@@ -144,13 +198,14 @@ gcc_type_t *get_tag_type(env_t *env, sss_type_t *t)
 gcc_type_t *get_union_type(env_t *env, sss_type_t *t)
 {
     t = base_variant(t);
-    static sss_hashmap_t cache = {0};
-    gcc_type_t *gcc_t = hget(&cache, type_to_string(t), gcc_type_t*);
+    sss_hashmap_t *cache = context_cache(&union_caches, env->ctx);
+    gcc_type_t *gcc_t = hget(cache, canonical_type(t), gcc_type_t*);
     if (gcc_t) return gcc_t;
+    sss_hashmap_t *opaque_structs = context_cache(&opaque_struct_caches, env->ctx);
     auto tagged = Match(base_variant(t), TaggedUnionType);
     auto fields = LIST(gcc_field_t*);
     foreach (tagged->members, member, _) {
-        if (member->type && hget(&opaque_structs, type_to_string(member->type), gcc_type_t*))
+        if (member->type && hget(opaque_structs, canonical_type(member->type), gcc_type_t*))
             compiler_err(env, NULL, "The tagged union %T recursively contains itself, which could be infinitely large. If you want to reference other %T values, use a pointer or an array.",
                          t, t);
         gcc_type_t *gcc_ft = member->type ? sss_type_to_gcc(env, member->type)
@@ -159,18 +214,23 @@ gcc_type_t *get_union_type(env_t *env, sss_type_t *t)
         append(fields, field);
     }
     gcc_type_t *union_gcc_t = gcc_union(env->ctx, NULL, "data_union", length(fields), fields[0]);
-    hset(&cache, type_to_string(t), union_gcc_t);
+    hset(cache, canonical_type(t), union_gcc_t);
     return union_gcc_t;
 }
 
 // This must be memoized because GCC JIT doesn't do structural equality
 gcc_type_t *sss_type_to_gcc(env_t *env, sss_type_t *t)
 {
-    static sss_hashmap_t cache = {0};
-    t = with_units(t, NULL);
-    const char *cache_key = type_to_string(t);
-    gcc_type_t *gcc_t = hget(&cache, cache_key, gcc_type_t*);
+    if (env->ctx != last_ctx) {
+        last_cache = context_cache(&type_caches, env->ctx);
+        last_ctx = env->ctx;
+    }
+    sss_hashmap_t *cache = last_cache;
+    if (type_units(t)) t = with_units(t, NULL);
+    sss_type_t *cache_key = canonical_type(t);
+    gcc_type_t *gcc_t = hget(cache, cache_key, gcc_type_t*);
     if (gcc_t) return gcc_t;
+    ++compile_counts.types;
 
     const char *name = NULL;
 
@@ -223,9 +283,9 @@ gcc_type_t *sss_type_to_gcc(env_t *env, sss_type_t *t)
         sss_type_t *item_type = Match(t, ArrayType)->item_type;
         gcc_field_t *fields[] = {
             [ARRAY_DATA_FIELD]=gcc_new_field(env->ctx, NULL, gcc_get_ptr_type(sss_type_to_gcc(env, item_type)), "items"),
-            [ARRAY_LENGTH_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, INT32), "length"),
-            [ARRAY_STRIDE_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, INT16), "stride"),
-            [ARRAY_CAPACITY_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, INT16), "free"),
+            [ARRAY_LENGTH_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, ARRAY_LENGTH), "length"),
+            [ARRAY_STRIDE_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, ARRAY_STRIDE), "stride"),
+            [ARRAY_CAPACITY_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, ARRAY_FREE), "free"),
         };
         gcc_struct_t *array = gcc_new_struct_type(env->ctx, NULL, fresh("Array"), sizeof(fields)/sizeof(fields[0]), fields);
         gcc_t = gcc_struct_as_type(array);
@@ -237,22 +297,19 @@ gcc_type_t *sss_type_to_gcc(env_t *env, sss_type_t *t)
         if (table->key_type->tag == VoidType || table->value_type->tag == VoidType)
             compiler_err(env, NULL, "Tables can't hold Void types");
 
-        gcc_field_t *bucket_fields[] = {
-            gcc_new_field(env->ctx, NULL, u32, "index1"),
-            gcc_new_field(env->ctx, NULL, u32, "next1"),
-        };
-        gcc_struct_t *bucket = gcc_new_struct_type(env->ctx, NULL, "Bucket", 2, bucket_fields);
-
         gcc_struct_t *gcc_struct = gcc_opaque_struct(env->ctx, NULL, "Table");
         gcc_field_t *fields[] = {
             [TABLE_ENTRIES_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, VOID_PTR), "entries"),
-            [TABLE_BUCKETS_FIELD]=gcc_new_field(env->ctx, NULL, gcc_get_ptr_type(gcc_struct_as_type(bucket)), "buckets"),
+            [TABLE_BUCKETS_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, VOID_PTR), "buckets"),
             [TABLE_FALLBACK_FIELD]=gcc_new_field(env->ctx, NULL, gcc_get_ptr_type(gcc_struct_as_type(gcc_struct)), "fallback"),
             [TABLE_DEFAULT_FIELD]=gcc_new_field(env->ctx, NULL, gcc_get_ptr_type(sss_type_to_gcc(env, table->value_type)), "default_value"),
             [TABLE_CAPACITY_FIELD]=gcc_new_field(env->ctx, NULL, u32, "capacity"),
             [TABLE_COUNT_FIELD]=gcc_new_field(env->ctx, NULL, u32, "count"),
-            [TABLE_LASTFREE_FIELD]=gcc_new_field(env->ctx, NULL, u32, "lastfree_index1"),
+            [TABLE_GROWTH_LEFT_FIELD]=gcc_new_field(env->ctx, NULL, u32, "growth_left"),
             [TABLE_COW_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, BOOL), "copy_on_write"),
+            [TABLE_COW_COPIES_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, UINT8), "cow_copies"),
+            [TABLE_STORES_HASHES_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, BOOL), "stores_hashes"),
+            [TABLE_KEY_FILTER_FIELD]=gcc_new_field(env->ctx, NULL, gcc_type(env->ctx, UINT64), "key_filter"),
         };
         gcc_set_fields(gcc_struct, NULL, sizeof(fields)/sizeof(fields[0]), fields);
         gcc_t = gcc_struct_as_type(gcc_struct);
@@ -272,18 +329,19 @@ gcc_type_t *sss_type_to_gcc(env_t *env, sss_type_t *t)
     }
     case StructType: {
         auto struct_t = Match(t, StructType);
-        const char *t_str = type_to_string(t);
-        gcc_type_t *opaque = hget(&opaque_structs, t_str, gcc_type_t*);
+        sss_type_t *canonical_t = canonical_type(t);
+        sss_hashmap_t *opaque_structs = context_cache(&opaque_struct_caches, env->ctx);
+        gcc_type_t *opaque = hget(opaque_structs, canonical_t, gcc_type_t*);
         if (opaque) return opaque;
         gcc_struct_t *gcc_struct = gcc_opaque_struct(env->ctx, NULL, name ? name : "Tuple");
         gcc_t = gcc_struct_as_type(gcc_struct);
-        hset(&cache, t_str, gcc_t);
-        hset(&opaque_structs, t_str, gcc_t);
+        hset(cache, canonical_t, gcc_t);
+        hset(opaque_structs, canonical_t, gcc_t);
 
         NEW_LIST(gcc_field_t*, fields);
         for (int64_t i = 0; i < length(struct_t->field_types); i++) {
             sss_type_t *sss_ft = ith(struct_t->field_types, i);
-            if (hget(&opaque_structs, type_to_string(sss_ft), gcc_type_t*))
+            if (hget(opaque_structs, canonical_type(sss_ft), gcc_type_t*))
                 compiler_err(env, NULL, "The struct %T recursively contains itself, which would be infinitely large. If you want to reference other %T structs, use a pointer or an array.",
                              t, t);
             gcc_type_t *gcc_ft = sss_type_to_gcc(env, sss_ft);
@@ -295,22 +353,23 @@ gcc_type_t *sss_type_to_gcc(env_t *env, sss_type_t *t)
         }
         gcc_set_fields(gcc_struct, NULL, length(fields), fields[0]);
         gcc_t = gcc_struct_as_type(gcc_struct);
-        hremove(&opaque_structs, t_str, gcc_type_t*);
+        hremove(opaque_structs, canonical_t, gcc_type_t*);
         break;
     }
     case TaggedUnionType: {
-        const char *t_str = type_to_string(t);
-        gcc_type_t *opaque = hget(&opaque_structs, t_str, gcc_type_t*);
+        sss_type_t *canonical_t = canonical_type(t);
+        sss_hashmap_t *opaque_structs = context_cache(&opaque_struct_caches, env->ctx);
+        gcc_type_t *opaque = hget(opaque_structs, canonical_t, gcc_type_t*);
         if (opaque) return opaque;
         gcc_struct_t *gcc_struct = gcc_opaque_struct(env->ctx, NULL, name ? name : "TaggedUnion");
         gcc_t = gcc_struct_as_type(gcc_struct);
-        hset(&cache, t_str, gcc_t);
-        hset(&opaque_structs, t_str, gcc_t);
+        hset(cache, canonical_t, gcc_t);
+        hset(opaque_structs, canonical_t, gcc_t);
         gcc_set_fields(gcc_struct, NULL, 2, (gcc_field_t*[]){
             gcc_new_field(env->ctx, NULL, get_tag_type(env, t), "tag"),
             gcc_new_field(env->ctx, NULL, get_union_type(env, t), "__data"),
         });
-        hremove(&opaque_structs, t_str, gcc_type_t*);
+        hremove(opaque_structs, canonical_t, gcc_type_t*);
         break;
     }
     case TypeType: {
@@ -340,7 +399,7 @@ gcc_type_t *sss_type_to_gcc(env_t *env, sss_type_t *t)
     }
     }
 
-    hset(&cache, cache_key, gcc_t);
+    hset(cache, cache_key, gcc_t);
     return gcc_t;
 }
 
@@ -24,6 +24,13 @@ static gcc_rvalue_t *rvalue_in_var(gcc_block_t **block, const char *name, gcc_ty
     return gcc_rval(var);
 }
 
+// Let a comprehension know how many times its loop is going to run
+static void reserve_comprehension(env_t *env, gcc_block_t **block, ast_t *loop, gcc_rvalue_t *count)
+{
+    if (env->comprehension_callback && env->comprehension_reserve)
+        env->comprehension_reserve(env, block, loop, gcc_cast(env->ctx, NULL, count, gcc_type(env->ctx, INT64)), env->comprehension_userdata);
+}
+
 void compile_for_loop(env_t *env, gcc_block_t **block, ast_t *ast)
 {
     auto for_ = Match(ast, For);
@@ -149,10 +156,12 @@ void compile_for_loop(env_t *env, gcc_block_t **block, ast_t *ast)
                    gcc_rvalue_access_field(iter_rval, NULL, gcc_get_field(array_struct, ARRAY_DATA_FIELD)));
 
         // len = array->len
-        gcc_lvalue_t *len = gcc_local(func, NULL, gcc_type(env->ctx, INT32), "_len");
+        gcc_lvalue_t *len = gcc_local(func, NULL, gcc_type(env->ctx, ARRAY_LENGTH), "_len");
         gcc_assign(*block, NULL, len,
                    gcc_rvalue_access_field(iter_rval, NULL, gcc_get_field(array_struct, ARRAY_LENGTH_FIELD)));
 
+        reserve_comprehension(env, block, ast, gcc_rval(len));
+
         item_shadow = gcc_local(func, NULL, gcc_item_t, "_item");
         gcc_rvalue_t *stride = gcc_rvalue_access_field(iter_rval, NULL, gcc_get_field(array_struct, ARRAY_STRIDE_FIELD));
 
@@ -184,19 +193,18 @@ void compile_for_loop(env_t *env, gcc_block_t **block, ast_t *ast)
         break;
     }
     case TableType: {
-        // entry_ptr = table->entries
+        // entry_ptr = sss_hashmap_entries(table)
         gcc_struct_t *array_struct = gcc_type_if_struct(gcc_iter_t);
         item_t = table_entry_type(iter_t);
         gcc_type_t *gcc_item_t = sss_type_to_gcc(env, item_t);
         gcc_lvalue_t *entry_ptr = gcc_local(func, NULL, gcc_get_ptr_type(gcc_item_t), "_entry_ptr");
-        gcc_assign(*block, NULL, entry_ptr,
-                   gcc_cast(env->ctx, NULL, gcc_rvalue_access_field(iter_rval, NULL, gcc_get_field(array_struct, TABLE_ENTRIES_FIELD)),
-                            gcc_get_ptr_type(gcc_item_t)));
+        gcc_assign(*block, NULL, entry_ptr, gcc_cast(env->ctx, NULL, table_entries(env, block, iter_t, iter_rval), gcc_get_ptr_type(gcc_item_t)));
 
         // len = table->count
-        gcc_lvalue_t *len = gcc_local(func, NULL, gcc_type(env->ctx, INT32), "_len");
+        gcc_lvalue_t *len = gcc_local(func, NULL, gcc_type(env->ctx, INT64), "_len");
         gcc_assign(*block, NULL, len,
-                   gcc_cast(env->ctx, NULL, gcc_rvalue_access_field(iter_rval, NULL, gcc_get_field(array_struct, TABLE_COUNT_FIELD)), gcc_type(env->ctx, INT32)));
+                   gcc_cast(env->ctx, NULL, gcc_rvalue_access_field(iter_rval, NULL, gcc_get_field(array_struct, TABLE_COUNT_FIELD)), gcc_type(env->ctx, INT64)));
+        reserve_comprehension(env, block, ast, gcc_rval(len));
 
         item_shadow = gcc_local(func, NULL, gcc_item_t, "_item");
 
@@ -216,7 +224,7 @@ void compile_for_loop(env_t *env, gcc_block_t **block, ast_t *ast)
 
         // Now populate .next block
         gcc_assign(for_next, NULL, entry_ptr, pointer_offset(env, gcc_get_ptr_type(gcc_item_t), gcc_rval(entry_ptr),
-                                                             gcc_rvalue_int32(env->ctx, gcc_sizeof(env, item_t))));
+                                                             gcc_rvalue_int64(env->ctx, gcc_sizeof(env, item_t))));
 
         // goto is_done ? end : between
         gcc_jump_condition(for_next, NULL, is_done, for_end,
@@ -277,8 +285,27 @@ void compile_for_loop(env_t *env, gcc_block_t **block, ast_t *ast)
         /////////////////////////// Overflow-sensitive code ends here ////////////////////////////////
         //////////////////////////////////////////////////////////////////////////////////////////////
 
-        gcc_jump_condition(*block, NULL, is_empty, for_empty ? for_empty : for_end,
-                           for_first ? for_first : for_body);
+        if (env->comprehension_callback && env->comprehension_reserve) {
+            gcc_block_t *nonempty = gcc_new_block(func, fresh("nonempty"));
+            gcc_jump_condition(*block, NULL, is_empty, for_empty ? for_empty : for_end, nonempty);
+            *block = nonempty;
+            // Unsigned math can't overflow here: count = |last - x| / |step| + 1
+            gcc_type_t *u64 = gcc_type(env->ctx, UINT64);
+            gcc_rvalue_t *sign = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, u64,
+                gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, u64, gcc_rvalue_from_long(env->ctx, u64, 2),
+                              gcc_cast(env->ctx, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_GT, step, zero64), u64)),
+                gcc_one(env->ctx, u64));
+            gcc_rvalue_t *distance = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, u64, sign,
+                gcc_binary_op(env->ctx, NULL, GCC_BINOP_MINUS, u64, gcc_cast(env->ctx, NULL, last, u64), gcc_cast(env->ctx, NULL, x, u64)));
+            gcc_rvalue_t *abs_step = gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, u64, sign, gcc_cast(env->ctx, NULL, step, u64));
+            gcc_rvalue_t *count = gcc_binary_op(env->ctx, NULL, GCC_BINOP_PLUS, u64,
+                gcc_binary_op(env->ctx, NULL, GCC_BINOP_DIVIDE, u64, distance, abs_step), gcc_one(env->ctx, u64));
+            reserve_comprehension(env, block, ast, count);
+            gcc_jump(*block, NULL, for_first ? for_first : for_body);
+        } else {
+            gcc_jump_condition(*block, NULL, is_empty, for_empty ? for_empty : for_end,
+                               for_first ? for_first : for_body);
+        }
         *block = NULL;
 
         // Shadow loop variables so they can be mutated without breaking the loop's functionality
@@ -371,12 +398,12 @@ void compile_for_loop(env_t *env, gcc_block_t **block, ast_t *ast)
     auto label_names = LIST(const char*, "for");
     if (for_->index) {
         append(label_names, Match(for_->index, Var)->name);
-        hset(loop_env->bindings, Match(for_->index, Var)->name,
+        set_binding(loop_env->bindings, Match(for_->index, Var)->name,
              new(binding_t, .rval=gcc_rval(index_shadow), .lval=index_shadow, .type=INT_TYPE));
     }
     if (for_->value) {
         append(label_names, Match(for_->value, Var)->name);
-        hset(loop_env->bindings, Match(for_->value, Var)->name,
+        set_binding(loop_env->bindings, Match(for_->value, Var)->name,
              new(binding_t, .rval=gcc_rval(item_shadow), .lval=item_shadow, .type=item_t));
     }
     loop_env->loop_label = &(loop_label_t){
@@ -1,14 +1,145 @@
 // Math operations
+#include <assert.h>
 #include <libgccjit.h>
 #include <stdint.h>
 
 #include "../ast.h"
 #include "compile.h"
 #include "libgccjit_abbrev.h"
+#include "../libsss/parallel.h"
 #include "../typecheck.h"
 #include "../types.h"
 #include "../util.h"
 
+// Element-wise math on arrays is done by a loop over the items. For long
+// arrays, the loop goes in a kernel function that does the math for a range of
+// items, `void kernel(int64_t start, int64_t end, args_t *args)`, so the
+// runtime can split the array between threads (see libsss/parallel.c). Short
+// arrays aren't worth the call, so they get an inline loop, the same as
+// before. The code for each item is emitted twice, once for each loop:
+//
+//     kernel_t k = begin_kernel(env, block, len, num_args, arg_types, arg_values);
+//     do {
+//         // Code for the item at k.offset, using k.args, goes in k.block
+//     } while (next_kernel(env, block, &k));
+//
+// The kernel can't see the caller's variables, so the values it needs are
+// passed in a struct and copied into its own locals.
+#define MAX_KERNEL_ARGS 3
+
+typedef struct {
+    // Code for each item goes in `block`, for the item at `offset`
+    gcc_block_t *block;
+    gcc_lvalue_t *offset;
+    // The values passed in, or the kernel's copies of them
+    gcc_rvalue_t *args[MAX_KERNEL_ARGS];
+
+    int num_args;
+    gcc_type_t *arg_types[MAX_KERNEL_ARGS];
+    gcc_rvalue_t *arg_values[MAX_KERNEL_ARGS];
+    gcc_rvalue_t *len;
+    bool in_kernel;
+    gcc_func_t *func;
+    gcc_struct_t *args_struct;
+    gcc_block_t *loop_condition, *loop_done;
+    // Blocks in the caller for calling the kernel, and for after the loop
+    gcc_block_t *parallel, *finished;
+} kernel_t;
+
+// Start a loop in `func` over [start, end), which begins at `entry`
+static void start_loop(env_t *env, kernel_t *k, gcc_func_t *func, gcc_block_t *entry, gcc_rvalue_t *start, gcc_rvalue_t *end)
+{
+    k->loop_condition = gcc_new_block(func, fresh("loop_condition"));
+    k->block = gcc_new_block(func, fresh("loop_body"));
+    k->loop_done = gcc_new_block(func, fresh("loop_done"));
+    k->offset = gcc_local(func, NULL, gcc_type(env->ctx, ARRAY_LENGTH), fresh("offset"));
+    gcc_assign(entry, NULL, k->offset, start);
+    gcc_jump(entry, NULL, k->loop_condition);
+    gcc_jump_condition(k->loop_condition, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(k->offset), end),
+                       k->block, k->loop_done);
+}
+
+static kernel_t begin_kernel(env_t *env, gcc_block_t **block, gcc_rvalue_t *len, int num_args, gcc_type_t *arg_types[], gcc_rvalue_t *arg_values[])
+{
+    assert(num_args <= MAX_KERNEL_ARGS);
+    kernel_t k = {.num_args=num_args, .len=len};
+    for (int i = 0; i < num_args; i++) {
+        k.arg_types[i] = arg_types[i];
+        k.arg_values[i] = arg_values[i];
+        k.args[i] = arg_values[i];
+    }
+
+    // Same condition as array_contains(): sss_parallel_for() doesn't split up
+    // fewer items than this anyways, and with only one thread, there's no
+    // point in calling the kernel through it
+    gcc_func_t *func = gcc_block_func(*block);
+    gcc_block_t *inline_loop = gcc_new_block(func, fresh("inline_loop"));
+    k.parallel = gcc_new_block(func, fresh("parallel_loop"));
+    k.finished = gcc_new_block(func, fresh("loop_finished"));
+    gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
+    gcc_rvalue_t *one_thread = gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LE,
+                                              gcc_callx(env->ctx, NULL, get_function(env, "sss_thread_count")),
+                                              gcc_one(env->ctx, gcc_type(env->ctx, INT)));
+    gcc_jump_condition(*block, NULL,
+                       gcc_binary_op(env->ctx, NULL, GCC_BINOP_LOGICAL_OR, gcc_type(env->ctx, BOOL),
+                                     gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, len,
+                                                    gcc_rvalue_from_long(env->ctx, len_t, 2*SSS_PARALLEL_GRAIN)),
+                                     one_thread),
+                       inline_loop, k.parallel);
+    *block = NULL;
+    start_loop(env, &k, func, inline_loop, gcc_zero(env->ctx, len_t), len);
+    return k;
+}
+
+// Finish the current loop. After the inline loop, this starts the kernel's
+// loop and returns true. After the kernel's loop, this calls the kernel from
+// the caller, sets `*block` to the block after both loops, and returns false.
+static bool next_kernel(env_t *env, gcc_block_t **block, kernel_t *k)
+{
+    gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
+    gcc_update(k->block, NULL, k->offset, GCC_BINOP_PLUS, gcc_one(env->ctx, len_t));
+    gcc_jump(k->block, NULL, k->loop_condition);
+
+    if (!k->in_kernel) {
+        gcc_jump(k->loop_done, NULL, k->finished);
+
+        gcc_field_t *fields[MAX_KERNEL_ARGS];
+        for (int i = 0; i < k->num_args; i++)
+            fields[i] = gcc_new_field(env->ctx, NULL, k->arg_types[i], fresh("arg"));
+        k->args_struct = gcc_new_struct_type(env->ctx, NULL, fresh("kernel_args"), k->num_args, fields);
+
+        gcc_param_t *params[] = {
+            gcc_new_param(env->ctx, NULL, len_t, fresh("start")),
+            gcc_new_param(env->ctx, NULL, len_t, fresh("end")),
+            gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_struct_as_type(k->args_struct)), fresh("args")),
+        };
+        k->func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("math_kernel"), 3, params, 0);
+        gcc_block_t *entry = gcc_new_block(k->func, fresh("kernel"));
+        for (int i = 0; i < k->num_args; i++) {
+            gcc_lvalue_t *arg = gcc_local(k->func, NULL, k->arg_types[i], fresh("arg"));
+            gcc_assign(entry, NULL, arg, gcc_rval(gcc_rvalue_dereference_field(gcc_param_as_rvalue(params[2]), NULL, fields[i])));
+            k->args[i] = gcc_rval(arg);
+        }
+        start_loop(env, k, k->func, entry, gcc_param_as_rvalue(params[0]), gcc_param_as_rvalue(params[1]));
+        gcc_return_void(k->loop_done, NULL);
+        k->in_kernel = true;
+        return true;
+    }
+
+    gcc_lvalue_t *args = gcc_local(gcc_block_func(k->parallel), NULL, gcc_struct_as_type(k->args_struct), fresh("kernel_args"));
+    for (int i = 0; i < k->num_args; i++)
+        gcc_assign(k->parallel, NULL, gcc_lvalue_access_field(args, NULL, gcc_get_field(k->args_struct, i)), k->arg_values[i]);
+    gcc_type_t *void_ptr_t = gcc_type(env->ctx, VOID_PTR);
+    gcc_eval(k->parallel, NULL, gcc_callx(env->ctx, NULL, get_function(env, "sss_parallel_for"),
+                                          gcc_cast(env->ctx, NULL, k->len, gcc_type(env->ctx, INT64)),
+                                          gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, INT64), SSS_PARALLEL_GRAIN),
+                                          gcc_cast(env->ctx, NULL, gcc_get_func_address(k->func, NULL), void_ptr_t),
+                                          gcc_cast(env->ctx, NULL, gcc_lvalue_address(args, NULL), void_ptr_t)));
+    gcc_jump(k->parallel, NULL, k->finished);
+    *block = k->finished;
+    return false;
+}
+
 static gcc_rvalue_t *math_binop_rec(
     env_t *env, gcc_block_t **block, ast_t *ast,
     sss_type_t *lhs_t, gcc_rvalue_t *lhs,
@@ -28,8 +159,7 @@ static gcc_rvalue_t *math_binop_rec(
 
     gcc_func_t *func = gcc_block_func(*block);
 
-    gcc_type_t *i32 = gcc_type(env->ctx, INT32);
-    gcc_type_t *i16 = gcc_type(env->ctx, INT16);
+    gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
 
     if (lhs_t->tag == ArrayType && rhs_t->tag == ArrayType) {
         // Use the minimum common length:
@@ -39,8 +169,9 @@ static gcc_rvalue_t *math_binop_rec(
         // Pseudocode:
         // len = MIN(lhs->len, rhs->len)
         // result = alloc(len)
-        // for (i = 0; i < len; i++)
-        //     result->data[i] = lhs->data[i] {OP} &rhs->data[i]
+        // kernel(start, end):
+        //     for (i = start; i < end; i++)
+        //         result->data[i] = lhs->data[i] {OP} rhs->data[i]
 
         sss_type_t *result_t = get_math_type(env, ast, lhs_t, ast->tag, rhs_t);
         gcc_type_t *result_gcc_t = sss_type_to_gcc(env, result_t);
@@ -49,17 +180,15 @@ static gcc_rvalue_t *math_binop_rec(
 
         gcc_type_t *lhs_gcc_t = sss_type_to_gcc(env, lhs_t);
         gcc_struct_t *lhs_array_struct = gcc_type_if_struct(lhs_gcc_t);
-        gcc_rvalue_t *lhs_len32 = gcc_rvalue_access_field(lhs, loc, gcc_get_field(lhs_array_struct, ARRAY_LENGTH_FIELD));
-        gcc_rvalue_t *lhs_stride16 = gcc_rvalue_access_field(lhs, loc, gcc_get_field(lhs_array_struct, ARRAY_STRIDE_FIELD));
+        gcc_rvalue_t *lhs_len = gcc_rvalue_access_field(lhs, loc, gcc_get_field(lhs_array_struct, ARRAY_LENGTH_FIELD));
 
         gcc_type_t *rhs_gcc_t = sss_type_to_gcc(env, rhs_t);
         gcc_struct_t *rhs_array_struct = gcc_type_if_struct(rhs_gcc_t);
-        gcc_rvalue_t *rhs_len32 = gcc_rvalue_access_field(rhs, loc, gcc_get_field(rhs_array_struct, ARRAY_LENGTH_FIELD));
-        gcc_rvalue_t *rhs_stride16 = gcc_rvalue_access_field(rhs, loc, gcc_get_field(rhs_array_struct, ARRAY_STRIDE_FIELD));
+        gcc_rvalue_t *rhs_len = gcc_rvalue_access_field(rhs, loc, gcc_get_field(rhs_array_struct, ARRAY_LENGTH_FIELD));
 
         gcc_rvalue_t *len = ternary(block,
-                                    gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LE, lhs_len32, rhs_len32),
-                                    i32, lhs_len32, rhs_len32);
+                                    gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LE, lhs_len, rhs_len),
+                                    len_t, lhs_len, rhs_len);
 
         sss_type_t *item_t = Match(result_t, ArrayType)->item_type;
         gcc_func_t *alloc_func = hget(&env->global->funcs, has_heap_memory(item_t) ? "GC_malloc" : "GC_malloc_atomic", gcc_func_t*);
@@ -77,42 +206,36 @@ static gcc_rvalue_t *math_binop_rec(
                     gcc_get_field(result_array_struct, ARRAY_CAPACITY_FIELD),
                 },
                 (gcc_rvalue_t*[]){
-                    initial_items, len, gcc_rvalue_int16(env->ctx, gcc_sizeof(env, item_t)), gcc_zero(env->ctx, i16),
+                    initial_items, len, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), gcc_sizeof(env, item_t)), gcc_zero(env->ctx, gcc_type(env->ctx, ARRAY_FREE)),
                 }));
 
-        gcc_block_t *loop_condition = gcc_new_block(func, fresh("loop_condition")),
-                    *loop_body = gcc_new_block(func, fresh("loop_body")),
-                    *loop_end = gcc_new_block(func, fresh("loop_end"));
-
-        gcc_lvalue_t *offset = gcc_local(func, NULL, i32, "_offset");
-        gcc_assign(*block, NULL, offset, gcc_zero(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-
-        gcc_jump_condition(loop_condition, loc, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(offset), len),
-                           loop_body, loop_end);
-
-        *block = loop_body;
-#define ITEM(t, item_ptr, stride) gcc_rvalue_dereference(pointer_offset(env, sss_type_to_gcc(env, Type(PointerType, .pointed=Match(t, ArrayType)->item_type)), item_ptr, gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, i32, gcc_rval(offset), gcc_cast(env->ctx, NULL, stride, i32))), NULL)
-        gcc_rvalue_t *lhs_item_ptr = gcc_rvalue_access_field(lhs, NULL, gcc_get_field(lhs_array_struct, ARRAY_DATA_FIELD));
-        gcc_rvalue_t *lhs_item = gcc_rval(ITEM(lhs_t, lhs_item_ptr, lhs_stride16));
-        gcc_rvalue_t *rhs_item_ptr = gcc_rvalue_access_field(rhs, NULL, gcc_get_field(rhs_array_struct, ARRAY_DATA_FIELD));
-        gcc_rvalue_t *rhs_item = gcc_rval(ITEM(rhs_t, rhs_item_ptr, rhs_stride16));
-
-        gcc_rvalue_t *result_item_ptr = gcc_rvalue_access_field(gcc_rval(result), NULL, gcc_get_field(result_array_struct, ARRAY_DATA_FIELD));
-        gcc_lvalue_t *result_item = ITEM(result_t, result_item_ptr, gcc_rvalue_int16(env->ctx, gcc_sizeof(env, item_t)));
-
-        gcc_rvalue_t *item = math_binop_rec(env, block, ast, Match(lhs_t, ArrayType)->item_type, lhs_item, op, 
-                                            Match(rhs_t, ArrayType)->item_type, rhs_item);
-        gcc_assign(*block, NULL, result_item, item);
-        gcc_update(*block, NULL, offset, GCC_BINOP_PLUS, gcc_one(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-        *block = loop_end;
+        kernel_t k = begin_kernel(env, block, len, 3, (gcc_type_t*[]){lhs_gcc_t, rhs_gcc_t, result_gcc_t},
+                                   (gcc_rvalue_t*[]){lhs, rhs, gcc_rval(result)});
+        do {
+            gcc_rvalue_t *k_lhs = k.args[0], *k_rhs = k.args[1], *k_result = k.args[2];
+            gcc_lvalue_t *offset = k.offset;
+#define ITEM(t, item_ptr, stride) gcc_rvalue_dereference(pointer_offset(env, sss_type_to_gcc(env, Type(PointerType, .pointed=Match(t, ArrayType)->item_type)), item_ptr, gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, len_t, gcc_rval(offset), gcc_cast(env->ctx, NULL, stride, len_t))), NULL)
+            gcc_rvalue_t *lhs_item_ptr = gcc_rvalue_access_field(k_lhs, NULL, gcc_get_field(lhs_array_struct, ARRAY_DATA_FIELD));
+            gcc_rvalue_t *lhs_stride = gcc_rvalue_access_field(k_lhs, NULL, gcc_get_field(lhs_array_struct, ARRAY_STRIDE_FIELD));
+            gcc_rvalue_t *lhs_item = gcc_rval(ITEM(lhs_t, lhs_item_ptr, lhs_stride));
+            gcc_rvalue_t *rhs_item_ptr = gcc_rvalue_access_field(k_rhs, NULL, gcc_get_field(rhs_array_struct, ARRAY_DATA_FIELD));
+            gcc_rvalue_t *rhs_stride = gcc_rvalue_access_field(k_rhs, NULL, gcc_get_field(rhs_array_struct, ARRAY_STRIDE_FIELD));
+            gcc_rvalue_t *rhs_item = gcc_rval(ITEM(rhs_t, rhs_item_ptr, rhs_stride));
+
+            gcc_rvalue_t *result_item_ptr = gcc_rvalue_access_field(k_result, NULL, gcc_get_field(result_array_struct, ARRAY_DATA_FIELD));
+            gcc_lvalue_t *result_item = ITEM(result_t, result_item_ptr, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), gcc_sizeof(env, item_t)));
+
+            gcc_rvalue_t *item = math_binop_rec(env, &k.block, ast, Match(lhs_t, ArrayType)->item_type, lhs_item, op, 
+                                                Match(rhs_t, ArrayType)->item_type, rhs_item);
+            gcc_assign(k.block, NULL, result_item, item);
+        } while (next_kernel(env, block, &k));
         return gcc_rval(result);
     } else if (lhs_t->tag == ArrayType || rhs_t->tag == ArrayType) {
         // Pseudocode:
         // result = alloc(arr->len)
-        // for (i = 0; i < arr->len; i++)
-        //     result->data[i] = arr->data[i] {OP} scalar
+        // kernel(start, end):
+        //     for (i = start; i < end; i++)
+        //         result->data[i] = arr->data[i] {OP} scalar
 
         gcc_rvalue_t *array, *scalar;
         sss_type_t *array_t, *scalar_t;
@@ -132,11 +255,6 @@ static gcc_rvalue_t *math_binop_rec(
         gcc_type_t *array_gcc_t = sss_type_to_gcc(env, array_t);
         gcc_struct_t *array_struct = gcc_type_if_struct(array_gcc_t);
         gcc_rvalue_t *len = gcc_rvalue_access_field(array, loc, gcc_get_field(array_struct, ARRAY_LENGTH_FIELD));
-        gcc_rvalue_t *stride16 = gcc_rvalue_access_field(array, loc, gcc_get_field(array_struct, ARRAY_STRIDE_FIELD));
-
-        gcc_block_t *loop_condition = gcc_new_block(func, fresh("loop_condition")),
-                    *loop_body = gcc_new_block(func, fresh("loop_body")),
-                    *loop_end = gcc_new_block(func, fresh("loop_end"));
 
         sss_type_t *item_t = Match(result_t, ArrayType)->item_type;
         gcc_func_t *alloc_func = hget(&env->global->funcs, has_heap_memory(item_t) ? "GC_malloc" : "GC_malloc_atomic", gcc_func_t*);
@@ -153,34 +271,30 @@ static gcc_rvalue_t *math_binop_rec(
                     gcc_get_field(result_array_struct, ARRAY_CAPACITY_FIELD),
                 },
                 (gcc_rvalue_t*[]){
-                    initial_items, len, gcc_rvalue_int16(env->ctx, gcc_sizeof(env, item_t)), gcc_rvalue_int16(env->ctx, 0),
+                    initial_items, len, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), gcc_sizeof(env, item_t)), gcc_zero(env->ctx, gcc_type(env->ctx, ARRAY_FREE)),
                 }));
 
-        gcc_lvalue_t *offset = gcc_local(func, NULL, i32, "_offset");
-        gcc_assign(*block, NULL, offset, gcc_zero(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-
-        gcc_jump_condition(loop_condition, loc, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(offset), len),
-                           loop_body, loop_end);
-
-        *block = loop_body;
-        gcc_rvalue_t *array_item_ptr = gcc_rvalue_access_field(array, NULL, gcc_get_field(array_struct, ARRAY_DATA_FIELD));
-        gcc_rvalue_t *array_item = gcc_rval(ITEM(array_t, array_item_ptr, stride16));
-
-        gcc_rvalue_t *result_item_ptr = gcc_rvalue_access_field(gcc_rval(result), NULL, gcc_get_field(result_array_struct, ARRAY_DATA_FIELD));
-        gcc_lvalue_t *result_item = ITEM(result_t, result_item_ptr, gcc_rvalue_int16(env->ctx, gcc_sizeof(env, item_t)));
-
-        sss_type_t *array_item_t = Match(array_t, ArrayType)->item_type;
-        gcc_rvalue_t *item;
-        if (scalar_left) 
-            item = math_binop_rec(env, block, ast, scalar_t, scalar, op, array_item_t, array_item);
-        else
-            item = math_binop_rec(env, block, ast, array_item_t, array_item, op, scalar_t, scalar);
-
-        gcc_assign(*block, NULL, result_item, item);
-        gcc_update(*block, NULL, offset, GCC_BINOP_PLUS, gcc_one(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-        *block = loop_end;
+        kernel_t k = begin_kernel(env, block, len, 3, (gcc_type_t*[]){array_gcc_t, sss_type_to_gcc(env, scalar_t), result_gcc_t},
+                                   (gcc_rvalue_t*[]){array, scalar, gcc_rval(result)});
+        do {
+            gcc_rvalue_t *k_array = k.args[0], *k_scalar = k.args[1], *k_result = k.args[2];
+            gcc_lvalue_t *offset = k.offset;
+            gcc_rvalue_t *array_item_ptr = gcc_rvalue_access_field(k_array, NULL, gcc_get_field(array_struct, ARRAY_DATA_FIELD));
+            gcc_rvalue_t *stride = gcc_rvalue_access_field(k_array, NULL, gcc_get_field(array_struct, ARRAY_STRIDE_FIELD));
+            gcc_rvalue_t *array_item = gcc_rval(ITEM(array_t, array_item_ptr, stride));
+
+            gcc_rvalue_t *result_item_ptr = gcc_rvalue_access_field(k_result, NULL, gcc_get_field(result_array_struct, ARRAY_DATA_FIELD));
+            gcc_lvalue_t *result_item = ITEM(result_t, result_item_ptr, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, ARRAY_STRIDE), gcc_sizeof(env, item_t)));
+
+            sss_type_t *array_item_t = Match(array_t, ArrayType)->item_type;
+            gcc_rvalue_t *item;
+            if (scalar_left) 
+                item = math_binop_rec(env, &k.block, ast, scalar_t, k_scalar, op, array_item_t, array_item);
+            else
+                item = math_binop_rec(env, &k.block, ast, array_item_t, array_item, op, scalar_t, k_scalar);
+
+            gcc_assign(k.block, NULL, result_item, item);
+        } while (next_kernel(env, block, &k));
         return gcc_rval(result);
     }
 #undef ITEM
@@ -332,7 +446,7 @@ void math_update_rec(
     else if (!streq(type_units(lhs_t), type_units(rhs_t)) && (op == GCC_BINOP_PLUS || op == GCC_BINOP_MINUS))
         compiler_err(env, ast, "I can't do this math operation because it requires math operations between incompatible units: %T and %T", lhs_t, rhs_t);
 
-    gcc_type_t *i32 = gcc_type(env->ctx, INT32);
+    gcc_type_t *len_t = gcc_type(env->ctx, ARRAY_LENGTH);
     if (lhs_t->tag == ArrayType && rhs_t->tag == ArrayType) {
         check_cow(env, block, lhs_t, gcc_lvalue_address(lhs, loc));
 
@@ -342,78 +456,63 @@ void math_update_rec(
 
         // Pseudocode:
         // len = MIN(lhs->len, rhs->len)
-        // for (i = 0; i < len; i++)
-        //     update(&lhs->data[i], &rhs->data[i]);
+        // kernel(start, end):
+        //     for (i = start; i < end; i++)
+        //         update(&lhs->data[i], &rhs->data[i]);
 
         gcc_type_t *lhs_gcc_t = sss_type_to_gcc(env, lhs_t);
         gcc_struct_t *lhs_array_struct = gcc_type_if_struct(lhs_gcc_t);
-        gcc_rvalue_t *lhs_len32 = gcc_rvalue_access_field(gcc_rval(lhs), loc, gcc_get_field(lhs_array_struct, ARRAY_LENGTH_FIELD));
-        gcc_rvalue_t *lhs_stride16 = gcc_rvalue_access_field(gcc_rval(lhs), loc, gcc_get_field(lhs_array_struct, ARRAY_STRIDE_FIELD));
+        gcc_rvalue_t *lhs_len = gcc_rvalue_access_field(gcc_rval(lhs), loc, gcc_get_field(lhs_array_struct, ARRAY_LENGTH_FIELD));
 
         gcc_type_t *rhs_gcc_t = sss_type_to_gcc(env, rhs_t);
         gcc_struct_t *rhs_array_struct = gcc_type_if_struct(rhs_gcc_t);
-        gcc_rvalue_t *rhs_len32 = gcc_rvalue_access_field(rhs, loc, gcc_get_field(rhs_array_struct, ARRAY_LENGTH_FIELD));
-        gcc_rvalue_t *rhs_stride16 = gcc_rvalue_access_field(rhs, loc, gcc_get_field(rhs_array_struct, ARRAY_STRIDE_FIELD));
+        gcc_rvalue_t *rhs_len = gcc_rvalue_access_field(rhs, loc, gcc_get_field(rhs_array_struct, ARRAY_LENGTH_FIELD));
 
         gcc_rvalue_t *len = ternary(block,
-                                    gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LE, lhs_len32, rhs_len32),
-                                    i32, lhs_len32, rhs_len32);
-        gcc_func_t *func = gcc_block_func(*block);
-        gcc_block_t *loop_condition = gcc_new_block(func, fresh("loop_condition")),
-                    *loop_body = gcc_new_block(func, fresh("loop_body")),
-                    *loop_end = gcc_new_block(func, fresh("loop_end"));
-
-        gcc_lvalue_t *offset = gcc_local(func, NULL, i32, "_offset");
-        gcc_assign(*block, NULL, offset, gcc_zero(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-
-        gcc_jump_condition(loop_condition, loc, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(offset), len),
-                           loop_body, loop_end);
-
-        *block = loop_body;
-#define ITEM(t, item_ptr, stride) gcc_rvalue_dereference(pointer_offset(env, sss_type_to_gcc(env, Type(PointerType, .pointed=Match(t, ArrayType)->item_type)), item_ptr, gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, i32, gcc_rval(offset), gcc_cast(env->ctx, NULL, stride, i32))), NULL)
-        gcc_rvalue_t *lhs_item_ptr = gcc_rvalue_access_field(gcc_rval(lhs), NULL, gcc_get_field(lhs_array_struct, ARRAY_DATA_FIELD));
-        gcc_lvalue_t *lhs_item = ITEM(lhs_t, lhs_item_ptr, lhs_stride16);
-        gcc_rvalue_t *rhs_item_ptr = gcc_rvalue_access_field(rhs, NULL, gcc_get_field(rhs_array_struct, ARRAY_DATA_FIELD));
-        gcc_rvalue_t *rhs_item = gcc_rval(ITEM(rhs_t, rhs_item_ptr, rhs_stride16));
-
-        math_update_rec(env, block, ast, Match(lhs_t, ArrayType)->item_type, lhs_item,
-                        op, Match(rhs_t, ArrayType)->item_type, rhs_item);
-        gcc_update(*block, NULL, offset, GCC_BINOP_PLUS, gcc_one(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-        *block = loop_end;
+                                    gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LE, lhs_len, rhs_len),
+                                    len_t, lhs_len, rhs_len);
+
+        // The kernel gets a copy of the lhs array struct, but its items are
+        // the same memory, so they get updated in place
+        kernel_t k = begin_kernel(env, block, len, 2, (gcc_type_t*[]){lhs_gcc_t, rhs_gcc_t},
+                                   (gcc_rvalue_t*[]){gcc_rval(lhs), rhs});
+        do {
+            gcc_rvalue_t *k_lhs = k.args[0], *k_rhs = k.args[1];
+            gcc_lvalue_t *offset = k.offset;
+#define ITEM(t, item_ptr, stride) gcc_rvalue_dereference(pointer_offset(env, sss_type_to_gcc(env, Type(PointerType, .pointed=Match(t, ArrayType)->item_type)), item_ptr, gcc_binary_op(env->ctx, NULL, GCC_BINOP_MULT, len_t, gcc_rval(offset), gcc_cast(env->ctx, NULL, stride, len_t))), NULL)
+            gcc_rvalue_t *lhs_item_ptr = gcc_rvalue_access_field(k_lhs, NULL, gcc_get_field(lhs_array_struct, ARRAY_DATA_FIELD));
+            gcc_rvalue_t *lhs_stride = gcc_rvalue_access_field(k_lhs, NULL, gcc_get_field(lhs_array_struct, ARRAY_STRIDE_FIELD));
+            gcc_lvalue_t *lhs_item = ITEM(lhs_t, lhs_item_ptr, lhs_stride);
+            gcc_rvalue_t *rhs_item_ptr = gcc_rvalue_access_field(k_rhs, NULL, gcc_get_field(rhs_array_struct, ARRAY_DATA_FIELD));
+            gcc_rvalue_t *rhs_stride = gcc_rvalue_access_field(k_rhs, NULL, gcc_get_field(rhs_array_struct, ARRAY_STRIDE_FIELD));
+            gcc_rvalue_t *rhs_item = gcc_rval(ITEM(rhs_t, rhs_item_ptr, rhs_stride));
+
+            math_update_rec(env, &k.block, ast, Match(lhs_t, ArrayType)->item_type, lhs_item,
+                            op, Match(rhs_t, ArrayType)->item_type, rhs_item);
+        } while (next_kernel(env, block, &k));
     } else if (lhs_t->tag == ArrayType) {
         check_cow(env, block, lhs_t, gcc_lvalue_address(lhs, loc));
 
         // Pseudocode:
-        // for (i = 0; i < lhs->len; i++)
-        //     update(&lhs->data[i], rhs)
+        // kernel(start, end):
+        //     for (i = start; i < end; i++)
+        //         update(&lhs->data[i], rhs)
         gcc_type_t *lhs_gcc_t = sss_type_to_gcc(env, lhs_t);
         gcc_struct_t *lhs_array_struct = gcc_type_if_struct(lhs_gcc_t);
         gcc_rvalue_t *len = gcc_rvalue_access_field(gcc_rval(lhs), loc, gcc_get_field(lhs_array_struct, ARRAY_LENGTH_FIELD));
-        gcc_rvalue_t *stride = gcc_rvalue_access_field(gcc_rval(lhs), loc, gcc_get_field(lhs_array_struct, ARRAY_STRIDE_FIELD));
-
-        gcc_func_t *func = gcc_block_func(*block);
-        gcc_block_t *loop_condition = gcc_new_block(func, fresh("loop_condition")),
-                    *loop_body = gcc_new_block(func, fresh("loop_body")),
-                    *loop_end = gcc_new_block(func, fresh("loop_end"));
-
-        gcc_lvalue_t *offset = gcc_local(func, NULL, i32, "_offset");
-        gcc_assign(*block, NULL, offset, gcc_zero(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-
-        gcc_jump_condition(loop_condition, loc, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(offset), len),
-                           loop_body, loop_end);
 
-        *block = loop_body;
-        gcc_rvalue_t *lhs_item_ptr = gcc_rvalue_access_field(gcc_rval(lhs), NULL, gcc_get_field(lhs_array_struct, ARRAY_DATA_FIELD));
-        gcc_lvalue_t *lhs_item = ITEM(lhs_t, lhs_item_ptr, stride);
+        kernel_t k = begin_kernel(env, block, len, 2, (gcc_type_t*[]){lhs_gcc_t, sss_type_to_gcc(env, rhs_t)},
+                                   (gcc_rvalue_t*[]){gcc_rval(lhs), rhs});
+        do {
+            gcc_rvalue_t *k_lhs = k.args[0], *k_rhs = k.args[1];
+            gcc_lvalue_t *offset = k.offset;
+            gcc_rvalue_t *lhs_item_ptr = gcc_rvalue_access_field(k_lhs, NULL, gcc_get_field(lhs_array_struct, ARRAY_DATA_FIELD));
+            gcc_rvalue_t *stride = gcc_rvalue_access_field(k_lhs, NULL, gcc_get_field(lhs_array_struct, ARRAY_STRIDE_FIELD));
+            gcc_lvalue_t *lhs_item = ITEM(lhs_t, lhs_item_ptr, stride);
 #undef ITEM
 
-        math_update_rec(env, block, ast, Match(lhs_t, ArrayType)->item_type, lhs_item, op, rhs_t, rhs);
-        gcc_update(*block, NULL, offset, GCC_BINOP_PLUS, gcc_one(env->ctx, i32));
-        gcc_jump(*block, NULL, loop_condition);
-        *block = loop_end;
+            math_update_rec(env, &k.block, ast, Match(lhs_t, ArrayType)->item_type, lhs_item, op, rhs_t, k_rhs);
+        } while (next_kernel(env, block, &k));
     } else if (lhs_t->tag == StructType && rhs_t->tag == StructType) {
         if (!type_eq(with_units(lhs_t, NULL), with_units(rhs_t, NULL)))
             compiler_err(env, ast, "I can't do this math operation because it requires math operations between incompatible types: %T and %T", lhs_t, rhs_t);
@@ -2,9 +2,14 @@
 #include <assert.h>
 #include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <libgccjit.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "../ast.h"
 #include "../environment.h"
@@ -13,32 +18,222 @@
 #include "../types.h"
 #include "../util.h"
 #include "../files.h"
+#include "../cache.h"
 #include "compile.h"
 #include "libgccjit_abbrev.h"
 #include "../SipHash/halfsiphash.h"
 
-main_func_t compile_file(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, ast_t *ast, bool tail_calls, gcc_jit_result **result)
+// Declare `PROGRAM_NAME`, `ARGS`, and `USE_COLOR`, which are defined by the
+// main program and imported by separately compiled modules
+static void declare_program_globals(env_t *env, enum gcc_jit_global_kind kind)
 {
-    env_t *env = new_environment(ctx, on_err, f, tail_calls);
-
     sss_type_t *str_t = Type(ArrayType, .item_type=Type(CharType));
     sss_type_t *str_array_t = Type(ArrayType, .item_type=str_t);
-    gcc_type_t *gcc_string_t = sss_type_to_gcc(env, str_t);
 
-    // Set up `PROGRAM_NAME`
-    gcc_lvalue_t *program_name = gcc_global(ctx, NULL, GCC_GLOBAL_INTERNAL, gcc_string_t, "PROGRAM_NAME");
-    hset(&env->global->bindings, "PROGRAM_NAME",
-         new(binding_t, .rval=gcc_rval(program_name), .type=str_t, .visible_in_closures=true));
+    gcc_lvalue_t *program_name = gcc_global(env->ctx, NULL, kind, sss_type_to_gcc(env, str_t), "PROGRAM_NAME");
+    set_binding(&env->global->bindings, "PROGRAM_NAME",
+         new(binding_t, .lval=program_name, .rval=gcc_rval(program_name), .type=str_t, .visible_in_closures=true));
 
-    // Set up `ARGS`
-    gcc_type_t *args_gcc_t = sss_type_to_gcc(env, str_array_t);
-    gcc_lvalue_t *args = gcc_global(ctx, NULL, GCC_GLOBAL_INTERNAL, args_gcc_t, "ARGS");
-    hset(&env->global->bindings, "ARGS", new(binding_t, .rval=gcc_rval(args), .type=str_array_t, .visible_in_closures=true));
+    gcc_lvalue_t *args = gcc_global(env->ctx, NULL, kind, sss_type_to_gcc(env, str_array_t), "ARGS");
+    set_binding(&env->global->bindings, "ARGS",
+         new(binding_t, .lval=args, .rval=gcc_rval(args), .type=str_array_t, .visible_in_closures=true));
 
-    // Set up `USE_COLOR`
-    gcc_lvalue_t *use_color = gcc_global(ctx, NULL, GCC_GLOBAL_INTERNAL, gcc_type(ctx, BOOL), "USE_COLOR");
-    hset(&env->global->bindings, "USE_COLOR",
-         new(binding_t, .rval=gcc_rval(use_color), .type=Type(BoolType), .visible_in_closures=true));
+    gcc_lvalue_t *use_color = gcc_global(env->ctx, NULL, kind, gcc_type(env->ctx, BOOL), "USE_COLOR");
+    set_binding(&env->global->bindings, "USE_COLOR",
+         new(binding_t, .lval=use_color, .rval=gcc_rval(use_color), .type=Type(BoolType), .visible_in_closures=true));
+}
+
+static void compile_queued_functions(env_t *env)
+{
+    for (uint32_t i = 1; i <= env->global->ast_functions.count; i++) {
+        auto entry = hnth(&env->global->ast_functions, i, ast_t*, func_context_t*);
+        compile_function(&entry->value->env, entry->value->func, entry->key);
+    }
+}
+
+// Compile only the functions that are reachable from the program's top-level
+// code. Compiling a function can make more functions reachable, so this loops
+// until nothing changes, and the remaining functions get stub bodies.
+static void compile_reachable_functions(env_t *env)
+{
+    sss_hashmap_t compiled = {0}; // ast_t* -> bool
+    for (bool progress = true; progress; ) {
+        progress = false;
+        for (uint32_t i = 1; i <= env->global->ast_functions.count; i++) {
+            auto entry = hnth(&env->global->ast_functions, i, ast_t*, func_context_t*);
+            if (hget(&compiled, entry->key, bool) || !is_function_referenced(env, entry->key))
+                continue;
+            hset(&compiled, entry->key, true);
+            note_references(env, entry->key);
+            compile_function(&entry->value->env, entry->value->func, entry->key);
+            progress = true;
+        }
+    }
+
+    for (uint32_t i = 1; i <= env->global->ast_functions.count; i++) {
+        auto entry = hnth(&env->global->ast_functions, i, ast_t*, func_context_t*);
+        if (!hget(&compiled, entry->key, bool))
+            compile_unreferenced_function(env, entry->value->func);
+    }
+}
+
+// Compile a module into its own shared object (or find an up-to-date one in
+// the cache) and return its path, or NULL if it should be compiled inline.
+const char *compile_module_library(env_t *env, sss_file_t *file)
+{
+    static sss_hashmap_t in_progress = {0};
+    module_options_t *options = env->global->module_options;
+    if (!options || hget(&in_progress, file->filename, bool))
+        return NULL;
+
+    const char *flags = heap_strf("module%s", options->cache_flags);
+    const char *so_path = cache_lookup(file, flags);
+    if (so_path) return so_path;
+
+    hset(&in_progress, file->filename, true);
+    gcc_ctx_t *ctx = options->new_context();
+    // Errors are reported by compiler_err(), but the module has to be
+    // unmarked and its context released before passing the error on
+    jmp_buf on_err;
+    if (setjmp(on_err) != 0) {
+        hremove(&in_progress, file->filename, bool);
+        release_context(ctx);
+        if (env->on_err)
+            longjmp(*env->on_err, 1);
+        exit(1);
+    }
+    env_t *lib_env = new_environment(ctx, &on_err, file, env->tail_calls);
+    lib_env->global->module_options = options;
+    declare_program_globals(lib_env, GCC_GLOBAL_IMPORTED);
+
+    (void)prepare_use(lib_env, NewAST(file, file->text, file->text, Use, .path=file->filename, .file=file, .library=true));
+    compile_queued_functions(lib_env);
+    hremove(&in_progress, file->filename, bool);
+
+    so_path = cache_store_path(file, flags, &lib_env->global->used_files);
+    if (so_path) {
+        const char *tmp_path = heap_strf("%s.%d.tmp", so_path, getpid());
+        compile_phase_t prev_phase = enter_phase(PHASE_GCC);
+        gcc_jit_context_compile_to_file(ctx, GCC_OUTPUT_KIND_DYNAMIC_LIBRARY, tmp_path);
+        exit_phase(prev_phase);
+        if (gcc_jit_context_get_first_error(ctx) || rename(tmp_path, so_path) != 0) {
+            unlink(tmp_path);
+            so_path = NULL;
+        }
+    }
+    release_context(ctx);
+    return so_path;
+}
+
+typedef struct module_job_s {
+    sss_file_t *file;
+    List(const char*) uses;
+    bool started, finished;
+} module_job_t;
+
+static void find_uses(ast_t *ast, void *userdata)
+{
+    if (ast->tag == Use) {
+        List(const char*) uses = userdata;
+        APPEND(uses, Match(ast, Use)->path);
+    } else {
+        visit_ast_children(ast, find_uses, userdata);
+    }
+}
+
+static void add_module_jobs(sss_hashmap_t *jobs, List(const char*) paths)
+{
+    foreach (paths, path, _) {
+        if (hget(jobs, *path, module_job_t*)) continue;
+        sss_file_t *file = sss_load_file(*path);
+        if (!file) continue;
+        module_job_t *job = new(module_job_t, .file=file, .uses=LIST(const char*));
+        hset(jobs, *path, job);
+        visit_ast_children(parse_file(file, NULL), find_uses, job->uses);
+        add_module_jobs(jobs, job->uses);
+    }
+}
+
+// Compile all of the modules a program uses into the cache, using up to
+// `options->jobs` worker processes. A module is only started once all the
+// modules it uses are finished, so workers never duplicate each other's work.
+// libgccjit serializes compilation within a process, so this uses fork()
+// rather than threads. Anything that fails here will be compiled (and its
+// errors reported) when the program itself is compiled, so workers don't
+// print their errors.
+static void precompile_modules(env_t *env, ast_t *ast)
+{
+    sss_hashmap_t jobs = {0};
+    NEW_LIST(const char*, uses);
+    visit_ast_children(ast, find_uses, uses);
+    add_module_jobs(&jobs, uses);
+
+    fflush(stdout);
+    fflush(stderr);
+    sss_hashmap_t running = {0}; // pid -> module_job_t*
+    for (;;) {
+        for (uint32_t i = 1; i <= jobs.count && running.count < (uint32_t)env->global->module_options->jobs; i++) {
+            auto entry = hnth(&jobs, i, const char*, module_job_t*);
+            module_job_t *job = entry->value;
+            if (job->started) continue;
+            foreach (job->uses, dep, _) {
+                module_job_t *dep_job = hget(&jobs, *dep, module_job_t*);
+                if (dep_job && !dep_job->finished) goto not_ready;
+            }
+            int64_t pid = (int64_t)fork();
+            if (pid == 0) {
+                int devnull = open("/dev/null", O_WRONLY);
+                if (devnull >= 0) dup2(devnull, STDERR_FILENO);
+                jmp_buf on_err;
+                if (setjmp(on_err) != 0)
+                    _exit(1);
+                env->on_err = &on_err;
+                (void)compile_module_library(env, job->file);
+                _exit(0);
+            } else if (pid < 0) {
+                // Wait for the workers that did start before giving up, so
+                // none of them are still writing to the cache
+                for (uint32_t j = 1; j <= running.count; j++) {
+                    auto worker = hnth(&running, j, int64_t, module_job_t*);
+                    while (waitpid((pid_t)worker->key, NULL, 0) < 0 && errno == EINTR)
+                        continue;
+                }
+                return;
+            }
+            job->started = true;
+            hset(&running, pid, job);
+          not_ready: continue;
+        }
+        if (running.count == 0) break;
+
+        int status;
+        int64_t pid = (int64_t)wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        module_job_t *job = hget(&running, pid, module_job_t*);
+        if (!job) continue;
+        job->finished = true;
+        hremove(&running, pid, module_job_t*);
+    }
+}
+
+// Populate the context with code for the program, but don't compile it yet
+env_t *compile_program(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, ast_t *ast, bool tail_calls, module_options_t *module_options)
+{
+    env_t *env = new_environment(ctx, on_err, f, tail_calls);
+    env->global->module_options = module_options;
+    if (module_options && module_options->jobs > 1)
+        precompile_modules(env, ast);
+
+    sss_type_t *str_t = Type(ArrayType, .item_type=Type(CharType));
+    gcc_type_t *gcc_string_t = sss_type_to_gcc(env, str_t);
+    declare_program_globals(env, GCC_GLOBAL_EXPORTED);
+    gcc_lvalue_t *program_name = hget(&env->global->bindings, "PROGRAM_NAME", binding_t*)->lval,
+                 *args = hget(&env->global->bindings, "ARGS", binding_t*)->lval,
+                 *use_color = hget(&env->global->bindings, "USE_COLOR", binding_t*)->lval;
+    gcc_type_t *args_gcc_t = sss_type_to_gcc(env, Type(ArrayType, .item_type=str_t));
 
     // Compile main(int argc, char *argv[]) function
     gcc_param_t* main_params[] = {
@@ -92,12 +287,16 @@ main_func_t compile_file(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, ast_t *
     gcc_return(main_block, NULL, gcc_zero(ctx, gcc_type(ctx, INT)));
 
     // Actually compile the functions:
-    for (uint32_t i = 1; i <= env->global->ast_functions.count; i++) {
-        auto entry = hnth(&env->global->ast_functions, i, ast_t*, func_context_t*);
-        compile_function(&entry->value->env, entry->value->func, entry->key);
-    }
+    compile_reachable_functions(env);
+    return env;
+}
 
+main_func_t compile_file(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, ast_t *ast, bool tail_calls, gcc_jit_result **result)
+{
+    env_t *env = compile_program(ctx, on_err, f, ast, tail_calls, NULL);
+    compile_phase_t prev_phase = enter_phase(PHASE_GCC);
     *result = gcc_compile(ctx);
+    exit_phase(prev_phase);
     if (*result == NULL)
         compiler_err(env, ast, "Compilation failed");
 
@@ -40,6 +40,330 @@ void mark_table_cow(env_t *env, gcc_block_t **block, gcc_rvalue_t *table_ptr)
     gcc_assign(*block, NULL, cow, gcc_rvalue_from_long(env->ctx, gcc_type(env->ctx, BOOL), 1));
 }
 
+// Key types where compare(a,b) == 0 exactly when a == b
+static bool has_bitwise_equality(sss_type_t *t)
+{
+    while (t->tag == VariantType) t = Match(t, VariantType)->variant_of;
+    return t->tag == IntType || t->tag == CharType || t->tag == BoolType || t->tag == PointerType;
+}
+
+static gcc_rvalue_t *keys_equal(env_t *env, sss_type_t *key_t, gcc_rvalue_t *a, gcc_rvalue_t *b)
+{
+    if (has_bitwise_equality(key_t))
+        return gcc_comparison(env->ctx, NULL, GCC_COMPARISON_EQ, a, b);
+    return gcc_comparison(env->ctx, NULL, GCC_COMPARISON_EQ, gcc_callx(env->ctx, NULL, get_compare_func(env, key_t), a, b),
+                          gcc_zero(env->ctx, gcc_type(env->ctx, INT)));
+}
+
+// Get a function `(Table*, Key*) -> Value*` that finds a key in a table, not
+// counting fallbacks or defaults. This is the same probing as
+// sss_hashmap_get_raw(), but specialized for the table's type, so the hash
+// and comparison are direct calls (or just `==`), the entry size is a constant,
+// and the whole thing can be inlined into the caller.
+gcc_func_t *get_table_lookup_func(env_t *env, sss_type_t *t)
+{
+    binding_t *b = get_from_namespace(env, t, "__lookup");
+    if (b) return b->func;
+
+    sss_type_t *key_t = Match(t, TableType)->key_type,
+               *value_t = Match(t, TableType)->value_type;
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    gcc_type_t *key_gcc_t = sss_type_to_gcc(env, key_t);
+    gcc_type_t *value_ptr_t = gcc_get_ptr_type(sss_type_to_gcc(env, value_t));
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_t), fresh("table")),
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(key_gcc_t), fresh("key")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_ALWAYS_INLINE, value_ptr_t, fresh("lookup"), 2, params, 0);
+    set_in_namespace(env, t, "__lookup", new(binding_t, .func=func,
+        .type=Type(FunctionType, .arg_names=LIST(const char*, "table", "key"),
+                   .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t), Type(PointerType, .pointed=key_t)),
+                   .arg_defaults=LIST(ast_t*, NULL, NULL),
+                   .ret=Type(PointerType, .pointed=value_t, .is_optional=true))));
+
+    gcc_block_t *block = gcc_new_block(func, fresh("lookup"));
+    gcc_comment(block, NULL, heap_strf("Implementation of lookup(%s)", type_to_string(t)));
+    gcc_rvalue_t *table = gcc_param_as_rvalue(params[0]),
+                 *key = gcc_param_as_rvalue(params[1]);
+
+    gcc_rvalue_t *get_raw = gcc_cast(env->ctx, NULL, gcc_callx(
+        env->ctx, NULL, get_function(env, "sss_hashmap_get_raw"),
+        gcc_cast(env->ctx, NULL, table, gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_hash_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_indirect_compare_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))),
+        gcc_cast(env->ctx, NULL, key, gcc_type(env->ctx, VOID_PTR)),
+        table_entry_value_offset(env, t)), value_ptr_t);
+#ifdef SSS_HASHMAP_CHAINED
+    gcc_return(block, NULL, get_raw);
+#else
+    gcc_type_t *u8 = gcc_type(env->ctx, UINT8), *u32 = gcc_type(env->ctx, UINT32), *u64 = gcc_type(env->ctx, UINT64);
+    gcc_struct_t *table_struct = gcc_type_if_struct(gcc_t);
+    sss_type_t *entry_t = table_entry_type(t);
+    gcc_struct_t *entry_struct = gcc_type_if_struct(sss_type_to_gcc(env, entry_t));
+    gcc_type_t *entry_ptr_t = gcc_get_ptr_type(sss_type_to_gcc(env, entry_t));
+#define FIELD(name) gcc_rval(gcc_rvalue_dereference_field(table, NULL, gcc_get_field(table_struct, TABLE_##name##_FIELD)))
+#define U32(n) gcc_rvalue_from_long(env->ctx, u32, n)
+#define U64(n) gcc_rvalue_from_long(env->ctx, u64, (long)(n))
+#define BINOP(op, t, a, b) gcc_binary_op(env->ctx, NULL, GCC_BINOP_##op, t, a, b)
+
+    gcc_block_t *probe = gcc_new_block(func, fresh("probe")),
+                *no_capacity = gcc_new_block(func, fresh("no_capacity")),
+                *persistent = gcc_new_block(func, fresh("persistent")),
+                *missing = gcc_new_block(func, fresh("missing"));
+    gcc_jump_condition(block, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_EQ, FIELD(CAPACITY), U32(0)), no_capacity, probe);
+    // Persistent tables have buckets, but no capacity (see libsss/persistent_hashmap.c):
+    gcc_jump_condition(no_capacity, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_EQ, FIELD(BUCKETS), gcc_null(env->ctx, gcc_type(env->ctx, VOID_PTR))),
+                       missing, persistent);
+    gcc_return(persistent, NULL, get_raw);
+    gcc_return(missing, NULL, gcc_null(env->ctx, value_ptr_t));
+    block = probe;
+
+    gcc_lvalue_t *hash = gcc_local(func, NULL, u32, "_hash"),
+                 *mask = gcc_local(func, NULL, u32, "_mask"),
+                 *ctrl = gcc_local(func, NULL, gcc_get_ptr_type(u8), "_ctrl"),
+                 *slots = gcc_local(func, NULL, gcc_get_ptr_type(u32), "_slots"),
+                 *entries = gcc_local(func, NULL, entry_ptr_t, "_entries"),
+                 *h2_bytes = gcc_local(func, NULL, u64, "_h2_bytes"),
+                 *group = gcc_local(func, NULL, u32, "_group"),
+                 *step = gcc_local(func, NULL, u32, "_step"),
+                 *half = gcc_local(func, NULL, u32, "_half"),
+                 *word = gcc_local(func, NULL, u64, "_word"),
+                 *matches = gcc_local(func, NULL, u64, "_matches"),
+                 *empties = gcc_local(func, NULL, u64, "_empties"),
+                 *entry = gcc_local(func, NULL, entry_ptr_t, "_entry");
+    // Pointer keys share the hash function for `@Memory`, so the key may need a cast:
+    gcc_func_t *hash_fn = get_hash_func(env, key_t);
+    gcc_type_t *hash_arg_t = gcc_rvalue_type(gcc_param_as_rvalue(gcc_func_get_param(hash_fn, 0)));
+    gcc_assign(block, NULL, hash, gcc_callx(env->ctx, NULL, hash_fn, gcc_cast(env->ctx, NULL, key, hash_arg_t)));
+    gcc_assign(block, NULL, mask, BINOP(MINUS, u32, BINOP(DIVIDE, u32, FIELD(CAPACITY), U32(SSS_HASHMAP_GROUP_WIDTH)), U32(1)));
+    gcc_assign(block, NULL, ctrl, gcc_cast(env->ctx, NULL, FIELD(BUCKETS), gcc_get_ptr_type(u8)));
+    gcc_assign(block, NULL, slots, gcc_cast(env->ctx, NULL, gcc_lvalue_address(gcc_array_access(env->ctx, NULL, gcc_rval(ctrl), FIELD(CAPACITY)), NULL),
+                                            gcc_get_ptr_type(u32)));
+    gcc_assign(block, NULL, entries, gcc_cast(env->ctx, NULL, FIELD(ENTRIES), entry_ptr_t));
+    // The hash's top 7 bits, repeated in every byte:
+    gcc_assign(block, NULL, h2_bytes, BINOP(MULT, u64, gcc_cast(env->ctx, NULL, BINOP(RSHIFT, u32, gcc_rval(hash), U32(SSS_HASHMAP_H2_SHIFT)), u64),
+                                           U64(0x0101010101010101)));
+    gcc_assign(block, NULL, group, BINOP(BITWISE_AND, u32, gcc_rval(hash), gcc_rval(mask)));
+    gcc_assign(block, NULL, step, U32(1));
+
+    // Each group of 16 control bytes is checked as two 64-bit words, using the
+    // usual bit tricks for finding bytes equal to H2 and bytes equal to EMPTY.
+    // H2 matches can have false positives, but only on occupied slots, so the
+    // key comparison weeds them out.
+    gcc_block_t *group_loop = gcc_new_block(func, fresh("group")),
+                *half_loop = gcc_new_block(func, fresh("half_group")),
+                *match_loop = gcc_new_block(func, fresh("check_matches")),
+                *check_match = gcc_new_block(func, fresh("check_match")),
+                *next_match = gcc_new_block(func, fresh("next_match")),
+                *found = gcc_new_block(func, fresh("found")),
+                *half_done = gcc_new_block(func, fresh("half_done")),
+                *group_done = gcc_new_block(func, fresh("group_done")),
+                *next_group = gcc_new_block(func, fresh("next_group"));
+    gcc_jump(block, NULL, group_loop);
+
+    gcc_assign(group_loop, NULL, half, U32(0));
+    gcc_assign(group_loop, NULL, empties, U64(0));
+    gcc_jump(group_loop, NULL, half_loop);
+
+    gcc_rvalue_t *group_start = BINOP(MULT, u32, gcc_rval(group), U32(SSS_HASHMAP_GROUP_WIDTH));
+    gcc_rvalue_t *word_ptr = gcc_cast(env->ctx, NULL, gcc_lvalue_address(gcc_array_access(env->ctx, NULL, gcc_rval(ctrl), group_start), NULL),
+                                      gcc_get_ptr_type(u64));
+    gcc_assign(half_loop, NULL, word, gcc_rval(gcc_array_access(env->ctx, NULL, word_ptr, gcc_rval(half))));
+    // x = word ^ h2_bytes; matches = (x - 0x01..) & ~x & 0x80..
+    gcc_rvalue_t *x = BINOP(BITWISE_XOR, u64, gcc_rval(word), gcc_rval(h2_bytes));
+    gcc_assign(half_loop, NULL, matches, BINOP(BITWISE_AND, u64, BINOP(MINUS, u64, x, U64(0x0101010101010101)),
+                                               BINOP(BITWISE_AND, u64, gcc_unary_op(env->ctx, NULL, GCC_UNOP_BITWISE_NEGATE, u64, x),
+                                                     U64(0x8080808080808080))));
+    // EMPTY (0x80) is the only control byte with the high bit set and bit 1 clear:
+    gcc_update(half_loop, NULL, empties, GCC_BINOP_BITWISE_OR,
+               BINOP(BITWISE_AND, u64, BINOP(BITWISE_AND, u64, gcc_rval(word),
+                                             gcc_unary_op(env->ctx, NULL, GCC_UNOP_BITWISE_NEGATE, u64, BINOP(LSHIFT, u64, gcc_rval(word), U64(6)))),
+                     U64(0x8080808080808080)));
+    gcc_jump(half_loop, NULL, match_loop);
+
+    gcc_jump_condition(match_loop, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_NE, gcc_rval(matches), U64(0)), check_match, half_done);
+
+    gcc_rvalue_t *byte_index = BINOP(DIVIDE, u32, gcc_cast(env->ctx, NULL, gcc_callx(env->ctx, NULL, gcc_builtin_func(env->ctx, "__builtin_ctzll"),
+                                                                                  gcc_cast(env->ctx, NULL, gcc_rval(matches), gcc_type(env->ctx, UNSIGNED_LONG_LONG))), u32),
+                                     U32(8));
+    gcc_rvalue_t *slot = BINOP(PLUS, u32, group_start, BINOP(PLUS, u32, BINOP(MULT, u32, gcc_rval(half), U32(8)), byte_index));
+    gcc_rvalue_t *index1 = gcc_rval(gcc_array_access(env->ctx, NULL, gcc_rval(slots), slot));
+    gcc_assign(check_match, NULL, entry, gcc_lvalue_address(gcc_array_access(env->ctx, NULL, gcc_rval(entries), BINOP(MINUS, u32, index1, U32(1))), NULL));
+    gcc_rvalue_t *entry_key = gcc_rval(gcc_rvalue_dereference_field(gcc_rval(entry), NULL, gcc_get_field(entry_struct, 0)));
+    gcc_jump_condition(check_match, NULL, keys_equal(env, key_t, entry_key, gcc_rval(gcc_rvalue_dereference(key, NULL))), found, next_match);
+    gcc_return(found, NULL, gcc_lvalue_address(gcc_rvalue_dereference_field(gcc_rval(entry), NULL, gcc_get_field(entry_struct, 1)), NULL));
+
+    gcc_update(next_match, NULL, matches, GCC_BINOP_BITWISE_AND, BINOP(MINUS, u64, gcc_rval(matches), U64(1)));
+    gcc_jump(next_match, NULL, match_loop);
+
+    gcc_update(half_done, NULL, half, GCC_BINOP_PLUS, U32(1));
+    gcc_jump_condition(half_done, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_LT, gcc_rval(half), U32(2)), half_loop, group_done);
+
+    // A group with an empty slot ends the probe sequence:
+    gcc_jump_condition(group_done, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_NE, gcc_rval(empties), U64(0)), missing, next_group);
+
+    gcc_assign(next_group, NULL, group, BINOP(BITWISE_AND, u32, BINOP(PLUS, u32, gcc_rval(group), gcc_rval(step)), gcc_rval(mask)));
+    gcc_update(next_group, NULL, step, GCC_BINOP_PLUS, U32(1));
+    gcc_jump(next_group, NULL, group_loop);
+#undef BINOP
+#undef U64
+#undef U32
+#undef FIELD
+#endif
+    return func;
+}
+
+// Get a function `(Table*, Key*) -> Value*` that finds a key in a table or its
+// fallbacks, or else returns the default value (like sss_hashmap_get()).
+static gcc_func_t *get_table_get_func(env_t *env, sss_type_t *t)
+{
+    binding_t *b = get_from_namespace(env, t, "__get");
+    if (b) return b->func;
+
+    sss_type_t *key_t = Match(t, TableType)->key_type,
+               *value_t = Match(t, TableType)->value_type;
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    gcc_type_t *value_ptr_t = gcc_get_ptr_type(sss_type_to_gcc(env, value_t));
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_t), fresh("table")),
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(sss_type_to_gcc(env, key_t)), fresh("key")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, value_ptr_t, fresh("get"), 2, params, 0);
+    set_in_namespace(env, t, "__get", new(binding_t, .func=func,
+        .type=Type(FunctionType, .arg_names=LIST(const char*, "table", "key"),
+                   .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t), Type(PointerType, .pointed=key_t)),
+                   .arg_defaults=LIST(ast_t*, NULL, NULL),
+                   .ret=Type(PointerType, .pointed=value_t, .is_optional=true))));
+
+    gcc_struct_t *table_struct = gcc_type_if_struct(gcc_t);
+    gcc_rvalue_t *table = gcc_param_as_rvalue(params[0]),
+                 *key = gcc_param_as_rvalue(params[1]);
+    gcc_rvalue_t *fallback = gcc_rval(gcc_rvalue_dereference_field(table, NULL, gcc_get_field(table_struct, TABLE_FALLBACK_FIELD)));
+    gcc_rvalue_t *def = gcc_rval(gcc_rvalue_dereference_field(table, NULL, gcc_get_field(table_struct, TABLE_DEFAULT_FIELD)));
+    gcc_lvalue_t *value = gcc_local(func, NULL, value_ptr_t, "_value");
+
+    gcc_block_t *block = gcc_new_block(func, fresh("get")),
+                *lookup = gcc_new_block(func, fresh("lookup")),
+                *found = gcc_new_block(func, fresh("found")),
+                *missing = gcc_new_block(func, fresh("missing")),
+                *has_fallback = gcc_new_block(func, fresh("has_fallback"));
+    gcc_jump_condition(block, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_EQ, fallback, gcc_null(env->ctx, gcc_get_ptr_type(gcc_t))),
+                       lookup, has_fallback);
+
+    gcc_assign(lookup, NULL, value, gcc_callx(env->ctx, NULL, get_table_lookup_func(env, t), table, key));
+    gcc_jump_condition(lookup, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_NE, gcc_rval(value), gcc_null(env->ctx, value_ptr_t)),
+                       found, missing);
+    gcc_return(found, NULL, gcc_rval(value));
+    gcc_return(missing, NULL, def);
+
+    // The runtime walks fallback chains, hashing the key only once and
+    // skipping the tables whose key filter rules the key out:
+    gcc_rvalue_t *call = gcc_callx(
+        env->ctx, NULL, get_function(env, "sss_hashmap_get"),
+        gcc_cast(env->ctx, NULL, table, gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_hash_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_indirect_compare_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))),
+        gcc_cast(env->ctx, NULL, key, gcc_type(env->ctx, VOID_PTR)),
+        table_entry_value_offset(env, t));
+    gcc_return(has_fallback, NULL, gcc_cast(env->ctx, NULL, call, value_ptr_t));
+    return func;
+}
+
+// Tables whose keys are slow to hash store each key's hash alongside the
+// entries (see libsss/hashmap.c). The runtime can only start doing that before
+// the table has allocated anything, so this is done right before a table's
+// first insertion or reservation: `table->stores_hashes |= (table->buckets == NULL)`
+static void store_hashes_if_expensive(env_t *env, gcc_block_t *block, sss_type_t *t, gcc_rvalue_t *table_ptr)
+{
+    if (!has_expensive_hash(Match(t, TableType)->key_type)) return;
+    gcc_struct_t *table_struct = gcc_type_if_struct(sss_type_to_gcc(env, t));
+    gcc_lvalue_t *stores_hashes = gcc_rvalue_dereference_field(table_ptr, NULL, gcc_get_field(table_struct, TABLE_STORES_HASHES_FIELD));
+    gcc_rvalue_t *buckets = gcc_rval(gcc_rvalue_dereference_field(table_ptr, NULL, gcc_get_field(table_struct, TABLE_BUCKETS_FIELD)));
+    gcc_type_t *bool_t = gcc_type(env->ctx, BOOL);
+    gcc_assign(block, NULL, stores_hashes, gcc_binary_op(
+            env->ctx, NULL, GCC_BINOP_LOGICAL_OR, bool_t, gcc_rval(stores_hashes),
+            gcc_comparison(env->ctx, NULL, GCC_COMPARISON_EQ, buckets, gcc_null(env->ctx, gcc_type(env->ctx, VOID_PTR)))));
+}
+
+// Get a function `(Table*, Key*, Value*) -> Value*` that sets a key's value (or
+// leaves it alone if the value is NULL) and returns the address of the value.
+// Existing keys are updated in place, while new keys (which may need the table
+// to grow) and copy-on-write tables are handled by sss_hashmap_set().
+gcc_func_t *get_table_insert_func(env_t *env, sss_type_t *t)
+{
+    binding_t *b = get_from_namespace(env, t, "__insert");
+    if (b) return b->func;
+
+    sss_type_t *key_t = Match(t, TableType)->key_type,
+               *value_t = Match(t, TableType)->value_type;
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    gcc_type_t *value_ptr_t = gcc_get_ptr_type(sss_type_to_gcc(env, value_t));
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_t), fresh("table")),
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(sss_type_to_gcc(env, key_t)), fresh("key")),
+        gcc_new_param(env->ctx, NULL, value_ptr_t, fresh("value")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, value_ptr_t, fresh("insert"), 3, params, 0);
+    set_in_namespace(env, t, "__insert", new(binding_t, .func=func,
+        .type=Type(FunctionType, .arg_names=LIST(const char*, "table", "key", "value"),
+                   .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t), Type(PointerType, .pointed=key_t),
+                                   Type(PointerType, .pointed=value_t, .is_optional=true)),
+                   .arg_defaults=LIST(ast_t*, NULL, NULL, NULL),
+                   .ret=Type(PointerType, .pointed=value_t))));
+
+    gcc_rvalue_t *table = gcc_param_as_rvalue(params[0]),
+                 *key = gcc_param_as_rvalue(params[1]),
+                 *value = gcc_param_as_rvalue(params[2]);
+    gcc_struct_t *table_struct = gcc_type_if_struct(gcc_t);
+    gcc_lvalue_t *existing = gcc_local(func, NULL, value_ptr_t, "_existing");
+    gcc_block_t *block = gcc_new_block(func, fresh("insert")),
+                *fast_path = gcc_new_block(func, fresh("fast_path")),
+                *found = gcc_new_block(func, fresh("found")),
+                *update = gcc_new_block(func, fresh("update")),
+                *done = gcc_new_block(func, fresh("done")),
+                *slow_path = gcc_new_block(func, fresh("slow_path"));
+
+    gcc_rvalue_t *cow = gcc_rval(gcc_rvalue_dereference_field(table, NULL, gcc_get_field(table_struct, TABLE_COW_FIELD)));
+    gcc_jump_condition(block, NULL, cow, slow_path, fast_path);
+
+    gcc_assign(fast_path, NULL, existing, gcc_callx(env->ctx, NULL, get_table_lookup_func(env, t), table, key));
+    gcc_jump_condition(fast_path, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_NE, gcc_rval(existing), gcc_null(env->ctx, value_ptr_t)),
+                       found, slow_path);
+
+    gcc_jump_condition(found, NULL, gcc_comparison(env->ctx, NULL, GCC_COMPARISON_NE, value, gcc_null(env->ctx, value_ptr_t)),
+                       update, done);
+    gcc_assign(update, NULL, gcc_rvalue_dereference(gcc_rval(existing), NULL), gcc_rval(gcc_rvalue_dereference(value, NULL)));
+    gcc_jump(update, NULL, done);
+    gcc_return(done, NULL, gcc_rval(existing));
+
+    store_hashes_if_expensive(env, slow_path, t, table);
+    gcc_rvalue_t *call = gcc_callx(
+        env->ctx, NULL, get_function(env, "sss_hashmap_set"),
+        gcc_cast(env->ctx, NULL, table, gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_hash_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_indirect_compare_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))),
+        gcc_cast(env->ctx, NULL, key, gcc_type(env->ctx, VOID_PTR)),
+        table_entry_value_offset(env, t),
+        gcc_cast(env->ctx, NULL, value, gcc_type(env->ctx, VOID_PTR)));
+    gcc_return(slow_path, NULL, gcc_cast(env->ctx, NULL, call, value_ptr_t));
+    return func;
+}
+
+// Get a table's entries as a flat array. Persistent tables don't store them
+// that way, so this calls sss_hashmap_entries(), which gathers them up if needed.
+gcc_rvalue_t *table_entries(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_rvalue_t *table)
+{
+    gcc_func_t *func = gcc_block_func(*block);
+    gcc_lvalue_t *table_var = gcc_local(func, NULL, sss_type_to_gcc(env, t), "_table");
+    gcc_assign(*block, NULL, table_var, table);
+    return gcc_callx(env->ctx, NULL, get_function(env, "sss_hashmap_entries"),
+                     gcc_cast(env->ctx, NULL, gcc_lvalue_address(table_var, NULL), gcc_type(env->ctx, VOID_PTR)),
+                     gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))));
+}
+
 gcc_lvalue_t *table_lvalue(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_rvalue_t *table, ast_t *key_ast, bool autocreate)
 {
     gcc_func_t *func = gcc_block_func(*block);
@@ -53,38 +377,18 @@ gcc_lvalue_t *table_lvalue(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_r
 
     gcc_lvalue_t *key_lval = gcc_local(func, NULL, needed_key_gcc_t, "_key");
     gcc_assign(*block, NULL, key_lval, key_val);
-    flatten_arrays(env, block, needed_key_t, gcc_lvalue_address(key_lval, NULL));
 
-    gcc_func_t *key_hash = get_hash_func(env, needed_key_t);
-    gcc_func_t *key_cmp = get_indirect_compare_func(env, needed_key_t);
     gcc_type_t *value_gcc_t = sss_type_to_gcc(env, Match(t, TableType)->value_type);
     gcc_lvalue_t *dest = gcc_local(func, NULL, gcc_get_ptr_type(value_gcc_t), "_dest");
+    table = gcc_cast(env->ctx, NULL, table, gcc_get_ptr_type(sss_type_to_gcc(env, t)));
     if (autocreate) {
-        gcc_func_t *hashmap_set_fn = get_function(env, "sss_hashmap_set");
-        gcc_rvalue_t *call = gcc_callx(
-            env->ctx, NULL, hashmap_set_fn,
-            gcc_cast(env->ctx, NULL, table, gcc_type(env->ctx, VOID_PTR)),
-            gcc_cast(env->ctx, NULL, gcc_get_func_address(key_hash, NULL), gcc_type(env->ctx, VOID_PTR)),
-            gcc_cast(env->ctx, NULL, gcc_get_func_address(key_cmp, NULL), gcc_type(env->ctx, VOID_PTR)),
-            gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))),
-            gcc_lvalue_address(key_lval, NULL),
-            table_entry_value_offset(env, t),
-            gcc_null(env->ctx, gcc_type(env->ctx, VOID_PTR)));
-
-        gcc_assign(*block, NULL, dest, gcc_cast(env->ctx, NULL, call, gcc_get_ptr_type(value_gcc_t)));
+        // The key may be stored in the table, so it shouldn't alias a strided view
+        flatten_arrays(env, block, needed_key_t, gcc_lvalue_address(key_lval, NULL));
+        gcc_assign(*block, NULL, dest, gcc_callx(env->ctx, NULL, get_table_insert_func(env, t), table, gcc_lvalue_address(key_lval, NULL),
+                                                 gcc_null(env->ctx, gcc_get_ptr_type(value_gcc_t))));
         return gcc_rvalue_dereference(gcc_rval(dest), NULL);
     } else {
-        gcc_func_t *hashmap_get_raw_fn = get_function(env, "sss_hashmap_get_raw");
-        gcc_rvalue_t *call = gcc_callx(
-            env->ctx, NULL, hashmap_get_raw_fn,
-            gcc_cast(env->ctx, NULL, table, gcc_type(env->ctx, VOID_PTR)),
-            gcc_cast(env->ctx, NULL, gcc_get_func_address(key_hash, NULL), gcc_type(env->ctx, VOID_PTR)),
-            gcc_cast(env->ctx, NULL, gcc_get_func_address(key_cmp, NULL), gcc_type(env->ctx, VOID_PTR)),
-            gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))),
-            gcc_lvalue_address(key_lval, NULL),
-            table_entry_value_offset(env, t));
-
-        gcc_assign(*block, NULL, dest, gcc_cast(env->ctx, NULL, call, gcc_get_ptr_type(value_gcc_t)));
+        gcc_assign(*block, NULL, dest, gcc_callx(env->ctx, NULL, get_table_lookup_func(env, t), table, gcc_lvalue_address(key_lval, NULL)));
 
         gcc_block_t *if_missing = gcc_new_block(func, fresh("if_missing")),
                     *done = gcc_new_block(func, fresh("done"));
@@ -99,6 +403,41 @@ gcc_lvalue_t *table_lvalue(env_t *env, gcc_block_t **block, sss_type_t *t, gcc_r
     }
 }
 
+// sss_hashmap_reserve(table_ptr, key_hash, key_cmp, entry_size, count)
+static void table_reserve(env_t *env, gcc_block_t *block, sss_type_t *t, gcc_rvalue_t *table_ptr, gcc_rvalue_t *count)
+{
+    sss_type_t *key_t = Match(t, TableType)->key_type;
+    store_hashes_if_expensive(env, block, t, table_ptr);
+    gcc_eval(block, NULL, gcc_callx(
+        env->ctx, NULL, get_function(env, "sss_hashmap_reserve"),
+        gcc_cast(env->ctx, NULL, table_ptr, gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_hash_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_cast(env->ctx, NULL, gcc_get_func_address(get_indirect_compare_func(env, key_t), NULL), gcc_type(env->ctx, VOID_PTR)),
+        gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))),
+        count));
+}
+
+static binding_t *define_table_reserve_method(env_t *env, sss_type_t *t)
+{
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, gcc_get_ptr_type(gcc_t), fresh("table")),
+        gcc_new_param(env->ctx, NULL, gcc_type(env->ctx, INT64), fresh("count")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, gcc_type(env->ctx, VOID), fresh("reserve"), 2, params, 0);
+    gcc_block_t *block = gcc_new_block(func, fresh("reserve"));
+    table_reserve(env, block, t, gcc_param_as_rvalue(params[0]), gcc_param_as_rvalue(params[1]));
+    gcc_return_void(block, NULL);
+
+    binding_t *b = new(binding_t, .func=func,
+        .type=Type(FunctionType, .arg_names=LIST(const char*, "table", "count"),
+                   .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t, .is_stack=true), Type(IntType, .bits=64)),
+                   .arg_defaults=LIST(ast_t*, NULL, NULL),
+                   .ret=Type(VoidType)));
+    set_in_namespace(env, t, "reserve", b);
+    return b;
+}
+
 static binding_t *define_table_remove_method(env_t *env, sss_type_t *t)
 {
     gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
@@ -118,7 +457,6 @@ static binding_t *define_table_remove_method(env_t *env, sss_type_t *t)
     if (key_val) {
         gcc_lvalue_t *key_lval = gcc_local(func, NULL, key_gcc_t, "_key");
         gcc_assign(block, NULL, key_lval, key_val);
-        flatten_arrays(env, &block, Match(t, TableType)->key_type, gcc_lvalue_address(key_lval, NULL));
         key_ptr = gcc_lvalue_address(key_lval, NULL);
     } else {
         key_ptr = gcc_null(env->ctx, gcc_get_ptr_type(key_gcc_t));
@@ -146,6 +484,55 @@ static binding_t *define_table_remove_method(env_t *env, sss_type_t *t)
     return b;
 }
 
+// Methods that call sss_hashmap_<name>() with another table of the same type:
+// `table.union(other)`, `table.intersection(other)` and `table.difference(other)`
+// return a new table, `table.contains_all(other)` returns a Bool, and
+// `table.merge(other)` modifies the table in place
+static binding_t *define_table_bulk_method(env_t *env, sss_type_t *t, const char *name)
+{
+    bool in_place = streq(name, "merge"), is_check = streq(name, "contains_all");
+    sss_type_t *self_t = in_place ? Type(PointerType, .pointed=t, .is_stack=true) : t;
+    sss_type_t *ret_t = in_place ? Type(VoidType) : (is_check ? Type(BoolType) : t);
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    gcc_param_t *params[] = {
+        gcc_new_param(env->ctx, NULL, sss_type_to_gcc(env, self_t), fresh("table")),
+        gcc_new_param(env->ctx, NULL, gcc_t, fresh("other")),
+    };
+    gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_INTERNAL, sss_type_to_gcc(env, ret_t), fresh(name), 2, params, 0);
+    gcc_block_t *block = gcc_new_block(func, fresh(name));
+
+#define AS_VOID_PTR(x) gcc_cast(env->ctx, NULL, x, gcc_type(env->ctx, VOID_PTR))
+    sss_type_t *key_t = Match(t, TableType)->key_type;
+    gcc_rvalue_t *table = in_place ? gcc_param_as_rvalue(params[0]) : gcc_lvalue_address(gcc_param_as_lvalue(params[0]), NULL),
+                 *other = gcc_lvalue_address(gcc_param_as_lvalue(params[1]), NULL),
+                 *key_hash = AS_VOID_PTR(gcc_get_func_address(get_hash_func(env, key_t), NULL)),
+                 *key_cmp = AS_VOID_PTR(gcc_get_func_address(get_indirect_compare_func(env, key_t), NULL)),
+                 *entry_size = gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(t))),
+                 *value_offset = table_entry_value_offset(env, t);
+    gcc_func_t *bulk_fn = get_function(env, heap_strf("sss_hashmap_%s", name));
+    if (in_place) {
+        store_hashes_if_expensive(env, block, t, table);
+        gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, bulk_fn, AS_VOID_PTR(table), AS_VOID_PTR(other), key_hash, key_cmp, entry_size, value_offset));
+        gcc_return_void(block, NULL);
+    } else if (is_check) {
+        gcc_return(block, NULL, gcc_callx(env->ctx, NULL, bulk_fn, AS_VOID_PTR(table), AS_VOID_PTR(other), key_hash, key_cmp, entry_size, value_offset));
+    } else {
+        gcc_lvalue_t *result = gcc_local(func, NULL, gcc_t, "_result");
+        gcc_eval(block, NULL, gcc_callx(env->ctx, NULL, bulk_fn, AS_VOID_PTR(gcc_lvalue_address(result, NULL)), AS_VOID_PTR(table), AS_VOID_PTR(other),
+                                        key_hash, key_cmp, entry_size, value_offset));
+        gcc_return(block, NULL, gcc_rval(result));
+    }
+#undef AS_VOID_PTR
+
+    binding_t *b = new(binding_t, .func=func,
+        .type=Type(FunctionType, .arg_names=LIST(const char*, "table", "other"),
+                   .arg_types=LIST(sss_type_t*, self_t, t),
+                   .arg_defaults=LIST(ast_t*, NULL, NULL),
+                   .ret=ret_t));
+    set_in_namespace(env, t, name, b);
+    return b;
+}
+
 binding_t *get_table_method(env_t *env, sss_type_t *t, const char *method_name)
 {
     for (;;) {
@@ -159,6 +546,11 @@ binding_t *get_table_method(env_t *env, sss_type_t *t, const char *method_name)
 
     if (streq(method_name, "remove")) {
         return define_table_remove_method(env, t);
+    } else if (streq(method_name, "reserve")) {
+        return define_table_reserve_method(env, t);
+    } else if (streq(method_name, "union") || streq(method_name, "intersection") || streq(method_name, "difference")
+               || streq(method_name, "contains_all") || streq(method_name, "merge")) {
+        return define_table_bulk_method(env, t, method_name);
     } else {
         return NULL;
     }
@@ -196,19 +588,21 @@ static void add_table_entry(env_t *env, gcc_block_t **block, ast_t *entry, table
     gcc_assign(*block, NULL, key_lval, key_val);
     gcc_assign(*block, NULL, value_lval, value_val);
 
-    gcc_func_t *hashmap_set_fn = get_function(env, "sss_hashmap_set");
-    gcc_func_t *key_hash = get_hash_func(env, Match(info->table_type, TableType)->key_type);
-    gcc_func_t *key_cmp = get_indirect_compare_func(env, Match(info->table_type, TableType)->key_type);
-    gcc_eval(*block, NULL, gcc_callx(env->ctx, NULL, hashmap_set_fn,
-                                     gcc_cast(env->ctx, NULL, info->table_ptr, gcc_type(env->ctx, VOID_PTR)),
-                                     gcc_cast(env->ctx, NULL, gcc_get_func_address(key_hash, NULL), gcc_type(env->ctx, VOID_PTR)),
-                                     gcc_cast(env->ctx, NULL, gcc_get_func_address(key_cmp, NULL), gcc_type(env->ctx, VOID_PTR)),
-                                     gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(info->table_type))),
+    gcc_eval(*block, NULL, gcc_callx(env->ctx, NULL, get_table_insert_func(env, info->table_type),
+                                     gcc_cast(env->ctx, NULL, info->table_ptr, gcc_get_ptr_type(sss_type_to_gcc(env, info->table_type))),
                                      gcc_lvalue_address(key_lval, NULL),
-                                     table_entry_value_offset(env, info->table_type),
                                      gcc_lvalue_address(value_lval, NULL)));
 }
 
+// Comprehensions that add one entry per loop iteration can make room for all
+// of their entries before the loop starts
+static void reserve_table_entries(env_t *env, gcc_block_t **block, ast_t *loop, gcc_rvalue_t *count, table_insert_info_t *info)
+{
+    ast_t *body = Match(loop, For)->body;
+    if (body && body->tag == TableEntry)
+        table_reserve(env, *block, info->table_type, info->table_ptr, count);
+}
+
 // Returns an optional pointer to a value
 gcc_rvalue_t *table_lookup_optional(env_t *env, gcc_block_t **block, ast_t *table_ast, ast_t *key_ast, gcc_rvalue_t **key_rval_out, bool raw)
 {
@@ -230,9 +624,7 @@ gcc_rvalue_t *table_lookup_optional(env_t *env, gcc_block_t **block, ast_t *tabl
     sss_type_t *key_t = Match(table_t, TableType)->key_type;
     sss_type_t *value_t = Match(table_t, TableType)->value_type;
 
-    gcc_func_t *hashmap_get_fn = get_function(env, raw ? "sss_hashmap_get_raw" : "sss_hashmap_get");
-    gcc_func_t *key_hash = get_hash_func(env, key_t);
-    gcc_func_t *key_cmp = get_indirect_compare_func(env, key_t);
+    gcc_func_t *lookup_fn = raw ? get_table_lookup_func(env, table_t) : get_table_get_func(env, table_t);
 
     sss_type_t *raw_key_t = get_type(env, key_ast);
     gcc_rvalue_t *key_val = compile_expr(env, block, key_ast);
@@ -241,17 +633,8 @@ gcc_rvalue_t *table_lookup_optional(env_t *env, gcc_block_t **block, ast_t *tabl
     gcc_lvalue_t *key_lval = gcc_local(func, loc, sss_type_to_gcc(env, key_t), "_key");
     gcc_assign(*block, loc, key_lval, key_val);
     if (key_rval_out) *key_rval_out = gcc_rval(key_lval);
-    flatten_arrays(env, block, key_t, gcc_lvalue_address(key_lval, loc));
-    gcc_rvalue_t *val_ptr = gcc_callx(
-        env->ctx, loc, hashmap_get_fn,
-        gcc_cast(env->ctx, loc, gcc_lvalue_address(table_var, loc), gcc_type(env->ctx, VOID_PTR)),
-        gcc_cast(env->ctx, loc, gcc_get_func_address(key_hash, loc), gcc_type(env->ctx, VOID_PTR)),
-        gcc_cast(env->ctx, loc, gcc_get_func_address(key_cmp, loc), gcc_type(env->ctx, VOID_PTR)),
-        gcc_rvalue_size(env->ctx, gcc_sizeof(env, table_entry_type(table_t))),
-        gcc_lvalue_address(key_lval, loc),
-        table_entry_value_offset(env, table_t));
+    gcc_rvalue_t *val_ptr = gcc_callx(env->ctx, loc, lookup_fn, gcc_lvalue_address(table_var, loc), gcc_lvalue_address(key_lval, loc));
     gcc_type_t *val_ptr_gcc_t = gcc_get_ptr_type(sss_type_to_gcc(env, value_t));
-    val_ptr = gcc_cast(env->ctx, loc, val_ptr, val_ptr_gcc_t);
 
     gcc_lvalue_t *value_lval = gcc_local(func, loc, val_ptr_gcc_t, "_value");
     gcc_assign(*block, loc, value_lval, val_ptr);
@@ -281,10 +664,18 @@ gcc_rvalue_t *compile_table(env_t *env, gcc_block_t **block, ast_t *ast, bool ma
     env_t env2 = *env;
     env2.comprehension_callback = (void*)add_table_entry;
     table_insert_info_t info = {t, gcc_lvalue_address(table_var, loc)};
+    env2.comprehension_reserve = (void*)reserve_table_entries;
     env2.comprehension_userdata = &info;
     env = &env2;
 
     if (table->entries) {
+        int64_t num_literal_entries = 0;
+        foreach (table->entries, entry_ast, _) {
+            if ((*entry_ast)->tag == TableEntry) ++num_literal_entries;
+        }
+        if (num_literal_entries > 1)
+            table_reserve(env, *block, t, info.table_ptr, gcc_rvalue_int64(env->ctx, num_literal_entries));
+
         gcc_block_t *table_done = gcc_new_block(func, fresh("table_done"));
         foreach (table->entries, entry_ast, _) {
             gcc_block_t *entry_done = gcc_new_block(func, fresh("entry_done"));
@@ -357,7 +748,7 @@ void compile_table_cord_func(env_t *env, gcc_block_t **block, gcc_rvalue_t *obj,
     gcc_lvalue_t *i = gcc_local(func, NULL, gcc_type(env->ctx, INT64), "_i");
     gcc_assign(*block, NULL, i, gcc_zero(env->ctx, gcc_type(env->ctx, INT64)));
     gcc_struct_t *table_struct = gcc_type_if_struct(gcc_t);
-    gcc_rvalue_t *entries = gcc_rvalue_access_field(obj, NULL, gcc_get_field(table_struct, TABLE_ENTRIES_FIELD));
+    gcc_rvalue_t *entries = table_entries(env, block, t, obj);
     gcc_rvalue_t *len = gcc_rvalue_access_field(obj, NULL, gcc_get_field(table_struct, TABLE_COUNT_FIELD));
 
     gcc_rvalue_t *len64 = gcc_cast(env->ctx, NULL, len, gcc_type(env->ctx, INT64));
@@ -52,7 +52,7 @@ static inline void _load_method(
     gcc_func_t *func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_IMPORTED, sss_type_to_gcc(env, ret_t),
                                     extern_name, nargs, params, 0);
     sss_type_t *fn_type = Type(FunctionType, .arg_types=arg_type_list, .arg_names=arg_name_list, .arg_defaults=arg_default_list, .ret=ret_t);
-    hset(ns, heap_str(method_name), new(binding_t, .type=fn_type, .func=func));
+    set_binding(ns, heap_str(method_name), new(binding_t, .type=fn_type, .func=func));
 }
 
 sss_type_t *define_tagged_union(env_t *env, int tag_bits, const char *name, List(sss_tagged_union_member_t) members)
@@ -70,7 +70,7 @@ sss_type_t *define_tagged_union(env_t *env, int tag_bits, const char *name, List
     }
     sss_type_t *t = Type(VariantType, .filename="<builtin>", .name=name, .variant_of=Type(TaggedUnionType, .tag_bits=tag_bits, .members=members));
     gcc_rvalue_t *rval = gcc_str(env->ctx, name);
-    hset(&env->global->bindings, name, new(binding_t, .type=Type(TypeType, t), .rval=rval, .visible_in_closures=true));
+    set_binding(&env->global->bindings, name, new(binding_t, .type=Type(TypeType, t), .rval=rval, .visible_in_closures=true));
     populate_tagged_union_constructors(env, t);
     return t;
 }
@@ -136,7 +136,7 @@ static void load_global_functions(env_t *env)
                          PARAM(t_int, "end"));
     load_global_var_func(env, t_void, "exit", PARAM(gcc_get_type(ctx, GCC_T_INT), "status"));
     gcc_func_t *exit_fn = hget(&env->global->funcs, "exit", gcc_func_t*);
-    hset(&env->global->bindings, "exit", new(binding_t, .func=exit_fn, .sym_name="exit", .visible_in_closures=true, .type=Type(
+    set_binding(&env->global->bindings, "exit", new(binding_t, .func=exit_fn, .sym_name="exit", .visible_in_closures=true, .type=Type(
         FunctionType,
         .arg_names=LIST(const char*, "status"),
         .arg_types=LIST(sss_type_t*, Type(IntType, .bits=32)),
@@ -145,7 +145,7 @@ static void load_global_functions(env_t *env)
     load_global_func(env, t_double, "sane_fmod", PARAM(t_double, "num"), PARAM(t_double, "modulus"));
     load_global_func(env, gcc_type(ctx, STRING), "range_to_cord", PARAM(t_range, "range"), PARAM(t_void_ptr, "stack"), PARAM(t_bool, "color"));
     gcc_func_t *range_to_cord = hget(&env->global->funcs, "range_to_cord", gcc_func_t*);
-    hset(get_namespace(env, Type(RangeType)), "__cord",
+    set_binding(get_namespace(env, Type(RangeType)), "__cord",
          new(binding_t, .func=range_to_cord, .sym_name="range_to_cord"));
     load_global_func(env, t_bl_str, "range_slice", PARAM(t_bl_str, "array"), PARAM(t_range, "range"), PARAM(t_size, "item_size"));
     load_global_func(env, t_void_ptr, "dlopen", PARAM(t_str, "filename"), PARAM(t_int, "flags"));
@@ -161,6 +161,10 @@ static void load_global_functions(env_t *env)
                      PARAM(t_void_ptr, "other"),
                      PARAM(t_int64, "index"),
                      PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
+    load_global_func(env, t_void, "array_reserve", PARAM(t_void_ptr, "array"),
+                     PARAM(t_int64, "count"),
+                     PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
+    load_global_func(env, t_void, "array_shrink_to_fit", PARAM(t_void_ptr, "array"), PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
     load_global_func(env, t_void, "array_remove", PARAM(t_void_ptr, "array"),
                      PARAM(t_int64, "index"),
                      PARAM(t_int64, "count"),
@@ -168,12 +172,26 @@ static void load_global_functions(env_t *env)
     load_global_func(env, t_void, "array_sort", PARAM(t_void_ptr, "array"),
                      PARAM(t_void_ptr, "compare"),
                      PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
+    load_global_func(env, t_void, "array_stable_sort", PARAM(t_void_ptr, "array"),
+                     PARAM(t_void_ptr, "compare"),
+                     PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
+    load_global_func(env, t_void, "array_sort_ints", PARAM(t_void_ptr, "array"), PARAM(t_size, "item_size"), PARAM(t_bool, "is_signed"));
+    load_global_func(env, t_void, "array_sort_nums", PARAM(t_void_ptr, "array"), PARAM(t_size, "item_size"));
+    load_global_func(env, t_void, "array_sort_compiled", PARAM(t_void_ptr, "array"),
+                     PARAM(t_void_ptr, "sort"), PARAM(t_void_ptr, "merge"), PARAM(t_void_ptr, "compare"),
+                     PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
+    load_global_func(env, t_void, "array_sort_by", PARAM(t_void_ptr, "array"),
+                     PARAM(t_void_ptr, "get_key"), PARAM(t_void_ptr, "userdata"), PARAM(t_void_ptr, "key_compare"),
+                     PARAM(t_size, "key_size"), PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
     load_global_func(env, t_void, "array_shuffle", PARAM(t_void_ptr, "array"), PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
     load_global_func(env, t_bl_str, "array_join", PARAM(t_void_ptr, "array"), PARAM(t_void_ptr, "glue"), PARAM(t_size, "item_size"), PARAM(t_bool, "atomic"));
+    load_global_func(env, t_int64, "array_index_of", PARAM(t_void_ptr, "array"), PARAM(t_void_ptr, "item"), PARAM(t_void_ptr, "compare"));
+    _load_global_func(env, t_int, "sss_thread_count", 0, NULL, 0);
+    load_global_func(env, t_void, "sss_parallel_for", PARAM(t_int64, "n"), PARAM(t_int64, "grain"), PARAM(t_void_ptr, "fn"), PARAM(t_void_ptr, "userdata"));
 
-    // int halfsiphash(const void *in, const size_t inlen, const void *k, void *out, const size_t outlen);
-    load_global_func(env, t_int, "halfsiphash", PARAM(t_void_ptr, "in"), PARAM(t_size, "inlen"), PARAM(t_void_ptr, "k"),
-                     PARAM(t_void_ptr, "out"), PARAM(t_size, "outlen"));
+    load_global_func(env, t_u32, "sss_hash", PARAM(t_void_ptr, "data"), PARAM(t_size, "len"));
+    load_global_func(env, t_u32, "sss_hash_strided", PARAM(t_void_ptr, "data"), PARAM(t_int64, "len"),
+                     PARAM(t_int64, "stride"), PARAM(t_size, "item_size"));
 
     load_global_func(env, t_void_ptr, "sss_hashmap_get", PARAM(t_void_ptr, "table"), PARAM(t_void_ptr, "key_hash"),
                      PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_void_ptr, "key"), PARAM(t_size, "value_offset"));
@@ -184,12 +202,25 @@ static void load_global_functions(env_t *env)
                      PARAM(t_size, "value_offset"), PARAM(t_void_ptr, "value"));
     load_global_func(env, t_void, "sss_hashmap_remove", PARAM(t_void_ptr, "table"), PARAM(t_void_ptr, "key_hash"),
                      PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_void_ptr, "key"));
+    load_global_func(env, t_void, "sss_hashmap_reserve", PARAM(t_void_ptr, "table"), PARAM(t_void_ptr, "key_hash"),
+                     PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_int64, "count"));
     load_global_func(env, t_u32, "sss_hashmap_hash", PARAM(t_void_ptr, "table"), PARAM(t_void_ptr, "entry_hash"), PARAM(t_size, "entry_size"));
     load_global_func(env, t_u32, "sss_hashmap_len", PARAM(t_void_ptr, "table"));
+    load_global_func(env, t_void_ptr, "sss_hashmap_entries", PARAM(t_void_ptr, "table"), PARAM(t_size, "entry_size"));
     load_global_func(env, t_void, "sss_hashmap_mark_cow", PARAM(t_void_ptr, "table"));
     load_global_func(env, t_int, "sss_hashmap_compare", PARAM(t_void_ptr, "table1"), PARAM(t_void_ptr, "table2"), PARAM(t_void_ptr, "key_hash"),
                      PARAM(t_void_ptr, "key_compare"), PARAM(t_void_ptr, "value_compare"),
                      PARAM(t_size, "entry_size"), PARAM(t_size, "value_offset"));
+    load_global_func(env, t_void, "sss_hashmap_merge", PARAM(t_void_ptr, "table"), PARAM(t_void_ptr, "other"), PARAM(t_void_ptr, "key_hash"),
+                     PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_size, "value_offset"));
+    load_global_func(env, t_bool, "sss_hashmap_contains_all", PARAM(t_void_ptr, "table"), PARAM(t_void_ptr, "other"), PARAM(t_void_ptr, "key_hash"),
+                     PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_size, "value_offset"));
+    load_global_func(env, t_void, "sss_hashmap_union", PARAM(t_void_ptr, "result"), PARAM(t_void_ptr, "a"), PARAM(t_void_ptr, "b"),
+                     PARAM(t_void_ptr, "key_hash"), PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_size, "value_offset"));
+    load_global_func(env, t_void, "sss_hashmap_intersection", PARAM(t_void_ptr, "result"), PARAM(t_void_ptr, "a"), PARAM(t_void_ptr, "b"),
+                     PARAM(t_void_ptr, "key_hash"), PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_size, "value_offset"));
+    load_global_func(env, t_void, "sss_hashmap_difference", PARAM(t_void_ptr, "result"), PARAM(t_void_ptr, "a"), PARAM(t_void_ptr, "b"),
+                     PARAM(t_void_ptr, "key_hash"), PARAM(t_void_ptr, "key_cmp"), PARAM(t_size, "entry_size"), PARAM(t_size, "value_offset"));
     load_global_func(env, t_u32, "hash_64bits", PARAM(t_void_ptr, "ptr"));
     load_global_func(env, t_u32, "compare_64bits", PARAM(t_void_ptr, "a"), PARAM(t_void_ptr, "b"));
 #undef PARAM
@@ -200,7 +231,7 @@ static sss_type_t *define_string_type(env_t *env, sss_type_t *str_type)
     const char *name = type_to_string(str_type);
     gcc_rvalue_t *rval = gcc_str(env->ctx, name);
     binding_t *binding = new(binding_t, .rval=rval, .type=Type(TypeType, .type=str_type));
-    hset(&env->global->bindings, name, binding);
+    set_binding(&env->global->bindings, name, binding);
 
     sss_hashmap_t *ns = get_namespace(env, str_type);
     load_method(env, ns, "sss_string_uppercased", "uppercased", str_type, ARG("str",str_type,0));
@@ -228,7 +259,7 @@ static sss_type_t *define_string_type(env_t *env, sss_type_t *str_type)
 
     load_method(env, ns, "sss_string_find", "find",
                 define_tagged_union(env, 8, "FindResult", LIST(sss_tagged_union_member_t,
-                    {"Failure", 0, NULL}, {"Success", 1, Type(IntType, .bits=32)})),
+                    {"Failure", 0, NULL}, {"Success", 1, Type(IntType, .bits=64)})),
                 ARG("str",str_type,0),
                 ARG("pattern",str_type,0));
 
@@ -242,7 +273,7 @@ static void define_num_types(env_t *env)
     {
         gcc_rvalue_t *rval = gcc_str(env->ctx, "Num");
         binding_t *binding = new(binding_t, .rval=rval, .type=Type(TypeType, .type=num64_type));
-        hset(&env->global->bindings, "Num", binding);
+        set_binding(&env->global->bindings, "Num", binding);
 
         sss_type_t *partial_t = Type(StructType, .field_names=LIST(const char*, "value", "remainder"),
                                      .field_types=LIST(sss_type_t*, num64_type, Type(ArrayType, .item_type=Type(CharType))));
@@ -259,7 +290,7 @@ static void define_num_types(env_t *env)
     {
         gcc_rvalue_t *rval = gcc_str(env->ctx, "Num32");
         binding_t *binding = new(binding_t, .rval=rval, .type=Type(TypeType, .type=num32_type));
-        hset(&env->global->bindings, "Num32", binding);
+        set_binding(&env->global->bindings, "Num32", binding);
     }
 
     struct { const char *c_name, *sss_name; } unary_methods[] = {
@@ -329,7 +360,7 @@ static void define_num_types(env_t *env)
         gcc_type_t *gcc_num_t = sss_type_to_gcc(env, num64_type);
         sss_hashmap_t *ns = get_namespace(env, num64_type);
         for (size_t i = 0; i < sizeof(constants)/sizeof(constants[0]); i++)
-            hset(ns, constants[i].name, new(binding_t, .type=num64_type,
+            set_binding(ns, constants[i].name, new(binding_t, .type=num64_type,
                                             .rval=gcc_rvalue_from_double(env->ctx, gcc_num_t, constants[i].val)));
     }
 
@@ -337,7 +368,7 @@ static void define_num_types(env_t *env)
         gcc_type_t *gcc_num32_t = sss_type_to_gcc(env, num32_type);
         sss_hashmap_t *ns = get_namespace(env, num32_type);
         for (size_t i = 0; i < sizeof(constants)/sizeof(constants[0]); i++)
-            hset(ns, constants[i].name, new(binding_t, .type=num32_type,
+            set_binding(ns, constants[i].name, new(binding_t, .type=num32_type,
                                             .rval=gcc_rvalue_from_double(env->ctx, gcc_num32_t, constants[i].val)));
     }
 
@@ -389,14 +420,14 @@ static void define_int_types(env_t *env)
                         ARG("max", t, FakeAST(Int, .i=type.max, .precision=type.bits, .is_unsigned=true)));
 
         gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
-        hset(ns, "min", new(binding_t, .type=t, .rval=gcc_rvalue_from_long(env->ctx, gcc_t, type.min)));
-        hset(ns, "max", new(binding_t, .type=t, .rval=gcc_rvalue_from_long(env->ctx, gcc_t, type.max)));
+        set_binding(ns, "min", new(binding_t, .type=t, .rval=gcc_rvalue_from_long(env->ctx, gcc_t, type.min)));
+        set_binding(ns, "max", new(binding_t, .type=t, .rval=gcc_rvalue_from_long(env->ctx, gcc_t, type.max)));
 
         const char* name = heap_strf("%s%d", type.is_signed ? "Int" : "UInt", type.bits);
         binding_t *binding = new(binding_t, .rval=gcc_str(env->ctx, name), .type=Type(TypeType, .type=t));
-        hset(&env->global->bindings, name, binding);
+        set_binding(&env->global->bindings, name, binding);
         if (type.bits == 64)
-            hset(&env->global->bindings, type.is_signed ? "Int" : "UInt", binding);
+            set_binding(&env->global->bindings, type.is_signed ? "Int" : "UInt", binding);
         load_method(env, ns, "sss_string_int_format", "format", str_t, ARG("i",t,0), ARG("digits",INT_TYPE,0));
         load_method(env, ns, "sss_string_hex", "hex", str_t, ARG("i",t,0),
                     ARG("digits",INT_TYPE,FakeAST(Int, .i=1, .precision=64)),
@@ -416,8 +447,8 @@ env_t *new_environment(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, bool tail
         .global=global,
         .on_err = on_err,
         .file = f,
-        .file_bindings = new(sss_hashmap_t, .fallback=&global->bindings),
-        .bindings = new(sss_hashmap_t),
+        .file_bindings = new_bindings(&global->bindings),
+        .bindings = new_bindings(NULL),
         .tail_calls = tail_calls,
     );
     env->bindings->fallback = env->file_bindings;
@@ -447,13 +478,13 @@ env_t *new_environment(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, bool tail
                 APPEND_STRUCT(error_members, item);
         }
         sss_type_t *c_err = define_tagged_union(env, 32, "CError", error_members);
-        hset(&env->global->bindings, "CError", new(binding_t, .rval=gcc_str(ctx, "CError"), .type=Type(TypeType, .type=c_err)));
+        set_binding(&env->global->bindings, "CError", new(binding_t, .rval=gcc_str(ctx, "CError"), .type=Type(TypeType, .type=c_err)));
 
         gcc_type_t *errno_ptr_gcc_t = gcc_get_ptr_type(sss_type_to_gcc(env, c_err));
         gcc_func_t *errno_loc_func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_IMPORTED, errno_ptr_gcc_t, "__errno_location", 0, NULL, 0);
         gcc_rvalue_t *errno_ptr = gcc_callx(env->ctx, NULL, errno_loc_func);
         gcc_lvalue_t *errno_lval = gcc_rvalue_dereference(errno_ptr, NULL);
-        hset(&env->global->bindings, "errno", new(binding_t, .rval=gcc_rval(errno_lval), .lval=errno_lval, .type=c_err));
+        set_binding(&env->global->bindings, "errno", new(binding_t, .rval=gcc_rval(errno_lval), .lval=errno_lval, .type=c_err));
     }
 
     sss_type_t *c_str = Type(PointerType, .pointed=Type(CStringCharType), .is_optional=true);
@@ -478,7 +509,7 @@ env_t *new_environment(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, bool tail
     };
     gcc_func_t *say_func = gcc_new_func(ctx, NULL, GCC_FUNCTION_IMPORTED, gcc_type(ctx, VOID), "say", 2, gcc_say_params, 0);
     gcc_rvalue_t *say_rvalue = gcc_get_func_address(say_func, NULL);
-    hset(&env->global->bindings, "say", new(binding_t, .func=say_func, .rval=say_rvalue, .type=say_type));
+    set_binding(&env->global->bindings, "say", new(binding_t, .func=say_func, .rval=say_rvalue, .type=say_type));
     sss_type_t *warn_type = Type(
         FunctionType,
         .arg_names=LIST(const char*, "str", "end", "colorize"),
@@ -491,9 +522,9 @@ env_t *new_environment(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, bool tail
         gcc_new_param(ctx, NULL, gcc_type(env->ctx, BOOL), "colorize"),
     };
     gcc_func_t *warn_func = gcc_new_func(ctx, NULL, GCC_FUNCTION_IMPORTED, gcc_type(ctx, VOID), "warn", 3, gcc_warn_params, 0);
-    hset(&env->global->bindings, "warn", new(binding_t, .func=warn_func, .rval=gcc_get_func_address(warn_func, NULL), .type=warn_type));
+    set_binding(&env->global->bindings, "warn", new(binding_t, .func=warn_func, .rval=gcc_get_func_address(warn_func, NULL), .type=warn_type));
     define_num_types(env);
-#define DEFTYPE(t) hset(&env->global->bindings, #t, new(binding_t, .rval=gcc_str(ctx, #t), .type=Type(TypeType, .type=Type(t##Type))));
+#define DEFTYPE(t) set_binding(&env->global->bindings, #t, new(binding_t, .rval=gcc_str(ctx, #t), .type=Type(TypeType, .type=Type(t##Type))));
     // Primitive types:
     DEFTYPE(Bool); DEFTYPE(Void); DEFTYPE(Abort); DEFTYPE(Memory);
     DEFTYPE(Char); DEFTYPE(CStringChar);
@@ -507,7 +538,7 @@ env_t *fresh_scope(env_t *env)
 {
     env_t *fresh = GC_MALLOC(sizeof(env_t));
     *fresh = *env;
-    fresh->bindings = new(sss_hashmap_t, .fallback=env->bindings);
+    fresh->bindings = new_bindings(env->bindings);
     return fresh;
 }
 
@@ -515,7 +546,7 @@ env_t *scope_with_type(env_t *env, sss_type_t *t)
 {
     env_t *fresh = GC_MALLOC(sizeof(env_t));
     *fresh = *env;
-    fresh->bindings = new(sss_hashmap_t, .fallback=env->bindings);
+    fresh->bindings = new_bindings(env->bindings);
     sss_hashmap_t *ns = get_namespace(env, t);
     if (t->tag == TaggedUnionType) {
         auto members = Match(t, TaggedUnionType)->members;
@@ -525,7 +556,7 @@ env_t *scope_with_type(env_t *env, sss_type_t *t)
     for (uint32_t i = 1; i <= ns->count; i++) {
         auto entry = hnth(ns, i, const char*, binding_t*);
         if (!hget(fresh->bindings, entry->key, binding_t*))
-            hset(fresh->bindings, entry->key, entry->value);
+            set_binding(fresh->bindings, entry->key, entry->value);
     }
     return fresh;
 }
@@ -536,7 +567,7 @@ static void copy_global_bindings(sss_hashmap_t *dest, sss_hashmap_t *src)
         for (uint32_t i = 1; i <= src->count; i++) {
             auto entry = hnth(src, i, const char*, binding_t*);
             if (entry->value->visible_in_closures)
-                hset(dest, entry->key, entry->value);
+                set_binding(dest, entry->key, entry->value);
         }
     }
 }
@@ -545,7 +576,7 @@ env_t *file_scope(env_t *env)
 {
     env_t *fresh = GC_MALLOC(sizeof(env_t));
     *fresh = *env;
-    fresh->bindings = new(sss_hashmap_t, .fallback=env->file_bindings);
+    fresh->bindings = new_bindings(env->file_bindings);
     copy_global_bindings(fresh->bindings, env->bindings);
     return fresh;
 }
@@ -574,13 +605,60 @@ void compiler_err(env_t *env, ast_t *ast, const char *fmt, ...)
     exit(1);
 }
 
+uint64_t bindings_generation = 0, namespaces_changed = 0;
+
+sss_hashmap_t *new_bindings(sss_hashmap_t *fallback)
+{
+    return &new(bindings_t, .table.fallback=fallback)->table;
+}
+
+static void note_change(sss_hashmap_t *bindings)
+{
+    bindings_t *b = (bindings_t*)bindings;
+    b->last_change = ++bindings_generation;
+    if (b->is_namespace)
+        namespaces_changed = bindings_generation;
+}
+
+void set_binding(sss_hashmap_t *bindings, const char *name, binding_t *b)
+{
+    note_change(bindings);
+    hset(bindings, name, b);
+}
+
+void remove_binding(sss_hashmap_t *bindings, const char *name)
+{
+    note_change(bindings);
+    hremove(bindings, name, binding_t*);
+}
+
+void set_fallback(sss_hashmap_t *bindings, sss_hashmap_t *fallback)
+{
+    note_change(bindings);
+    bindings->fallback = fallback;
+}
+
+// Whether anything visible from a scope could have changed since the given generation
+bool bindings_unchanged_since(sss_hashmap_t *bindings, uint64_t generation)
+{
+    if (namespaces_changed > generation)
+        return false;
+    for (; bindings; bindings = bindings->fallback) {
+        if (((bindings_t*)bindings)->last_change > generation)
+            return false;
+    }
+    return true;
+}
+
 binding_t *get_binding(env_t *env, const char *name)
 {
+    ++compile_counts.binding_lookups;
     return hget(env->bindings, name, binding_t*);
 }
 
 binding_t *get_local_binding(env_t *env, const char *name)
 {
+    ++compile_counts.binding_lookups;
     sss_hashmap_t *fallback = env->bindings->fallback;
     binding_t *b = hget(env->bindings, name, binding_t*);
     env->bindings->fallback = fallback;
@@ -628,10 +706,11 @@ binding_t *get_ast_binding(env_t *env, ast_t *ast)
 
 sss_hashmap_t *get_namespace(env_t *env, sss_type_t *t)
 {
-    sss_hashmap_t *ns = hget(&env->global->type_namespaces, type_to_string(t), sss_hashmap_t*);
+    sss_hashmap_t *ns = hget(&env->global->type_namespaces, canonical_type(t), sss_hashmap_t*);
     if (!ns) {
-        ns = new(sss_hashmap_t, .fallback=env->file_bindings);
-        hset(&env->global->type_namespaces, type_to_string(t), ns);
+        ns = new_bindings(env->file_bindings);
+        ((bindings_t*)ns)->is_namespace = true;
+        hset(&env->global->type_namespaces, canonical_type(t), ns);
 
         sss_type_t *base_t = t;
         for (;;) {
@@ -659,6 +738,7 @@ binding_t *get_from_namespace(env_t *env, sss_type_t *t, const char *name)
     // (we don't want module.Struct.__cord to return module.__cord, even
     // though the namespace may have that set as a fallback so that code
     // module.Struct can reference things inside the module's namespace)
+    ++compile_counts.binding_lookups;
     sss_hashmap_t *ns = get_namespace(env, t);
     sss_hashmap_t *fallback = ns->fallback;
     ns->fallback = NULL;
@@ -669,7 +749,7 @@ binding_t *get_from_namespace(env_t *env, sss_type_t *t, const char *name)
 
 void set_in_namespace(env_t *env, sss_type_t *t, const char *name, void *value)
 {
-    hset(get_namespace(env, t), heap_str(name), value);
+    set_binding(get_namespace(env, t), heap_str(name), value);
 }
 
 #define MIN3(a, b, c) ((a) < (b) ? ((a) < (c) ? (a) : (c)) : ((b) < (c) ? (b) : (c)))
@@ -41,12 +41,35 @@ typedef struct {
     bool visible_in_closures:1;
 } binding_t;
 
+// Settings for compiling `use`d modules into their own shared objects
 typedef struct {
-    sss_hashmap_t bindings; // name -> binding_t*
+    gcc_ctx_t *(*new_context)(void);
+    const char *cache_flags;
+    int jobs; // Number of modules to compile in parallel
+} module_options_t;
+
+// A table of bindings (a scope or a namespace), which records the last time it
+// was changed, so get_type() can tell if a cached type may be stale. Every
+// bindings table is one of these, made with new_bindings().
+typedef struct {
+    sss_hashmap_t table; // name -> binding_t*
+    uint64_t last_change;
+    bool is_namespace;
+} bindings_t;
+
+typedef struct {
+    union { // The outermost scope
+        sss_hashmap_t bindings;
+        bindings_t global_bindings;
+    };
     sss_hashmap_t funcs; // name -> func
     sss_hashmap_t type_namespaces; // sss_type_t* -> name -> binding_t*
     sss_hashmap_t def_types; // ast_t* -> binding_t*
     sss_hashmap_t ast_functions; // ast_t* -> func_context_t*
+    sss_hashmap_t used_files; // path -> sss_file_t*
+    sss_hashmap_t referenced_names; // name -> bool, for names used by code that will be compiled
+    sss_hashmap_t type_cache; // ast_t* -> type_cache_entry_t*, see get_type()
+    module_options_t *module_options; // NULL means modules are compiled inline
 } global_env_t;
 
 typedef struct env_s {
@@ -61,8 +84,11 @@ typedef struct env_s {
     derived_units_t *derived_units;
     void (*comprehension_callback)(struct env_s *env, gcc_block_t **block, ast_t *item, void *userdata);
     void *comprehension_userdata;
+    // If set, comprehension loops call this first with how many times they'll run
+    void (*comprehension_reserve)(struct env_s *env, gcc_block_t **block, ast_t *loop, gcc_rvalue_t *count, void *userdata);
     defer_t *deferred;
-    bool tail_calls:1, is_deferred:1, should_mark_cow:1;
+    const char *symbol_prefix; // Prefix for stable symbol names of a module's top-level definitions
+    bool tail_calls:1, is_deferred:1, should_mark_cow:1, importing_module:1;
 } env_t;
 
 typedef struct {
@@ -77,6 +103,15 @@ env_t *new_environment(gcc_ctx_t *ctx, jmp_buf *on_err, sss_file_t *f, bool tail
 env_t *fresh_scope(env_t *env);
 env_t *file_scope(env_t *env);
 env_t *scope_with_type(env_t *env, sss_type_t *t);
+sss_hashmap_t *new_bindings(sss_hashmap_t *fallback);
+// Scopes and namespaces are only changed through these, which record when
+// they were changed. Namespaces are also looked up directly by typechecking,
+// so namespaces_changed is when any namespace last changed.
+extern uint64_t bindings_generation, namespaces_changed;
+bool bindings_unchanged_since(sss_hashmap_t *bindings, uint64_t generation);
+void set_binding(sss_hashmap_t *bindings, const char *name, binding_t *b);
+void remove_binding(sss_hashmap_t *bindings, const char *name);
+void set_fallback(sss_hashmap_t *bindings, sss_hashmap_t *fallback);
 binding_t *get_binding(env_t *env, const char *name);
 binding_t *get_local_binding(env_t *env, const char *name);
 gcc_func_t *get_function(env_t *env, const char *name);
@@ -0,0 +1,63 @@
+// arena.c - Bump allocation for objects that live as long as a compilation
+#include <gc.h>
+#include <stdalign.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (256*1024)
+
+typedef struct arena_chunk_s {
+    struct arena_chunk_s *next;
+    alignas(max_align_t) char data[];
+} arena_chunk_t;
+
+static struct {
+    arena_chunk_t *chunks;
+    char *pos, *end;
+    int depth;
+} arena = {0};
+
+void arena_begin(void)
+{
+    ++arena.depth;
+}
+
+void arena_end(void)
+{
+    if (arena.depth > 0 && --arena.depth == 0) {
+        for (arena_chunk_t *chunk = arena.chunks, *next; chunk; chunk = next) {
+            next = chunk->next;
+            GC_FREE(chunk);
+        }
+        arena.chunks = NULL;
+        arena.pos = arena.end = NULL;
+    }
+}
+
+void *arena_alloc(size_t size)
+{
+    if (arena.depth == 0)
+        return GC_MALLOC(size);
+
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+    // Big objects would waste too much of a chunk:
+    if (size > ARENA_CHUNK_SIZE/8)
+        return GC_MALLOC(size);
+
+    if (arena.pos == NULL || (size_t)(arena.end - arena.pos) < size) {
+        // Chunks are scanned for pointers to GC memory, but the collector
+        // never has to track or sweep the objects in them. Like GC_MALLOC(),
+        // this memory is zeroed, so objects don't need to be cleared.
+        arena_chunk_t *chunk = GC_MALLOC_UNCOLLECTABLE(sizeof(arena_chunk_t) + ARENA_CHUNK_SIZE);
+        chunk->next = arena.chunks;
+        arena.chunks = chunk;
+        arena.pos = chunk->data;
+        arena.end = chunk->data + ARENA_CHUNK_SIZE;
+    }
+    void *p = arena.pos;
+    arena.pos += size;
+    return p;
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
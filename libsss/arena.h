@@ -0,0 +1,18 @@
+// arena.h - Bump allocation for objects that live as long as a compilation
+#pragma once
+#include <stddef.h>
+#include <string.h>
+
+// While an arena session is active, arena_alloc() carves objects out of large
+// uncollectable chunks instead of making a separate GC allocation for each
+// object. The chunks can hold pointers to GC memory, but the collector doesn't
+// manage the objects inside them. When the outermost session ends, every
+// chunk is freed at once, so nothing from the arena may be used after that.
+// Outside of a session, arena_alloc() is just GC_MALLOC().
+void arena_begin(void);
+void arena_end(void);
+void *arena_alloc(size_t size);
+
+#define arena_new(t, ...) ((t*)memcpy(arena_alloc(sizeof(t)), &(t){__VA_ARGS__}, sizeof(t)))
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
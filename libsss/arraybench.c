@@ -0,0 +1,76 @@
+// Benchmark for building arrays by appending to them.
+// `make arraybench` builds it against the runtime library.
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "utils.h"
+
+#define N 10000000
+#define CHUNK 16
+
+typedef struct { long *items; int64_t length; int32_t stride, free; } long_array_t;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+static void report(const char *what, long n, double start, int reallocations)
+{
+    double elapsed = now() - start;
+    printf("%-32s %8.2f Mitems/s %6d reallocations\n", what, (double)n/elapsed/1e6, reallocations);
+}
+
+int main(void) {
+    GC_INIT();
+    long checksum = 0;
+
+    long_array_t arr = {0};
+    int reallocations = 0;
+    double start = now();
+    for (long i = 0; i < N; i++) {
+        long *before = arr.items;
+        array_insert(&arr, (char*)&i, arr.length+1, sizeof(long), true);
+        reallocations += arr.items != before;
+    }
+    report("Append 10M", N, start, reallocations);
+    checksum += arr.items[N-1];
+
+    long_array_t reserved = {0};
+    reallocations = 0;
+    start = now();
+    array_reserve(&reserved, N, sizeof(long), true);
+    for (long i = 0; i < N; i++) {
+        long *before = reserved.items;
+        array_insert(&reserved, (char*)&i, reserved.length+1, sizeof(long), true);
+        reallocations += reserved.items != before;
+    }
+    report("Append 10M (reserved)", N, start, reallocations);
+    checksum += reserved.items[N/2];
+
+    long chunk_items[CHUNK];
+    long_array_t chunk = {chunk_items, CHUNK, sizeof(long), 0};
+    long_array_t chunked = {0};
+    reallocations = 0;
+    start = now();
+    for (long i = 0; i < N; i += CHUNK) {
+        for (long j = 0; j < CHUNK; j++) chunk_items[j] = i + j;
+        long *before = chunked.items;
+        array_insert_all(&chunked, &chunk, chunked.length+1, sizeof(long), true);
+        reallocations += chunked.items != before;
+    }
+    report("Append 10M (16 at a time)", N, start, reallocations);
+    checksum += chunked.items[N-1];
+
+    start = now();
+    array_shrink_to_fit(&arr, sizeof(long), true);
+    report("Shrink 10M to fit", N, start, 1);
+    checksum += arr.items[N-1];
+
+    printf("(checksum: %ld)\n", checksum);
+    return 0;
+}
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -77,11 +77,11 @@ typedef struct {
 b64decode_result_t base64_decode(string_t b64)
 {
     unsigned char* p = (unsigned char*)b64.data;
-    int32_t len = b64.length;
-    int32_t stride = b64.stride;
+    int64_t len = b64.length;
+    int64_t stride = b64.stride;
     int pad = len > 0 && (len % 4 || p[(len - 1)*stride] == '=');
-    int32_t L = ((len + 3) / 4 - pad) * 4;
-    int32_t ret_len = L / 4 * 3 + pad;
+    int64_t L = ((len + 3) / 4 - pad) * 4;
+    int64_t ret_len = L / 4 * 3 + pad;
     string_t ret = {
         .data = GC_MALLOC_ATOMIC(ret_len + 2),
         .length = 0,
@@ -89,7 +89,7 @@ b64decode_result_t base64_decode(string_t b64)
         .free = 0,
     };
     char *str = (char*)ret.data;
-    for (int32_t i = 0; i < L; i += 4) {
+    for (int64_t i = 0; i < L; i += 4) {
         int n = B64index[p[i*stride]] << 18 | B64index[p[(i + 1)*stride]] << 12 | B64index[p[(i + 2)*stride]] << 6 | B64index[p[(i + 3)*stride]];
         if (n < 0) return (b64decode_result_t){.success=false};
         str[ret.length++] = n >> 16;
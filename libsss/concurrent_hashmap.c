@@ -0,0 +1,290 @@
+// concurrent_hashmap.c - Hash tables shared between threads
+// Copyright 2023 Bruce Hill
+// Provided under the MIT license with the Commons Clause
+// See included LICENSE for details.
+
+// Keys are split into shards by the top bits of their hashes. Each shard is an
+// open addressing table of pointers to entries, and entries are immutable
+// once they're in a table: setting a key swaps in a new entry, removing a key
+// swaps in a tombstone, and growing a shard builds a new slot array and swaps
+// that in. So readers never lock anything. They load the shard's current slot
+// array and probe it, and every entry they find is complete, because pointers
+// are only published (with release ordering) after the entry is filled in.
+// Writers lock only the shard that the key belongs to, so writers working on
+// different keys rarely wait on each other. Nothing is ever freed explicitly:
+// old entries and slot arrays are left to the garbage collector, so a reader
+// that's still probing an old slot array never touches freed memory.
+
+#include <err.h>
+#include <gc.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "concurrent_hashmap.h"
+
+#define SHARD_BITS 6
+#define NUM_SHARDS (1u << SHARD_BITS)
+#define MIN_CAPACITY 16u
+#define CACHE_LINE 64
+
+typedef struct {
+    uint64_t hash; // 64 bits, so the data after it is 8-byte aligned
+    char data[];
+} entry_t;
+
+// Marks a slot whose entry was removed, so probes keep going past it
+static entry_t tombstone;
+#define TOMBSTONE (&tombstone)
+
+// Each slot's hash is kept next to the slot array too, so probing past other
+// keys doesn't have to load their entries. A slot's hash is only changed when
+// the slot gets an entry for a different key (after the old key is removed),
+// so a reader that sees a stale hash can only miss a key that was removed.
+typedef struct {
+    uint32_t capacity;
+    _Atomic(uint32_t) *hashes;
+    _Atomic(entry_t*) slots[];
+} slots_t;
+
+// Shards are kept on separate cache lines, so writers locking one shard don't
+// slow down threads using its neighbors
+typedef struct {
+    alignas(CACHE_LINE) pthread_mutex_t lock;
+    _Atomic(slots_t*) slots;
+    _Atomic(uint32_t) count;
+    uint32_t used; // Slots that aren't empty (entries and tombstones), only touched while locked
+} shard_t;
+
+struct sss_concurrent_hashmap_s {
+    shard_t shards[NUM_SHARDS];
+};
+
+static void destroy_locks(void *obj, void *userdata)
+{
+    (void)userdata;
+    sss_concurrent_hashmap_t *h = obj;
+    for (uint32_t i = 0; i < NUM_SHARDS; i++)
+        pthread_mutex_destroy(&h->shards[i].lock);
+}
+
+sss_concurrent_hashmap_t *sss_concurrent_hashmap_new(void)
+{
+    sss_concurrent_hashmap_t *h = GC_memalign(CACHE_LINE, sizeof(sss_concurrent_hashmap_t));
+    memset(h, 0, sizeof(sss_concurrent_hashmap_t));
+    for (uint32_t i = 0; i < NUM_SHARDS; i++) {
+        if (pthread_mutex_init(&h->shards[i].lock, NULL) != 0)
+            errx(1, "Failed to initialize a concurrent table's locks");
+    }
+    GC_register_finalizer(h, destroy_locks, NULL, NULL, NULL);
+    return h;
+}
+
+static inline shard_t *shard_for(sss_concurrent_hashmap_t *h, uint32_t hash)
+{
+    return &h->shards[hash >> (32 - SHARD_BITS)];
+}
+
+// Find the index of the slot holding a key (and the entry in it), or -1
+static int64_t find_index(slots_t *slots, cmp_fn_t key_cmp, const void *key, uint32_t hash, entry_t **found)
+{
+    if (!slots) return -1;
+    uint32_t mask = slots->capacity - 1;
+    // Shards are never more than 3/4 full, so this always reaches an empty slot:
+    for (uint32_t i = hash & mask; ; i = (i + 1) & mask) {
+        entry_t *e = atomic_load_explicit(&slots->slots[i], memory_order_acquire);
+        if (!e) return -1;
+        if (atomic_load_explicit(&slots->hashes[i], memory_order_relaxed) == hash && e != TOMBSTONE
+            && (uint32_t)e->hash == hash && key_cmp(e->data, key) == 0) {
+            if (found) *found = e;
+            return (int64_t)i;
+        }
+    }
+}
+
+// Put an entry in the first free slot for its hash (the key must not already be in the table)
+static void insert_entry(shard_t *shard, slots_t *slots, entry_t *e)
+{
+    uint32_t mask = slots->capacity - 1;
+    for (uint32_t i = (uint32_t)e->hash & mask; ; i = (i + 1) & mask) {
+        entry_t *existing = atomic_load_explicit(&slots->slots[i], memory_order_relaxed);
+        if (!existing || existing == TOMBSTONE) {
+            if (!existing) ++shard->used;
+            atomic_store_explicit(&slots->hashes[i], (uint32_t)e->hash, memory_order_relaxed);
+            atomic_store_explicit(&slots->slots[i], e, memory_order_release);
+            return;
+        }
+    }
+}
+
+// Make sure there's room for another entry in a shard, which must be locked.
+// A shard that fills up gets a new slot array with all of the live entries
+// (and none of the tombstones), which is only published once it's complete.
+static slots_t *make_room(shard_t *shard)
+{
+    slots_t *slots = atomic_load_explicit(&shard->slots, memory_order_relaxed);
+    if (slots && shard->used + 1 <= slots->capacity/4*3)
+        return slots;
+
+    uint32_t count = atomic_load_explicit(&shard->count, memory_order_relaxed);
+    uint32_t capacity = MIN_CAPACITY;
+    while (capacity/2 < count + 1) {
+        if (capacity == 1u << 31)
+            errx(1, "This concurrent table is too big");
+        capacity *= 2;
+    }
+    slots_t *grown = GC_MALLOC(sizeof(slots_t) + capacity*sizeof(entry_t*));
+    grown->capacity = capacity;
+    grown->hashes = GC_MALLOC_ATOMIC(capacity*sizeof(uint32_t));
+    shard->used = 0;
+    for (uint32_t i = 0; slots && i < slots->capacity; i++) {
+        entry_t *e = atomic_load_explicit(&slots->slots[i], memory_order_relaxed);
+        if (e && e != TOMBSTONE)
+            insert_entry(shard, grown, e);
+    }
+    atomic_store_explicit(&shard->slots, grown, memory_order_release);
+    return grown;
+}
+
+static entry_t *new_entry(uint32_t hash, size_t entry_size_padded, const void *key, size_t value_offset, const void *value)
+{
+    entry_t *e = GC_MALLOC(sizeof(entry_t) + entry_size_padded);
+    e->hash = hash;
+    memcpy(e->data, key, value_offset);
+    if (value && entry_size_padded > value_offset)
+        memcpy(e->data + value_offset, value, entry_size_padded - value_offset);
+    return e;
+}
+
+uint32_t sss_concurrent_hashmap_len(sss_concurrent_hashmap_t *h)
+{
+    uint32_t len = 0;
+    for (uint32_t i = 0; i < NUM_SHARDS; i++)
+        len += atomic_load_explicit(&h->shards[i].count, memory_order_relaxed);
+    return len;
+}
+
+static void *get_hashed(sss_concurrent_hashmap_t *h, cmp_fn_t key_cmp, const void *key, uint32_t hash, size_t value_offset)
+{
+    slots_t *slots = atomic_load_explicit(&shard_for(h, hash)->slots, memory_order_acquire);
+    entry_t *e;
+    return find_index(slots, key_cmp, key, hash, &e) >= 0 ? e->data + value_offset : NULL;
+}
+
+// Return address of value or NULL
+void *sss_concurrent_hashmap_get(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, const void *key, size_t value_offset)
+{
+    return get_hashed(h, key_cmp, key, key_hash(key), value_offset);
+}
+
+// Set a key's value and return the address of the new value
+void *sss_concurrent_hashmap_set(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded,
+                                 const void *key, size_t value_offset, const void *value)
+{
+    uint32_t hash = key_hash(key);
+    shard_t *shard = shard_for(h, hash);
+    // Filling in the entry doesn't need the lock:
+    entry_t *e = new_entry(hash, entry_size_padded, key, value_offset, value);
+    pthread_mutex_lock(&shard->lock);
+    slots_t *slots = atomic_load_explicit(&shard->slots, memory_order_relaxed);
+    int64_t i = find_index(slots, key_cmp, key, hash, NULL);
+    if (i >= 0) {
+        atomic_store_explicit(&slots->slots[i], e, memory_order_release);
+    } else {
+        insert_entry(shard, make_room(shard), e);
+        atomic_fetch_add_explicit(&shard->count, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return e->data + value_offset;
+}
+
+// Set a key's value only if the key isn't in the table yet, and return the
+// address of whichever value the table ends up with
+void *sss_concurrent_hashmap_set_default(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded,
+                                         const void *key, size_t value_offset, const void *value)
+{
+    uint32_t hash = key_hash(key);
+    void *existing = get_hashed(h, key_cmp, key, hash, value_offset);
+    if (existing) return existing;
+
+    shard_t *shard = shard_for(h, hash);
+    pthread_mutex_lock(&shard->lock);
+    // Another thread may have added the key since it was looked up:
+    entry_t *e;
+    if (find_index(atomic_load_explicit(&shard->slots, memory_order_relaxed), key_cmp, key, hash, &e) < 0) {
+        e = new_entry(hash, entry_size_padded, key, value_offset, value);
+        insert_entry(shard, make_room(shard), e);
+        atomic_fetch_add_explicit(&shard->count, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return e->data + value_offset;
+}
+
+// Remove a key, returning whether it was in the table
+bool sss_concurrent_hashmap_remove(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, const void *key)
+{
+    uint32_t hash = key_hash(key);
+    shard_t *shard = shard_for(h, hash);
+    pthread_mutex_lock(&shard->lock);
+    slots_t *slots = atomic_load_explicit(&shard->slots, memory_order_relaxed);
+    int64_t i = find_index(slots, key_cmp, key, hash, NULL);
+    if (i >= 0) {
+        atomic_store_explicit(&slots->slots[i], TOMBSTONE, memory_order_release);
+        atomic_fetch_sub_explicit(&shard->count, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return i >= 0;
+}
+
+// Str keys (which may be strided) with pointer values:
+typedef struct {
+    string_t key;
+    void *value;
+} str_entry_t;
+
+static uint32_t hash_str_key(const void *key)
+{
+    const string_t *s = key;
+    return sss_hash_strided(s->data, s->length, s->stride, 1);
+}
+
+static int32_t compare_str_keys(const void *a, const void *b)
+{
+    const string_t *x = a, *y = b;
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    for (int64_t i = 0; i < x->length; i++) {
+        char cx = x->data[i*x->stride], cy = y->data[i*y->stride];
+        if (cx != cy) return (unsigned char)cx < (unsigned char)cy ? -1 : 1;
+    }
+    return 0;
+}
+
+#define STR_ENTRY_ARGS hash_str_key, compare_str_keys, sizeof(str_entry_t)
+
+void **sss_concurrent_table_get(sss_concurrent_hashmap_t *h, string_t key)
+{
+    return sss_concurrent_hashmap_get(h, hash_str_key, compare_str_keys, &key, offsetof(str_entry_t, value));
+}
+
+void sss_concurrent_table_set(sss_concurrent_hashmap_t *h, string_t key, void *value)
+{
+    // Stored keys shouldn't alias a strided view
+    key = flatten(key);
+    sss_concurrent_hashmap_set(h, STR_ENTRY_ARGS, &key, offsetof(str_entry_t, value), &value);
+}
+
+void **sss_concurrent_table_set_default(sss_concurrent_hashmap_t *h, string_t key, void *value)
+{
+    key = flatten(key);
+    return sss_concurrent_hashmap_set_default(h, STR_ENTRY_ARGS, &key, offsetof(str_entry_t, value), &value);
+}
+
+bool sss_concurrent_table_remove(sss_concurrent_hashmap_t *h, string_t key)
+{
+    return sss_concurrent_hashmap_remove(h, hash_str_key, compare_str_keys, &key);
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hashmap.h"
+#include "string.h"
+
+// A hash table that many threads can read and write at the same time (see
+// concurrent_hashmap.c). Keys and values are stored by value, like
+// sss_hashmap_t, but entries are never modified in place, so a pointer to a
+// value is a snapshot that stays valid after the key is set again or removed.
+typedef struct sss_concurrent_hashmap_s sss_concurrent_hashmap_t;
+
+sss_concurrent_hashmap_t *sss_concurrent_hashmap_new(void);
+uint32_t sss_concurrent_hashmap_len(sss_concurrent_hashmap_t *h);
+void *sss_concurrent_hashmap_get(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, const void *key, size_t value_offset);
+void *sss_concurrent_hashmap_set(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded,
+                                 const void *key, size_t value_offset, const void *value);
+void *sss_concurrent_hashmap_set_default(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded,
+                                         const void *key, size_t value_offset, const void *value);
+bool sss_concurrent_hashmap_remove(sss_concurrent_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, const void *key);
+
+// Tables from Str to pointers, for stdlib/concurrent_table.sss
+void **sss_concurrent_table_get(sss_concurrent_hashmap_t *h, string_t key);
+void sss_concurrent_table_set(sss_concurrent_hashmap_t *h, string_t key, void *value);
+void **sss_concurrent_table_set_default(sss_concurrent_hashmap_t *h, string_t key, void *value);
+bool sss_concurrent_table_remove(sss_concurrent_hashmap_t *h, string_t key);
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -0,0 +1,114 @@
+// Benchmark for concurrent hash map throughput as threads are added.
+// `make concurrentbench` builds it. Each workload is run on the concurrent
+// table and on a regular table guarded by a single mutex, for comparison.
+#define GC_THREADS
+#include <gc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "concurrent_hashmap.h"
+#include "hashmap.h"
+
+#define KEYS (1 << 16)
+#define OPS_PER_THREAD 2000000
+#define ARGS hash_64bit_value, (cmp_fn_t*)compare_64bit_value
+
+typedef struct {
+    sss_concurrent_hashmap_t *concurrent;
+    sss_hashmap_t *locked;
+    pthread_mutex_t *lock;
+    unsigned seed;
+    int write_percent;
+    long checksum;
+} worker_t;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+static void *run_concurrent(void *arg)
+{
+    worker_t *w = arg;
+    for (long i = 0; i < OPS_PER_THREAD; i++) {
+        long key = rand_r(&w->seed) % KEYS;
+        if (rand_r(&w->seed) % 100 < w->write_percent) {
+            sss_concurrent_hashmap_set(w->concurrent, ARGS, 2*sizeof(long), &key, sizeof(long), &i);
+        } else {
+            long *value = sss_concurrent_hashmap_get(w->concurrent, ARGS, &key, sizeof(long));
+            if (value) w->checksum += *value;
+        }
+    }
+    return NULL;
+}
+
+static void *run_locked(void *arg)
+{
+    worker_t *w = arg;
+    for (long i = 0; i < OPS_PER_THREAD; i++) {
+        long key = rand_r(&w->seed) % KEYS;
+        bool write = rand_r(&w->seed) % 100 < w->write_percent;
+        pthread_mutex_lock(w->lock);
+        if (write) {
+            hset(w->locked, key, i);
+        } else {
+            long *value = sss_hashmap_get(w->locked, ARGS, 2*sizeof(long), &key, sizeof(long));
+            if (value) w->checksum += *value;
+        }
+        pthread_mutex_unlock(w->lock);
+    }
+    return NULL;
+}
+
+static double run(int num_threads, void *(*fn)(void*), worker_t *proto, long *checksum)
+{
+    pthread_t threads[num_threads];
+    worker_t workers[num_threads];
+    double start = now();
+    for (int t = 0; t < num_threads; t++) {
+        workers[t] = *proto;
+        workers[t].seed = (unsigned)t + 1;
+        pthread_create(&threads[t], NULL, fn, &workers[t]);
+    }
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+        *checksum += workers[t].checksum;
+    }
+    return (double)num_threads*OPS_PER_THREAD/(now() - start)/1e6;
+}
+
+int main(int argc, char *argv[]) {
+    GC_INIT();
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 1) max_threads = 1;
+
+    sss_concurrent_hashmap_t *concurrent = sss_concurrent_hashmap_new();
+    sss_hashmap_t locked = {0};
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    for (long key = 0; key < KEYS; key++) {
+        sss_concurrent_hashmap_set(concurrent, ARGS, 2*sizeof(long), &key, sizeof(long), &key);
+        hset(&locked, key, key);
+    }
+
+    long checksum = 0;
+    int write_percents[] = {1, 10, 50};
+    for (int w = 0; w < (int)(sizeof(write_percents)/sizeof(write_percents[0])); w++) {
+        printf("%d%% writes:\n", write_percents[w]);
+        printf("%8s %16s %16s\n", "threads", "concurrent", "mutex");
+        worker_t proto = {.concurrent=concurrent, .locked=&locked, .lock=&lock, .write_percent=write_percents[w]};
+        for (int n = 1; ; n *= 2) {
+            if (n > max_threads) n = max_threads;
+            double c = run(n, run_concurrent, &proto, &checksum);
+            double m = run(n, run_locked, &proto, &checksum);
+            printf("%8d %9.2f Mops/s %9.2f Mops/s\n", n, c, m);
+            if (n == max_threads) break;
+        }
+    }
+    printf("(checksum: %ld)\n", checksum);
+    return 0;
+}
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -0,0 +1,120 @@
+// deque.c - Double-ended queues
+// Copyright 2023 Bruce Hill
+// Provided under the MIT license with the Commons Clause
+// See included LICENSE for details.
+
+// A deque is a ring buffer: the items live in a buffer whose size is a power
+// of two, starting at `head` and wrapping around past the end of the buffer,
+// so items can be added to or removed from either end in constant time. When
+// the buffer fills up, the items are copied into one twice as big.
+
+#include <gc.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "deque.h"
+
+#define MIN_CAPACITY 8
+
+sss_deque_t *sss_deque_new(size_t item_size, bool atomic)
+{
+    sss_deque_t *d = GC_MALLOC(sizeof(sss_deque_t));
+    d->item_size = item_size;
+    d->atomic = atomic;
+    return d;
+}
+
+int64_t sss_deque_length(sss_deque_t *d)
+{
+    return d->length;
+}
+
+// Address of the i-th item (0-indexed) from the front
+static inline char *item_at(sss_deque_t *d, int64_t i)
+{
+    return d->items + ((d->head + i) & (d->capacity - 1)) * (int64_t)d->item_size;
+}
+
+// Copy the items into a contiguous buffer (in order) with room for `capacity` items
+static char *unwrapped(sss_deque_t *d, int64_t capacity)
+{
+    size_t size = (size_t)capacity * d->item_size;
+    char *items = d->atomic ? GC_MALLOC_ATOMIC(size) : GC_MALLOC(size);
+    int64_t first_part = MIN(d->length, d->capacity - d->head);
+    if (first_part > 0)
+        memcpy(items, d->items + d->head*(int64_t)d->item_size, (size_t)first_part * d->item_size);
+    if (d->length > first_part)
+        memcpy(items + first_part*(int64_t)d->item_size, d->items, (size_t)(d->length - first_part) * d->item_size);
+    return items;
+}
+
+static void make_room(sss_deque_t *d)
+{
+    if (d->length < d->capacity) return;
+    int64_t capacity = d->capacity ? 2*d->capacity : MIN_CAPACITY;
+    d->items = unwrapped(d, capacity);
+    d->capacity = capacity;
+    d->head = 0;
+}
+
+void sss_deque_push_back(sss_deque_t *d, const void *item)
+{
+    make_room(d);
+    memcpy(item_at(d, d->length), item, d->item_size);
+    ++d->length;
+}
+
+void sss_deque_push_front(sss_deque_t *d, const void *item)
+{
+    make_room(d);
+    d->head = (d->head - 1) & (d->capacity - 1);
+    memcpy(item_at(d, 0), item, d->item_size);
+    ++d->length;
+}
+
+// Removed items are zeroed out, so the deque doesn't keep whatever they
+// point to from being garbage collected
+bool sss_deque_pop_back(sss_deque_t *d, void *item_out)
+{
+    if (d->length == 0) return false;
+    char *item = item_at(d, d->length - 1);
+    if (item_out) memcpy(item_out, item, d->item_size);
+    memset(item, 0, d->item_size);
+    --d->length;
+    return true;
+}
+
+bool sss_deque_pop_front(sss_deque_t *d, void *item_out)
+{
+    if (d->length == 0) return false;
+    char *item = item_at(d, 0);
+    if (item_out) memcpy(item_out, item, d->item_size);
+    memset(item, 0, d->item_size);
+    d->head = (d->head + 1) & (d->capacity - 1);
+    --d->length;
+    return true;
+}
+
+// Return the address of the item at a 1-indexed position from the front, or NULL
+void *sss_deque_nth(sss_deque_t *d, int64_t index)
+{
+    if (index < 1 || index > d->length) return NULL;
+    return item_at(d, index - 1);
+}
+
+void sss_deque_clear(sss_deque_t *d)
+{
+    d->items = NULL;
+    d->head = d->length = d->capacity = 0;
+}
+
+// Return an array holding a copy of the items, in order from front to back
+string_t sss_deque_items(sss_deque_t *d)
+{
+    if (d->length == 0)
+        return (string_t){.data=NULL, .length=0, .stride=(int32_t)d->item_size};
+    return (string_t){.data=unwrapped(d, d->length), .length=d->length, .stride=(int32_t)d->item_size};
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "string.h"
+
+// A double-ended queue of fixed-size items (see deque.c)
+typedef struct {
+    char *items;
+    int64_t head, length, capacity;
+    size_t item_size;
+    bool atomic; // Whether the items are free of pointers
+} sss_deque_t;
+
+sss_deque_t *sss_deque_new(size_t item_size, bool atomic);
+int64_t sss_deque_length(sss_deque_t *d);
+void sss_deque_push_back(sss_deque_t *d, const void *item);
+void sss_deque_push_front(sss_deque_t *d, const void *item);
+bool sss_deque_pop_back(sss_deque_t *d, void *item_out);
+bool sss_deque_pop_front(sss_deque_t *d, void *item_out);
+void *sss_deque_nth(sss_deque_t *d, int64_t index);
+void sss_deque_clear(sss_deque_t *d);
+string_t sss_deque_items(sss_deque_t *d);
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
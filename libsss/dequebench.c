@@ -0,0 +1,58 @@
+// Benchmark for using a deque vs. an array as a FIFO queue at different depths.
+// `make dequebench` builds it against the runtime library.
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "deque.h"
+#include "utils.h"
+
+#define OPS 1000000
+
+typedef struct { long *items; int64_t length; int32_t stride, free; } long_array_t;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+int main(void) {
+    GC_INIT();
+    long checksum = 0;
+    long depths[] = {10, 1000, 100000};
+    for (size_t d = 0; d < sizeof(depths)/sizeof(depths[0]); d++) {
+        long depth = depths[d];
+        // Keep `depth` items queued up while adding to the back and removing from the front
+        sss_deque_t *deque = sss_deque_new(sizeof(long), true);
+        for (long i = 0; i < depth; i++)
+            sss_deque_push_back(deque, &i);
+        double start = now();
+        for (long i = 0; i < OPS; i++) {
+            long item;
+            sss_deque_push_back(deque, &i);
+            sss_deque_pop_front(deque, &item);
+            checksum += item;
+        }
+        double deque_rate = (double)OPS/(now() - start)/1e6;
+
+        long_array_t arr = {0};
+        for (long i = 0; i < depth; i++)
+            array_insert(&arr, (char*)&i, arr.length+1, sizeof(long), true);
+        // Removing from the front of an array moves everything after it, so use fewer operations
+        long array_ops = depth > 1000 ? OPS/100 : OPS;
+        start = now();
+        for (long i = 0; i < array_ops; i++) {
+            array_insert(&arr, (char*)&i, arr.length+1, sizeof(long), true);
+            checksum += arr.items[0];
+            array_remove(&arr, 1, 1, sizeof(long), true);
+        }
+        double array_rate = (double)array_ops/(now() - start)/1e6;
+
+        printf("Depth %-8ld deque: %8.2f Mops/s   array: %8.2f Mops/s\n", depth, deque_rate, array_rate);
+    }
+    printf("(checksum: %ld)\n", checksum);
+    return 0;
+}
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -0,0 +1,103 @@
+// Benchmark comparing the hash functions available for table keys.
+// `make hashbench` builds `hashbench`, which measures raw hashing speed and
+// then table insert/lookup throughput with each hash family in turn.
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hashmap.h"
+
+#define N 1000000
+#define LOOKUPS 10000000
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+static void report(const char *family, const char *what, long n, double start)
+{
+    double elapsed = now() - start;
+    printf("%-8s %-24s %8.2f Mops/s\n", family, what, (double)n/elapsed/1e6);
+}
+
+static const struct {
+    const char *name;
+    sss_hash_family_e family;
+    uint32_t (*hash)(const void*, size_t);
+} families[] = {
+    {"wyhash", SSS_HASH_WYHASH, sss_hash_wyhash},
+    {"siphash", SSS_HASH_SIPHASH, sss_hash_siphash},
+};
+
+int main(void) {
+    GC_INIT();
+    uint32_t checksum = 0;
+
+    static char buf[4096];
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (char)(i*131);
+
+    size_t lengths[] = {8, 16, 32, 256, 4096};
+    for (size_t f = 0; f < sizeof(families)/sizeof(families[0]); f++) {
+        for (size_t l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++) {
+            size_t len = lengths[l];
+            long reps = (long)(LOOKUPS*8/len);
+            double start = now();
+            for (long i = 0; i < reps; i++) {
+                buf[0] = (char)i;
+                checksum += families[f].hash(buf, len);
+            }
+            double elapsed = now() - start;
+            printf("%-8s hash %-4ld bytes          %8.2f GB/s\n", families[f].name, len,
+                   (double)(reps*len)/elapsed/1e9);
+        }
+    }
+
+    char **strs = GC_MALLOC(N*sizeof(char*));
+    for (long i = 0; i < N; i++) {
+        strs[i] = GC_MALLOC_ATOMIC(24);
+        snprintf(strs[i], 24, "key_%ld", i);
+    }
+
+    for (size_t f = 0; f < sizeof(families)/sizeof(families[0]); f++) {
+        // Tables are rebuilt from scratch for each family, since a table's
+        // buckets are only valid for the hash function that filled them.
+        // (The bench doesn't use symbols, so they don't need to be rehashed.)
+        sss_hash_family = families[f].family;
+        const char *name = families[f].name;
+
+        sss_hashmap_t ints = {0};
+        double start = now();
+        for (long i = 0; i < N; i++) {
+            long key = i*7919;
+            hset(&ints, key, i);
+        }
+        report(name, "Int insert", N, start);
+
+        start = now();
+        for (long i = 0; i < LOOKUPS; i++) {
+            long key = (i % N)*7919;
+            checksum += (uint32_t)hget(&ints, key, long);
+        }
+        report(name, "Int lookup", LOOKUPS, start);
+
+        sss_hashmap_t strings = {0};
+        start = now();
+        for (long i = 0; i < N; i++)
+            hset(&strings, strs[i], i);
+        report(name, "Str insert", N, start);
+
+        start = now();
+        for (long i = 0; i < LOOKUPS; i++)
+            checksum += (uint32_t)hget(&strings, strs[(i*31) % N], long);
+        report(name, "Str lookup", LOOKUPS, start);
+    }
+
+    printf("(checksum: %u)\n", checksum);
+    return 0;
+}
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
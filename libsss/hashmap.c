@@ -5,14 +5,18 @@
 
 // Hash Map (aka Dictionary) Implementation
 // Hash keys and values are stored *by value*
-// The hash insertion/lookup implementation is based on Lua's tables,
-// which use a chained scatter with Brent's variation.
+// Buckets use Swiss-table style open addressing, with a byte of hash bits per
+// slot that is checked 16 slots at a time. Building with -DSSS_HASHMAP_CHAINED
+// instead uses the older layout based on Lua's tables, which use a chained
+// scatter with Brent's variation.
 
 #include <assert.h>
+#include <err.h>
 #include <stdlib.h>
 #include <string.h>
 #include <gc.h>
 #include <stdio.h>
+#include <sys/mman.h>
 
 #include "hashmap.h"
 
@@ -20,43 +24,233 @@
 #define hdebug(fmt, ...) printf("\x1b[2m" fmt "\x1b[m" __VA_OPT__(,) __VA_ARGS__)
 #else
 #define hdebug(...) (void)0
+// The loop in hshow() isn't always optimized away (e.g. with -Og), so skip it entirely:
+#define hshow(h) (void)(h)
 #endif
 
 #include "../SipHash/halfsiphash.h"
-static uint8_t hash_random_vector[16] = {42,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15};
-uint32_t hash_64bits(const void *x) {
+
+// Hashing: the default is a wyhash-style hash, which is fast for both short
+// fixed-size keys and long strings. SSS_HASH=siphash selects a keyed hash
+// (halfsiphash) for programs that hash untrusted input. Either way, the seed
+// is chosen randomly when the process starts, unless SSS_HASH_SEED is set.
+sss_hash_family_e sss_hash_family = SSS_HASH_WYHASH;
+static uint64_t hash_seed = 0x243f6a8885a308d3ull;
+static uint8_t siphash_key[16] = {42,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15};
+
+__attribute__((constructor))
+static void init_hash_seed(void)
+{
+    const char *family = getenv("SSS_HASH");
+    if (family && strcmp(family, "siphash") == 0)
+        sss_hash_family = SSS_HASH_SIPHASH;
+
+    const char *seed = getenv("SSS_HASH_SEED");
+    if (seed && *seed) {
+        hash_seed = strtoull(seed, NULL, 0);
+        for (int i = 0; i < 16; i++)
+            siphash_key[i] = (uint8_t)(hash_seed >> (8*(i % 8))) ^ (uint8_t)i;
+    } else {
+        arc4random_buf(&hash_seed, sizeof(hash_seed));
+        arc4random_buf(siphash_key, sizeof(siphash_key));
+    }
+}
+
+static const uint64_t wyp[4] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull};
+
+static inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wyr8(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint64_t wyr4(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static inline uint64_t wyr3(const uint8_t *p, size_t k) { return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1]; }
+
+uint32_t sss_hash_wyhash(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t seed = hash_seed ^ wymix(hash_seed ^ wyp[0], wyp[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t seed1 = seed, seed2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+                seed1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ seed1);
+                seed2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+    __uint128_t r = (__uint128_t)(a ^ wyp[1]) * (b ^ seed);
+    return (uint32_t)wymix((uint64_t)r ^ wyp[0] ^ len, (uint64_t)(r >> 64) ^ wyp[1]);
+}
+
+uint32_t sss_hash_siphash(const void *data, size_t len)
+{
     uint32_t hash;
-    halfsiphash(*(char**)x, 8, hash_random_vector, (uint8_t*)&hash, sizeof(hash));
+    halfsiphash(data, len, siphash_key, (uint8_t*)&hash, sizeof(hash));
     return hash;
 }
+
+uint32_t sss_hash(const void *data, size_t len)
+{
+    if (__builtin_expect(sss_hash_family == SSS_HASH_SIPHASH, 0))
+        return sss_hash_siphash(data, len);
+    return sss_hash_wyhash(data, len);
+}
+
+// Hash `len` items of `item_size` bytes, which are `stride` bytes apart, as
+// if they were laid out contiguously. Strided data is gathered into a small
+// buffer on the stack a chunk at a time, so this never allocates. Short data
+// is hashed in one go; longer data is hashed in fixed-size chunks whose hashes
+// are chained together, so the result doesn't depend on the stride.
+#define HASH_CHUNK_SIZE 1024
+uint32_t sss_hash_strided(const void *data, int64_t len, int64_t stride, size_t item_size)
+{
+    const char *items = data;
+    size_t total = (size_t)len * item_size;
+    if (total == 0 || ((size_t)stride == item_size && total <= HASH_CHUNK_SIZE))
+        return sss_hash(items, total);
+
+    char buf[HASH_CHUNK_SIZE];
+    uint32_t chained[2] = {0, 0};
+    int64_t i = 0;
+    size_t item_offset = 0;
+    for (size_t pos = 0; pos < total; ) {
+        size_t chunk_len = total - pos < HASH_CHUNK_SIZE ? total - pos : HASH_CHUNK_SIZE;
+        const char *chunk;
+        if ((size_t)stride == item_size) {
+            chunk = items + pos;
+        } else {
+            for (size_t filled = 0; filled < chunk_len; ) {
+                size_t n = item_size - item_offset;
+                if (n > chunk_len - filled) n = chunk_len - filled;
+                memcpy(buf + filled, items + i*stride + item_offset, n);
+                filled += n;
+                item_offset += n;
+                if (item_offset == item_size) {
+                    ++i;
+                    item_offset = 0;
+                }
+            }
+            chunk = buf;
+        }
+        if (total <= HASH_CHUNK_SIZE)
+            return sss_hash(chunk, chunk_len);
+        chained[1] = sss_hash(chunk, chunk_len);
+        chained[0] = sss_hash(chained, sizeof(chained));
+        pos += chunk_len;
+    }
+    return chained[0];
+}
+
+uint32_t hash_64bits(const void *x) {
+    return sss_hash(*(char**)x, 8);
+}
 int compare_64bits(const void *x, const void *y) {
     return memcmp(*(void**)x, *(void**)y, 8);
 }
 uint32_t hash_64bit_value(const void *x) {
-    uint32_t hash;
-    halfsiphash((char*)x, 8, hash_random_vector, (uint8_t*)&hash, sizeof(hash));
-    return hash;
+    return sss_hash(x, 8);
 }
 int compare_64bit_value(const void *x, const void *y) {
     return memcmp((void*)x, (void*)y, 8);
 }
+
+// Symbols (interned strings) live in a single reserved region, each one
+// preceded by its hash, so it's cheap to tell whether a string is a symbol.
+#define SYMBOL_REGION_SIZE (64ul*1024*1024)
+const char *sss_symbols_start = NULL, *sss_symbols_end = NULL;
+const uint8_t *sss_symbol_starts = NULL;
+static sss_hashmap_t symbols = {0}; // const char* -> symbol
+
 uint32_t hash_str(const void *x) {
-    uint32_t hash;
-    halfsiphash(*(void**)x, strlen(*(char**)x), hash_random_vector, (uint8_t*)&hash, sizeof(hash));
-    return hash;
+    const char *str = *(char**)x;
+    if (is_symbol(str)) return symbol_hash(str);
+    return sss_hash(str, strlen(str));
 }
 int32_t compare_str(const void *x, const void *y) {
-    return (int32_t)strcmp(*(char**)x, *(char**)y);
+    const char *a = *(char**)x, *b = *(char**)y;
+    // Symbols are unique, so equal symbols are always the same pointer, and
+    // two different symbols can be told apart without reading them. (Tables
+    // only need to know whether keys are equal, not how they're ordered.)
+    if (a == b) return 0;
+    if (is_symbol(a) && is_symbol(b)) return a < b ? -1 : 1;
+    return (int32_t)strcmp(a, b);
 }
 
-static inline void hshow(sss_hashmap_t *h)
+const char *intern_str(const char *str)
 {
-    hdebug("{");
-    for (uint32_t i = 0; i < h->capacity; i++) {
-        if (i > 0) hdebug(" ");
-        hdebug("[%d]=%d(%d)", i, h->buckets[i].index1, h->buckets[i].next1);
+    const char *sym = hget(&symbols, str, const char*);
+    if (sym) return sym;
+
+    static char *region = NULL, *region_end = NULL;
+    static uint8_t *starts = NULL;
+    if (!region) {
+        region = mmap(NULL, SYMBOL_REGION_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        starts = mmap(NULL, SYMBOL_REGION_SIZE/32, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED || starts == MAP_FAILED) {
+            if (region != MAP_FAILED) munmap(region, SYMBOL_REGION_SIZE);
+            if (starts != MAP_FAILED) munmap(starts, SYMBOL_REGION_SIZE/32);
+            region = NULL;
+            starts = NULL;
+        }
+        region_end = region ? region + SYMBOL_REGION_SIZE : NULL;
+        sss_symbols_start = sss_symbols_end = region;
+        sss_symbol_starts = starts;
     }
-    hdebug("}\n");
+
+    size_t len = strlen(str);
+    char *pos = (char*)sss_symbols_end;
+    pos += (alignof(uint32_t) - ((uintptr_t)pos % alignof(uint32_t))) % alignof(uint32_t);
+    if (!region || pos + sizeof(uint32_t) + len + 1 > region_end) {
+        // Out of space, so just use an ordinary (uninterned) copy:
+        char *copy = GC_MALLOC_ATOMIC(len + 1);
+        memcpy(copy, str, len + 1);
+        sym = copy;
+    } else {
+        *(uint32_t*)pos = sss_hash(str, len);
+        char *copy = pos + sizeof(uint32_t);
+        memcpy(copy, str, len + 1);
+        size_t i = (size_t)(copy - region) / 4;
+        starts[i/8] |= (uint8_t)(1 << (i%8));
+        sss_symbols_end = copy + len + 1;
+        sym = copy;
+    }
+    hset(&symbols, sym, sym);
+    return sym;
+}
+
+const char *intern_strn(const char *str, size_t len)
+{
+    char buf[len < 256 ? len + 1 : 1];
+    char *copy = len < 256 ? buf : GC_MALLOC_ATOMIC(len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return intern_str(copy);
 }
 
 uint32_t sss_hashmap_len(sss_hashmap_t *h)
@@ -64,56 +258,157 @@ uint32_t sss_hashmap_len(sss_hashmap_t *h)
     return h->count;
 }
 
-static void copy_on_write(sss_hashmap_t *h, size_t entry_size_padded, sss_hash_bucket_t *original_buckets, char *original_entries)
+#ifdef SSS_HASHMAP_CHAINED
+// Chained scatter: `buckets` is an array of `capacity` buckets, each holding a
+// 1-indexed entry index and a 1-indexed link to the next bucket in its chain.
+typedef struct {
+    uint32_t index1, next1;
+} sss_hash_bucket_t;
+
+#define BUCKETS(h) ((sss_hash_bucket_t*)(h)->buckets)
+#define BUCKETS_SIZE(capacity) ((size_t)(capacity)*sizeof(sss_hash_bucket_t))
+#define ENTRIES_CAPACITY(capacity) (capacity)
+#define MIN_CAPACITY 4
+#else
+// Open addressing (Swiss table): `buckets` holds `capacity` control bytes,
+// followed by `capacity` 1-indexed entry indices. Each control byte is EMPTY,
+// DELETED, or the top 7 bits of the hash of the entry in that slot, so a group
+// of 16 slots can be checked against a hash all at once, and keys are only
+// compared when the hash bits match.
+#define GROUP_WIDTH SSS_HASHMAP_GROUP_WIDTH
+#define CTRL_EMPTY ((uint8_t)SSS_HASHMAP_CTRL_EMPTY)
+#define CTRL_DELETED ((uint8_t)SSS_HASHMAP_CTRL_DELETED)
+#define H2(hash) ((uint8_t)((hash) >> SSS_HASHMAP_H2_SHIFT))
+
+#define CTRL(h) ((uint8_t*)(h)->buckets)
+#define SLOTS(h) ((uint32_t*)(CTRL(h) + (h)->capacity))
+#define BUCKETS_SIZE(capacity) ((size_t)(capacity)*(1 + sizeof(uint32_t)))
+// Tables are kept at most 7/8ths full, so every probe sequence reaches an empty slot
+#define ENTRIES_CAPACITY(capacity) ((capacity) - (capacity)/8)
+#define MIN_CAPACITY GROUP_WIDTH
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+// Bitmask of the slots in a group whose control byte is `c`
+static inline uint32_t group_match(const uint8_t *group, uint8_t c)
+{
+    __m128i ctrl = _mm_load_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+}
+
+// Bitmask of the slots in a group that are EMPTY or DELETED (high bit set)
+static inline uint32_t group_match_free(const uint8_t *group)
+{
+    return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i*)group));
+}
+#else
+static inline uint32_t group_match(const uint8_t *group, uint8_t c)
 {
-    if (h->entries && h->entries == original_entries)
-        h->entries = memcpy(GC_MALLOC((h->count+1)*entry_size_padded), h->entries, (h->count+1)*entry_size_padded);
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < GROUP_WIDTH; i++)
+        mask |= (uint32_t)(group[i] == c) << i;
+    return mask;
+}
+
+static inline uint32_t group_match_free(const uint8_t *group)
+{
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < GROUP_WIDTH; i++)
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    return mask;
+}
+#endif
+#endif
+
+// Tables with `stores_hashes` set keep the hash of each entry's key in an
+// array after the entries (in the same allocation), so growing the table or
+// moving entries around doesn't need to hash any keys again, and lookups only
+// compare keys whose full hashes match. The flag can only change while the
+// table has no entries allocated.
+#define HASHES_OFFSET(capacity, entry_size_padded) (((size_t)ENTRIES_CAPACITY(capacity)*(entry_size_padded) + 3) & ~(size_t)3)
+#define ENTRIES_SIZE(h, capacity, entry_size_padded) ((h)->stores_hashes ? \
+    HASHES_OFFSET(capacity, entry_size_padded) + (size_t)ENTRIES_CAPACITY(capacity)*sizeof(uint32_t) \
+    : (size_t)ENTRIES_CAPACITY(capacity)*(entry_size_padded))
+#define HASHES(h, entry_size_padded) ((uint32_t*)((h)->entries + HASHES_OFFSET((h)->capacity, entry_size_padded)))
+
+// The hash of the key of the entry at `index1`
+static inline uint32_t entry_hash(sss_hashmap_t *h, hash_fn_t key_hash, size_t entry_size_padded, uint32_t index1)
+{
+    if (h->stores_hashes && h->capacity > 0)
+        return HASHES(h, entry_size_padded)[index1-1];
+    return key_hash(sss_hashmap_entries(h, entry_size_padded) + (index1-1)*entry_size_padded);
+}
+
+// Each table also keeps a 64-bit Bloom filter with two bits set for the hash
+// of every key that has been added to it (removing keys doesn't clear them).
+// Lookups that walk a chain of fallback tables check the filter first, so
+// they can skip the tables that definitely don't have the key without probing
+// them.
+#define KEY_FILTER_BITS(hash) ((UINT64_C(1) << ((hash) >> 14 & 63)) | (UINT64_C(1) << ((hash) >> 20 & 63)))
+#define may_have_key(h, hash) (((h)->key_filter & KEY_FILTER_BITS(hash)) == KEY_FILTER_BITS(hash))
+
+static void copy_on_write(sss_hashmap_t *h, size_t entry_size_padded, void *original_buckets, char *original_entries)
+{
+    if (h->entries && h->entries == original_entries) {
+        char *copy = memcpy(GC_MALLOC(ENTRIES_SIZE(h, h->capacity, entry_size_padded)), h->entries, h->count*entry_size_padded);
+        if (h->stores_hashes)
+            memcpy(copy + HASHES_OFFSET(h->capacity, entry_size_padded), HASHES(h, entry_size_padded), h->count*sizeof(uint32_t));
+        h->entries = copy;
+    }
     if (h->buckets && h->buckets == original_buckets)
-        h->buckets = memcpy(GC_MALLOC(sizeof(sss_hash_bucket_t)*h->capacity), h->buckets, sizeof(sss_hash_bucket_t)*h->capacity);
+        h->buckets = memcpy(GC_MALLOC_ATOMIC(BUCKETS_SIZE(h->capacity)), h->buckets, BUCKETS_SIZE(h->capacity));
     h->copy_on_write = false;
+    if (h->cow_copies < UINT8_MAX) ++h->cow_copies;
 }
 
+// A big table that gets copied on write again is likely to keep getting
+// copied, so it's cheaper to switch it to the persistent layout, which can
+// be modified without copying everything.
+#define should_become_persistent(h) ((h)->copy_on_write && (h)->capacity > 0 && (h)->cow_copies > 0 \
+                                     && sss_hashmap_persistent_min > 0 && (h)->count >= sss_hashmap_persistent_min)
+
 void sss_hashmap_mark_cow(sss_hashmap_t *h)
 {
     h->copy_on_write = true;
 }
 
-// Return address of value or NULL
-void *sss_hashmap_get_raw(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset)
+#ifdef SSS_HASHMAP_CHAINED
+#ifdef DEBUG_HASHTABLE
+static inline void hshow(sss_hashmap_t *h)
 {
-    if (!h || !key || h->capacity == 0) return NULL;
-
-    uint32_t hash = key_hash(key) % (uint32_t)h->capacity;
-    hshow(h);
-    hdebug("Getting with initial probe at %u\n", hash);
-    for (uint32_t i = hash; h->buckets[i].index1; i = h->buckets[i].next1 - 1) {
-        char *entry = h->entries + entry_size_padded*(h->buckets[i].index1-1);
-        if (key_cmp(entry, key) == 0)
-            return entry + value_offset;
-        if (h->buckets[i].next1 == 0)
-            break;
+    hdebug("{");
+    for (uint32_t i = 0; i < h->capacity; i++) {
+        if (i > 0) hdebug(" ");
+        hdebug("[%d]=%d(%d)", i, BUCKETS(h)[i].index1, BUCKETS(h)[i].next1);
     }
-    return NULL;
+    hdebug("}\n");
 }
+#endif
 
-void *sss_hashmap_get(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset)
+// Return the entry with the given key (whose hash is `hash`) or NULL
+static char *find_entry(sss_hashmap_t *h, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, uint32_t hash)
 {
-    for (sss_hashmap_t *iter = h; iter; iter = iter->fallback) {
-        void *ret = sss_hashmap_get_raw(iter, key_hash, key_cmp, entry_size_padded, key, value_offset);
-        if (ret) return ret;
-    }
-    for (sss_hashmap_t *iter = h; iter; iter = iter->fallback) {
-        if (iter->default_value) return iter->default_value;
+    const uint32_t *hashes = h->stores_hashes ? HASHES(h, entry_size_padded) : NULL;
+    uint32_t home = hash % (uint32_t)h->capacity;
+    hshow(h);
+    hdebug("Getting with initial probe at %u\n", home);
+    for (uint32_t i = home; BUCKETS(h)[i].index1; i = BUCKETS(h)[i].next1 - 1) {
+        uint32_t index1 = BUCKETS(h)[i].index1;
+        char *entry = h->entries + entry_size_padded*(index1-1);
+        if ((!hashes || hashes[index1-1] == hash) && key_cmp(entry, key) == 0)
+            return entry;
+        if (BUCKETS(h)[i].next1 == 0)
+            break;
     }
     return NULL;
 }
 
-static void sss_hashmap_set_bucket(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, const void *entry, size_t entry_size_padded, int32_t index1)
+static void sss_hashmap_set_bucket(sss_hashmap_t *h, hash_fn_t key_hash, size_t entry_size_padded, uint32_t full_hash, uint32_t index1)
 {
     hshow(h);
-    uint32_t hash = key_hash(entry) % (uint32_t)h->capacity;
+    uint32_t hash = full_hash % (uint32_t)h->capacity;
     hdebug("Hash value = %u\n", hash);
-    sss_hash_bucket_t *bucket = &h->buckets[hash];
+    sss_hash_bucket_t *bucket = &BUCKETS(h)[hash];
     if (bucket->index1 == 0) {
         hdebug("Got an empty space\n");
         // Empty space:
@@ -122,38 +417,29 @@ static void sss_hashmap_set_bucket(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_
         return;
     }
 
-    while (h->buckets[h->lastfree_index1-1].index1)
+    while (BUCKETS(h)[h->lastfree_index1-1].index1)
         --h->lastfree_index1;
     assert(h->lastfree_index1);
 
-    uint32_t collided_hash = key_hash(h->entries + entry_size_padded*(bucket->index1-1)) % (uint32_t)h->capacity;
+    uint32_t collided_hash = entry_hash(h, key_hash, entry_size_padded, bucket->index1) % (uint32_t)h->capacity;
     if (collided_hash != hash) { // Collided with a mid-chain entry
         hdebug("Hit a mid-chain entry\n");
         // Find chain predecessor
-        sss_hash_bucket_t *prev = &h->buckets[collided_hash];
-        while (prev->next1 != hash+1) {
-            assert(key_hash(h->entries + entry_size_padded*(bucket->index1-1)) % (uint32_t)h->capacity == collided_hash);
-            prev = &h->buckets[prev->next1-1];
-        }
+        sss_hash_bucket_t *prev = &BUCKETS(h)[collided_hash];
+        while (prev->next1 != hash+1)
+            prev = &BUCKETS(h)[prev->next1-1];
 
         // Move mid-chain entry to free space and update predecessor
         prev->next1 = h->lastfree_index1--;
-        h->buckets[prev->next1-1] = *bucket;
+        BUCKETS(h)[prev->next1-1] = *bucket;
     } else { // Collided with the start of a chain
         hdebug("Hit start of a chain\n");
-        for (;;) {
-            assert(key_cmp(h->entries + (bucket->index1-1)*entry_size_padded, entry) != 0);
-            if (bucket->next1 == 0) {
-                // End of chain
-                break;
-            } else {
-                bucket = &h->buckets[bucket->next1-1];
-            }
-        }
+        while (bucket->next1 != 0)
+            bucket = &BUCKETS(h)[bucket->next1-1];
         hdebug("Appending to chain\n");
         // Chain now ends on the free space:
         bucket->next1 = h->lastfree_index1--;
-        bucket = &h->buckets[bucket->next1-1];
+        bucket = &BUCKETS(h)[bucket->next1-1];
     }
 
     bucket->next1 = 0;
@@ -161,96 +447,29 @@ static void sss_hashmap_set_bucket(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_
     hshow(h);
 }
 
-static void hashmap_resize(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, uint32_t new_capacity, size_t entry_size_padded)
+static void reset_buckets(sss_hashmap_t *h, uint32_t new_capacity)
 {
-    hdebug("About to resize from %u to %u\n", h->capacity, new_capacity);
-    hshow(h);
-    h->buckets = GC_MALLOC_ATOMIC((size_t)new_capacity*sizeof(sss_hash_bucket_t));
-    memset(h->buckets, 0, (size_t)new_capacity*sizeof(sss_hash_bucket_t));
+    h->buckets = GC_MALLOC_ATOMIC(BUCKETS_SIZE(new_capacity));
+    memset(h->buckets, 0, BUCKETS_SIZE(new_capacity));
     h->capacity = new_capacity;
     h->lastfree_index1 = new_capacity;
-    // Rehash:
-    for (uint32_t i = 1; i <= h->count; i++) {
-        hdebug("Rehashing %u\n", i);
-        sss_hashmap_set_bucket(h, key_hash, key_cmp, h->entries + entry_size_padded*(i-1), entry_size_padded, i);
-    }
-
-    char *new_entries = GC_MALLOC(new_capacity*entry_size_padded);
-    if (h->entries) memcpy(new_entries, h->entries, h->count*entry_size_padded);
-    h->entries = new_entries;
-
-    hshow(h);
-    hdebug("Finished resizing\n");
 }
 
-// Return address of value
-void *sss_hashmap_set(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset, const void *value)
-{
-    hdebug("Raw hash of key being set: %u\n", key_hash(key));
-    if (!h || !key) return NULL;
-    hshow(h);
-
-    sss_hash_bucket_t *original_buckets = h->buckets;
-    char *original_entries = h->entries;
-
-    if (h->capacity == 0)
-        hashmap_resize(h, key_hash, key_cmp, 4, entry_size_padded);
-
-    size_t value_size = entry_size_padded - value_offset;
-    void *value_home = sss_hashmap_get_raw(h, key_hash, key_cmp, entry_size_padded, key, value_offset);
-    if (value_home) { // Update existing slot
-        if (h->copy_on_write) {
-            // Ensure that `value_home` is still inside h->entries, even if COW occurs
-            ptrdiff_t offset = value_home - (void*)h->entries;
-            copy_on_write(h, entry_size_padded, original_buckets, original_entries);
-            value_home = h->entries + offset;
-        }
-
-        if (value && value_size > 0)
-            memcpy(value_home, value, value_size);
-
-        return value_home;
-    }
-    // Otherwise add a new entry:
-
-    // Resize buckets if necessary
-    if (h->count >= h->capacity) {
-        uint32_t newsize = h->capacity;
-        if (h->count + 1 > newsize) newsize *= 2;
-        else if (h->count + 1 <= newsize/2) newsize /= 2;
-        hashmap_resize(h, key_hash, key_cmp, newsize, entry_size_padded);
-    }
-
-    if (!value && value_size > 0) {
-        for (sss_hashmap_t *iter = h->fallback; iter; iter = iter->fallback) {
-            value = sss_hashmap_get_raw(iter, key_hash, key_cmp, entry_size_padded, key, value_offset);
-            if (value) break;
-        }
-        for (sss_hashmap_t *iter = h; !value && iter; iter = iter->fallback) {
-            if (iter->default_value) value = iter->default_value;
-        }
-    }
-
-    if (h->copy_on_write)
-        copy_on_write(h, entry_size_padded, original_buckets, original_entries);
-
-    int32_t index1 = ++h->count;
-    void *entry = h->entries + (index1-1)*entry_size_padded;
-    memcpy(entry, key, value_offset);
-    if (value && value_size > 0)
-        memcpy(entry + value_offset, value, entry_size_padded - value_offset);
-
-    sss_hashmap_set_bucket(h, key_hash, key_cmp, entry, entry_size_padded, index1);
-
-    return entry + value_offset;
-}
+#define hashmap_is_full(h) ((h)->count >= (h)->capacity)
+#define grown_capacity(h) ((h)->capacity*2)
+#define room_left(h) ((h)->capacity - (h)->count)
 
 void sss_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key)
 {
-    if (!h || h->capacity == 0) return;
+    if (!h || h->count == 0) return;
+
+    if (should_become_persistent(h))
+        sss_hashmap_make_persistent(h, key_hash, entry_size_padded);
+    if (sss_hashmap_is_persistent(h))
+        return sss_persistent_hashmap_remove(h, key_hash, key_cmp, entry_size_padded, key);
 
     if (h->copy_on_write)
-        copy_on_write(h, entry_size_padded, NULL, NULL);
+        copy_on_write(h, entry_size_padded, h->buckets, h->entries);
 
     // If unspecified, pop a random key:
     if (!key)
@@ -273,15 +492,15 @@ void sss_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp,
 
     uint32_t hash = key_hash(key) % (uint32_t)h->capacity;
     sss_hash_bucket_t *bucket, *prev = NULL;
-    for (uint32_t i = hash; h->buckets[i].index1; i = h->buckets[i].next1 - 1) {
-        if (key_cmp(h->entries + entry_size_padded*(h->buckets[i].index1-1), key) == 0) {
-            bucket = &h->buckets[i];
+    for (uint32_t i = hash; BUCKETS(h)[i].index1; i = BUCKETS(h)[i].next1 - 1) {
+        if (key_cmp(h->entries + entry_size_padded*(BUCKETS(h)[i].index1-1), key) == 0) {
+            bucket = &BUCKETS(h)[i];
             hdebug("Found key to delete\n");
             goto found_it;
         }
-        if (h->buckets[i].next1 == 0)
+        if (BUCKETS(h)[i].next1 == 0)
             return;
-        prev = &h->buckets[i];
+        prev = &BUCKETS(h)[i];
     }
     return;
 
@@ -294,13 +513,15 @@ void sss_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp,
     } else {
         hdebug("Removing key/value from middle\n");
         uint32_t last_index1 = h->count;
-        uint32_t last_hash = key_hash(h->entries + (last_index1-1)*entry_size_padded) % (uint32_t)h->capacity;
+        uint32_t last_hash = entry_hash(h, key_hash, entry_size_padded, last_index1) % (uint32_t)h->capacity;
 
         uint32_t i = last_hash;
-        while (h->buckets[i].index1 != last_index1) i = h->buckets[i].next1 - 1;
-        h->buckets[i].index1 = bucket->index1;
+        while (BUCKETS(h)[i].index1 != last_index1) i = BUCKETS(h)[i].next1 - 1;
+        BUCKETS(h)[i].index1 = bucket->index1;
 
         memcpy(h->entries + (bucket->index1-1)*entry_size_padded, h->entries + (last_index1-1)*entry_size_padded, entry_size_padded);
+        if (h->stores_hashes)
+            HASHES(h, entry_size_padded)[bucket->index1-1] = HASHES(h, entry_size_padded)[last_index1-1];
         memset(h->entries + (last_index1-1)*entry_size_padded, 0, entry_size_padded);
     }
 
@@ -309,30 +530,329 @@ void sss_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp,
     uint32_t to_clear_index1;
     if (prev) { // Middle (or end) of a chain
         hdebug("Removing from middle of a chain\n");
-        to_clear_index1 = 1 + (bucket - h->buckets);
+        to_clear_index1 = 1 + (bucket - BUCKETS(h));
         prev->next1 = bucket->next1;
     } else if (bucket->next1) { // Start of a chain
         hdebug("Removing from start of a chain\n");
         to_clear_index1 = bucket->next1;
-        *bucket = h->buckets[bucket->next1-1];
+        *bucket = BUCKETS(h)[bucket->next1-1];
     } else { // Empty chain
         hdebug("Removing from empty chain\n");
-        to_clear_index1 = 1 + (bucket - h->buckets);
+        to_clear_index1 = 1 + (bucket - BUCKETS(h));
     }
 
-    h->buckets[to_clear_index1-1].next1 = 0;
-    h->buckets[to_clear_index1-1].index1 = 0;
+    BUCKETS(h)[to_clear_index1-1].next1 = 0;
+    BUCKETS(h)[to_clear_index1-1].index1 = 0;
     if (to_clear_index1 > h->lastfree_index1)
         h->lastfree_index1 = to_clear_index1;
 
     hshow(h);
 }
+#else
+#ifdef DEBUG_HASHTABLE
+static inline void hshow(sss_hashmap_t *h)
+{
+    hdebug("{");
+    for (uint32_t i = 0; i < h->capacity; i++) {
+        if (i > 0) hdebug(" ");
+        if (CTRL(h)[i] == CTRL_EMPTY) hdebug("[%d]=_", i);
+        else if (CTRL(h)[i] == CTRL_DELETED) hdebug("[%d]=X", i);
+        else hdebug("[%d]=%d(%02x)", i, SLOTS(h)[i], CTRL(h)[i]);
+    }
+    hdebug("}\n");
+}
+#endif
+
+// Groups are probed in triangular order (g, g+1, g+3, g+6, ...), which
+// visits every group when the number of groups is a power of two.
+
+// Return the entry with the given key (whose hash is `hash`) or NULL
+static char *find_entry(sss_hashmap_t *h, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, uint32_t hash)
+{
+    uint32_t mask = h->capacity/GROUP_WIDTH - 1;
+    hshow(h);
+    hdebug("Getting with initial probe at group %u\n", hash & mask);
+    const uint8_t *ctrl = CTRL(h);
+    const uint32_t *slots = SLOTS(h);
+    const uint32_t *hashes = h->stores_hashes ? HASHES(h, entry_size_padded) : NULL;
+    for (uint32_t g = hash & mask, step = 1; ; g = (g + step++) & mask) {
+        const uint8_t *group = &ctrl[g*GROUP_WIDTH];
+        for (uint32_t matches = group_match(group, H2(hash)); matches; matches &= matches - 1) {
+            uint32_t i = g*GROUP_WIDTH + (uint32_t)__builtin_ctz(matches);
+            if (hashes && hashes[slots[i]-1] != hash) continue;
+            char *entry = h->entries + entry_size_padded*(slots[i]-1);
+            if (key_cmp(entry, key) == 0)
+                return entry;
+        }
+        if (group_match(group, CTRL_EMPTY))
+            return NULL;
+    }
+}
+
+// Find the slot holding the given entry index, which must be in the table
+static uint32_t slot_for_index(sss_hashmap_t *h, uint32_t hash, uint32_t index1)
+{
+    uint32_t mask = h->capacity/GROUP_WIDTH - 1;
+    for (uint32_t g = hash & mask, step = 1; ; g = (g + step++) & mask) {
+        for (uint32_t matches = group_match(&CTRL(h)[g*GROUP_WIDTH], H2(hash)); matches; matches &= matches - 1) {
+            uint32_t i = g*GROUP_WIDTH + (uint32_t)__builtin_ctz(matches);
+            if (SLOTS(h)[i] == index1)
+                return i;
+        }
+    }
+}
+
+static void sss_hashmap_set_bucket(sss_hashmap_t *h, hash_fn_t key_hash, size_t entry_size_padded, uint32_t hash, uint32_t index1)
+{
+    (void)key_hash, (void)entry_size_padded;
+    uint32_t mask = h->capacity/GROUP_WIDTH - 1;
+    hdebug("Hash value = %u\n", hash);
+    for (uint32_t g = hash & mask, step = 1; ; g = (g + step++) & mask) {
+        uint32_t free_slots = group_match_free(&CTRL(h)[g*GROUP_WIDTH]);
+        if (free_slots) {
+            uint32_t i = g*GROUP_WIDTH + (uint32_t)__builtin_ctz(free_slots);
+            if (CTRL(h)[i] == CTRL_EMPTY)
+                --h->growth_left;
+            CTRL(h)[i] = H2(hash);
+            SLOTS(h)[i] = index1;
+            hshow(h);
+            return;
+        }
+    }
+}
+
+static void reset_buckets(sss_hashmap_t *h, uint32_t new_capacity)
+{
+    h->buckets = GC_MALLOC_ATOMIC(BUCKETS_SIZE(new_capacity));
+    memset(h->buckets, CTRL_EMPTY, new_capacity);
+    h->capacity = new_capacity;
+    h->growth_left = ENTRIES_CAPACITY(new_capacity);
+}
+
+#define hashmap_is_full(h) ((h)->growth_left == 0)
+// Deleted slots use up space too, so if most of the used space is deleted
+// slots, rehashing at the same capacity is enough to free it up.
+#define grown_capacity(h) ((h)->count + 1 > ENTRIES_CAPACITY((h)->capacity)/2 ? (h)->capacity*2 : (h)->capacity)
+#define room_left(h) ((h)->growth_left)
+
+void sss_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key)
+{
+    if (!h || h->count == 0) return;
+
+    if (should_become_persistent(h))
+        sss_hashmap_make_persistent(h, key_hash, entry_size_padded);
+    if (sss_hashmap_is_persistent(h))
+        return sss_persistent_hashmap_remove(h, key_hash, key_cmp, entry_size_padded, key);
+
+    if (h->copy_on_write)
+        copy_on_write(h, entry_size_padded, h->buckets, h->entries);
+
+    // If unspecified, pop a random key:
+    if (!key)
+        key = h->entries + entry_size_padded*arc4random_uniform(h->count);
+
+    char *entry = sss_hashmap_get_raw(h, key_hash, key_cmp, entry_size_padded, key, 0);
+    if (!entry) return;
+
+    uint32_t index1 = (uint32_t)((entry - h->entries)/entry_size_padded) + 1;
+    uint32_t i = slot_for_index(h, entry_hash(h, key_hash, entry_size_padded, index1), index1);
+    // A slot can only go back to EMPTY if no probe sequence has ever passed
+    // over it, which is the case when its group has never been full:
+    if (group_match(&CTRL(h)[i - i % GROUP_WIDTH], CTRL_EMPTY)) {
+        CTRL(h)[i] = CTRL_EMPTY;
+        ++h->growth_left;
+    } else {
+        CTRL(h)[i] = CTRL_DELETED;
+    }
+
+    // Move the last entry into the hole to keep entries in a contiguous array:
+    char *last = h->entries + (h->count-1)*entry_size_padded;
+    if (entry != last) {
+        SLOTS(h)[slot_for_index(h, entry_hash(h, key_hash, entry_size_padded, h->count), h->count)] = index1;
+        memcpy(entry, last, entry_size_padded);
+        if (h->stores_hashes)
+            HASHES(h, entry_size_padded)[index1-1] = HASHES(h, entry_size_padded)[h->count-1];
+    }
+    memset(last, 0, entry_size_padded);
+    --h->count;
+
+    hshow(h);
+}
+#endif
+
+// Return address of value or NULL, for a key whose hash is already known
+static void *get_hashed(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, uint32_t hash, size_t value_offset)
+{
+    if (!may_have_key(h, hash)) return NULL;
+    if (h->capacity == 0)
+        return sss_hashmap_is_persistent(h) ? sss_persistent_hashmap_get_raw(h, key_hash, key_cmp, entry_size_padded, key, value_offset) : NULL;
+    char *entry = find_entry(h, key_cmp, entry_size_padded, key, hash);
+    return entry ? entry + value_offset : NULL;
+}
+
+// Return address of value or NULL
+void *sss_hashmap_get_raw(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset)
+{
+    if (!h || !key) return NULL;
+    if (h->capacity == 0)
+        return sss_hashmap_is_persistent(h) ? sss_persistent_hashmap_get_raw(h, key_hash, key_cmp, entry_size_padded, key, value_offset) : NULL;
+    char *entry = find_entry(h, key_cmp, entry_size_padded, key, key_hash(key));
+    return entry ? entry + value_offset : NULL;
+}
+
+// Look a key up in a table and its fallbacks, or else return the first default value
+static void *get_with_fallbacks(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, uint32_t hash, size_t value_offset)
+{
+    void *default_value = NULL;
+    for (sss_hashmap_t *iter = h; iter; iter = iter->fallback) {
+        void *ret = get_hashed(iter, key_hash, key_cmp, entry_size_padded, key, hash, value_offset);
+        if (ret) return ret;
+        if (!default_value) default_value = iter->default_value;
+    }
+    return default_value;
+}
+
+void *sss_hashmap_get(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset)
+{
+    if (!key) return NULL;
+    return get_with_fallbacks(h, key_hash, key_cmp, entry_size_padded, key, key_hash(key), value_offset);
+}
+
+static void hashmap_resize(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, uint32_t new_capacity, size_t entry_size_padded)
+{
+    (void)key_cmp;
+    hdebug("About to resize from %u to %u\n", h->capacity, new_capacity);
+    hshow(h);
+    const uint32_t *old_hashes = h->stores_hashes && h->entries ? HASHES(h, entry_size_padded) : NULL;
+    char *new_entries = GC_MALLOC(ENTRIES_SIZE(h, new_capacity, entry_size_padded));
+    if (h->entries) memcpy(new_entries, h->entries, h->count*entry_size_padded);
+    h->entries = new_entries;
+    reset_buckets(h, new_capacity);
+    uint32_t *new_hashes = h->stores_hashes ? HASHES(h, entry_size_padded) : NULL;
+    // Rehash:
+    for (uint32_t i = 1; i <= h->count; i++) {
+        hdebug("Rehashing %u\n", i);
+        uint32_t hash = old_hashes ? old_hashes[i-1] : key_hash(h->entries + entry_size_padded*(i-1));
+        if (new_hashes) new_hashes[i-1] = hash;
+        sss_hashmap_set_bucket(h, key_hash, entry_size_padded, hash, i);
+    }
+
+    hshow(h);
+    hdebug("Finished resizing\n");
+}
+
+// Make room for `n` more entries, so adding them won't need to resize the table
+void sss_hashmap_reserve(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, int64_t n)
+{
+    if (!h || n <= 0 || sss_hashmap_is_persistent(h)) return;
+    if (h->capacity > 0 && room_left(h) >= n) return;
+
+    if (n > (int64_t)(UINT32_MAX - h->count))
+        errx(1, "This table is too big (tables can hold at most %u entries)", (uint32_t)ENTRIES_CAPACITY(1u << 31));
+    uint32_t needed = h->count + (uint32_t)n;
+    uint32_t new_capacity = MIN_CAPACITY;
+    while (ENTRIES_CAPACITY(new_capacity) < needed) {
+        if (new_capacity == 1u << 31)
+            errx(1, "This table is too big (tables can hold at most %u entries)", (uint32_t)ENTRIES_CAPACITY(new_capacity));
+        new_capacity *= 2;
+    }
+    // If the table is big enough, but has used its space up on deleted slots,
+    // rehashing at the same capacity frees that space up:
+    if (new_capacity < h->capacity) new_capacity = h->capacity;
+    hashmap_resize(h, key_hash, key_cmp, new_capacity, entry_size_padded);
+    // The buckets and entries were just reallocated, so nothing else shares them:
+    h->copy_on_write = false;
+}
+
+// Return address of value, for a key whose hash is already known
+static void *set_hashed(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, uint32_t hash, size_t value_offset, const void *value)
+{
+    hdebug("Raw hash of key being set: %u\n", hash);
+    hshow(h);
+    h->key_filter |= KEY_FILTER_BITS(hash);
+
+    if (should_become_persistent(h))
+        sss_hashmap_make_persistent(h, key_hash, entry_size_padded);
+    if (sss_hashmap_is_persistent(h))
+        return sss_persistent_hashmap_set(h, key_hash, key_cmp, entry_size_padded, key, value_offset, value);
+
+    void *original_buckets = h->buckets;
+    char *original_entries = h->entries;
+
+    if (h->capacity == 0)
+        hashmap_resize(h, key_hash, key_cmp, MIN_CAPACITY, entry_size_padded);
+
+    size_t value_size = entry_size_padded - value_offset;
+    void *value_home = find_entry(h, key_cmp, entry_size_padded, key, hash);
+    if (value_home) { // Update existing slot
+        value_home += value_offset;
+        if (h->copy_on_write) {
+            // Ensure that `value_home` is still inside h->entries, even if COW occurs
+            ptrdiff_t offset = value_home - (void*)h->entries;
+            copy_on_write(h, entry_size_padded, original_buckets, original_entries);
+            value_home = h->entries + offset;
+        }
+
+        if (value && value_size > 0)
+            memcpy(value_home, value, value_size);
+
+        return value_home;
+    }
+    // Otherwise add a new entry:
+
+    // Resize buckets if necessary
+    if (hashmap_is_full(h)) {
+        uint32_t new_capacity = grown_capacity(h);
+        // Entry indices are 32 bits, so the capacity can't double past 2^31
+        if (new_capacity == 0)
+            errx(1, "This table is too big (tables can hold at most %u entries)", (uint32_t)ENTRIES_CAPACITY(h->capacity));
+        hashmap_resize(h, key_hash, key_cmp, new_capacity, entry_size_padded);
+    }
+
+    if (!value && value_size > 0) {
+        for (sss_hashmap_t *iter = h->fallback; iter; iter = iter->fallback) {
+            value = get_hashed(iter, key_hash, key_cmp, entry_size_padded, key, hash, value_offset);
+            if (value) break;
+        }
+        for (sss_hashmap_t *iter = h; !value && iter; iter = iter->fallback) {
+            if (iter->default_value) value = iter->default_value;
+        }
+    }
+
+    if (h->copy_on_write)
+        copy_on_write(h, entry_size_padded, original_buckets, original_entries);
+
+    uint32_t index1 = ++h->count;
+    void *entry = h->entries + (index1-1)*entry_size_padded;
+    memcpy(entry, key, value_offset);
+    if (value && value_size > 0)
+        memcpy(entry + value_offset, value, entry_size_padded - value_offset);
+    if (h->stores_hashes)
+        HASHES(h, entry_size_padded)[index1-1] = hash;
+
+    sss_hashmap_set_bucket(h, key_hash, entry_size_padded, hash, index1);
+
+    return entry + value_offset;
+}
+
+// Return address of value
+void *sss_hashmap_set(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset, const void *value)
+{
+    if (!h || !key) return NULL;
+    return set_hashed(h, key_hash, key_cmp, entry_size_padded, key, key_hash(key), value_offset, value);
+}
+
+// Get the entries as a flat array (persistent tables may need to gather them up)
+char *sss_hashmap_entries(sss_hashmap_t *h, size_t entry_size_padded)
+{
+    return sss_hashmap_is_persistent(h) ? sss_persistent_hashmap_entries(h, entry_size_padded) : h->entries;
+}
 
 void *sss_hashmap_nth(sss_hashmap_t *h, int32_t n, size_t entry_size_padded)
 {
     assert(n >= 1 && n <= (int32_t)h->count);
     if (n < 1 || n > (int32_t)h->count) return NULL;
-    return h->entries + (n-1)*entry_size_padded;
+    return sss_hashmap_entries(h, entry_size_padded) + (n-1)*entry_size_padded;
 }
 
 uint32_t sss_hashmap_hash(sss_hashmap_t *h, hash_fn_t entry_hash, size_t entry_size_padded)
@@ -340,8 +860,9 @@ uint32_t sss_hashmap_hash(sss_hashmap_t *h, hash_fn_t entry_hash, size_t entry_s
     if (!h) return 0;
 
     uint32_t hash = 0x12345678;
+    char *entries = sss_hashmap_entries(h, entry_size_padded);
     for (uint32_t i = 0; i < h->count; i++)
-        hash ^= entry_hash(h->entries + i*entry_size_padded);
+        hash ^= entry_hash(entries + i*entry_size_padded);
 
     if (h->fallback)
         hash ^= sss_hashmap_hash(h->fallback, entry_hash, entry_size_padded);
@@ -351,10 +872,12 @@ uint32_t sss_hashmap_hash(sss_hashmap_t *h, hash_fn_t entry_hash, size_t entry_s
 int32_t sss_hashmap_compare(sss_hashmap_t *h1, sss_hashmap_t *h2, hash_fn_t key_hash, cmp_fn_t key_cmp, cmp_fn_t value_cmp, size_t entry_size_padded, size_t value_offset)
 {
     if (h1->count != h2->count) return (int32_t)h1->count - (int32_t)h2->count;
+    char *entries = sss_hashmap_entries(h1, entry_size_padded);
     for (uint32_t i = 0; i < h1->count; i++) {
-        void *val = sss_hashmap_get(h2, key_hash, key_cmp, entry_size_padded, h1->entries + i*entry_size_padded, value_offset);
+        void *val = get_with_fallbacks(h2, key_hash, key_cmp, entry_size_padded, entries + i*entry_size_padded,
+                                       entry_hash(h1, key_hash, entry_size_padded, i+1), value_offset);
         if (!val) return 1;
-        int32_t diff = value_cmp(h1->entries + i*entry_size_padded + value_offset, val);
+        int32_t diff = value_cmp(entries + i*entry_size_padded + value_offset, val);
         if (diff) return diff;
     }
     if (h1->fallback != h2->fallback) {
@@ -376,4 +899,122 @@ int32_t sss_hashmap_compare(sss_hashmap_t *h1, sss_hashmap_t *h2, hash_fn_t key_
     return 0;
 }
 
+// Bulk operations on two tables of the same type. These only look at the
+// tables' own entries (not fallbacks or defaults), and the tables they produce
+// don't have fallbacks or defaults. Wherever possible, they loop over the
+// smaller table and make room in the result before adding anything to it.
+// Keys are looked up in the other table with their stored hashes, if any.
+
+// Give `result` the same entries as `h` without rehashing them, by sharing
+// the entries and buckets until one of the two tables is modified
+static void share_entries(sss_hashmap_t *result, const sss_hashmap_t *h)
+{
+    *result = (sss_hashmap_t){.entries=h->entries, .buckets=h->buckets, .capacity=h->capacity, .count=h->count,
+                              .growth_left=h->growth_left, .copy_on_write=true, .stores_hashes=h->stores_hashes,
+                              .key_filter=h->key_filter};
+}
+
+// Add an entry whose key isn't in the table yet, when there's room for it
+static void append_entry(sss_hashmap_t *h, hash_fn_t key_hash, size_t entry_size_padded, const void *entry, uint32_t hash)
+{
+    uint32_t index1 = ++h->count;
+    memcpy(h->entries + (index1-1)*entry_size_padded, entry, entry_size_padded);
+    if (h->stores_hashes)
+        HASHES(h, entry_size_padded)[index1-1] = hash;
+    h->key_filter |= KEY_FILTER_BITS(hash);
+    sss_hashmap_set_bucket(h, key_hash, entry_size_padded, hash, index1);
+}
+
+// Set all of `other`'s entries in `h`
+void sss_hashmap_merge(sss_hashmap_t *h, sss_hashmap_t *other, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset)
+{
+    if (h == other || other->count == 0) return;
+    sss_hashmap_reserve(h, key_hash, key_cmp, entry_size_padded, other->count);
+    char *entries = sss_hashmap_entries(other, entry_size_padded);
+    for (uint32_t i = 0; i < other->count; i++) {
+        char *entry = entries + i*entry_size_padded;
+        set_hashed(h, key_hash, key_cmp, entry_size_padded, entry, entry_hash(other, key_hash, entry_size_padded, i+1),
+                   value_offset, entry + value_offset);
+    }
+}
+
+// All of the entries in `a` or `b`, with `b`'s values for keys in both
+void sss_hashmap_union(sss_hashmap_t *result, sss_hashmap_t *a, sss_hashmap_t *b, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset)
+{
+    sss_hashmap_t merged;
+    if (a->count >= b->count) {
+        share_entries(&merged, a);
+        sss_hashmap_merge(&merged, b, key_hash, key_cmp, entry_size_padded, value_offset);
+    } else {
+        // Start with `b`'s entries and only add the keys from `a` that are missing:
+        share_entries(&merged, b);
+        sss_hashmap_reserve(&merged, key_hash, key_cmp, entry_size_padded, a->count);
+        char *entries = sss_hashmap_entries(a, entry_size_padded);
+        for (uint32_t i = 0; i < a->count; i++) {
+            char *entry = entries + i*entry_size_padded;
+            uint32_t hash = entry_hash(a, key_hash, entry_size_padded, i+1);
+            if (!get_hashed(&merged, key_hash, key_cmp, entry_size_padded, entry, hash, 0))
+                set_hashed(&merged, key_hash, key_cmp, entry_size_padded, entry, hash, value_offset, entry + value_offset);
+        }
+    }
+    *result = merged;
+}
+
+// The entries in `a` whose keys are also in `b`
+void sss_hashmap_intersection(sss_hashmap_t *result, sss_hashmap_t *a, sss_hashmap_t *b, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset)
+{
+    (void)value_offset;
+    sss_hashmap_t common = {.stores_hashes=a->stores_hashes};
+    sss_hashmap_t *smaller = a->count <= b->count ? a : b, *larger = smaller == a ? b : a;
+    sss_hashmap_reserve(&common, key_hash, key_cmp, entry_size_padded, smaller->count);
+    char *entries = sss_hashmap_entries(smaller, entry_size_padded);
+    for (uint32_t i = 0; i < smaller->count; i++) {
+        char *entry = entries + i*entry_size_padded;
+        uint32_t hash = entry_hash(smaller, key_hash, entry_size_padded, i+1);
+        char *match = get_hashed(larger, key_hash, key_cmp, entry_size_padded, entry, hash, 0);
+        if (match)
+            append_entry(&common, key_hash, entry_size_padded, smaller == a ? entry : match, hash);
+    }
+    *result = common;
+}
+
+// The entries in `a` whose keys aren't in `b`
+void sss_hashmap_difference(sss_hashmap_t *result, sss_hashmap_t *a, sss_hashmap_t *b, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset)
+{
+    (void)value_offset;
+    sss_hashmap_t rest;
+    if (b->count < a->count) {
+        // Removing `b`'s keys from `a` is less work than adding the rest of `a`:
+        share_entries(&rest, a);
+        char *entries = sss_hashmap_entries(b, entry_size_padded);
+        for (uint32_t i = 0; i < b->count && rest.count > 0; i++)
+            sss_hashmap_remove(&rest, key_hash, key_cmp, entry_size_padded, entries + i*entry_size_padded);
+    } else {
+        rest = (sss_hashmap_t){.stores_hashes=a->stores_hashes};
+        sss_hashmap_reserve(&rest, key_hash, key_cmp, entry_size_padded, a->count);
+        char *entries = sss_hashmap_entries(a, entry_size_padded);
+        for (uint32_t i = 0; i < a->count; i++) {
+            char *entry = entries + i*entry_size_padded;
+            uint32_t hash = entry_hash(a, key_hash, entry_size_padded, i+1);
+            if (!get_hashed(b, key_hash, key_cmp, entry_size_padded, entry, hash, 0))
+                append_entry(&rest, key_hash, entry_size_padded, entry, hash);
+        }
+    }
+    *result = rest;
+}
+
+// Whether every key in `other` is also in `h`
+bool sss_hashmap_contains_all(sss_hashmap_t *h, sss_hashmap_t *other, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset)
+{
+    (void)value_offset;
+    if (other->count > h->count) return false;
+    char *entries = sss_hashmap_entries(other, entry_size_padded);
+    for (uint32_t i = 0; i < other->count; i++) {
+        if (!get_hashed(h, key_hash, key_cmp, entry_size_padded, entries + i*entry_size_padded,
+                        entry_hash(other, key_hash, entry_size_padded, i+1), 0))
+            return false;
+    }
+    return true;
+}
+
 // vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1
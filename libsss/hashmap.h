@@ -4,10 +4,6 @@
 #include <stdbool.h>
 #include <string.h>
 
-typedef struct {
-    uint32_t index1, next1;
-} sss_hash_bucket_t;
-
 typedef uint32_t (hash_fn_t)(const void *data);
 typedef int32_t (cmp_fn_t)(const void *a, const void *b);
 
@@ -15,19 +11,54 @@ typedef int32_t (cmp_fn_t)(const void *a, const void *b);
 
 typedef struct sss_hashmap_s {
     char *entries;
-    sss_hash_bucket_t *buckets;
+    void *buckets; // Layout depends on the bucket implementation (see hashmap.c)
     struct sss_hashmap_s *fallback;
     void *default_value;
-    uint32_t capacity, count, lastfree_index1;
+    uint32_t capacity, count;
+    union { uint32_t growth_left, lastfree_index1; };
     bool copy_on_write;
+    uint8_t cow_copies; // How many times this table's data has been copied on write (saturating)
+    bool stores_hashes; // Whether each entry's hash is stored after the entries (see hashmap.c)
+    uint64_t key_filter; // Bloom filter of the hashes of keys added to this table (see hashmap.c)
 } sss_hashmap_t;
 
+// Bucket layout details, which compiled code relies on to do lookups inline
+// (see compile/tables.c):
+#define SSS_HASHMAP_GROUP_WIDTH 16
+#define SSS_HASHMAP_CTRL_EMPTY 0x80
+#define SSS_HASHMAP_CTRL_DELETED 0xFE
+#define SSS_HASHMAP_H2_SHIFT 25
+
+typedef enum { SSS_HASH_WYHASH, SSS_HASH_SIPHASH } sss_hash_family_e;
+// Chosen from SSS_HASH when the process starts. Changing it afterwards makes
+// every table and symbol that was already hashed invalid.
+extern sss_hash_family_e sss_hash_family;
+uint32_t sss_hash(const void *data, size_t len);
+uint32_t sss_hash_wyhash(const void *data, size_t len);
+uint32_t sss_hash_siphash(const void *data, size_t len);
+uint32_t sss_hash_strided(const void *data, int64_t len, int64_t stride, size_t item_size);
+
 uint32_t hash_64bit_value(const void *x);
 int compare_64bit_value(const void *x, const void *y);
 uint32_t hash_64bits(const void *x);
 int compare_64bits(const void *x, const void *y);
 uint32_t hash_str(const void *x);
 int compare_str(const void *x, const void *y);
+
+// Interned strings, which are unique and have a precomputed hash:
+extern const char *sss_symbols_start, *sss_symbols_end;
+// One bit for each 4-byte aligned position in the symbol region, which is set
+// if a symbol starts there (pointers into the middle of a symbol aren't symbols)
+extern const uint8_t *sss_symbol_starts;
+const char *intern_str(const char *str);
+const char *intern_strn(const char *str, size_t len);
+static inline bool is_symbol(const char *str) {
+    if (str < sss_symbols_start || str >= sss_symbols_end || (uintptr_t)str % 4 != 0) return false;
+    size_t i = (size_t)(str - sss_symbols_start) / 4;
+    return (sss_symbol_starts[i/8] >> (i%8)) & 1;
+}
+static inline uint32_t symbol_hash(const char *sym) { return ((const uint32_t*)sym)[-1]; }
+
 #define FIX_STR(x) _Generic(x, char*:(char*)x, default:x)
 #define HASH_FN(t) _Generic(t, char*:hash_str, const char*:hash_str, default: hash_64bit_value)
 #define COMPARE_FN(t) _Generic(t, char*:compare_str, const char*:compare_str, default:compare_64bit_value)
@@ -44,8 +75,24 @@ void *sss_hashmap_set(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, si
 void *sss_hashmap_get(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset);
 void *sss_hashmap_get_raw(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset);
 void sss_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key);
+void sss_hashmap_reserve(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, int64_t n);
 uint32_t sss_hashmap_len(sss_hashmap_t *h);
 void sss_hashmap_mark_cow(sss_hashmap_t *h);
+char *sss_hashmap_entries(sss_hashmap_t *h, size_t entry_size_padded);
 void *sss_hashmap_nth(sss_hashmap_t *h, int32_t n, size_t entry_size_padded);
 uint32_t sss_hashmap_hash(sss_hashmap_t *h, hash_fn_t entry_hash, size_t entry_size_padded);
 int32_t sss_hashmap_compare(sss_hashmap_t *h1, sss_hashmap_t *h2, hash_fn_t key_hash, cmp_fn_t key_cmp, cmp_fn_t value_cmp, size_t entry_size_padded, size_t value_offset);
+void sss_hashmap_merge(sss_hashmap_t *h, sss_hashmap_t *other, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset);
+void sss_hashmap_union(sss_hashmap_t *result, sss_hashmap_t *a, sss_hashmap_t *b, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset);
+void sss_hashmap_intersection(sss_hashmap_t *result, sss_hashmap_t *a, sss_hashmap_t *b, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset);
+void sss_hashmap_difference(sss_hashmap_t *result, sss_hashmap_t *a, sss_hashmap_t *b, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset);
+bool sss_hashmap_contains_all(sss_hashmap_t *h, sss_hashmap_t *other, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, size_t value_offset);
+
+// Persistent tables (see persistent_hashmap.c):
+extern uint32_t sss_hashmap_persistent_min;
+static inline bool sss_hashmap_is_persistent(const sss_hashmap_t *h) { return h->capacity == 0 && h->buckets != NULL; }
+void sss_hashmap_make_persistent(sss_hashmap_t *h, hash_fn_t key_hash, size_t entry_size_padded);
+void *sss_persistent_hashmap_get_raw(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset);
+void *sss_persistent_hashmap_set(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset, const void *value);
+void sss_persistent_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key);
+char *sss_persistent_hashmap_entries(sss_hashmap_t *h, size_t entry_size_padded);
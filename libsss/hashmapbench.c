@@ -0,0 +1,215 @@
+// Benchmark for hash map insert and lookup throughput.
+// `make hashmapbench` builds `hashmapbench` (open addressing) and
+// `hashmapbench-chained` (-DSSS_HASHMAP_CHAINED) for comparison.
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hashmap.h"
+
+#define N 1000000
+#define LOOKUPS 10000000
+#define COPIES 10000
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+static void report(const char *what, long n, double start)
+{
+    double elapsed = now() - start;
+    printf("%-28s %8.2f Mops/s\n", what, (double)n/elapsed/1e6);
+}
+
+static sss_hashmap_t *new_scope(sss_hashmap_t *parent)
+{
+    sss_hashmap_t *scope = GC_MALLOC(sizeof(sss_hashmap_t));
+    scope->fallback = parent;
+    return scope;
+}
+
+int main(void) {
+    GC_INIT();
+    long checksum = 0;
+
+    sss_hashmap_t ints = {0};
+    double start = now();
+    for (long i = 0; i < N; i++) {
+        long key = i*7919;
+        hset(&ints, key, i);
+    }
+    report("Int insert", N, start);
+
+    sss_hashmap_t reserved = {0};
+    start = now();
+    sss_hashmap_reserve(&reserved, hash_64bit_value, (cmp_fn_t*)compare_64bit_value, 2*sizeof(long), N);
+    for (long i = 0; i < N; i++) {
+        long key = i*7919;
+        hset(&reserved, key, i);
+    }
+    report("Int insert (reserved)", N, start);
+
+    start = now();
+    for (long i = 0; i < LOOKUPS; i++) {
+        long key = (i % N)*7919;
+        checksum += hget(&ints, key, long);
+    }
+    report("Int lookup (hit)", LOOKUPS, start);
+
+    start = now();
+    for (long i = 0; i < LOOKUPS; i++) {
+        long key = i*7919 + 1;
+        checksum += hget(&ints, key, long);
+    }
+    report("Int lookup (miss)", LOOKUPS, start);
+
+    char **strs = GC_MALLOC(N*sizeof(char*));
+    const char **syms = GC_MALLOC(N*sizeof(char*));
+    for (long i = 0; i < N; i++) {
+        strs[i] = GC_MALLOC_ATOMIC(24);
+        snprintf(strs[i], 24, "key_%ld", i);
+        syms[i] = intern_str(strs[i]);
+    }
+
+    sss_hashmap_t strings = {0};
+    start = now();
+    for (long i = 0; i < N; i++)
+        hset(&strings, strs[i], i);
+    report("Str insert", N, start);
+
+    start = now();
+    for (long i = 0; i < LOOKUPS; i++)
+        checksum += hget(&strings, strs[(i*31) % N], long);
+    report("Str lookup", LOOKUPS, start);
+
+    // Long keys are slow to hash, so storing their hashes saves rehashing
+    // them whenever the table grows:
+    char **paths = GC_MALLOC(N*sizeof(char*));
+    for (long i = 0; i < N; i++) {
+        paths[i] = GC_MALLOC_ATOMIC(96);
+        snprintf(paths[i], 96, "/usr/local/share/some/fairly/deeply/nested/directory/file_%ld.txt", i);
+    }
+    for (int stores_hashes = 0; stores_hashes <= 1; stores_hashes++) {
+        sss_hashmap_t long_strings = {.stores_hashes=stores_hashes};
+        start = now();
+        for (long i = 0; i < N; i++)
+            hset(&long_strings, paths[i], i);
+        report(stores_hashes ? "Long str insert (hashes)" : "Long str insert", N, start);
+
+        sss_hashmap_t copy = {.stores_hashes=stores_hashes};
+        start = now();
+        sss_hashmap_merge(&copy, &long_strings, hash_str, (cmp_fn_t*)compare_str, 2*sizeof(long), sizeof(long));
+        report(stores_hashes ? "Long str merge (hashes)" : "Long str merge", N, start);
+    }
+
+    sss_hashmap_t symbols = {0};
+    start = now();
+    for (long i = 0; i < N; i++)
+        hset(&symbols, syms[i], i);
+    report("Symbol insert", N, start);
+
+    start = now();
+    for (long i = 0; i < LOOKUPS; i++)
+        checksum += hget(&symbols, syms[(i*31) % N], long);
+    report("Symbol lookup", LOOKUPS, start);
+
+    // Nested scopes, like the compiler's bindings: a chain of small tables,
+    // each falling back to the one before it
+    enum { SCOPES = 32, PER_SCOPE = 8 };
+    sss_hashmap_t *scope = NULL;
+    for (long i = 0; i < SCOPES; i++) {
+        scope = new_scope(scope);
+        for (long j = 0; j < PER_SCOPE; j++)
+            hset(scope, syms[i*PER_SCOPE + j], j);
+    }
+    start = now();
+    for (long i = 0; i < LOOKUPS; i++)
+        checksum += hget(scope, syms[i % PER_SCOPE], long);
+    report("Scope chain lookup (outer)", LOOKUPS, start);
+    start = now();
+    for (long i = 0; i < LOOKUPS; i++)
+        checksum += hget(scope, syms[SCOPES*PER_SCOPE + i % 1000], long);
+    report("Scope chain lookup (miss)", LOOKUPS, start);
+
+    // Copying a table and changing one key, the way value semantics does,
+    // with flat tables and then with persistent tables:
+    sss_hashmap_t original = {0};
+    for (long i = 0; i < N/10; i++) {
+        long key = i*7919;
+        hset(&original, key, i);
+    }
+    for (int persistent = 0; persistent <= 1; persistent++) {
+        sss_hashmap_persistent_min = persistent ? 1 : 0;
+        sss_hashmap_t latest = original;
+        start = 0;
+        for (long i = -2; i < COPIES; i++) {
+            // The first couple of copies (which switch to the persistent layout) aren't timed:
+            if (i == 0) start = now();
+            sss_hashmap_mark_cow(&latest);
+            sss_hashmap_t copy = latest;
+            long key = (labs(i) % (N/10))*7919, value = -i;
+            hset(&copy, key, value);
+            latest = copy;
+        }
+        printf("%-28s %8.2f us/copy\n", persistent ? "Copy+set 100k (persistent)" : "Copy+set 100k (flat)",
+               (now() - start)/COPIES*1e6);
+
+        start = now();
+        for (long i = 0; i < LOOKUPS; i++) {
+            long key = (i % (N/10))*7919;
+            checksum += hget(&latest, key, long);
+        }
+        report(persistent ? "Int lookup (persistent)" : "Int lookup (flat)", LOOKUPS, start);
+    }
+
+    // Bulk set operations, compared with doing the same thing one key at a time:
+    sss_hashmap_t others = {0};
+    for (long i = 0; i < N/10; i++) {
+        long key = i*2*7919 + (i % 2);
+        hset(&others, key, i);
+    }
+    start = now();
+    sss_hashmap_t combined;
+    sss_hashmap_union(&combined, &ints, &others, hash_64bit_value, (cmp_fn_t*)compare_64bit_value, 2*sizeof(long), sizeof(long));
+    report("Union (bulk)", N + N/10, start);
+    start = now();
+    combined = (sss_hashmap_t){0};
+    for (uint32_t i = 1; i <= ints.count; i++) {
+        __auto_type entry = hnth(&ints, i, long, long);
+        hset(&combined, entry->key, entry->value);
+    }
+    for (uint32_t i = 1; i <= others.count; i++) {
+        __auto_type entry = hnth(&others, i, long, long);
+        hset(&combined, entry->key, entry->value);
+    }
+    report("Union (key by key)", N + N/10, start);
+    checksum += combined.count;
+
+    start = now();
+    sss_hashmap_t common;
+    sss_hashmap_intersection(&common, &ints, &others, hash_64bit_value, (cmp_fn_t*)compare_64bit_value, 2*sizeof(long), sizeof(long));
+    report("Intersection (bulk)", N/10, start);
+    start = now();
+    common = (sss_hashmap_t){0};
+    for (uint32_t i = 1; i <= ints.count; i++) {
+        __auto_type entry = hnth(&ints, i, long, long);
+        if (hget_opt(&others, entry->key, long))
+            hset(&common, entry->key, entry->value);
+    }
+    report("Intersection (key by key)", N/10, start);
+    checksum += common.count;
+
+    start = now();
+    for (long i = 0; i < N; i++) {
+        long key = i*7919;
+        hremove(&ints, key, long);
+    }
+    report("Int remove", N, start);
+
+    printf("(checksum: %ld)\n", checksum);
+    return 0;
+}
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -6,14 +6,15 @@
 #include <string.h>
 
 #include "../util.h"
+#include "arena.h"
 #include "list.h"
 
 list_t *list_new(size_t item_size, size_t min_items) {
-    return new(list_t, .items=GC_MALLOC(item_size * min_items), .slack=(uint8_t)min_items);
+    return arena_new(list_t, .items=arena_alloc(item_size * min_items), .slack=(uint8_t)min_items);
 }
 
 list_t *list_new_items(size_t item_size, size_t len, void *items) {
-    list_t *list = new(list_t, .items=GC_MALLOC(item_size * len), .len=len);
+    list_t *list = arena_new(list_t, .items=arena_alloc(item_size * len), .len=len);
     memcpy(list->items, items, item_size * len);
     return list;
 }
@@ -24,7 +25,7 @@ void list_append(list_t *list, size_t item_size, void *item) {
     } else {
         char *old_items = list->items;
         list->slack = 8;
-        list->items = GC_MALLOC(item_size * (list->len + 1 + list->slack));
+        list->items = arena_alloc(item_size * (list->len + 1 + list->slack));
         memcpy(list->items, old_items, item_size*list->len);
     }
     memcpy(list->items + item_size * list->len, item, item_size);
@@ -0,0 +1,216 @@
+// parallel.c - A work-stealing thread pool for array operations
+// Copyright 2023 Bruce Hill
+// Provided under the MIT license with the Commons Clause
+// See included LICENSE for details.
+
+// The pool's threads are started the first time something runs in parallel
+// (or when more threads are asked for, with sss_set_thread_count()).
+// sss_parallel_for() splits the work into chunks and deals out a contiguous
+// run of chunks to each thread (including the caller). Each thread takes
+// chunks from the front of its own run, and when it runs out, it steals the
+// back half of another thread's run. A run is packed into a single 64-bit
+// atomic (first chunk and end chunk), so taking and stealing are both a
+// compare-and-swap on it. Only one operation uses the pool at a time. If the
+// pool is busy (e.g. a parallel operation inside of another one), the work
+// just runs on the calling thread.
+
+#define GC_THREADS
+#include <gc.h>
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+#define MAX_THREADS 256
+#define MAX_CHUNKS INT32_MAX
+#define CACHE_LINE 64
+
+#define RUN(first, end) (((uint64_t)(first) << 32) | (uint64_t)(end))
+#define RUN_FIRST(run) ((int64_t)((run) >> 32))
+#define RUN_END(run) ((int64_t)((run) & 0xFFFFFFFF))
+
+// Each thread's run of chunks is on its own cache line, so thieves checking
+// one thread's run don't slow down the others
+typedef struct {
+    alignas(CACHE_LINE) _Atomic(uint64_t) run;
+} worker_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    pthread_mutex_t in_use;
+    // Incremented for each operation, so threads know when there's new work
+    uint64_t generation;
+    // Threads working on the current operation, and how many of the pool's
+    // threads it uses (counting the caller)
+    int active, threads;
+
+    parallel_fn_t *fn;
+    void *userdata;
+    int64_t n, grain;
+    worker_t workers[MAX_THREADS];
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .in_use = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Atomic(int) num_threads = 1;
+static int started_threads = 1;
+
+__attribute__((constructor))
+static void init_thread_count(void)
+{
+    const char *threads = getenv("SSS_THREADS");
+    long n = (threads && *threads) ? strtol(threads, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    sss_set_thread_count(n > MAX_THREADS ? MAX_THREADS : (int)n);
+}
+
+int sss_thread_count(void)
+{
+    return num_threads;
+}
+
+// This waits for any parallel operation that's running to finish first
+void sss_set_thread_count(int n)
+{
+    pthread_mutex_lock(&pool.in_use);
+    num_threads = n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : n);
+    pthread_mutex_unlock(&pool.in_use);
+}
+
+// Take the next chunk from the front of a thread's own run
+static bool take_chunk(worker_t *w, int64_t *chunk)
+{
+    uint64_t run = atomic_load(&w->run);
+    while (RUN_FIRST(run) < RUN_END(run)) {
+        if (atomic_compare_exchange_weak(&w->run, &run, RUN(RUN_FIRST(run) + 1, RUN_END(run)))) {
+            *chunk = RUN_FIRST(run);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Steal the back half of another thread's run (or its last chunk) and make it
+// this thread's run. Returns false when there's nothing left to steal.
+static bool steal_chunks(int id)
+{
+    for (int i = 1; i < pool.threads; i++) {
+        worker_t *victim = &pool.workers[(id + i) % pool.threads];
+        uint64_t run = atomic_load(&victim->run);
+        while (RUN_FIRST(run) < RUN_END(run)) {
+            int64_t first = RUN_FIRST(run), end = RUN_END(run);
+            int64_t split = end - (end - first + 1)/2;
+            if (atomic_compare_exchange_weak(&victim->run, &run, RUN(first, split))) {
+                atomic_store(&pool.workers[id].run, RUN(split, end));
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void do_work(int id)
+{
+    for (;;) {
+        int64_t chunk;
+        while (take_chunk(&pool.workers[id], &chunk)) {
+            int64_t start = chunk*pool.grain;
+            int64_t end = start + pool.grain < pool.n ? start + pool.grain : pool.n;
+            pool.fn(start, end, pool.userdata);
+        }
+        if (!steal_chunks(id))
+            return;
+    }
+}
+
+static void *pool_thread(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+        if (id >= pool.threads) continue;
+        ++pool.active;
+        pthread_mutex_unlock(&pool.lock);
+
+        do_work(id);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.active == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    return NULL;
+}
+
+// Called while the pool is in use, so nothing else is starting threads
+static void start_threads(void)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (; started_threads < num_threads; started_threads++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, pool_thread, (void*)(intptr_t)started_threads) != 0) {
+            // Make do with the threads that did start
+            num_threads = started_threads;
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+void sss_parallel_for(int64_t n, int64_t grain, parallel_fn_t fn, void *userdata)
+{
+    if (n <= 0) return;
+    if (grain < 1) grain = 1;
+    if (n <= grain || num_threads == 1 || pthread_mutex_trylock(&pool.in_use) != 0) {
+        fn(0, n, userdata);
+        return;
+    }
+
+    if (started_threads < num_threads)
+        start_threads();
+
+    // Chunk numbers have to fit in 32 bits
+    if ((n + grain - 1)/grain > MAX_CHUNKS)
+        grain = (n + MAX_CHUNKS - 1)/MAX_CHUNKS;
+    int64_t chunks = (n + grain - 1)/grain;
+
+    pthread_mutex_lock(&pool.lock);
+    // Threads that woke up late for the last operation have to finish with it first
+    while (pool.active > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pool.fn = fn;
+    pool.userdata = userdata;
+    pool.n = n;
+    pool.grain = grain;
+    pool.threads = num_threads;
+    for (int id = 0; id < num_threads; id++)
+        atomic_store(&pool.workers[id].run, RUN(chunks*id/num_threads, chunks*(id+1)/num_threads));
+    ++pool.generation;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    do_work(0);
+
+    // Every chunk has been taken by now, but some may still be in progress
+    pthread_mutex_lock(&pool.lock);
+    while (pool.active > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    pthread_mutex_unlock(&pool.in_use);
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
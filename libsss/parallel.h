@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+// Array operations split arrays into ranges of about this many items for
+// threads to work on, so arrays shorter than this aren't worth splitting
+#define SSS_PARALLEL_GRAIN (1 << 14)
+
+// Work on the range [start, end) of items, for sss_parallel_for()
+typedef void (parallel_fn_t)(int64_t start, int64_t end, void *userdata);
+
+// How many threads parallel operations use, counting the calling thread
+// (SSS_THREADS, or by default, the number of CPUs)
+int sss_thread_count(void);
+void sss_set_thread_count(int n);
+
+// Call fn() on ranges of [0, n) of about `grain` items each, using the
+// runtime's thread pool, and return once every item has been handled. This
+// just calls fn(0, n, userdata) when there's only one range's worth of items
+// or the pool is already in use.
+void sss_parallel_for(int64_t n, int64_t grain, parallel_fn_t fn, void *userdata);
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
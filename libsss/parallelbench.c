@@ -0,0 +1,196 @@
+// Benchmark for array operations that run on the runtime's thread pool, with
+// different numbers of threads. `make parallelbench` builds it against the
+// runtime library. It uses 1, 2, 4, ... threads, up to the number of CPUs,
+// and an array length can be passed as an argument (default: 10M items).
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "sort.h"
+#include "string.h"
+#include "utils.h"
+
+typedef struct { char *items; int64_t length; int32_t stride, free; } array_t;
+typedef struct { int64_t id; double score; } record_t;
+
+static int64_t n;
+static int64_t *ints;
+static double *nums, *other_nums;
+static record_t *records;
+static string_t *strs;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+static uint64_t random_u64(void)
+{
+    static uint64_t state = 88172645463325252ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static int32_t compare_ints(const void *a, const void *b)
+{
+    int64_t x = *(int64_t*)a, y = *(int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int32_t compare_records(const void *a, const void *b)
+{
+    const record_t *x = a, *y = b;
+    if (x->id != y->id) return (x->id > y->id) - (x->id < y->id);
+    return (x->score > y->score) - (x->score < y->score);
+}
+
+static array_t copy_of(const void *items, size_t item_size)
+{
+    array_t arr = {GC_MALLOC_ATOMIC((size_t)n*item_size), n, (int32_t)item_size, 0};
+    memcpy(arr.items, items, (size_t)n*item_size);
+    return arr;
+}
+
+// Each benchmark returns how long it took, not counting setup
+static double sort_ints(void)
+{
+    array_t arr = copy_of(ints, sizeof(int64_t));
+    double start = now();
+    array_sort_ints(&arr, sizeof(int64_t), true);
+    return now() - start;
+}
+
+static double sort_nums(void)
+{
+    array_t arr = copy_of(nums, sizeof(double));
+    double start = now();
+    array_sort_nums(&arr, sizeof(double));
+    return now() - start;
+}
+
+static double sort_records(void)
+{
+    array_t arr = copy_of(records, sizeof(record_t));
+    double start = now();
+    array_sort(&arr, compare_records, sizeof(record_t), true);
+    return now() - start;
+}
+
+static double stable_sort_records(void)
+{
+    array_t arr = copy_of(records, sizeof(record_t));
+    double start = now();
+    array_stable_sort(&arr, compare_records, sizeof(record_t), true);
+    return now() - start;
+}
+
+typedef struct { const double *a, *b; double *result; } add_args_t;
+
+// This is what the compiler generates for `a + b` with arrays of Num
+static void add_nums(int64_t start, int64_t end, void *userdata)
+{
+    add_args_t *args = userdata;
+    for (int64_t i = start; i < end; i++)
+        args->result[i] = args->a[i] + args->b[i];
+}
+
+static double add_arrays(void)
+{
+    add_args_t args = {nums, other_nums, GC_MALLOC_ATOMIC((size_t)n*sizeof(double))};
+    double start = now();
+    sss_parallel_for(n, SSS_PARALLEL_GRAIN, add_nums, &args);
+    double elapsed = now() - start;
+    GC_FREE(args.result);
+    return elapsed;
+}
+
+static double search_ints(void)
+{
+    array_t arr = {(char*)ints, n, sizeof(int64_t), 0};
+    int64_t missing = -1;
+    double start = now();
+    if (array_index_of(&arr, &missing, compare_ints) != 0)
+        fprintf(stderr, "Found an item that shouldn't be there\n");
+    return now() - start;
+}
+
+static double shuffle_ints(void)
+{
+    array_t arr = copy_of(ints, sizeof(int64_t));
+    double start = now();
+    array_shuffle(&arr, sizeof(int64_t), true);
+    return now() - start;
+}
+
+// Joining n/16 strings of 16 characters
+static double join_strs(void)
+{
+    array_t arr = {(char*)strs, n/16, sizeof(string_t), 0};
+    string_t glue = {.data="", .length=0, .stride=1};
+    double start = now();
+    (void)array_join(&arr, &glue, 1, true);
+    return now() - start;
+}
+
+static void nothing(int64_t start, int64_t end, void *userdata)
+{
+    (void)start, (void)end, (void)userdata;
+}
+
+int main(int argc, char *argv[]) {
+    GC_INIT();
+    n = argc > 1 ? strtol(argv[1], NULL, 10) : 10000000;
+
+    ints = GC_MALLOC_ATOMIC((size_t)n*sizeof(int64_t));
+    nums = GC_MALLOC_ATOMIC((size_t)n*sizeof(double));
+    other_nums = GC_MALLOC_ATOMIC((size_t)n*sizeof(double));
+    records = GC_MALLOC_ATOMIC((size_t)n*sizeof(record_t));
+    for (int64_t i = 0; i < n; i++) {
+        ints[i] = (int64_t)(random_u64() >> 1);
+        nums[i] = (double)(int64_t)random_u64() / 1e9;
+        other_nums[i] = (double)(int64_t)random_u64() / 1e9;
+        records[i] = (record_t){(int64_t)(random_u64() % 1000), (double)random_u64()};
+    }
+    strs = GC_MALLOC((size_t)(n/16 + 1)*sizeof(string_t));
+    for (int64_t i = 0; i < n/16; i++) {
+        char *str = GC_MALLOC_ATOMIC(17);
+        snprintf(str, 17, "%016lx", random_u64());
+        strs[i] = (string_t){.data=str, .length=16, .stride=1};
+    }
+
+    struct { const char *name; double (*run)(void); } benchmarks[] = {
+        {"Int sort", sort_ints}, {"Num sort", sort_nums}, {"Struct sort", sort_records},
+        {"Struct stable sort", stable_sort_records}, {"Num array + Num array", add_arrays},
+        {"Int search", search_ints}, {"Int shuffle", shuffle_ints}, {"Str join", join_strs},
+    };
+    const int num_benchmarks = (int)(sizeof(benchmarks)/sizeof(benchmarks[0]));
+
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_counts[32], num_counts = 0;
+    for (int threads = 1; threads < cpus && num_counts < 31; threads *= 2)
+        thread_counts[num_counts++] = threads;
+    thread_counts[num_counts++] = cpus > 1 ? cpus : 1;
+
+    double baseline[num_benchmarks];
+    printf("%ld items, %d CPUs\n", n, cpus);
+    for (int c = 0; c < num_counts; c++) {
+        sss_set_thread_count(thread_counts[c]);
+        // Start up any new threads before timing anything
+        sss_parallel_for(1000, 1, nothing, NULL);
+        printf("%d thread%s:\n", thread_counts[c], thread_counts[c] == 1 ? "" : "s");
+        for (int b = 0; b < num_benchmarks; b++) {
+            double elapsed = benchmarks[b].run();
+            if (c == 0) baseline[b] = elapsed;
+            printf("  %-24s %8.2f Mitems/s  %5.2fx\n", benchmarks[b].name, (double)n/elapsed/1e6, baseline[b]/elapsed);
+        }
+    }
+    return 0;
+}
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
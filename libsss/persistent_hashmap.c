@@ -0,0 +1,399 @@
+// persistent_hashmap.c - Persistent tables with structural sharing
+// Copyright 2023 Bruce Hill
+// Provided under the MIT license with the Commons Clause
+// See included LICENSE for details.
+
+// Tables have value semantics, so a table that is shared by several copies is
+// copied in full the first time one of them is modified. For big tables that
+// keep getting copied and modified, that's O(n) work per modification, so
+// those tables switch to a persistent layout, where nodes are shared between
+// copies and a modification only copies the nodes on the path to the change:
+//
+// - Entries are stored in a trie of 32-way nodes indexed by entry position
+//   (like Clojure's vectors), with 32 entries per leaf. Entries stay in the
+//   same order as they would be in a regular table.
+// - Instead of buckets, a hash array mapped trie maps each hash to the
+//   1-indexed position of the entry with that hash. Past the 32 bits of the
+//   hash, the entries with identical hashes are kept in collision nodes.
+//
+// A persistent table has `capacity == 0` and `buckets` pointing to a
+// `persistent_t`, so compiled code that checks the capacity before probing
+// the buckets falls back to sss_hashmap_get_raw(). `entries` is NULL, and
+// sss_hashmap_entries() gathers the entries up into a flat array on demand.
+// Persistent tables always have `copy_on_write` set, so nothing modifies
+// them in place.
+
+#include <err.h>
+#include <gc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashmap.h"
+
+#define BITS 5
+#define WIDTH (1u << BITS)
+#define MASK (WIDTH - 1)
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// Tables switch to the persistent layout when they have at least this many
+// entries and have been copied on write before (0 means never)
+uint32_t sss_hashmap_persistent_min = 128;
+
+__attribute__((constructor))
+static void init_persistent_min(void)
+{
+    const char *min = getenv("SSS_PERSISTENT_TABLE_MIN");
+    if (min && *min)
+        sss_hashmap_persistent_min = (uint32_t)strtoul(min, NULL, 0);
+}
+
+typedef struct {
+    uint32_t hash, index1;
+} hamt_slot_t;
+
+typedef struct hamt_node_s {
+    // Which of the 32 branches hold a slot and which hold a child node. In
+    // collision nodes, `datamap` is the number of slots instead.
+    uint32_t datamap, nodemap;
+    // Slots come first, followed by child nodes
+    union {
+        hamt_slot_t slot;
+        struct hamt_node_s *child;
+    } items[];
+} hamt_node_t;
+
+typedef struct {
+    void *entries; // Trie of entries, `depth` levels of `trie_node_t` above the leaves
+    hamt_node_t *index;
+    char *flat; // Cached flat array of entries (see sss_hashmap_entries())
+    uint32_t depth;
+} persistent_t;
+
+typedef struct {
+    void *children[WIDTH];
+} trie_node_t;
+
+#define PERSISTENT(h) ((persistent_t*)(h)->buckets)
+#define popcount(x) ((uint32_t)__builtin_popcount(x))
+
+static char *trie_entry(const persistent_t *p, uint32_t i, size_t entry_size_padded)
+{
+    void *node = p->entries;
+    for (uint32_t level = p->depth; level > 0; level--)
+        node = ((trie_node_t*)node)->children[(i >> (BITS*level)) & MASK];
+    return (char*)node + (i & MASK)*entry_size_padded;
+}
+
+// Copy the path to entry `i` (creating any missing nodes) and store the
+// address of the entry's new home in `home`
+static void *trie_assoc(void *node, uint32_t level, uint32_t i, size_t entry_size_padded, char **home)
+{
+    if (level == 0) {
+        char *leaf = GC_MALLOC(WIDTH*entry_size_padded);
+        if (node) memcpy(leaf, node, WIDTH*entry_size_padded);
+        *home = leaf + (i & MASK)*entry_size_padded;
+        return leaf;
+    }
+    trie_node_t *copy = GC_MALLOC(sizeof(trie_node_t));
+    if (node) *copy = *(trie_node_t*)node;
+    uint32_t branch = (i >> (BITS*level)) & MASK;
+    copy->children[branch] = trie_assoc(copy->children[branch], level - 1, i, entry_size_padded, home);
+    return copy;
+}
+
+static hamt_node_t *new_hamt_node(uint32_t datamap, uint32_t nodemap, uint32_t num_items)
+{
+    hamt_node_t *node = GC_MALLOC(sizeof(hamt_node_t) + num_items*sizeof(node->items[0]));
+    node->datamap = datamap;
+    node->nodemap = nodemap;
+    return node;
+}
+
+#define is_collision_node(shift) ((shift) >= 32)
+#define num_items(node, shift) (is_collision_node(shift) ? (node)->datamap : popcount((node)->datamap) + popcount((node)->nodemap))
+
+static uint32_t hamt_find(const persistent_t *p, uint32_t hash, const void *key, cmp_fn_t key_cmp, size_t entry_size_padded)
+{
+    const hamt_node_t *node = p->index;
+    for (uint32_t shift = 0; node; shift += BITS) {
+        if (is_collision_node(shift)) {
+            for (uint32_t i = 0; i < node->datamap; i++) {
+                if (key_cmp(trie_entry(p, node->items[i].slot.index1 - 1, entry_size_padded), key) == 0)
+                    return node->items[i].slot.index1;
+            }
+            return 0;
+        }
+        uint32_t bit = 1u << ((hash >> shift) & MASK);
+        if (node->datamap & bit) {
+            hamt_slot_t slot = node->items[popcount(node->datamap & (bit - 1))].slot;
+            if (slot.hash == hash && key_cmp(trie_entry(p, slot.index1 - 1, entry_size_padded), key) == 0)
+                return slot.index1;
+            return 0;
+        } else if (node->nodemap & bit) {
+            node = node->items[popcount(node->datamap) + popcount(node->nodemap & (bit - 1))].child;
+        } else {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Add a slot for a hash that isn't in the trie yet
+static hamt_node_t *hamt_insert(const hamt_node_t *node, uint32_t shift, hamt_slot_t slot)
+{
+    if (is_collision_node(shift)) {
+        uint32_t n = node ? node->datamap : 0;
+        hamt_node_t *copy = new_hamt_node(n + 1, 0, n + 1);
+        if (n) memcpy(copy->items, node->items, n*sizeof(node->items[0]));
+        copy->items[n].slot = slot;
+        return copy;
+    }
+
+    if (!node) {
+        hamt_node_t *leaf = new_hamt_node(1u << ((slot.hash >> shift) & MASK), 0, 1);
+        leaf->items[0].slot = slot;
+        return leaf;
+    }
+
+    uint32_t bit = 1u << ((slot.hash >> shift) & MASK);
+    uint32_t num_data = popcount(node->datamap), n = num_items(node, shift);
+    if (node->datamap & bit) {
+        // Both this slot and the one already there move down into a new child:
+        uint32_t data_index = popcount(node->datamap & (bit - 1));
+        hamt_node_t *child = hamt_insert(hamt_insert(NULL, shift + BITS, node->items[data_index].slot), shift + BITS, slot);
+        uint32_t child_index = num_data - 1 + popcount(node->nodemap & (bit - 1));
+        hamt_node_t *copy = new_hamt_node(node->datamap & ~bit, node->nodemap | bit, n);
+        memcpy(&copy->items[0], &node->items[0], data_index*sizeof(node->items[0]));
+        memcpy(&copy->items[data_index], &node->items[data_index + 1], (child_index - data_index)*sizeof(node->items[0]));
+        copy->items[child_index].child = child;
+        memcpy(&copy->items[child_index + 1], &node->items[child_index + 1], (n - child_index - 1)*sizeof(node->items[0]));
+        return copy;
+    } else if (node->nodemap & bit) {
+        uint32_t child_index = num_data + popcount(node->nodemap & (bit - 1));
+        hamt_node_t *copy = new_hamt_node(node->datamap, node->nodemap, n);
+        memcpy(copy->items, node->items, n*sizeof(node->items[0]));
+        copy->items[child_index].child = hamt_insert(node->items[child_index].child, shift + BITS, slot);
+        return copy;
+    } else {
+        uint32_t data_index = popcount(node->datamap & (bit - 1));
+        hamt_node_t *copy = new_hamt_node(node->datamap | bit, node->nodemap, n + 1);
+        memcpy(&copy->items[0], &node->items[0], data_index*sizeof(node->items[0]));
+        copy->items[data_index].slot = slot;
+        memcpy(&copy->items[data_index + 1], &node->items[data_index], (n - data_index)*sizeof(node->items[0]));
+        return copy;
+    }
+}
+
+// Remove the slot for an entry, returning NULL if nothing is left
+static hamt_node_t *hamt_remove(const hamt_node_t *node, uint32_t shift, uint32_t hash, uint32_t index1)
+{
+    if (is_collision_node(shift)) {
+        uint32_t n = node->datamap;
+        if (n == 1) return NULL;
+        hamt_node_t *copy = new_hamt_node(n - 1, 0, n - 1);
+        for (uint32_t i = 0, j = 0; i < n; i++) {
+            if (node->items[i].slot.index1 != index1)
+                copy->items[j++] = node->items[i];
+        }
+        return copy;
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & MASK);
+    uint32_t num_data = popcount(node->datamap), n = num_items(node, shift);
+    if (node->datamap & bit) {
+        if (n == 1) return NULL;
+        uint32_t data_index = popcount(node->datamap & (bit - 1));
+        hamt_node_t *copy = new_hamt_node(node->datamap & ~bit, node->nodemap, n - 1);
+        memcpy(&copy->items[0], &node->items[0], data_index*sizeof(node->items[0]));
+        memcpy(&copy->items[data_index], &node->items[data_index + 1], (n - data_index - 1)*sizeof(node->items[0]));
+        return copy;
+    }
+
+    uint32_t child_index = num_data + popcount(node->nodemap & (bit - 1));
+    hamt_node_t *child = hamt_remove(node->items[child_index].child, shift + BITS, hash, index1);
+    if (child && num_items(child, shift + BITS) == 1 && (is_collision_node(shift + BITS) || child->nodemap == 0)) {
+        // A child with a single slot gets folded back into this node:
+        uint32_t data_index = popcount(node->datamap & (bit - 1));
+        hamt_node_t *copy = new_hamt_node(node->datamap | bit, node->nodemap & ~bit, n);
+        memcpy(&copy->items[0], &node->items[0], data_index*sizeof(node->items[0]));
+        copy->items[data_index].slot = child->items[0].slot;
+        memcpy(&copy->items[data_index + 1], &node->items[data_index], (child_index - data_index)*sizeof(node->items[0]));
+        memcpy(&copy->items[child_index + 1], &node->items[child_index + 1], (n - child_index - 1)*sizeof(node->items[0]));
+        return copy;
+    } else if (!child) {
+        if (n == 1) return NULL;
+        hamt_node_t *copy = new_hamt_node(node->datamap, node->nodemap & ~bit, n - 1);
+        memcpy(&copy->items[0], &node->items[0], child_index*sizeof(node->items[0]));
+        memcpy(&copy->items[child_index], &node->items[child_index + 1], (n - child_index - 1)*sizeof(node->items[0]));
+        return copy;
+    } else {
+        hamt_node_t *copy = new_hamt_node(node->datamap, node->nodemap, n);
+        memcpy(copy->items, node->items, n*sizeof(node->items[0]));
+        copy->items[child_index].child = child;
+        return copy;
+    }
+}
+
+// Point the slot for an entry at a different position
+static hamt_node_t *hamt_move(const hamt_node_t *node, uint32_t shift, uint32_t hash, uint32_t index1, uint32_t new_index1)
+{
+    uint32_t n = num_items(node, shift);
+    hamt_node_t *copy = new_hamt_node(node->datamap, node->nodemap, n);
+    memcpy(copy->items, node->items, n*sizeof(node->items[0]));
+    if (is_collision_node(shift)) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (copy->items[i].slot.index1 == index1)
+                copy->items[i].slot.index1 = new_index1;
+        }
+        return copy;
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & MASK);
+    if (node->datamap & bit) {
+        copy->items[popcount(node->datamap & (bit - 1))].slot.index1 = new_index1;
+    } else {
+        uint32_t child_index = popcount(node->datamap) + popcount(node->nodemap & (bit - 1));
+        copy->items[child_index].child = hamt_move(node->items[child_index].child, shift + BITS, hash, index1, new_index1);
+    }
+    return copy;
+}
+
+void sss_hashmap_make_persistent(sss_hashmap_t *h, hash_fn_t key_hash, size_t entry_size_padded)
+{
+    persistent_t *p = GC_MALLOC(sizeof(persistent_t));
+
+    // Build the trie bottom-up, starting with leaves of 32 entries:
+    uint32_t num_nodes = (h->count + MASK) / WIDTH;
+    void **nodes = GC_MALLOC(num_nodes*sizeof(void*));
+    for (uint32_t i = 0; i < num_nodes; i++) {
+        nodes[i] = GC_MALLOC(WIDTH*entry_size_padded);
+        memcpy(nodes[i], h->entries + i*WIDTH*entry_size_padded, MIN(WIDTH, h->count - i*WIDTH)*entry_size_padded);
+    }
+    for (; num_nodes > 1; ++p->depth) {
+        uint32_t num_parents = (num_nodes + MASK) / WIDTH;
+        for (uint32_t i = 0; i < num_parents; i++) {
+            trie_node_t *parent = GC_MALLOC(sizeof(trie_node_t));
+            memcpy(parent->children, &nodes[i*WIDTH], MIN(WIDTH, num_nodes - i*WIDTH)*sizeof(void*));
+            nodes[i] = parent;
+        }
+        num_nodes = num_parents;
+    }
+    p->entries = nodes[0];
+
+    for (uint32_t i = 0; i < h->count; i++)
+        p->index = hamt_insert(p->index, 0, (hamt_slot_t){key_hash(h->entries + i*entry_size_padded), i + 1});
+
+    h->entries = NULL;
+    h->buckets = p;
+    h->capacity = 0;
+    h->growth_left = 0;
+    h->copy_on_write = true;
+}
+
+void *sss_persistent_hashmap_get_raw(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset)
+{
+    persistent_t *p = PERSISTENT(h);
+    uint32_t index1 = hamt_find(p, key_hash(key), key, key_cmp, entry_size_padded);
+    return index1 ? trie_entry(p, index1 - 1, entry_size_padded) + value_offset : NULL;
+}
+
+void *sss_persistent_hashmap_set(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key, size_t value_offset, const void *value)
+{
+    persistent_t *p = PERSISTENT(h);
+    persistent_t *updated = GC_MALLOC(sizeof(persistent_t));
+    *updated = (persistent_t){.entries=p->entries, .index=p->index, .depth=p->depth};
+
+    // Even if the value doesn't change, the caller may write to the address
+    // that's returned, so the entry always gets a new home:
+    char *home;
+    uint32_t hash = key_hash(key);
+    size_t value_size = entry_size_padded - value_offset;
+    uint32_t index1 = hamt_find(p, hash, key, key_cmp, entry_size_padded);
+    if (index1) {
+        updated->entries = trie_assoc(p->entries, p->depth, index1 - 1, entry_size_padded, &home);
+    } else {
+        if (!value && value_size > 0) {
+            for (sss_hashmap_t *iter = h->fallback; iter; iter = iter->fallback) {
+                value = sss_hashmap_get_raw(iter, key_hash, key_cmp, entry_size_padded, key, value_offset);
+                if (value) break;
+            }
+            for (sss_hashmap_t *iter = h; !value && iter; iter = iter->fallback) {
+                if (iter->default_value) value = iter->default_value;
+            }
+        }
+
+        if (h->count == UINT32_MAX)
+            errx(1, "This table is too big (tables can hold at most %u entries)", UINT32_MAX);
+        index1 = h->count + 1;
+        if (BITS*(updated->depth + 1) < 32 && (index1 - 1) >> (BITS*(updated->depth + 1))) {
+            trie_node_t *root = GC_MALLOC(sizeof(trie_node_t));
+            root->children[0] = updated->entries;
+            updated->entries = root;
+            ++updated->depth;
+        }
+        updated->entries = trie_assoc(updated->entries, updated->depth, index1 - 1, entry_size_padded, &home);
+        memcpy(home, key, value_offset);
+        updated->index = hamt_insert(p->index, 0, (hamt_slot_t){hash, index1});
+        h->count = index1;
+    }
+
+    if (value && value_size > 0)
+        memcpy(home + value_offset, value, value_size);
+    h->buckets = updated;
+    return home + value_offset;
+}
+
+void sss_persistent_hashmap_remove(sss_hashmap_t *h, hash_fn_t key_hash, cmp_fn_t key_cmp, size_t entry_size_padded, const void *key)
+{
+    persistent_t *p = PERSISTENT(h);
+    // If unspecified, pop a random key:
+    if (!key)
+        key = trie_entry(p, arc4random_uniform(h->count), entry_size_padded);
+
+    uint32_t hash = key_hash(key);
+    uint32_t index1 = hamt_find(p, hash, key, key_cmp, entry_size_padded);
+    if (!index1) return;
+
+    if (h->count == 1) {
+        h->buckets = NULL;
+        h->count = 0;
+        h->copy_on_write = false;
+        return;
+    }
+
+    persistent_t *updated = GC_MALLOC(sizeof(persistent_t));
+    *updated = (persistent_t){.entries=p->entries, .index=p->index, .depth=p->depth};
+    updated->index = hamt_remove(p->index, 0, hash, index1);
+
+    // Move the last entry into the hole, the same as a regular table would:
+    char *home;
+    uint32_t last1 = h->count;
+    if (index1 != last1) {
+        char *last = trie_entry(p, last1 - 1, entry_size_padded);
+        updated->index = hamt_move(updated->index, 0, key_hash(last), last1, index1);
+        updated->entries = trie_assoc(updated->entries, updated->depth, index1 - 1, entry_size_padded, &home);
+        memcpy(home, last, entry_size_padded);
+    }
+    updated->entries = trie_assoc(updated->entries, updated->depth, last1 - 1, entry_size_padded, &home);
+    memset(home, 0, entry_size_padded);
+
+    --h->count;
+    h->buckets = updated;
+}
+
+char *sss_persistent_hashmap_entries(sss_hashmap_t *h, size_t entry_size_padded)
+{
+    persistent_t *p = PERSISTENT(h);
+    if (!p->flat) {
+        // Every copy of the table that shares this root has the same entries,
+        // so it's safe to cache them on the root
+        char *flat = GC_MALLOC(h->count*entry_size_padded);
+        for (uint32_t i = 0; i < h->count; i += WIDTH)
+            memcpy(flat + i*entry_size_padded, trie_entry(p, i, entry_size_padded), MIN(WIDTH, h->count - i)*entry_size_padded);
+        p->flat = flat;
+    }
+    return p->flat;
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
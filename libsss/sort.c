@@ -0,0 +1,502 @@
+// sort.c - Sorting arrays
+// Copyright 2023 Bruce Hill
+// Provided under the MIT license with the Commons Clause
+// See included LICENSE for details.
+
+// Arrays of integers and floating point numbers are sorted with an LSD radix
+// sort, or for short arrays, a pattern-defeating quicksort (pdqsort) that is
+// specialized for the item type, so comparisons are inlined. The compiler
+// sorts other arrays with a merge sort that it generates for the item type,
+// which also inlines comparisons (see array_sort_compiled()). When there's
+// only a comparison function, arrays are sorted with pdqsort, or a merge sort
+// when the sort needs to be stable. Long arrays are sorted in parallel when there are
+// multiple threads (see parallel.c): each thread sorts a block of the array
+// that way, and then the sorted blocks are merged.
+
+#include <gc.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "parallel.h"
+#include "sort.h"
+#include "string.h"
+#include "utils.h"
+
+#define INSERTION_SORT_THRESHOLD 24
+#define NINTHER_THRESHOLD 128
+#define PARTIAL_INSERTION_SORT_LIMIT 8
+#define MERGE_SORT_THRESHOLD 16
+// Below this length, pdqsort beats the radix sort's fixed costs:
+#define RADIX_SORT_THRESHOLD 512
+// Arrays at least this long are sorted in parallel
+#define PARALLEL_SORT_THRESHOLD (1 << 16)
+
+// Make sure the array's items are contiguous and not shared with other arrays
+static char *own_items(void *voidarr, size_t item_size, bool atomic)
+{
+    string_t *arr = voidarr;
+    if (arr->free < 0 || (size_t)arr->stride != item_size)
+        array_flatten(voidarr, item_size, atomic);
+    return (char*)arr->data;
+}
+
+#define SORT_NAME(x) generic_##x
+#define SORT_PARAMS , size_t item_size, cmp_fn_t compare
+#define SORT_ARGS , item_size, compare
+#define SORT_SIZE item_size
+#define SORT_LESS(a, b) (compare(a, b) < 0)
+#include "sort_impl.h"
+
+// Items of common sizes still use a comparison function, but get their own
+// copy of pdqsort so items can be moved without calling memcpy()
+#define SORT_NAME(x) generic8_##x
+#define SORT_PARAMS , cmp_fn_t compare
+#define SORT_ARGS , compare
+#define SORT_SIZE 8
+#define SORT_LESS(a, b) (compare(a, b) < 0)
+#include "sort_impl.h"
+
+#define SORT_NAME(x) generic16_##x
+#define SORT_PARAMS , cmp_fn_t compare
+#define SORT_ARGS , compare
+#define SORT_SIZE 16
+#define SORT_LESS(a, b) (compare(a, b) < 0)
+#include "sort_impl.h"
+
+#define SORT_NAME(x) generic24_##x
+#define SORT_PARAMS , cmp_fn_t compare
+#define SORT_ARGS , compare
+#define SORT_SIZE 24
+#define SORT_LESS(a, b) (compare(a, b) < 0)
+#include "sort_impl.h"
+
+// Numbers are sorted as unsigned integers of the same size. Signed integers
+// and floats are converted into unsigned integers that sort in the same
+// order beforehand, and converted back afterwards.
+#define SORT_NAME(x) u8_##x
+#define SORT_PARAMS
+#define SORT_ARGS
+#define SORT_SIZE sizeof(uint8_t)
+#define SORT_LESS(a, b) (*(const uint8_t*)(a) < *(const uint8_t*)(b))
+#include "sort_impl.h"
+
+#define SORT_NAME(x) u16_##x
+#define SORT_PARAMS
+#define SORT_ARGS
+#define SORT_SIZE sizeof(uint16_t)
+#define SORT_LESS(a, b) (*(const uint16_t*)(a) < *(const uint16_t*)(b))
+#include "sort_impl.h"
+
+#define SORT_NAME(x) u32_##x
+#define SORT_PARAMS
+#define SORT_ARGS
+#define SORT_SIZE sizeof(uint32_t)
+#define SORT_LESS(a, b) (*(const uint32_t*)(a) < *(const uint32_t*)(b))
+#include "sort_impl.h"
+
+#define SORT_NAME(x) u64_##x
+#define SORT_PARAMS
+#define SORT_ARGS
+#define SORT_SIZE sizeof(uint64_t)
+#define SORT_LESS(a, b) (*(const uint64_t*)(a) < *(const uint64_t*)(b))
+#include "sort_impl.h"
+
+// Parallel sorts need to sort blocks of items and merge them, which is done
+// differently for each kind of sort
+typedef struct sorter_s sorter_t;
+struct sorter_s {
+    size_t item_size;
+    cmp_fn_t *compare;
+    bool atomic;
+    block_sort_fn_t *block_sort;
+    block_merge_fn_t *block_merge;
+    void (*sort)(char *items, int64_t n, const sorter_t *s);
+    void (*merge)(const char *a, int64_t na, const char *b, int64_t nb, char *out, const sorter_t *s);
+    int64_t (*merge_split)(const char *a, int64_t na, const char *b, int64_t nb, int64_t k, const sorter_t *s);
+};
+
+// Sorter merge functions for one of the specializations above, given the
+// extra arguments it takes (starting with a comma)
+#define DEFINE_SORTER_MERGES(name, ...) \
+    static void name##_sorter_merge(const char *a, int64_t na, const char *b, int64_t nb, char *out, const sorter_t *s) \
+    { \
+        (void)s; \
+        name##_merge(a, na, b, nb, out __VA_ARGS__); \
+    } \
+    static int64_t name##_sorter_merge_split(const char *a, int64_t na, const char *b, int64_t nb, int64_t k, const sorter_t *s) \
+    { \
+        (void)s; \
+        return name##_merge_split(a, na, b, nb, k __VA_ARGS__); \
+    }
+
+DEFINE_SORTER_MERGES(generic, , s->item_size, s->compare)
+DEFINE_SORTER_MERGES(generic8, , s->compare)
+DEFINE_SORTER_MERGES(generic16, , s->compare)
+DEFINE_SORTER_MERGES(generic24, , s->compare)
+
+typedef struct {
+    const sorter_t *sorter;
+    char *src, *dest;
+    int64_t n, block_len;
+    // For each round of merges: the length of the sorted blocks being merged
+    // and how the merges are split into pieces
+    int64_t width, piece_len, pieces_per_merge;
+} sort_job_t;
+
+static void sort_blocks(int64_t start, int64_t end, void *userdata)
+{
+    sort_job_t *job = userdata;
+    int64_t size = (int64_t)job->sorter->item_size;
+    for (int64_t block = start; block < end; block++) {
+        int64_t first = block*job->block_len;
+        if (first >= job->n) break;
+        job->sorter->sort(job->src + first*size, MIN(job->block_len, job->n - first), job->sorter);
+    }
+}
+
+// Each piece is a range of the output of one merge of two neighboring blocks
+static void merge_pieces(int64_t start, int64_t end, void *userdata)
+{
+    sort_job_t *job = userdata;
+    const sorter_t *s = job->sorter;
+    int64_t size = (int64_t)s->item_size;
+    for (int64_t piece = start; piece < end; piece++) {
+        int64_t lo = (piece / job->pieces_per_merge) * 2*job->width;
+        int64_t mid = MIN(lo + job->width, job->n), hi = MIN(lo + 2*job->width, job->n);
+        int64_t k_start = (piece % job->pieces_per_merge) * job->piece_len;
+        if (lo + k_start >= hi) continue;
+        int64_t k_end = MIN(k_start + job->piece_len, hi - lo);
+
+        const char *a = job->src + lo*size, *b = job->src + mid*size;
+        int64_t na = mid - lo, nb = hi - mid;
+        int64_t a_start = s->merge_split(a, na, b, nb, k_start, s);
+        int64_t a_end = s->merge_split(a, na, b, nb, k_end, s);
+        int64_t b_start = k_start - a_start, b_end = k_end - a_end;
+        s->merge(a + a_start*size, a_end - a_start, b + b_start*size, b_end - b_start,
+                 job->dest + (lo + k_start)*size, s);
+    }
+}
+
+static void copy_items(int64_t start, int64_t end, void *userdata)
+{
+    sort_job_t *job = userdata;
+    int64_t size = (int64_t)job->sorter->item_size;
+    memcpy(job->dest + start*size, job->src + start*size, (size_t)((end - start)*size));
+}
+
+// Sort a block of the array on each thread, then merge neighboring blocks in
+// rounds until there's only one, going back and forth between the array and a
+// buffer. Every merge is split into pieces, so all the threads have work to do
+// even when there are only a couple of blocks left.
+static void parallel_sort(char *items, int64_t n, const sorter_t *s)
+{
+    int64_t threads = sss_thread_count();
+    size_t size = (size_t)n * s->item_size;
+    char *buf = s->atomic ? GC_MALLOC_ATOMIC(size) : GC_MALLOC(size);
+    sort_job_t job = {.sorter=s, .src=items, .dest=buf, .n=n, .block_len=(n + threads - 1)/threads};
+    sss_parallel_for(threads, 1, sort_blocks, &job);
+
+    job.piece_len = MAX(SSS_PARALLEL_GRAIN, (n + 4*threads - 1)/(4*threads));
+    for (job.width = job.block_len; job.width < n; job.width *= 2) {
+        int64_t merges = (n + 2*job.width - 1)/(2*job.width);
+        job.pieces_per_merge = (2*job.width + job.piece_len - 1)/job.piece_len;
+        sss_parallel_for(merges*job.pieces_per_merge, 1, merge_pieces, &job);
+        char *tmp = job.src;
+        job.src = job.dest;
+        job.dest = tmp;
+    }
+
+    if (job.src != items) {
+        job.dest = items;
+        sss_parallel_for(n, SSS_PARALLEL_GRAIN, copy_items, &job);
+    }
+    GC_FREE(buf);
+}
+
+static void sort_items(char *items, int64_t n, const sorter_t *s)
+{
+    if (n >= PARALLEL_SORT_THRESHOLD && sss_thread_count() > 1)
+        parallel_sort(items, n, s);
+    else
+        s->sort(items, n, s);
+}
+
+// Sort one byte at a time, starting with the least significant byte. Bytes
+// that are the same for every item are skipped, so small numbers only take
+// one or two passes.
+#define DEFINE_UNSIGNED_SORT(name, T) \
+    static void name##_radix_sort(T *items, int64_t n) \
+    { \
+        int64_t counts[sizeof(T)][256] = {{0}}; \
+        for (int64_t i = 0; i < n; i++) { \
+            for (size_t b = 0; b < sizeof(T); b++) \
+                ++counts[b][(items[i] >> (8*b)) & 0xFF]; \
+        } \
+        T *src = items, *dest = GC_MALLOC_ATOMIC((size_t)n * sizeof(T)), *buf = dest; \
+        for (size_t b = 0; b < sizeof(T); b++) { \
+            int64_t *offsets = counts[b]; \
+            if (offsets[(items[0] >> (8*b)) & 0xFF] == n) continue; \
+            int64_t offset = 0; \
+            for (int digit = 0; digit < 256; digit++) { \
+                int64_t count = offsets[digit]; \
+                offsets[digit] = offset; \
+                offset += count; \
+            } \
+            for (int64_t i = 0; i < n; i++) \
+                dest[offsets[(src[i] >> (8*b)) & 0xFF]++] = src[i]; \
+            T *tmp = src; \
+            src = dest; \
+            dest = tmp; \
+        } \
+        if (src != items) memcpy(items, src, (size_t)n * sizeof(T)); \
+        GC_FREE(buf); \
+    } \
+    static void name##_sorter_sort(char *items, int64_t n, const sorter_t *s) \
+    { \
+        (void)s; \
+        if (n < RADIX_SORT_THRESHOLD) \
+            name##_sort(items, n); \
+        else \
+            name##_radix_sort((T*)items, n); \
+    } \
+    DEFINE_SORTER_MERGES(name) \
+    static const sorter_t name##_sorter = { \
+        .item_size=sizeof(T), .atomic=true, .sort=name##_sorter_sort, \
+        .merge=name##_sorter_merge, .merge_split=name##_sorter_merge_split, \
+    };
+
+DEFINE_UNSIGNED_SORT(u8, uint8_t)
+DEFINE_UNSIGNED_SORT(u16, uint16_t)
+DEFINE_UNSIGNED_SORT(u32, uint32_t)
+DEFINE_UNSIGNED_SORT(u64, uint64_t)
+
+static const sorter_t *unsigned_sorter(size_t item_size)
+{
+    switch (item_size) {
+    case 1: return &u8_sorter;
+    case 2: return &u16_sorter;
+    case 4: return &u32_sorter;
+    case 8: return &u64_sorter;
+    default: return NULL;
+    }
+}
+
+// Signed integers and floats are converted into unsigned integers that sort
+// in the same order, and converted back afterwards
+typedef enum { FLIP_SIGN_BITS, FLOATS_TO_KEYS, KEYS_TO_FLOATS } conversion_e;
+
+typedef struct {
+    char *items;
+    size_t item_size;
+    conversion_e conversion;
+} conversion_job_t;
+
+#define CONVERT(T) do { \
+    T *items = (T*)job->items; \
+    const T sign = (T)1 << (8*sizeof(T) - 1); \
+    switch (job->conversion) { \
+    case FLIP_SIGN_BITS: \
+        for (int64_t i = start; i < end; i++) items[i] ^= sign; \
+        break; \
+    case FLOATS_TO_KEYS: \
+        for (int64_t i = start; i < end; i++) items[i] = (items[i] & sign) ? ~items[i] : (items[i] | sign); \
+        break; \
+    case KEYS_TO_FLOATS: \
+        for (int64_t i = start; i < end; i++) items[i] = (items[i] & sign) ? (items[i] & ~sign) : ~items[i]; \
+        break; \
+    } \
+} while (0)
+
+static void convert_range(int64_t start, int64_t end, void *userdata)
+{
+    conversion_job_t *job = userdata;
+    switch (job->item_size) {
+    case 1: CONVERT(uint8_t); break;
+    case 2: CONVERT(uint16_t); break;
+    case 4: CONVERT(uint32_t); break;
+    case 8: CONVERT(uint64_t); break;
+    }
+}
+#undef CONVERT
+
+static void convert(char *items, int64_t n, size_t item_size, conversion_e conversion)
+{
+    conversion_job_t job = {.items=items, .item_size=item_size, .conversion=conversion};
+    sss_parallel_for(n, SSS_PARALLEL_GRAIN, convert_range, &job);
+}
+
+static void generic_sorter_sort(char *items, int64_t n, const sorter_t *s) { generic_sort(items, n, s->item_size, s->compare); }
+static void generic8_sorter_sort(char *items, int64_t n, const sorter_t *s) { generic8_sort(items, n, s->compare); }
+static void generic16_sorter_sort(char *items, int64_t n, const sorter_t *s) { generic16_sort(items, n, s->compare); }
+static void generic24_sorter_sort(char *items, int64_t n, const sorter_t *s) { generic24_sort(items, n, s->compare); }
+
+void array_sort(void *arr, cmp_fn_t compare, size_t item_size, bool atomic)
+{
+    char *items = own_items(arr, item_size, atomic);
+    int64_t n = ((string_t*)arr)->length;
+    sorter_t s = {.item_size=item_size, .compare=compare, .atomic=atomic};
+    switch (item_size) {
+    case 8: s.sort = generic8_sorter_sort, s.merge = generic8_sorter_merge, s.merge_split = generic8_sorter_merge_split; break;
+    case 16: s.sort = generic16_sorter_sort, s.merge = generic16_sorter_merge, s.merge_split = generic16_sorter_merge_split; break;
+    case 24: s.sort = generic24_sorter_sort, s.merge = generic24_sorter_merge, s.merge_split = generic24_sorter_merge_split; break;
+    default: s.sort = generic_sorter_sort, s.merge = generic_sorter_merge, s.merge_split = generic_sorter_merge_split; break;
+    }
+    sort_items(items, n, &s);
+}
+
+void array_sort_ints(void *arr, size_t item_size, bool is_signed)
+{
+    const sorter_t *s = unsigned_sorter(item_size);
+    if (!s) fail("Unsupported integer size for sorting: %ld", item_size);
+    char *items = own_items(arr, item_size, true);
+    int64_t n = ((string_t*)arr)->length;
+    if (is_signed) convert(items, n, item_size, FLIP_SIGN_BITS);
+    sort_items(items, n, s);
+    if (is_signed) convert(items, n, item_size, FLIP_SIGN_BITS);
+}
+
+// Floats sort from -inf to inf, with -0 before 0, and NaNs at the end (in
+// their original order)
+void array_sort_nums(void *arr, size_t item_size)
+{
+    char *items = own_items(arr, item_size, true);
+    int64_t n = ((string_t*)arr)->length;
+
+    int64_t num_nans = 0;
+    char *nans = NULL;
+    for (int64_t i = 0; i < n; i++) {
+        char *item = items + i*(int64_t)item_size;
+        bool is_nan = item_size == sizeof(float) ? isnan(*(float*)item) : isnan(*(double*)item);
+        if (is_nan) {
+            if (!nans) nans = GC_MALLOC_ATOMIC((size_t)(n - i) * item_size);
+            memcpy(nans + (num_nans++)*(int64_t)item_size, item, item_size);
+        } else if (num_nans > 0) {
+            memcpy(items + (i - num_nans)*(int64_t)item_size, item, item_size);
+        }
+    }
+
+    int64_t len = n - num_nans;
+    convert(items, len, item_size, FLOATS_TO_KEYS);
+    sort_items(items, len, unsigned_sorter(item_size));
+    convert(items, len, item_size, KEYS_TO_FLOATS);
+
+    if (num_nans > 0)
+        memcpy(items + len*(int64_t)item_size, nans, (size_t)num_nans * item_size);
+}
+
+// Merge sort, using a buffer big enough for half of the items
+static void merge_sort(char *items, int64_t n, char *buf, size_t item_size, cmp_fn_t compare)
+{
+    if (n <= MERGE_SORT_THRESHOLD) {
+        // Insertion sort only moves items past ones that are greater, so it's stable
+        generic_insertion_sort(items, n, item_size, compare);
+        return;
+    }
+
+    int64_t half = n / 2;
+    char *mid = items + half*(int64_t)item_size;
+    merge_sort(items, half, buf, item_size, compare);
+    merge_sort(mid, n - half, buf, item_size, compare);
+    if (compare(mid, mid - item_size) >= 0)
+        return;
+
+    // Move the left half out of the way, then merge it with the right half.
+    // Taking from the left half on ties keeps equal items in order.
+    memcpy(buf, items, (size_t)half * item_size);
+    int64_t left = 0, right = half, dest = 0;
+    while (left < half && right < n) {
+        char *next = compare(items + right*(int64_t)item_size, buf + left*(int64_t)item_size) < 0 ?
+            items + (right++)*(int64_t)item_size : buf + (left++)*(int64_t)item_size;
+        memcpy(items + (dest++)*(int64_t)item_size, next, item_size);
+    }
+    // Anything left over on the right is already in place
+    memcpy(items + dest*(int64_t)item_size, buf + left*(int64_t)item_size, (size_t)(half - left) * item_size);
+}
+
+static void stable_sorter_sort(char *items, int64_t n, const sorter_t *s)
+{
+    if (n < 2) return;
+    size_t buf_size = (size_t)(n/2 + 1) * s->item_size;
+    char *buf = s->atomic ? GC_MALLOC_ATOMIC(buf_size) : GC_MALLOC(buf_size);
+    merge_sort(items, n, buf, s->item_size, s->compare);
+    GC_FREE(buf);
+}
+
+static void stable_sort(char *items, int64_t n, size_t item_size, cmp_fn_t compare, bool atomic)
+{
+    sorter_t s = {
+        .item_size=item_size, .compare=compare, .atomic=atomic, .sort=stable_sorter_sort,
+        .merge=generic_sorter_merge, .merge_split=generic_sorter_merge_split,
+    };
+    sort_items(items, n, &s);
+}
+
+void array_stable_sort(void *arr, cmp_fn_t compare, size_t item_size, bool atomic)
+{
+    char *items = own_items(arr, item_size, atomic);
+    stable_sort(items, ((string_t*)arr)->length, item_size, compare, atomic);
+}
+
+static void compiled_sorter_sort(char *items, int64_t n, const sorter_t *s)
+{
+    if (n < 2) return;
+    size_t buf_size = (size_t)(n/2 + 1) * s->item_size;
+    char *buf = s->atomic ? GC_MALLOC_ATOMIC(buf_size) : GC_MALLOC(buf_size);
+    s->block_sort(items, n, buf);
+    GC_FREE(buf);
+}
+
+static void compiled_sorter_merge(const char *a, int64_t na, const char *b, int64_t nb, char *out, const sorter_t *s)
+{
+    s->block_merge(a, na, b, nb, out);
+}
+
+// Stable sort with a merge sort and merge function that were compiled for the
+// item type. Only splitting up merges for parallel sorts uses `compare`, which
+// takes a few comparisons per merge.
+void array_sort_compiled(void *arr, block_sort_fn_t sort, block_merge_fn_t merge, cmp_fn_t compare, size_t item_size, bool atomic)
+{
+    char *items = own_items(arr, item_size, atomic);
+    sorter_t s = {
+        .item_size=item_size, .compare=compare, .atomic=atomic, .block_sort=sort, .block_merge=merge,
+        .sort=compiled_sorter_sort, .merge=compiled_sorter_merge, .merge_split=generic_sorter_merge_split,
+    };
+    sort_items(items, ((string_t*)arr)->length, &s);
+}
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+// Stable sort by keys, computing each item's key only once. The keys and items
+// are sorted together in pairs, with the key first so the key comparison
+// function can compare pairs.
+void array_sort_by(void *voidarr, get_key_fn_t get_key, void *userdata, cmp_fn_t key_compare, size_t key_size, size_t item_size, bool atomic)
+{
+    string_t *arr = voidarr;
+    int64_t n = arr->length;
+    if (n < 2) return;
+
+    size_t item_offset = ALIGN8(key_size), pair_size = item_offset + ALIGN8(item_size);
+    char *pairs = GC_MALLOC((size_t)n * pair_size);
+    for (int64_t i = 0; i < n; i++) {
+        char *pair = pairs + i*(int64_t)pair_size;
+        const char *item = arr->data + i*(int64_t)arr->stride;
+        memcpy(pair + item_offset, item, item_size);
+        get_key(item, pair, userdata);
+    }
+
+    stable_sort(pairs, n, pair_size, key_compare, false);
+
+    // The items go into a new buffer, so it doesn't matter if the old one was shared
+    char *items = atomic ? GC_MALLOC_ATOMIC((size_t)n * item_size) : GC_MALLOC((size_t)n * item_size);
+    for (int64_t i = 0; i < n; i++)
+        memcpy(items + i*(int64_t)item_size, pairs + i*(int64_t)pair_size + item_offset, item_size);
+    GC_FREE(pairs);
+    arr->data = items;
+    arr->stride = (int32_t)item_size;
+    arr->free = 0;
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
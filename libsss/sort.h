@@ -0,0 +1,20 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int32_t (cmp_fn_t)(const void *a, const void *b);
+typedef void (get_key_fn_t)(const void *item, void *key, void *userdata);
+// Stable sorting functions compiled for an item type (see compile/arrays.c)
+typedef void (block_sort_fn_t)(void *items, int64_t n, void *buf);
+typedef void (block_merge_fn_t)(const void *a, int64_t na, const void *b, int64_t nb, void *out);
+
+// Arrays (any array type, passed as a pointer to the array struct):
+void array_sort(void *arr, cmp_fn_t compare, size_t item_size, bool atomic);
+void array_stable_sort(void *arr, cmp_fn_t compare, size_t item_size, bool atomic);
+void array_sort_ints(void *arr, size_t item_size, bool is_signed);
+void array_sort_nums(void *arr, size_t item_size);
+void array_sort_compiled(void *arr, block_sort_fn_t sort, block_merge_fn_t merge, cmp_fn_t compare, size_t item_size, bool atomic);
+void array_sort_by(void *arr, get_key_fn_t get_key, void *userdata, cmp_fn_t key_compare, size_t key_size, size_t item_size, bool atomic);
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
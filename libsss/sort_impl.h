@@ -0,0 +1,311 @@
+// sort_impl.h - Pattern-defeating quicksort, included once per specialization
+// Copyright 2023 Bruce Hill
+// Provided under the MIT license with the Commons Clause
+// See included LICENSE for details.
+
+// This follows Orson Peters' pdqsort (https://github.com/orlp/pdqsort): a
+// quicksort that uses insertion sort on small ranges, picks pivots with a
+// median of three (or Tukey's ninther on big ranges), handles runs of equal
+// items in linear time, notices ranges that are already sorted, and breaks up
+// patterns that cause bad partitions, falling back to heapsort if there are
+// too many of them.
+//
+// Before including this file, define:
+//   SORT_NAME(x)     - prefix for the generated functions' names
+//   SORT_PARAMS      - extra parameters for the functions (starting with a comma)
+//   SORT_ARGS        - the extra arguments to pass along (starting with a comma)
+//   SORT_SIZE        - the size of each item
+//   SORT_LESS(a, b)  - whether the item at `a` sorts before the one at `b`
+// The generated entry point is `SORT_NAME(sort)(char *items, int64_t n SORT_PARAMS)`.
+// This also generates `SORT_NAME(merge)` and `SORT_NAME(merge_split)` for
+// merging sorted ranges, which parallel sorts use to combine sorted blocks.
+
+#define AT(p, i) ((p) + (int64_t)(i)*(int64_t)(SORT_SIZE))
+#define COPY(dest, src) memcpy(dest, src, SORT_SIZE)
+#define SWAP(a, b) do { char *_a = (a), *_b = (b); COPY(tmp, _a); COPY(_a, _b); COPY(_b, tmp); } while (0)
+
+static void SORT_NAME(insertion_sort)(char *begin, int64_t n SORT_PARAMS)
+{
+    char tmp[SORT_SIZE];
+    for (int64_t i = 1; i < n; i++) {
+        if (!SORT_LESS(AT(begin, i), AT(begin, i-1))) continue;
+        COPY(tmp, AT(begin, i));
+        int64_t j = i;
+        do {
+            COPY(AT(begin, j), AT(begin, j-1));
+            --j;
+        } while (j > 0 && SORT_LESS(tmp, AT(begin, j-1)));
+        COPY(AT(begin, j), tmp);
+    }
+}
+
+// Insertion sort for ranges that aren't at the start, so the item before the
+// range is known to not be greater than anything in it
+static void SORT_NAME(unguarded_insertion_sort)(char *begin, int64_t n SORT_PARAMS)
+{
+    char tmp[SORT_SIZE];
+    for (int64_t i = 1; i < n; i++) {
+        if (!SORT_LESS(AT(begin, i), AT(begin, i-1))) continue;
+        COPY(tmp, AT(begin, i));
+        int64_t j = i;
+        do {
+            COPY(AT(begin, j), AT(begin, j-1));
+            --j;
+        } while (SORT_LESS(tmp, AT(begin, j-1)));
+        COPY(AT(begin, j), tmp);
+    }
+}
+
+// Insertion sort that gives up if it has to move too many items, returning
+// whether the range got sorted
+static bool SORT_NAME(partial_insertion_sort)(char *begin, int64_t n SORT_PARAMS)
+{
+    char tmp[SORT_SIZE];
+    int64_t moved = 0;
+    for (int64_t i = 1; i < n; i++) {
+        if (SORT_LESS(AT(begin, i), AT(begin, i-1))) {
+            COPY(tmp, AT(begin, i));
+            int64_t j = i;
+            do {
+                COPY(AT(begin, j), AT(begin, j-1));
+                --j;
+            } while (j > 0 && SORT_LESS(tmp, AT(begin, j-1)));
+            COPY(AT(begin, j), tmp);
+            moved += i - j;
+        }
+        if (moved > PARTIAL_INSERTION_SORT_LIMIT) return false;
+    }
+    return true;
+}
+
+static void SORT_NAME(sift_down)(char *begin, int64_t n, int64_t i SORT_PARAMS)
+{
+    char tmp[SORT_SIZE];
+    for (;;) {
+        int64_t child = 2*i + 1;
+        if (child >= n) return;
+        if (child + 1 < n && SORT_LESS(AT(begin, child), AT(begin, child+1)))
+            ++child;
+        if (!SORT_LESS(AT(begin, i), AT(begin, child))) return;
+        SWAP(AT(begin, i), AT(begin, child));
+        i = child;
+    }
+}
+
+static void SORT_NAME(heapsort)(char *begin, int64_t n SORT_PARAMS)
+{
+    char tmp[SORT_SIZE];
+    for (int64_t i = n/2 - 1; i >= 0; i--)
+        SORT_NAME(sift_down)(begin, n, i SORT_ARGS);
+    for (int64_t end = n - 1; end > 0; end--) {
+        SWAP(begin, AT(begin, end));
+        SORT_NAME(sift_down)(begin, end, 0 SORT_ARGS);
+    }
+}
+
+static void SORT_NAME(sort2)(char *a, char *b SORT_PARAMS)
+{
+    char tmp[SORT_SIZE];
+    if (SORT_LESS(b, a)) SWAP(a, b);
+}
+
+static void SORT_NAME(sort3)(char *a, char *b, char *c SORT_PARAMS)
+{
+    SORT_NAME(sort2)(a, b SORT_ARGS);
+    SORT_NAME(sort2)(b, c SORT_ARGS);
+    SORT_NAME(sort2)(a, b SORT_ARGS);
+}
+
+// Partition around the first item, putting items equal to it on the right.
+// Returns the pivot's new index and whether the range was already partitioned.
+static int64_t SORT_NAME(partition_right)(char *begin, int64_t n, bool *already_partitioned SORT_PARAMS)
+{
+    char tmp[SORT_SIZE], pivot[SORT_SIZE];
+    COPY(pivot, begin);
+    int64_t first = 0, last = n;
+    while (SORT_LESS(AT(begin, ++first), pivot))
+        continue;
+    if (first == 1) {
+        while (first < last && !SORT_LESS(AT(begin, --last), pivot))
+            continue;
+    } else {
+        while (!SORT_LESS(AT(begin, --last), pivot))
+            continue;
+    }
+    *already_partitioned = first >= last;
+    while (first < last) {
+        SWAP(AT(begin, first), AT(begin, last));
+        while (SORT_LESS(AT(begin, ++first), pivot))
+            continue;
+        while (!SORT_LESS(AT(begin, --last), pivot))
+            continue;
+    }
+    int64_t pivot_pos = first - 1;
+    COPY(begin, AT(begin, pivot_pos));
+    COPY(AT(begin, pivot_pos), pivot);
+    return pivot_pos;
+}
+
+// Partition around the first item, putting items equal to it on the left.
+// This is used when the pivot is equal to the item before the range, which
+// means nothing in the range is smaller than it, so all the items equal to
+// the pivot end up in place.
+static int64_t SORT_NAME(partition_left)(char *begin, int64_t n SORT_PARAMS)
+{
+    char tmp[SORT_SIZE], pivot[SORT_SIZE];
+    COPY(pivot, begin);
+    int64_t first = 0, last = n;
+    while (SORT_LESS(pivot, AT(begin, --last)))
+        continue;
+    if (last + 1 == n) {
+        while (first < last && !SORT_LESS(pivot, AT(begin, ++first)))
+            continue;
+    } else {
+        while (!SORT_LESS(pivot, AT(begin, ++first)))
+            continue;
+    }
+    while (first < last) {
+        SWAP(AT(begin, first), AT(begin, last));
+        while (SORT_LESS(pivot, AT(begin, --last)))
+            continue;
+        while (!SORT_LESS(pivot, AT(begin, ++first)))
+            continue;
+    }
+    COPY(begin, AT(begin, last));
+    COPY(AT(begin, last), pivot);
+    return last;
+}
+
+static void SORT_NAME(loop)(char *begin, int64_t n, int bad_allowed, bool leftmost SORT_PARAMS)
+{
+    char tmp[SORT_SIZE];
+    for (;;) {
+        if (n < INSERTION_SORT_THRESHOLD) {
+            if (leftmost)
+                SORT_NAME(insertion_sort)(begin, n SORT_ARGS);
+            else
+                SORT_NAME(unguarded_insertion_sort)(begin, n SORT_ARGS);
+            return;
+        }
+
+        // Move the median of three (or the ninther) to the front as the pivot
+        int64_t half = n / 2;
+        if (n > NINTHER_THRESHOLD) {
+            SORT_NAME(sort3)(begin, AT(begin, half), AT(begin, n-1) SORT_ARGS);
+            SORT_NAME(sort3)(AT(begin, 1), AT(begin, half-1), AT(begin, n-2) SORT_ARGS);
+            SORT_NAME(sort3)(AT(begin, 2), AT(begin, half+1), AT(begin, n-3) SORT_ARGS);
+            SORT_NAME(sort3)(AT(begin, half-1), AT(begin, half), AT(begin, half+1) SORT_ARGS);
+            SWAP(begin, AT(begin, half));
+        } else {
+            SORT_NAME(sort3)(AT(begin, half), begin, AT(begin, n-1) SORT_ARGS);
+        }
+
+        // If the pivot is equal to the item before this range, it's the
+        // smallest value here, so put everything equal to it in place and
+        // only sort what's left
+        if (!leftmost && !SORT_LESS(AT(begin, -1), begin)) {
+            int64_t pivot_pos = SORT_NAME(partition_left)(begin, n SORT_ARGS);
+            begin = AT(begin, pivot_pos + 1);
+            n -= pivot_pos + 1;
+            continue;
+        }
+
+        bool already_partitioned;
+        int64_t pivot_pos = SORT_NAME(partition_right)(begin, n, &already_partitioned SORT_ARGS);
+        int64_t left_n = pivot_pos, right_n = n - (pivot_pos + 1);
+        char *pivot = AT(begin, pivot_pos), *end = AT(begin, n);
+
+        if (left_n < n/8 || right_n < n/8) {
+            // A bad partition: give up on quicksort if it keeps happening,
+            // otherwise shuffle some items around to break up the pattern
+            if (--bad_allowed == 0) {
+                SORT_NAME(heapsort)(begin, n SORT_ARGS);
+                return;
+            }
+            if (left_n >= INSERTION_SORT_THRESHOLD) {
+                SWAP(begin, AT(begin, left_n/4));
+                SWAP(AT(pivot, -1), AT(pivot, -left_n/4));
+                if (left_n > NINTHER_THRESHOLD) {
+                    SWAP(AT(begin, 1), AT(begin, left_n/4 + 1));
+                    SWAP(AT(begin, 2), AT(begin, left_n/4 + 2));
+                    SWAP(AT(pivot, -2), AT(pivot, -(left_n/4 + 1)));
+                    SWAP(AT(pivot, -3), AT(pivot, -(left_n/4 + 2)));
+                }
+            }
+            if (right_n >= INSERTION_SORT_THRESHOLD) {
+                SWAP(AT(pivot, 1), AT(pivot, 1 + right_n/4));
+                SWAP(AT(end, -1), AT(end, -right_n/4));
+                if (right_n > NINTHER_THRESHOLD) {
+                    SWAP(AT(pivot, 2), AT(pivot, 2 + right_n/4));
+                    SWAP(AT(pivot, 3), AT(pivot, 3 + right_n/4));
+                    SWAP(AT(end, -2), AT(end, -(1 + right_n/4)));
+                    SWAP(AT(end, -3), AT(end, -(2 + right_n/4)));
+                }
+            }
+        } else if (already_partitioned
+                   && SORT_NAME(partial_insertion_sort)(begin, left_n SORT_ARGS)
+                   && SORT_NAME(partial_insertion_sort)(AT(pivot, 1), right_n SORT_ARGS)) {
+            // The range was (nearly) sorted already
+            return;
+        }
+
+        SORT_NAME(loop)(begin, left_n, bad_allowed, leftmost SORT_ARGS);
+        begin = AT(pivot, 1);
+        n = right_n;
+        leftmost = false;
+    }
+}
+
+static void SORT_NAME(sort)(char *items, int64_t n SORT_PARAMS)
+{
+    if (n < 2) return;
+    int bad_allowed = 1;
+    for (int64_t i = n; i > 1; i >>= 1)
+        ++bad_allowed;
+    SORT_NAME(loop)(items, n, bad_allowed, true SORT_ARGS);
+}
+
+// Merge two sorted ranges into `out`. On ties, items from `a` go first, so
+// this is stable.
+static void SORT_NAME(merge)(const char *a, int64_t na, const char *b, int64_t nb, char *out SORT_PARAMS)
+{
+    const char *a_end = AT(a, na), *b_end = AT(b, nb);
+    while (a < a_end && b < b_end) {
+        if (SORT_LESS(b, a)) {
+            COPY(out, b);
+            b = AT(b, 1);
+        } else {
+            COPY(out, a);
+            a = AT(a, 1);
+        }
+        out = AT(out, 1);
+    }
+    if (a < a_end) memcpy(out, a, (size_t)(a_end - a));
+    if (b < b_end) memcpy(out, b, (size_t)(b_end - b));
+}
+
+// How many of the first `k` items that merge() would output come from `a`.
+// This lets a merge be split into pieces that are done independently.
+static int64_t SORT_NAME(merge_split)(const char *a, int64_t na, const char *b, int64_t nb, int64_t k SORT_PARAMS)
+{
+    int64_t lo = k > nb ? k - nb : 0, hi = k < na ? k : na;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo)/2;
+        if (SORT_LESS(AT(b, k - mid - 1), AT(a, mid)))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+#undef AT
+#undef COPY
+#undef SWAP
+#undef SORT_NAME
+#undef SORT_PARAMS
+#undef SORT_ARGS
+#undef SORT_SIZE
+#undef SORT_LESS
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -0,0 +1,128 @@
+// Benchmark for sorting arrays of Int, Num, Str, and structs, compared to qsort().
+// `make sortbench` builds it against the runtime library. Pass array lengths
+// as arguments to change them from the default (1M and 10M items).
+#include <gc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sort.h"
+#include "string.h"
+
+typedef struct { char *items; int64_t length; int32_t stride, free; } array_t;
+typedef struct { int64_t id; double score; } record_t;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec*1e-9;
+}
+
+static uint64_t random_u64(void)
+{
+    static uint64_t state = 88172645463325252ull;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+static int32_t compare_ints(const void *a, const void *b)
+{
+    int64_t x = *(int64_t*)a, y = *(int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int32_t compare_nums(const void *a, const void *b)
+{
+    double x = *(double*)a, y = *(double*)b;
+    return (x > y) - (x < y);
+}
+
+static int32_t compare_strs(const void *a, const void *b)
+{
+    const string_t *x = a, *y = b;
+    int cmp = memcmp(x->data, y->data, (size_t)(x->length < y->length ? x->length : y->length));
+    if (cmp) return cmp;
+    return (x->length > y->length) - (x->length < y->length);
+}
+
+static int32_t compare_records(const void *a, const void *b)
+{
+    const record_t *x = a, *y = b;
+    if (x->id != y->id) return (x->id > y->id) - (x->id < y->id);
+    return (x->score > y->score) - (x->score < y->score);
+}
+
+static void get_score(const void *item, void *key, void *userdata)
+{
+    (void)userdata;
+    *(double*)key = ((record_t*)item)->score;
+}
+
+static void report(const char *what, int64_t n, double start)
+{
+    printf("  %-28s %8.2f Mitems/s\n", what, (double)n/(now() - start)/1e6);
+}
+
+#define BENCH(what, n, item_size, sort) do { \
+        array_t arr = {GC_MALLOC_ATOMIC((size_t)(n)*(item_size)), n, (int32_t)(item_size), 0}; \
+        memcpy(arr.items, original, (size_t)(n)*(item_size)); \
+        double start = now(); \
+        sort; \
+        report(what, n, start); \
+    } while (0)
+
+int main(int argc, char *argv[]) {
+    GC_INIT();
+    int64_t default_lengths[] = {1000000, 10000000};
+    int64_t num_lengths = argc > 1 ? argc - 1 : 2;
+    for (int64_t l = 0; l < num_lengths; l++) {
+        int64_t n = argc > 1 ? strtol(argv[l+1], NULL, 10) : default_lengths[l];
+        printf("%ld items:\n", n);
+
+        int64_t *ints = GC_MALLOC_ATOMIC((size_t)n*sizeof(int64_t));
+        for (int64_t i = 0; i < n; i++) ints[i] = (int64_t)random_u64();
+        void *original = ints;
+        BENCH("Int qsort()", n, sizeof(int64_t), qsort(arr.items, n, sizeof(int64_t), (void*)compare_ints));
+        BENCH("Int pdqsort", n, sizeof(int64_t), array_sort(&arr, compare_ints, sizeof(int64_t), true));
+        BENCH("Int radix sort", n, sizeof(int64_t), array_sort_ints(&arr, sizeof(int64_t), true));
+        for (int64_t i = 0; i < n; i++) ints[i] = (int64_t)(random_u64() % 1000);
+        BENCH("Int 0-999 qsort()", n, sizeof(int64_t), qsort(arr.items, n, sizeof(int64_t), (void*)compare_ints));
+        BENCH("Int 0-999 radix sort", n, sizeof(int64_t), array_sort_ints(&arr, sizeof(int64_t), true));
+        GC_FREE(ints);
+
+        double *nums = GC_MALLOC_ATOMIC((size_t)n*sizeof(double));
+        for (int64_t i = 0; i < n; i++) nums[i] = (double)(int64_t)random_u64() / 1e9;
+        original = nums;
+        BENCH("Num qsort()", n, sizeof(double), qsort(arr.items, n, sizeof(double), (void*)compare_nums));
+        BENCH("Num pdqsort", n, sizeof(double), array_sort(&arr, compare_nums, sizeof(double), true));
+        BENCH("Num radix sort", n, sizeof(double), array_sort_nums(&arr, sizeof(double)));
+        GC_FREE(nums);
+
+        string_t *strs = GC_MALLOC((size_t)n*sizeof(string_t));
+        for (int64_t i = 0; i < n; i++) {
+            char *str = GC_MALLOC_ATOMIC(16);
+            int len = snprintf(str, 16, "%lx", random_u64() % 100000000000ul);
+            strs[i] = (string_t){.data=str, .length=len, .stride=1};
+        }
+        original = strs;
+        BENCH("Str qsort()", n, sizeof(string_t), qsort(arr.items, n, sizeof(string_t), (void*)compare_strs));
+        BENCH("Str pdqsort", n, sizeof(string_t), array_sort(&arr, compare_strs, sizeof(string_t), false));
+        BENCH("Str stable sort", n, sizeof(string_t), array_stable_sort(&arr, compare_strs, sizeof(string_t), false));
+        strs = NULL;
+
+        record_t *records = GC_MALLOC_ATOMIC((size_t)n*sizeof(record_t));
+        for (int64_t i = 0; i < n; i++)
+            records[i] = (record_t){(int64_t)(random_u64() % 1000), (double)random_u64()};
+        original = records;
+        BENCH("Struct qsort()", n, sizeof(record_t), qsort(arr.items, n, sizeof(record_t), (void*)compare_records));
+        BENCH("Struct pdqsort", n, sizeof(record_t), array_sort(&arr, compare_records, sizeof(record_t), true));
+        BENCH("Struct stable sort", n, sizeof(record_t), array_stable_sort(&arr, compare_records, sizeof(record_t), true));
+        BENCH("Struct sort by Num key", n, sizeof(record_t), array_sort_by(&arr, get_score, NULL, compare_nums, sizeof(double), sizeof(record_t), true));
+        GC_FREE(records);
+    }
+    return 0;
+}
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
@@ -15,21 +15,21 @@
 
 string_t sss_string_uppercased(string_t s) {
     char *s2 = GC_MALLOC_ATOMIC(s.length + 1);
-    for (int32_t i = 0; i < s.length; i++)
+    for (int64_t i = 0; i < s.length; i++)
         s2[i] = toupper(s.data[i*s.stride]);
     return (string_t){.data=s2, .length=s.length, .stride=1};
 }
 
 string_t sss_string_lowercased(string_t s) {
     char *s2 = GC_MALLOC_ATOMIC(s.length + 1);
-    for (int32_t i = 0; i < s.length; i++)
+    for (int64_t i = 0; i < s.length; i++)
         s2[i] = tolower(s.data[i*s.stride]);
     return (string_t){.data=s2, .length=s.length, .stride=1};
 }
 
 string_t sss_string_capitalized(string_t s) {
     char *s2 = GC_MALLOC_ATOMIC(s.length + 1);
-    int32_t i;
+    int64_t i;
     for (i = 0; i < s.length; i++) {
         if (isalpha(s.data[i*s.stride])) {
             s2[i] = toupper(s.data[i*s.stride]);
@@ -47,7 +47,7 @@ string_t sss_string_capitalized(string_t s) {
 string_t sss_string_titlecased(string_t s) {
     char *s2 = GC_MALLOC_ATOMIC(s.length + 1);
     bool should_uppercase = true;
-    for (int32_t i = 0; i < s.length; i++) {
+    for (int64_t i = 0; i < s.length; i++) {
         if (isalpha(s.data[i*s.stride])) {
             if (should_uppercase) {
                 s2[i] = toupper(s.data[i*s.stride]);
@@ -65,7 +65,7 @@ string_t sss_string_titlecased(string_t s) {
 
 bool sss_string_starts_with(string_t s, string_t prefix) {
     if (s.length < prefix.length) return false;
-    for (int32_t i = 0; i < prefix.length; i++) {
+    for (int64_t i = 0; i < prefix.length; i++) {
         if (s.data[i*s.stride] != prefix.data[i*prefix.stride])
             return false;
     }
@@ -74,7 +74,7 @@ bool sss_string_starts_with(string_t s, string_t prefix) {
 
 bool sss_string_ends_with(string_t s, string_t suffix) {
     if (s.length < suffix.length) return false;
-    for (int32_t i = 0; i < suffix.length; i++) {
+    for (int64_t i = 0; i < suffix.length; i++) {
         if (s.data[(s.length-suffix.length+i)*s.stride] != suffix.data[i*suffix.stride])
             return false;
     }
@@ -83,7 +83,7 @@ bool sss_string_ends_with(string_t s, string_t suffix) {
 
 string_t sss_string_without_prefix(string_t s, string_t prefix) {
     if (s.length < prefix.length) return s;
-    for (int32_t i = 0; i < prefix.length; i++) {
+    for (int64_t i = 0; i < prefix.length; i++) {
         if (s.data[i*s.stride] != prefix.data[i*prefix.stride])
             return s;
     }
@@ -97,7 +97,7 @@ string_t sss_string_without_prefix(string_t s, string_t prefix) {
 
 string_t sss_string_without_suffix(string_t s, string_t suffix) {
     if (s.length < suffix.length) return s;
-    for (int32_t i = 0; i < suffix.length; i++) {
+    for (int64_t i = 0; i < suffix.length; i++) {
         if (s.data[(s.length - suffix.length + i)*s.stride] != suffix.data[i*suffix.stride])
             return s;
     }
@@ -111,11 +111,11 @@ string_t sss_string_without_suffix(string_t s, string_t suffix) {
 
 string_t sss_string_trimmed(string_t s, string_t trim_chars, bool trim_left, bool trim_right)
 {
-    int32_t len = s.length;
-    int32_t start = 0;
+    int64_t len = s.length;
+    int64_t start = 0;
     if (trim_left) {
         for (; start < s.length; start++) {
-            for (int32_t t = 0; t < trim_chars.length; t++) {
+            for (int64_t t = 0; t < trim_chars.length; t++) {
                 if (s.data[start*s.stride] == trim_chars.data[t*trim_chars.stride])
                     goto found_ltrim;
             }
@@ -127,7 +127,7 @@ string_t sss_string_trimmed(string_t s, string_t trim_chars, bool trim_left, boo
   done_trimming_left:;
     if (trim_right) {
         while (len > 0) {
-            for (int32_t t = 0; t < trim_chars.length; t++) {
+            for (int64_t t = 0; t < trim_chars.length; t++) {
                 if (s.data[(start+len-1)*s.stride] == trim_chars.data[t*trim_chars.stride])
                     goto found_rtrim;
             }
@@ -141,12 +141,12 @@ string_t sss_string_trimmed(string_t s, string_t trim_chars, bool trim_left, boo
 }
 
 string_t sss_string_slice(string_t s, range_t *r) {
-    if (r->stride > INT16_MAX || r->stride < INT16_MIN)
+    if (r->stride > INT32_MAX || r->stride < INT32_MIN)
         errx(1, "Invalid string slice stride: %ld", r->stride);
-    int16_t stride = (int16_t)r->stride;
-    int32_t first = (int32_t)CLAMP(r->first-1, 0, (int64_t)s.length-1),
-            last = (int32_t)CLAMP(r->last-1, 0, (int64_t)s.length-1);
-    int32_t slice_len = (last - first)/stride;
+    int32_t stride = (int32_t)r->stride;
+    int64_t first = CLAMP(r->first-1, 0, s.length-1),
+            last = CLAMP(r->last-1, 0, s.length-1);
+    int64_t slice_len = (last - first)/stride;
     return (string_t){.data=&s.data[first*s.stride], .length=slice_len, .stride=stride};
 }
 
@@ -154,7 +154,7 @@ string_t flatten(string_t str)
 {
     if (str.stride == 1) return str;
     char *buf = GC_MALLOC_ATOMIC(str.length + 1);
-    for (int32_t i = 0; i < str.length; i++)
+    for (int64_t i = 0; i < str.length; i++)
         buf[i] = str.data[i*str.stride];
     return (string_t){.data=buf, .length=str.length, .stride=1};
 }
@@ -171,7 +171,7 @@ const char *c_string(string_t str)
         return str.data;
 
     char *buf = GC_MALLOC_ATOMIC(str.length + 1);
-    for (int32_t i = 0; i < str.length; i++)
+    for (int64_t i = 0; i < str.length; i++)
         buf[i] = str.data[i*str.stride];
     buf[str.length] = '\0';
     return buf;
@@ -194,8 +194,8 @@ find_result_t sss_string_find(string_t str, string_t pat)
 
     // For short strings, do naive approach:
     // if (str.length*pat.length < UCHAR_MAX) {
-    for (int32_t s = 0; s < str.length; s++) {
-        for (int32_t p = 0; p < pat.length; p++) {
+    for (int64_t s = 0; s < str.length; s++) {
+        for (int64_t p = 0; p < pat.length; p++) {
             if (str.data[s*str.stride] != pat.data[p*pat.stride])
                 goto not_a_match;
         }
@@ -207,18 +207,18 @@ find_result_t sss_string_find(string_t str, string_t pat)
 
     // // Boyer-Moore algorithm:
     // static int skip[UCHAR_MAX];
-    // for (int32_t i = 0; i <= UCHAR_MAX; ++i)
+    // for (int64_t i = 0; i <= UCHAR_MAX; ++i)
     //     skip[i] = str.length;
-    // for (int32_t i = 0; i < pat.length; ++i)
+    // for (int64_t i = 0; i < pat.length; ++i)
     //     skip[(unsigned char)pat.data[i*pat.stride]] = pat.length - i - 1;
     // char lastpatchar = pat.data[(pat.length - 1)*pat.stride];
     // int32_t min_skip = pat.length;
-    // for (int32_t p = 0; p < pat.length - 1; ++p) {
+    // for (int64_t p = 0; p < pat.length - 1; ++p) {
     //     if (pat.data[p*pat.stride] == lastpatchar)
     //         min_skip = pat.length - p - 1;
     // }
 
-    // for (int32_t i = pat.length - 1; i < str.length; ) {
+    // for (int64_t i = pat.length - 1; i < str.length; ) {
     //     // Use skip table:
     //     int32_t can_skip = skip[(unsigned char)str.data[i*str.stride]];
     //     if (can_skip != 0) {
@@ -226,7 +226,7 @@ find_result_t sss_string_find(string_t str, string_t pat)
     //         continue;
     //     }
     //     // Check for exact match:
-    //     for (int32_t j = 0; j < pat.length; j++) {
+    //     for (int64_t j = 0; j < pat.length; j++) {
     //         if (str.data[(i-pat.length+j)*str.stride] != pat.data[j*pat.stride]) {
     //             // Mismatch:
     //             i += min_skip;
@@ -274,7 +274,7 @@ string_t sss_string_quoted(string_t text, const char *dsl, bool colorize) {
     const char *escape_color = colorize ? "\x1b[1;34m" : "";
     const char *reset_color = colorize ? "\x1b[0;35m" : "";
     fputc('"', mem);
-    for (int32_t i = 0; i < text.length; i++) {
+    for (int64_t i = 0; i < text.length; i++) {
         char c = text.data[i*text.stride];
         switch (c) {
         case '\\': fprintf(mem, "%s\\\\%s", escape_color, reset_color); break;
@@ -344,15 +344,15 @@ string_t sss_string_octal(int64_t i, int64_t digits, bool prefix) {
 
 string_t sss_string_split(string_t str, string_t split_chars) {
     if (str.length == 0) return (string_t){.stride=sizeof(string_t)};
-    struct { string_t *data; int32_t length; int16_t stride, free; } strings = {.stride=sizeof(string_t)};
+    struct { string_t *data; int64_t length; int32_t stride, free; } strings = {.stride=sizeof(string_t)};
     size_t capacity = 0;
     bool separators[256] = {0};
-    for (int32_t i = 0; i < split_chars.length; i++)
+    for (int64_t i = 0; i < split_chars.length; i++)
         separators[(int)split_chars.data[split_chars.stride*i]] = true;
 
-    for (int32_t i = 0; i < str.length; i++) {
+    for (int64_t i = 0; i < str.length; i++) {
         if (separators[(int)str.data[str.stride*i]]) continue;
-        int32_t len = 0;
+        int64_t len = 0;
         while (i < str.length && !separators[(int)str.data[str.stride*i]]) {
             ++len;
             ++i;
@@ -5,13 +5,13 @@
 
 typedef struct {
     const char *data;
-    int32_t length;
-    int16_t stride, free;
+    int64_t length;
+    int32_t stride, free;
 } string_t;
 
 typedef struct {
     uint8_t success;
-    int32_t index;
+    int64_t index;
 } find_result_t;
 
 string_t sss_string_uppercased(string_t s);
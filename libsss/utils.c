@@ -5,10 +5,12 @@
 #include <limits.h>
 #include <math.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
@@ -16,6 +18,7 @@
 
 #include "../files.h"
 #include "../span.h"
+#include "parallel.h"
 #include "range.h"
 #include "string.h"
 #include "utils.h"
@@ -51,7 +54,7 @@ char *heap_strf(const char *fmt, ...)
 string_t first_arg(char *argv[]) {
     return (string_t){
         .data=heap_str(argv[0]),
-        .length=(int32_t)strlen(argv[0]),
+        .length=(int64_t)strlen(argv[0]),
         .stride=1,
     };
 }
@@ -64,7 +67,7 @@ str_array_t arg_list(int argc, char *argv[]) {
     for (int i = 0; i < argc; i++) {
         args.items[i] = (string_t){
             .data=heap_str(argv[i]),
-            .length=(int32_t)strlen(argv[i]),
+            .length=(int64_t)strlen(argv[i]),
             .stride=1,
         };
     }
@@ -76,14 +79,14 @@ void say(string_t str, string_t end)
     if (str.stride == 1) {
         write(STDOUT_FILENO, str.data, str.length);
     } else {
-        for (int32_t i = 0; i < str.length; i++)
+        for (int64_t i = 0; i < str.length; i++)
             write(STDOUT_FILENO, str.data + i*str.stride, 1);
     }
 
     if (end.stride == 1) {
         write(STDOUT_FILENO, end.data, end.length);
     } else {
-        for (int32_t i = 0; i < end.length; i++)
+        for (int64_t i = 0; i < end.length; i++)
             write(STDOUT_FILENO, end.data + i*end.stride, 1);
     }
 }
@@ -94,14 +97,14 @@ void warn(string_t str, string_t end, bool colorize)
     if (str.stride == 1) {
         write(STDERR_FILENO, str.data, str.length);
     } else {
-        for (int32_t i = 0; i < str.length; i++)
+        for (int64_t i = 0; i < str.length; i++)
             write(STDERR_FILENO, str.data + i*str.stride, 1);
     }
 
     if (end.stride == 1) {
         write(STDERR_FILENO, end.data, end.length);
     } else {
-        for (int32_t i = 0; i < end.length; i++)
+        for (int64_t i = 0; i < end.length; i++)
             write(STDERR_FILENO, end.data + i*end.stride, 1);
     }
     if (colorize) write(STDERR_FILENO, "\x1b[m", 3);
@@ -120,7 +123,7 @@ void fail(const char *fmt, ...)
 void fail_array(string_t fmt, ...)
 {
     char buf[fmt.length+1];
-    for (int32_t i = 0; i < fmt.length; i++)
+    for (int64_t i = 0; i < fmt.length; i++)
         buf[i] = fmt.data[i*fmt.stride];
     buf[fmt.length] = '\0';
 
@@ -157,7 +160,7 @@ string_t sss_time_format(sss_time_t sss_time, string_t fmt)
     char *copy = GC_MALLOC_ATOMIC(len+1);
     memcpy(copy, buf, len);
     copy[len] = '\0';
-    return (string_t){.data=copy, .length=(int32_t)len, .stride=1};
+    return (string_t){.data=copy, .length=(int64_t)len, .stride=1};
 }
 
 typedef struct {
@@ -228,10 +231,12 @@ CORD range_to_cord(range_t range, void *stack, bool color) {
 
 string_t range_slice(string_t array, range_t range, int64_t item_size)
 {
-    if (range.stride > INT16_MAX)
-        range.stride = INT16_MAX;
-    else if (range.stride < INT16_MIN)
-        range.stride = INT16_MIN;
+    // The resulting stride in bytes has to fit in 32 bits:
+    int64_t max_stride = INT32_MAX / (array.stride ? labs(array.stride) : 1);
+    if (range.stride > max_stride)
+        range.stride = max_stride;
+    else if (range.stride < -max_stride)
+        range.stride = -max_stride;
 
     if (range.stride == 0) {
         // printf("Zero stride\n");
@@ -271,19 +276,19 @@ string_t range_slice(string_t array, range_t range, int64_t item_size)
 
     return (string_t){
         (char*)array.data + item_size*(range.first-1),
-        (int32_t)len, (int16_t)(array.stride * range.stride), -1,
+        len, (int32_t)(array.stride * range.stride), -1,
     };
 }
 
 // Copy on write for arrays:
 void array_cow(void *voidarr, size_t item_size, bool atomic)
 {
-    struct {char *data; int32_t len; int16_t stride, free;} *arr = voidarr;
+    struct {char *data; int64_t len; int32_t stride, free;} *arr = voidarr;
     char *copy = atomic ? GC_MALLOC_ATOMIC(arr->len * item_size) : GC_MALLOC(arr->len * item_size);
     if ((size_t)arr->stride == item_size) {
         memcpy(copy, arr->data, arr->len * item_size);
     } else {
-        for (int32_t i = 0; i < arr->len; i++)
+        for (int64_t i = 0; i < arr->len; i++)
             memcpy(copy + i*item_size, arr->data + arr->stride*i, item_size);
     }
     arr->stride = item_size;
@@ -293,12 +298,12 @@ void array_cow(void *voidarr, size_t item_size, bool atomic)
 
 void array_flatten(void *voidarr, size_t item_size, bool atomic)
 {
-    struct {char *data; int32_t len; int16_t stride, free;} *arr = voidarr;
+    struct {char *data; int64_t len; int32_t stride, free;} *arr = voidarr;
     char *copy = atomic ? GC_MALLOC_ATOMIC(arr->len * item_size) : GC_MALLOC(arr->len * item_size);
     if ((size_t)arr->stride == item_size) {
         memcpy(copy, arr->data, arr->len * item_size);
     } else {
-        for (int32_t i = 0; i < arr->len; i++)
+        for (int64_t i = 0; i < arr->len; i++)
             memcpy(copy + i*item_size, arr->data + arr->stride*i, item_size);
     }
     arr->stride = item_size;
@@ -306,27 +311,79 @@ void array_flatten(void *voidarr, size_t item_size, bool atomic)
     arr->free = 0;
 }
 
+// Arrays grow geometrically, so building an array one item at a time takes
+// amortized constant time per item. The spare capacity is tracked in the
+// array's 32-bit `free` field, so the slack is capped at INT32_MAX items.
+#define MIN_ARRAY_SLACK 4
+
+// Move an array's items into a new buffer with room for `extra` more items
+// after `gap_index` (1-indexed) and `slack` unused items at the end
+static void array_regrow(string_t *arr, int64_t gap_index, int64_t extra, int64_t slack, size_t item_size, bool atomic)
+{
+    size_t new_size = (size_t)(arr->length + extra + slack) * item_size;
+    char *copy = atomic ? GC_MALLOC_ATOMIC(new_size) : GC_MALLOC(new_size);
+    if ((size_t)arr->stride == item_size) {
+        if (gap_index > 1)
+            memcpy(copy, arr->data, (size_t)(gap_index-1)*item_size);
+        if (gap_index <= arr->length)
+            memcpy(copy + (gap_index-1 + extra)*item_size, arr->data + (gap_index-1)*item_size, (size_t)(arr->length - gap_index + 1)*item_size);
+    } else {
+        for (int64_t i = 0; i < gap_index-1; i++)
+            memcpy(copy + i*item_size, arr->data + arr->stride*i, item_size);
+        for (int64_t i = gap_index-1; i < arr->length; i++)
+            memcpy(copy + (i+extra)*item_size, arr->data + arr->stride*i, item_size);
+    }
+    arr->data = copy;
+    arr->stride = (int32_t)item_size;
+    arr->free = (int32_t)slack;
+}
+
+// How much slack to leave after growing an array to `length` items
+static inline int64_t growth_slack(int64_t length)
+{
+    return MIN(MAX(length, MIN_ARRAY_SLACK), INT32_MAX);
+}
+
+// Make room for `count` more items at the end of an array, growing it
+// geometrically if it needs to grow at all
+void array_reserve(void *voidarr, int64_t count, size_t item_size, bool atomic)
+{
+    string_t *arr = voidarr;
+    if (count <= 0) return;
+    if (count > INT32_MAX) count = INT32_MAX;
+    if (arr->free >= count && (size_t)arr->stride == item_size && arr->data)
+        return;
+    // At least double the capacity, unless that's still not enough:
+    array_regrow(arr, arr->length+1, 0, MAX(count, growth_slack(arr->length)), item_size, atomic);
+}
+
+// Drop any spare capacity, so the array takes up no more memory than its items
+void array_shrink_to_fit(void *voidarr, size_t item_size, bool atomic)
+{
+    string_t *arr = voidarr;
+    if (arr->free <= 0 && (size_t)arr->stride == item_size) return;
+    if (arr->length == 0) {
+        arr->data = NULL;
+        arr->stride = (int32_t)item_size;
+        arr->free = 0;
+        return;
+    }
+    array_regrow(arr, arr->length+1, 0, 0, item_size, atomic);
+}
+
 void array_insert(void *voidarr, char *item, int64_t index, size_t item_size, bool atomic)
 {
     string_t *arr = voidarr;
     if (index < 1) index = 1;
     else if (index > (int64_t)arr->length + 1) index = (int64_t)arr->length + 1;
 
-    if (!arr->data) {
-        arr->data = atomic ? GC_MALLOC_ATOMIC(item_size) : GC_MALLOC(item_size);
-        arr->free = 1;
-    } else if (arr->free < 1 || (size_t)arr->stride != item_size) {
-        arr->free = 6;
-        char *copy = atomic ? GC_MALLOC_ATOMIC((arr->length + arr->free) * item_size) : GC_MALLOC((arr->length + arr->free) * item_size);
-        for (int32_t i = 0; i < index-1; i++)
-            memcpy(copy + i*item_size, arr->data + arr->stride*i, item_size);
-        for (int32_t i = index-1; i < arr->length; i++)
-            memcpy(copy + (i+1)*item_size, arr->data + arr->stride*i, item_size);
-        arr->data = copy;
-    } else if (index != arr->length+1) {
-        memmove((char*)arr->data + index*item_size, arr->data + (index-1)*item_size, (arr->length - index)*item_size);
+    if (arr->free < 1 || (size_t)arr->stride != item_size || !arr->data) {
+        array_regrow(arr, index, 1, growth_slack(arr->length + 1), item_size, atomic);
+    } else {
+        if (index <= arr->length)
+            memmove((char*)arr->data + index*item_size, arr->data + (index-1)*item_size, (arr->length - index + 1)*item_size);
+        --arr->free;
     }
-    --arr->free;
     ++arr->length;
     memcpy((char*)arr->data + (index-1)*item_size, item, item_size);
 }
@@ -336,24 +393,18 @@ void array_insert_all(void *voidarr, void *voidarr2, int64_t index, size_t item_
     string_t *arr = voidarr, *arr2 = voidarr2;
     if (index < 1) index = 1;
     else if (index > (int64_t)arr->length + 1) index = (int64_t)arr->length + 1;
+    if (arr2->length == 0) return;
 
-    if (!arr->data) {
-        arr->data = atomic ? GC_MALLOC_ATOMIC(item_size*arr2->length) : GC_MALLOC(item_size*arr2->length);
-        arr->free = arr2->length;
-    } else if ((int64_t)arr->free < (int64_t)arr2->length || (size_t)arr->stride != item_size) {
-        arr->free = arr2->length;
-        char *copy = atomic ? GC_MALLOC_ATOMIC((arr->length + arr->free) * item_size) : GC_MALLOC((arr->length + arr->free) * item_size);
-        for (int32_t i = 0; i < index-1; i++)
-            memcpy(copy + i*item_size, arr->data + arr->stride*i, item_size);
-        for (int32_t i = index-1; i < arr->length; i++)
-            memcpy(copy + (i+arr2->length)*item_size, arr->data + arr->stride*i, item_size);
-        arr->data = copy;
-    } else if (index != arr->length+1) {
-        memmove((char*)arr->data + index*item_size, arr->data + (index-1)*item_size, (arr->length - index + arr2->length-1)*item_size);
+    if ((int64_t)arr->free < arr2->length || (size_t)arr->stride != item_size || !arr->data) {
+        array_regrow(arr, index, arr2->length, growth_slack(arr->length + arr2->length), item_size, atomic);
+    } else {
+        if (index <= arr->length)
+            memmove((char*)arr->data + (index-1 + arr2->length)*item_size, arr->data + (index-1)*item_size, (arr->length - index + 1)*item_size);
+        // There's enough free space, so this fits in the 32-bit free count:
+        arr->free -= (int32_t)arr2->length;
     }
-    arr->free -= arr2->length;
     arr->length += arr2->length;
-    for (int32_t i = 0; i < arr2->length; i++)
+    for (int64_t i = 0; i < arr2->length; i++)
         memcpy((char*)arr->data + (index-1 + i)*item_size, arr2->data + i*arr2->stride, item_size);
 }
 
@@ -367,31 +418,96 @@ void array_remove(void *voidarr, int64_t index, int64_t count, size_t item_size,
 
     if (index + count > arr->length) {
         if (arr->free >= 0)
-            arr->free += count;
+            arr->free = (int32_t)MIN((int64_t)arr->free + count, INT32_MAX);
     } else if (arr->free < 0 || (size_t)arr->stride != item_size) { // Copy on write
-        char *copy = atomic ? GC_MALLOC_ATOMIC((arr->length-1) * item_size) : GC_MALLOC((arr->length-1) * item_size);
-        for (int32_t src = 1, dest = 1; src <= arr->length; src++) {
+        char *copy = atomic ? GC_MALLOC_ATOMIC((arr->length-count) * item_size) : GC_MALLOC((arr->length-count) * item_size);
+        for (int64_t src = 1, dest = 1; src <= arr->length; src++) {
             if (src < index || src >= index + count) {
                 memcpy(copy + (dest - 1)*item_size, arr->data + arr->stride*(src - 1), item_size);
                 ++dest;
             }
         }
         arr->data = copy;
+        arr->stride = (int32_t)item_size;
         arr->free = 0;
     } else {
-        memmove((char*)arr->data + (index-1)*item_size, arr->data + (index-1 + count)*item_size, (arr->length - index + count - 1)*item_size);
-        arr->free += count;
+        memmove((char*)arr->data + (index-1)*item_size, arr->data + (index-1 + count)*item_size, (arr->length - index - count + 1)*item_size);
+        arr->free = (int32_t)MIN((int64_t)arr->free + count, INT32_MAX);
     }
     arr->length -= count;
 }
 
-typedef int (cmp_fn_t)(const void *a, const void *b);
-void array_sort(void *voidarr, cmp_fn_t compare, size_t item_size, bool atomic)
+static void swap_items(char *a, char *b, size_t item_size)
 {
-    string_t *arr = voidarr;
-    if (arr->free < 0 || (size_t)arr->stride != item_size)
-        array_flatten(voidarr, item_size, atomic);
-    qsort((char*)arr->data, arr->length, item_size, compare);
+    char tmp[item_size];
+    memcpy(tmp, a, item_size);
+    memcpy(a, b, item_size);
+    memcpy(b, tmp, item_size);
+}
+
+// Fisher-Yates shuffle
+static void shuffle_items(char *items, int64_t n, size_t item_size)
+{
+    for (int64_t i = n-1; i > 0; i--) {
+        int64_t j;
+        if (i < UINT32_MAX) {
+            j = (int64_t)arc4random_uniform((uint32_t)i+1);
+        } else {
+            uint64_t r;
+            arc4random_buf(&r, sizeof(r));
+            j = (int64_t)(r % (uint64_t)(i+1));
+        }
+        swap_items(items + i*(int64_t)item_size, items + j*(int64_t)item_size, item_size);
+    }
+}
+
+// Long arrays are shuffled in parallel by putting each item in a random
+// bucket, then shuffling each bucket. Since every item is equally likely to
+// end up in each bucket, and each bucket's items end up in a random order,
+// every order of the items is equally likely.
+#define SHUFFLE_BUCKETS 256
+
+typedef struct {
+    const char *items;
+    char *shuffled;
+    size_t item_size;
+    int64_t n, chunk_len;
+    uint8_t *buckets;
+    // For each chunk of items, how many go in each bucket, then where the
+    // next one of them goes
+    int64_t (*counts)[SHUFFLE_BUCKETS];
+    int64_t bucket_starts[SHUFFLE_BUCKETS + 1];
+} shuffle_job_t;
+
+static void pick_buckets(int64_t start, int64_t end, void *userdata)
+{
+    shuffle_job_t *job = userdata;
+    for (int64_t chunk = start; chunk < end; chunk++) {
+        int64_t first = chunk*job->chunk_len, last = MIN(first + job->chunk_len, job->n);
+        arc4random_buf(job->buckets + first, (size_t)(last - first));
+        for (int64_t i = first; i < last; i++)
+            ++job->counts[chunk][job->buckets[i]];
+    }
+}
+
+static void fill_buckets(int64_t start, int64_t end, void *userdata)
+{
+    shuffle_job_t *job = userdata;
+    for (int64_t chunk = start; chunk < end; chunk++) {
+        int64_t first = chunk*job->chunk_len, last = MIN(first + job->chunk_len, job->n);
+        for (int64_t i = first; i < last; i++) {
+            int64_t dest = job->counts[chunk][job->buckets[i]]++;
+            memcpy(job->shuffled + dest*(int64_t)job->item_size, job->items + i*(int64_t)job->item_size, job->item_size);
+        }
+    }
+}
+
+static void shuffle_buckets(int64_t start, int64_t end, void *userdata)
+{
+    shuffle_job_t *job = userdata;
+    for (int64_t b = start; b < end; b++)
+        shuffle_items(job->shuffled + job->bucket_starts[b]*(int64_t)job->item_size,
+                      job->bucket_starts[b+1] - job->bucket_starts[b], job->item_size);
 }
 
 void array_shuffle(void *voidarr, size_t item_size, bool atomic)
@@ -400,40 +516,132 @@ void array_shuffle(void *voidarr, size_t item_size, bool atomic)
     if (arr->free < 0 || (size_t)arr->stride != item_size)
         array_flatten(voidarr, item_size, atomic);
 
-    char tmp[item_size];
-    for (int32_t i = arr->length-1; i > 1; i--) {
-        int32_t j = arc4random_uniform(i+1);
-        memcpy(tmp, arr->data + i*item_size, item_size);
-        memcpy((char*)arr->data + i*item_size, arr->data + j*item_size, item_size);
-        memcpy((char*)arr->data + j*item_size, tmp, item_size);
+    int64_t n = arr->length;
+    if (n < 2*SSS_PARALLEL_GRAIN || sss_thread_count() == 1) {
+        shuffle_items((char*)arr->data, n, item_size);
+        return;
+    }
+
+    int64_t chunks = 4*sss_thread_count();
+    shuffle_job_t job = {
+        .items=arr->data, .item_size=item_size, .n=n, .chunk_len=(n + chunks - 1)/chunks,
+        .shuffled=atomic ? GC_MALLOC_ATOMIC((size_t)n*item_size) : GC_MALLOC((size_t)n*item_size),
+        .buckets=GC_MALLOC_ATOMIC((size_t)n),
+        .counts=GC_MALLOC_ATOMIC((size_t)chunks*sizeof(int64_t[SHUFFLE_BUCKETS])),
+    };
+    memset(job.counts, 0, (size_t)chunks*sizeof(int64_t[SHUFFLE_BUCKETS]));
+    sss_parallel_for(chunks, 1, pick_buckets, &job);
+
+    // Each bucket's items go in chunk order
+    int64_t dest = 0;
+    for (int b = 0; b < SHUFFLE_BUCKETS; b++) {
+        job.bucket_starts[b] = dest;
+        for (int64_t chunk = 0; chunk < chunks; chunk++) {
+            int64_t count = job.counts[chunk][b];
+            job.counts[chunk][b] = dest;
+            dest += count;
+        }
+    }
+    job.bucket_starts[SHUFFLE_BUCKETS] = n;
+
+    sss_parallel_for(chunks, 1, fill_buckets, &job);
+    sss_parallel_for(SHUFFLE_BUCKETS, 1, shuffle_buckets, &job);
+    GC_FREE(job.buckets);
+    GC_FREE(job.counts);
+    arr->data = job.shuffled;
+    arr->free = 0;
+}
+
+static char *copy_string_items(char *dest, string_t str, size_t item_size)
+{
+    if ((size_t)str.stride == item_size)
+        return mempcpy(dest, str.data, (size_t)str.length*item_size);
+    for (int64_t j = 0; j < str.length; j++)
+        dest = mempcpy(dest, str.data + j*str.stride, item_size);
+    return dest;
+}
+
+typedef struct {
+    const char *strings;
+    int64_t strings_stride;
+    string_t glue;
+    char *data;
+    size_t item_size;
+    // Where each string (and the glue before it) goes in the output, when joining in parallel
+    int64_t *offsets;
+} join_job_t;
+
+static void join_strings(int64_t start, int64_t end, void *userdata)
+{
+    join_job_t *job = userdata;
+    char *ptr = job->data + (start > 0 ? job->offsets[start]*(int64_t)job->item_size : 0);
+    for (int64_t i = start; i < end; i++) {
+        if (i > 0) ptr = copy_string_items(ptr, job->glue, job->item_size);
+        ptr = copy_string_items(ptr, *(string_t*)(job->strings + i*job->strings_stride), job->item_size);
     }
 }
 
 string_t array_join(void *voidarr, void *voidglue, size_t item_size, bool atomic)
 {
-    struct {string_t *data; int32_t length; int16_t stride, free;} *strings = voidarr;
+    struct {string_t *data; int64_t length; int32_t stride, free;} *strings = voidarr;
     string_t *glue = voidglue;
     if (strings->length == 0) return (string_t){.stride=item_size};
 
-    int32_t len = 0;
-    for (int32_t i = 0; i < strings->length; i++) {
+    int64_t len = 0;
+    for (int64_t i = 0; i < strings->length; i++) {
         if (i > 0) len += glue->length;
         len += ((string_t*)((void*)strings->data + i*strings->stride))->length;
     }
-    char *data = atomic ? GC_MALLOC_ATOMIC((size_t)len*item_size) : GC_MALLOC((size_t)len*item_size);
-    char *ptr = data;
-    for (int32_t i = 0; i < strings->length; i++) {
-        if (i > 0) {
-            for (int32_t j = 0; j < glue->length; j++)
-                ptr = mempcpy(ptr, (void*)glue->data + j*glue->stride, item_size);
+    join_job_t job = {
+        .strings=(const char*)strings->data, .strings_stride=strings->stride, .glue=*glue, .item_size=item_size,
+        .data=atomic ? GC_MALLOC_ATOMIC((size_t)len*item_size) : GC_MALLOC((size_t)len*item_size),
+    };
+    if (len < 2*SSS_PARALLEL_GRAIN || strings->length < 2 || sss_thread_count() == 1) {
+        join_strings(0, strings->length, &job);
+    } else {
+        job.offsets = GC_MALLOC_ATOMIC((size_t)strings->length*sizeof(int64_t));
+        for (int64_t i = 0, offset = 0; i < strings->length; i++) {
+            job.offsets[i] = offset;
+            offset += (i > 0 ? glue->length : 0) + ((string_t*)((void*)strings->data + i*strings->stride))->length;
         }
-        string_t str = *(string_t*)((void*)strings->data + i*strings->stride);
-        for (int32_t j = 0; j < str.length; j++)
-            ptr = mempcpy(ptr, (void*)str.data + j*str.stride, item_size);
+        // Split the strings into groups of about SSS_PARALLEL_GRAIN items
+        int64_t grain = MAX(1, (int64_t)((double)strings->length * SSS_PARALLEL_GRAIN / (double)len));
+        sss_parallel_for(strings->length, grain, join_strings, &job);
+        GC_FREE(job.offsets);
     }
-    return (string_t){.data = data, .length = len, .stride = item_size};
+    return (string_t){.data = job.data, .length = len, .stride = item_size};
 }
 
+typedef struct {
+    const char *items;
+    int64_t stride;
+    const void *item;
+    int32_t (*compare)(const void*, const void*);
+    _Atomic(int64_t) found;
+} search_job_t;
+
+static void search_items(int64_t start, int64_t end, void *userdata)
+{
+    search_job_t *job = userdata;
+    // Stop early if another thread has already found a match before this range
+    for (int64_t i = start; i < end && i < atomic_load_explicit(&job->found, memory_order_relaxed); i++) {
+        if (job->compare(job->items + i*job->stride, job->item) == 0) {
+            int64_t found = atomic_load(&job->found);
+            while (i < found && !atomic_compare_exchange_weak(&job->found, &found, i))
+                continue;
+            return;
+        }
+    }
+}
+
+// Return the (1-indexed) position of the first item equal to `item`, or 0 if there isn't one
+int64_t array_index_of(void *voidarr, const void *item, int32_t (*compare)(const void*, const void*))
+{
+    string_t *arr = voidarr;
+    search_job_t job = {.items=arr->data, .stride=arr->stride, .item=item, .compare=compare, .found=arr->length};
+    sss_parallel_for(arr->length, SSS_PARALLEL_GRAIN, search_items, &job);
+    return job.found < arr->length ? job.found + 1 : 0;
+}
 
 typedef struct { FILE *file; } SSSFile;
 
@@ -454,7 +662,7 @@ void sss_file_finalizer(void *obj, void *_)
 }
 
 #include <assert.h>
-#define STR_LITERAL(s) (string_t){.data=s, .stride=1, .length=(int32_t)strlen(s)}
+#define STR_LITERAL(s) (string_t){.data=s, .stride=1, .length=(int64_t)strlen(s)}
 FileResult sss_fopen(string_t path, string_t mode)
 {
     if (path.length > PATH_MAX)
@@ -498,7 +706,7 @@ string_t sss_readfile(SSSFile *bf, int64_t bytes)
         buf_len += got;
         to_read -= got;
     }
-    return (string_t){.data=buf, .stride=1, .length=(int32_t)buf_len};
+    return (string_t){.data=buf, .stride=1, .length=(int64_t)buf_len};
 }
 
 string_t get_line(FILE *f)
@@ -508,7 +716,7 @@ string_t get_line(FILE *f)
     string_t ret = {.stride=1};
     if (got > 0) {
         if (buf[got-1] == '\n') --got;
-        ret.length = (int32_t)got;
+        ret.length = (int64_t)got;
         ret.data = GC_MALLOC_ATOMIC(got + 1);
         memcpy((char*)ret.data, buf, got);
         *(char*)(ret.data+got) = '\0';
@@ -557,7 +765,7 @@ int_conversion_t sss_string_to_int(string_t str, int64_t base)
                 .data.partial.value=n,
                 .data.partial.remaining=(string_t){
                     .data=endptr,
-                    .length=str.length - (int32_t)(endptr - str.data),
+                    .length=str.length - (int64_t)(endptr - str.data),
                     .stride=1,
                     .free=0,
                 },
@@ -595,7 +803,7 @@ num_conversion_t sss_string_to_num(string_t str)
                 .data.partial.value=num,
                 .data.partial.remaining=(string_t){
                     .data=endptr,
-                    .length=str.length - (int32_t)(endptr - str.data),
+                    .length=str.length - (int64_t)(endptr - str.data),
                     .stride=1,
                     .free=0,
                 },
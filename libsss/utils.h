@@ -3,10 +3,21 @@
 #include <stdbool.h>
 #include "string.h"
 
-typedef struct { string_t *items; int32_t length; int16_t stride, free; } str_array_t;
+typedef struct { string_t *items; int64_t length; int32_t stride, free; } str_array_t;
 str_array_t arg_list(int argc, char *argv[]);
 void say(string_t str, string_t end);
 void fail(const char *fmt, ...);
 void fail_array(string_t fmt, ...);
 double sane_fmod(double num, double modulus);
 string_t last_err();
+
+// Arrays (any array type, passed as a pointer to the array struct):
+void array_flatten(void *arr, size_t item_size, bool atomic);
+void array_insert(void *arr, char *item, int64_t index, size_t item_size, bool atomic);
+void array_insert_all(void *arr, void *other, int64_t index, size_t item_size, bool atomic);
+void array_reserve(void *arr, int64_t count, size_t item_size, bool atomic);
+void array_shrink_to_fit(void *arr, size_t item_size, bool atomic);
+void array_remove(void *arr, int64_t index, int64_t count, size_t item_size, bool atomic);
+void array_shuffle(void *arr, size_t item_size, bool atomic);
+string_t array_join(void *arr, void *glue, size_t item_size, bool atomic);
+int64_t array_index_of(void *arr, const void *item, int32_t (*compare)(const void*, const void*));
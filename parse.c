@@ -322,7 +322,7 @@ const char *get_word(const char **inout) {
             break;
     }
     *inout = (const char*)pos;
-    return heap_strn(word, (size_t)((const char*)pos - word));
+    return intern_strn(word, (size_t)((const char*)pos - word));
 }
 
 const char *get_id(const char **inout) {
@@ -2345,6 +2345,7 @@ ast_t *parse_file(sss_file_t *file, jmp_buf *on_err) {
         .on_err=on_err,
     };
 
+    compile_phase_t prev_phase = enter_phase(PHASE_PARSE);
     const char *pos = file->text;
     if (match(&pos, "#!")) // shebang
         some_not(&pos, "\r\n");
@@ -2356,6 +2357,7 @@ ast_t *parse_file(sss_file_t *file, jmp_buf *on_err) {
     if (strlen(pos) > 0) {
         parser_err(&ctx, pos, pos + strlen(pos), "I couldn't parse this part of the file");
     }
+    exit_phase(prev_phase);
     return ast;
 }
 
@@ -1,4 +1,5 @@
 // The main program
+#include <dlfcn.h>
 #include <err.h>
 #include <gc.h>
 #include <gc/cord.h>
@@ -10,7 +11,10 @@
 #include <unistd.h>
 
 #include "api.h"
+#include "cache.h"
+#include "libsss/arena.h"
 #include "parse.h"
+#include "stats.h"
 #include "files.h"
 #include "typecheck.h"
 #include "compile/compile.h"
@@ -18,9 +22,43 @@
 
 static bool verbose = false;
 static bool tail_calls = false;
+static bool use_cache = true;
+// Flags that affect code generation and therefore the cache key:
+static const char *cache_flags = "";
 
 #define endswith(str,end) (strlen(str) >= strlen(end) && strcmp((str) + strlen(str) - strlen(end), end) == 0)
 
+// Options from the command line that are needed for every context (including separately compiled modules):
+static int optimization_level = -1;
+static List(const char*) extra_gcc_options;
+
+static gcc_jit_context *new_context(void)
+{
+    gcc_jit_context *ctx = gcc_jit_context_acquire();
+    const char *gcc_flags[] = {
+        "-ftrapv", "-freg-struct-return",
+    };
+    for (size_t i = 0; i < sizeof(gcc_flags)/sizeof(gcc_flags[0]); i++)
+        gcc_jit_context_add_command_line_option(ctx, gcc_flags[i]);
+
+    const char *driver_flags[] = {
+        "-lgc", "-lcord", "-lm", "-L.", "-l:libsss.so."SSS_VERSION,
+        "-Wl,-rpath", "-Wl,$ORIGIN", "-Wl,-Bsymbolic",
+    };
+    for (size_t i = 0; i < sizeof(driver_flags)/sizeof(driver_flags[0]); i++)
+        gcc_add_driver_opt(ctx, driver_flags[i]);
+    gcc_jit_context_set_bool_option(ctx, GCC_JIT_BOOL_OPTION_DEBUGINFO, true);
+    gcc_jit_context_set_bool_allow_unreachable_blocks(ctx, true);
+
+    if (optimization_level >= 0)
+        gcc_jit_context_set_int_option(ctx, GCC_JIT_INT_OPTION_OPTIMIZATION_LEVEL, optimization_level);
+    foreach (extra_gcc_options, opt, _)
+        gcc_jit_context_add_command_line_option(ctx, *opt);
+    return ctx;
+}
+
+static module_options_t module_options = {.new_context=new_context};
+
 int compile_to_file(gcc_jit_context *ctx, sss_file_t *f, int argc, char *argv[])
 {
     if (verbose)
@@ -58,15 +96,41 @@ int compile_to_file(gcc_jit_context *ctx, sss_file_t *f, int argc, char *argv[])
         binary_name = CORD_cat("./", binary_name);
 
     binary_name = CORD_to_char_star(binary_name);
+    compile_phase_t prev_phase = enter_phase(PHASE_GCC);
     gcc_jit_context_compile_to_file(ctx, GCC_OUTPUT_KIND_EXECUTABLE, binary_name);
+    exit_phase(prev_phase);
+    print_time_report();
     printf("\x1b[0;1;32mSuccessfully compiled \x1b[33m%s\x1b[32m -> \x1b[37m%s\x1b[m\n", f->relative_filename, binary_name);
     gcc_jit_result_release(result);
 
     return 0;
 }
 
+static int run_cached(const char *so_path, int argc, char *argv[])
+{
+    void *lib = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    if (!lib) return -1;
+    main_func_t main_fn = (main_func_t)dlsym(lib, "main");
+    if (!main_fn) {
+        dlclose(lib);
+        return -1;
+    }
+    if (verbose)
+        fprintf(stderr, "\x1b[0;33;4;1mProgram Output (cached: %s)\x1b[m\n", so_path);
+    print_time_report();
+    arena_end();
+    main_fn(argc, argv);
+    return 0;
+}
+
 int run_file(gcc_jit_context *ctx, jmp_buf *on_err, sss_file_t *f, int argc, char *argv[])
 {
+    if (use_cache) {
+        const char *so_path = cache_lookup(f, cache_flags);
+        if (so_path && run_cached(so_path, argc, argv) == 0)
+            return 0;
+    }
+
     if (verbose)
         fprintf(stderr, "\x1b[33;4;1mParsing %s...\x1b[m\n", f->filename);
     ast_t *ast = parse_file(f, on_err);
@@ -77,17 +141,204 @@ int run_file(gcc_jit_context *ctx, jmp_buf *on_err, sss_file_t *f, int argc, cha
     if (verbose)
         fprintf(stderr, "\x1b[33;4;1mCompiling %s...\n\x1b[0;34;1m", f->filename);
 
+    if (use_cache) {
+        // Compile to a shared object in the cache, then load it from there
+        module_options.cache_flags = cache_flags;
+        env_t *env = compile_program(ctx, on_err, f, ast, tail_calls, &module_options);
+        const char *so_path = cache_store_path(f, cache_flags, &env->global->used_files);
+        if (so_path) {
+            const char *tmp_path = heap_strf("%s.%d.tmp", so_path, getpid());
+            compile_phase_t prev_phase = enter_phase(PHASE_GCC);
+            gcc_jit_context_compile_to_file(ctx, GCC_OUTPUT_KIND_DYNAMIC_LIBRARY, tmp_path);
+            exit_phase(prev_phase);
+            if (!gcc_jit_context_get_first_error(ctx) && rename(tmp_path, so_path) == 0
+                && run_cached(so_path, argc, argv) == 0)
+                return 0;
+            unlink(tmp_path);
+        }
+        // Fall back to running in-memory if the cache isn't usable
+        compile_phase_t prev_phase = enter_phase(PHASE_GCC);
+        gcc_jit_result *result = gcc_compile(ctx);
+        exit_phase(prev_phase);
+        if (!result) compiler_err(env, ast, "Compilation failed");
+        main_func_t main_fn = (main_func_t)gcc_jit_result_get_code(result, "main");
+        if (!main_fn) errx(1, "run func is NULL");
+        print_time_report();
+        arena_end();
+        main_fn(argc, argv);
+        gcc_jit_result_release(result);
+        return 0;
+    }
+
     gcc_jit_result *result;
     main_func_t main_fn = compile_file(ctx, on_err, f, ast, tail_calls, &result);
     if (!main_fn) errx(1, "run func is NULL");
 
     if (verbose)
         fprintf(stderr, "\x1b[0;33;4;1mProgram Output\x1b[m\n");
+    print_time_report();
+    arena_end();
     main_fn(argc, argv);
     gcc_jit_result_release(result);
     return 0;
 }
 
+static gcc_jit_context *binding_context(binding_t *b)
+{
+    if (b->func) return gcc_jit_object_get_context(gcc_jit_function_as_object(b->func));
+    else if (b->lval) return gcc_jit_object_get_context(gcc_jit_lvalue_as_object(b->lval));
+    else if (b->rval) return gcc_jit_object_get_context(gcc_jit_rvalue_as_object(b->rval));
+    else return NULL;
+}
+
+// Inline functions aren't in an entry's compiled code, so they are compiled
+// again in each entry that might use them
+typedef struct {
+    ast_t *def;
+    env_t *env;
+} inline_func_t;
+
+static void recompile_function(env_t *env, binding_t *b, inline_func_t *f)
+{
+    env_t def_env = *f->env;
+    def_env.ctx = env->ctx;
+    hremove(&env->global->ast_functions, f->def, func_context_t*);
+    b->func = get_function_def(&def_env, f->def, fresh(Match(f->def, FunctionDef)->name));
+    b->rval = gcc_get_func_address(b->func, NULL);
+}
+
+// Point a binding from an earlier REPL entry at the same memory in the current
+// context, returning false if that's not possible
+static bool rebind(env_t *env, binding_t *b, const char *name, gcc_jit_result *result, sss_hashmap_t *addresses, sss_hashmap_t *inline_funcs)
+{
+    if (b->type->tag == TypeType) {
+        if (b->rval) b->rval = gcc_str(env->ctx, name);
+        return true;
+    }
+
+    inline_func_t *inline_func = b->func ? hget(inline_funcs, b, inline_func_t*) : NULL;
+    if (inline_func) {
+        recompile_function(env, b, inline_func);
+        return true;
+    }
+
+    void *address = hget(addresses, b, void*);
+    if (!address && result) {
+        if (b->func)
+            address = gcc_jit_result_get_code(result, gcc_jit_object_get_debug_string(gcc_jit_function_as_object(b->func)));
+        else if (b->lval && b->sym_name)
+            address = gcc_jit_result_get_global(result, b->sym_name);
+
+        if (!address && b->func) {
+            for (uint32_t i = 1; i <= env->global->ast_functions.count; i++) {
+                auto entry = hnth(&env->global->ast_functions, i, ast_t*, func_context_t*);
+                if (entry->value->func != b->func || entry->key->tag != FunctionDef) continue;
+                inline_func = new(inline_func_t, .def=entry->key, .env=new(env_t));
+                *inline_func->env = entry->value->env;
+                hset(inline_funcs, b, inline_func);
+                recompile_function(env, b, inline_func);
+                return true;
+            }
+        }
+        if (!address) return false;
+        hset(addresses, b, address);
+    }
+    if (!address) return false;
+
+    if (b->lval) {
+        gcc_type_t *gcc_t = sss_type_to_gcc(env, b->type);
+        b->lval = gcc_rvalue_dereference(gcc_rvalue_from_ptr(env->ctx, gcc_get_ptr_type(gcc_t), address), NULL);
+        b->rval = gcc_rval(b->lval);
+    } else {
+        b->func = NULL;
+        b->rval = gcc_rvalue_from_ptr(env->ctx, sss_type_to_gcc(env, b->type), address);
+    }
+    return true;
+}
+
+static void add_namespace(sss_hashmap_t *seen, List(sss_hashmap_t*) namespaces, sss_hashmap_t *ns)
+{
+    for (; ns; ns = ns->fallback) {
+        if (hget(seen, ns, bool)) return;
+        hset(seen, ns, true);
+        APPEND(namespaces, ns);
+    }
+}
+
+// Each REPL entry is compiled in its own child context, so bindings from earlier
+// entries have to be moved into the current context. Functions and globals are
+// referenced by their address in the earlier entry's compiled code, inline
+// functions are compiled again, and type names are recreated. Anything else
+// (memoized helper functions and constants) is dropped so it gets regenerated
+// on demand. The scopes that functions were defined in are updated too, since
+// their default arguments are evaluated there.
+static void rebind_stale_bindings(env_t *env, gcc_jit_context *root_ctx, sss_hashmap_t *entry_results, sss_hashmap_t *addresses, sss_hashmap_t *inline_funcs)
+{
+    sss_hashmap_t seen = {0};
+    NEW_LIST(sss_hashmap_t*, namespaces);
+    add_namespace(&seen, namespaces, env->bindings);
+    for (uint32_t i = 1; i <= env->global->type_namespaces.count; i++) {
+        auto entry = hnth(&env->global->type_namespaces, i, sss_type_t*, sss_hashmap_t*);
+        add_namespace(&seen, namespaces, entry->value);
+    }
+
+    NEW_LIST(sss_type_t*, tagged_unions);
+    for (int64_t n = 0; n < length(namespaces); n++) {
+        sss_hashmap_t *ns = ith(namespaces, n);
+        NEW_LIST(const char*, stale);
+        for (uint32_t i = 1; i <= ns->count; i++) {
+            auto entry = hnth(ns, i, const char*, binding_t*);
+            binding_t *b = entry->value;
+            env_t *fn_env = b->type->tag == FunctionType ? Match(b->type, FunctionType)->env : NULL;
+            if (fn_env)
+                add_namespace(&seen, namespaces, fn_env->bindings);
+
+            gcc_jit_context *b_ctx = binding_context(b);
+            if (!b_ctx || b_ctx == root_ctx || b_ctx == env->ctx)
+                continue;
+            if (!rebind(env, b, entry->key, hget(entry_results, b_ctx, gcc_jit_result*), addresses, inline_funcs))
+                APPEND(stale, entry->key);
+            else if (b->type->tag == TypeType && base_variant(Match(b->type, TypeType)->type)->tag == TaggedUnionType)
+                APPEND(tagged_unions, Match(b->type, TypeType)->type);
+        }
+        foreach (stale, key, _)
+            remove_binding(ns, *key);
+    }
+
+    // Tagged union constructors are inline functions, so they need to be regenerated:
+    foreach (tagged_unions, t, _) {
+        auto members = Match(base_variant(*t), TaggedUnionType)->members;
+        if (length(members) > 0 && !get_from_namespace(env, *t, ith(members, 0).name))
+            populate_tagged_union_constructors(env, *t);
+    }
+}
+
+// Functions queued by an entry that failed to compile belong to a context
+// that was never compiled, so they're dropped instead of being compiled into
+// the next entry's context
+static void forget_uncompiled_functions(env_t *env, sss_hashmap_t *compiled_functions)
+{
+    NEW_LIST(ast_t*, uncompiled);
+    for (uint32_t i = 1; i <= env->global->ast_functions.count; i++) {
+        auto entry = hnth(&env->global->ast_functions, i, ast_t*, func_context_t*);
+        if (!hget(compiled_functions, entry->value, bool))
+            APPEND(uncompiled, entry->key);
+    }
+    foreach (uncompiled, def, _)
+        hremove(&env->global->ast_functions, *def, func_context_t*);
+}
+
+// The REPL's globals live in the compiler's memory, since anything defined in
+// the root context would be copied into each entry's compiled code
+static void *repl_global(env_t *env, sss_type_t *t, const char *name)
+{
+    void *storage = GC_MALLOC_UNCOLLECTABLE((size_t)gcc_sizeof(env, t));
+    gcc_type_t *gcc_t = sss_type_to_gcc(env, t);
+    gcc_lvalue_t *lval = gcc_rvalue_dereference(gcc_rvalue_from_ptr(env->ctx, gcc_get_ptr_type(gcc_t), storage), NULL);
+    set_binding(&env->global->bindings, name, new(binding_t, .lval=lval, .rval=gcc_rval(lval), .type=t, .visible_in_closures=true));
+    return storage;
+}
+
 int run_repl(gcc_jit_context *ctx)
 {
     bool use_color = !getenv("NO_COLOR");
@@ -109,28 +360,26 @@ int run_repl(gcc_jit_context *ctx)
         printf("     note: importing with 'use' isn't supported yet\n\n\n");
     }
 
-    // Set up `PROGRAM_NAME`
+    // Set up `PROGRAM_NAME`, `ARGS` and `USE_COLOR`
     sss_type_t *string_t = Type(ArrayType, .item_type=Type(CharType));
-    gcc_lvalue_t *program_name = gcc_global(env->ctx, NULL, GCC_GLOBAL_EXPORTED, gcc_type(ctx, STRING), "PROGRAM_NAME");
-    hset(&env->global->bindings, "PROGRAM_NAME",
-         new(binding_t, .rval=gcc_rval(program_name), .type=string_t, .visible_in_closures=true));
+    repl_global(env, string_t, "PROGRAM_NAME");
+    repl_global(env, Type(ArrayType, .item_type=string_t), "ARGS");
+    *(bool*)repl_global(env, Type(BoolType), "USE_COLOR") = use_color;
 
-    // Set up `ARGS`
-    gcc_type_t *args_gcc_t = sss_type_to_gcc(env, Type(ArrayType, .item_type=string_t));
-    gcc_lvalue_t *args = gcc_global(ctx, NULL, GCC_GLOBAL_EXPORTED, args_gcc_t, "ARGS");
-    hset(&env->global->bindings, "ARGS", new(binding_t, .rval=gcc_rval(args), .type=Type(ArrayType, .item_type=string_t), .visible_in_closures=true));
+    // Functions that have been compiled into an entry's context, so any others
+    // left over from an entry that failed can be dropped:
+    sss_hashmap_t compiled_functions = {0}; // func_context_t* -> bool
 
-    // Set up `USE_COLOR`
-    gcc_lvalue_t *use_color_var = gcc_global(env->ctx, NULL, GCC_GLOBAL_EXPORTED, gcc_type(env->ctx, BOOL), "USE_COLOR");
-    gcc_jit_global_set_initializer_rvalue(use_color_var, gcc_rvalue_bool(ctx, use_color));
-    hset(&env->global->bindings, "USE_COLOR",
-         new(binding_t, .rval=gcc_rval(use_color_var), .type=Type(BoolType), .visible_in_closures=true));
-
-    // Keep track of which functions have already been compiled:
-    sss_hashmap_t compiled_functions = {0};
+    // Each entry is compiled in a child of `ctx`, so the cost of compiling doesn't
+    // grow with the length of the session. Values from earlier entries are accessed
+    // through their addresses in the earlier entries' compiled code.
+    sss_hashmap_t entry_results = {0}; // gcc_jit_context* -> gcc_jit_result*
+    sss_hashmap_t addresses = {0}; // binding_t* -> void*
+    sss_hashmap_t inline_funcs = {0}; // binding_t* -> inline_func_t*
 
     // Keep these alive and clean them up at the end so we can continue accessing their memory:
     NEW_LIST(gcc_jit_result*, results);
+    NEW_LIST(gcc_jit_context*, entry_contexts);
 
     // Read lines until we get a blank line
     for (;;) {
@@ -206,6 +455,7 @@ int run_repl(gcc_jit_context *ctx)
         sss_file_t *f = sss_spoof_file("<repl>", buf);
         env->file = f;
         if (setjmp(on_err) != 0) {
+            forget_uncompiled_functions(env, &compiled_functions);
             CLEANUP();
             goto next_line;
         }
@@ -235,8 +485,12 @@ int run_repl(gcc_jit_context *ctx)
         if (verbose)
             fprintf(stderr, "Result: %s\n", ast_to_str(ast));
 
+        env->ctx = gcc_jit_context_new_child_context(ctx);
+        append(entry_contexts, env->ctx);
+        rebind_stale_bindings(env, ctx, &entry_results, &addresses, &inline_funcs);
+
         const char *repl_name = fresh("repl");
-        gcc_func_t *repl_func = gcc_new_func(ctx, NULL, GCC_FUNCTION_EXPORTED, gcc_type(ctx, VOID), repl_name, 0, NULL, 0);
+        gcc_func_t *repl_func = gcc_new_func(env->ctx, NULL, GCC_FUNCTION_EXPORTED, gcc_type(env->ctx, VOID), repl_name, 0, NULL, 0);
         block = gcc_new_block(repl_func, fresh("repl_body"));
 
         env_t *fresh_env = fresh_scope(env);
@@ -248,15 +502,18 @@ int run_repl(gcc_jit_context *ctx)
 
         for (uint32_t i = 1; i <= fresh_env->global->ast_functions.count; i++) {
             auto entry = hnth(&fresh_env->global->ast_functions, i, ast_t*, func_context_t*);
-            if (hget(&compiled_functions, entry->value->func, void*))
-                continue;
-            compile_function(&entry->value->env, entry->value->func, entry->key);
-            hset(&compiled_functions, entry->value->func, entry->value->func);
+            if (!hget(&compiled_functions, entry->value, bool))
+                compile_function(&entry->value->env, entry->value->func, entry->key);
         }
 
-        result = gcc_compile(ctx);
+        result = gcc_compile(env->ctx);
         if (result == NULL)
             compiler_err(fresh_env, NULL, "Compilation failed");
+        hset(&entry_results, env->ctx, result);
+        for (uint32_t i = 1; i <= fresh_env->global->ast_functions.count; i++) {
+            auto entry = hnth(&fresh_env->global->ast_functions, i, ast_t*, func_context_t*);
+            hset(&compiled_functions, entry->value, true);
+        }
 
         // Extract the generated code from "result".   
         void (*run_line)(void) = (void (*)(void))gcc_jit_result_get_code(result, repl_name);
@@ -269,22 +526,15 @@ int run_repl(gcc_jit_context *ctx)
             fputs("\x1b[m", stdout);
         fflush(stdout);
 
-        // Copy out the variables to GC memory
+        // Keep the new variables around for later entries (they will be rebound
+        // to their global memory at the start of the next entry)
         for (sss_hashmap_t *bindings = fresh_env->bindings; bindings; bindings = bindings->fallback) {
             for (uint32_t i = 1; i <= bindings->count; i++) {
                 auto entry = hnth(bindings, i, const char*, binding_t*);
                 binding_t *b = entry->value;
                 if (!b->sym_name || hget(env->bindings, entry->key, binding_t*) == b)
                     continue;
-
-                // Update the binding so it points to the global memory:
-                void *global = gcc_jit_result_get_global(result, b->sym_name);
-                assert(global);
-                gcc_type_t *gcc_t = sss_type_to_gcc(fresh_env, b->type);
-                gcc_rvalue_t *ptr = gcc_jit_context_new_rvalue_from_ptr(fresh_env->ctx, gcc_get_ptr_type(gcc_t), global);
-                b->lval = gcc_jit_rvalue_dereference(ptr, NULL);
-                b->rval = gcc_rval(b->lval);
-                hset(env->bindings, entry->key, b);
+                set_binding(env->bindings, entry->key, b);
             }
         }
 
@@ -298,6 +548,8 @@ int run_repl(gcc_jit_context *ctx)
     foreach (results, result, _) {
         if (*result) gcc_jit_result_release(*result);
     }
+    foreach (entry_contexts, entry_ctx, _)
+        release_context(*entry_ctx);
     return 0;
 }
 
@@ -312,31 +564,20 @@ int main(int argc, char *argv[])
 #endif
 
     GC_INIT();
+    // Compiler objects (ASTs, types, lists) are bump-allocated and then freed all at
+    // once when the program starts running (the REPL never ends its session):
+    arena_begin();
     char *prog_name = strrchr(argv[0], '/');
     prog_name = prog_name ? prog_name + 1 : argv[0];
     bool run_program = true;
 
-    gcc_jit_context *ctx = gcc_jit_context_acquire();
+    extra_gcc_options = LIST(const char*);
+    gcc_jit_context *ctx = new_context();
     assert(ctx != NULL);
 
     // Set $SSSPATH (without overriding if it already exists)
     setenv("SSSPATH", heap_strf(".:%s/.local/share/sss/modules:/usr/local/share/sss/modules", getenv("HOME")), 0);
 
-    const char *gcc_flags[] = {
-        "-ftrapv", "-freg-struct-return",
-    };
-    for (size_t i = 0; i < sizeof(gcc_flags)/sizeof(gcc_flags[0]); i++)
-        gcc_jit_context_add_command_line_option(ctx, gcc_flags[i]);
-
-    const char *driver_flags[] = {
-        "-lgc", "-lcord", "-lm", "-L.", "-l:libsss.so."SSS_VERSION,
-        "-Wl,-rpath", "-Wl,$ORIGIN",
-    };
-    for (size_t i = 0; i < sizeof(driver_flags)/sizeof(driver_flags[0]); i++)
-        gcc_add_driver_opt(ctx, driver_flags[i]);
-    gcc_jit_context_set_bool_option(ctx, GCC_JIT_BOOL_OPTION_DEBUGINFO, true);
-    gcc_jit_context_set_bool_allow_unreachable_blocks(ctx, true);
-
     // register_printf_modifier(L"p");
     if (register_printf_specifier('T', printf_type, printf_pointer_size))
         errx(1, "Couldn't set printf specifier");
@@ -346,7 +587,7 @@ int main(int argc, char *argv[])
     for (int i = 1; i < argc; i++) {
         if (streq(argv[i], "-h") || streq(argv[i], "--help")) {
             puts("sss - The SSS programming language runner");
-            puts("Usage: sss [-h|--help] [-v|--verbose] [--version] [-c|--compile] [-o outfile] [-A|--asm] [-O<optimization>] [-G<GCC flag>] [file.sss | -e '<expr>']");
+            puts("Usage: sss [-h|--help] [-v|--verbose] [--version] [-c|--compile] [-o outfile] [-A|--asm] [-O<optimization>] [-G<GCC flag>] [-j N] [--no-cache] [--time-report] [file.sss | -e '<expr>']");
             return 0;
         } else if (streq(argv[i], "-V")) {
             ++i;
@@ -356,6 +597,19 @@ int main(int argc, char *argv[])
         } else if (streq(argv[i], "-v") || streq(argv[i], "--verbose")) {
             gcc_jit_context_set_bool_option(ctx, GCC_JIT_BOOL_OPTION_DUMP_INITIAL_GIMPLE, 1);
             verbose = true;
+            use_cache = false;
+            continue;
+        } else if (strncmp(argv[i], "-j", 2) == 0) { // Parallel jobs
+            const char *n = argv[i][2] ? argv[i]+2 : (i+1 < argc ? argv[++i] : "");
+            module_options.jobs = atoi(n);
+            if (module_options.jobs < 1)
+                errx(1, "I expected a number of jobs after -j");
+            continue;
+        } else if (streq(argv[i], "--time-report")) {
+            enable_time_report();
+            continue;
+        } else if (streq(argv[i], "--no-cache")) {
+            use_cache = false;
             continue;
         } else if (streq(argv[i], "--version")) {
             puts(SSS_VERSION);
@@ -367,6 +621,7 @@ int main(int argc, char *argv[])
             gcc_jit_context_set_bool_option(ctx, GCC_JIT_BOOL_OPTION_DUMP_GENERATED_CODE, 1);
             gcc_jit_context_add_command_line_option(ctx, "-fverbose-asm");
             verbose = true;
+            use_cache = false;
             continue;
         } else if (streq(argv[i], "-a") || streq(argv[i], "--api")) {
             if (i+1 >= argc)
@@ -383,18 +638,24 @@ int main(int argc, char *argv[])
         } else if (strncmp(argv[i], "-O", 2) == 0) { // Optimization level
             if (streq(argv[i]+2, "fast")) {
                 tail_calls = true;
+                optimization_level = 3;
                 gcc_jit_context_set_int_option(ctx, GCC_JIT_INT_OPTION_OPTIMIZATION_LEVEL, 3);
                 gcc_jit_context_add_command_line_option(ctx, argv[i]);
+                APPEND(extra_gcc_options, argv[i]);
             } else {
                 int opt = atoi(argv[i]+2);
                 tail_calls = opt >= 2;
+                optimization_level = opt;
                 gcc_jit_context_set_int_option(ctx, GCC_JIT_INT_OPTION_OPTIMIZATION_LEVEL, opt);
             }
+            cache_flags = heap_strf("%s %s", cache_flags, argv[i]);
             continue;
         } else if (strncmp(argv[i], "-G", 2) == 0) { // GCC Flag
             if (streq(argv[i]+2, "Ofast") || streq(argv[i]+2, "O2") || streq(argv[i]+2,"O3"))
                 tail_calls = true;
             gcc_jit_context_add_command_line_option(ctx, heap_strf("-%s", argv[i]+2));
+            APPEND(extra_gcc_options, heap_strf("-%s", argv[i]+2));
+            cache_flags = heap_strf("%s %s", cache_flags, argv[i]);
             continue;
         } else if (streq(argv[i], "-e") || streq(argv[i], "--eval")) {
             if (i+1 >= argc)
@@ -402,6 +663,7 @@ int main(int argc, char *argv[])
             const char *src = isatty(STDOUT_FILENO) ? heap_strf(">>> %s", argv[++i]) : heap_strf("say \"$(%s)\"", argv[++i]);
             sss_file_t *f = sss_spoof_file("<argument>", src);
             argv[i] = argv[0];
+            use_cache = false;
             return run_file(ctx, NULL, f, argc-i, &argv[i]);
         }
 
@@ -411,7 +673,9 @@ int main(int argc, char *argv[])
             err(1, "could not pledge");
 #endif
 
+        compile_phase_t prev_phase = enter_phase(PHASE_LOAD);
         sss_file_t *f = sss_load_file(argv[i]);
+        exit_phase(prev_phase);
         if (!f) {
             if (argv[i][0] == '-')
                 errx(1, "'%s' is not a recognized command-line argument", argv[i]);
@@ -430,6 +694,7 @@ int main(int argc, char *argv[])
         run_repl(ctx);
     } else {
         sss_file_t *f = sss_load_file("/dev/stdin");
+        use_cache = false;
         if (run_program) {
             return run_file(ctx, NULL, f, 1, argv);
         } else {
@@ -437,7 +702,7 @@ int main(int argc, char *argv[])
         }
     }
 
-    gcc_jit_context_release(ctx);
+    release_context(ctx);
 
     return 0;
 }
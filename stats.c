@@ -0,0 +1,98 @@
+//
+// stats.c - Phase timing and counters for `sss --time-report`
+//
+// Wall time, CPU time, and GC allocation volume are charged to whichever phase
+// is currently active, and the active phase changes whenever a phase is entered
+// or exited. This means that (for example) time spent typechecking while
+// lowering code to GCC's representation is counted as typechecking, not lowering.
+//
+
+#include <gc.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+bool time_report = false;
+compile_counts_t compile_counts = {0};
+
+static const char *phase_names[NUM_PHASES] = {
+    [PHASE_OTHER]="other", [PHASE_LOAD]="file loading", [PHASE_PARSE]="parsing",
+    [PHASE_TYPECHECK]="type checking", [PHASE_LOWER]="lowering", [PHASE_GCC]="gcc compile",
+};
+
+static struct {
+    double wall, cpu;
+    size_t allocated;
+} totals[NUM_PHASES];
+
+static compile_phase_t current_phase = PHASE_OTHER;
+static double last_wall, last_cpu;
+static size_t last_allocated;
+
+static double now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (double)ts.tv_sec + 1e-9*(double)ts.tv_nsec;
+}
+
+static void charge_current_phase(void)
+{
+    double wall = now(CLOCK_MONOTONIC), cpu = now(CLOCK_PROCESS_CPUTIME_ID);
+    size_t allocated = GC_get_total_bytes();
+    totals[current_phase].wall += wall - last_wall;
+    totals[current_phase].cpu += cpu - last_cpu;
+    totals[current_phase].allocated += allocated - last_allocated;
+    last_wall = wall;
+    last_cpu = cpu;
+    last_allocated = allocated;
+}
+
+void enable_time_report(void)
+{
+    time_report = true;
+    last_wall = now(CLOCK_MONOTONIC);
+    last_cpu = now(CLOCK_PROCESS_CPUTIME_ID);
+    last_allocated = GC_get_total_bytes();
+}
+
+compile_phase_t _switch_phase(compile_phase_t phase)
+{
+    compile_phase_t prev = current_phase;
+    if (phase != prev) {
+        charge_current_phase();
+        current_phase = phase;
+    }
+    return prev;
+}
+
+void print_time_report(void)
+{
+    if (!time_report) return;
+    charge_current_phase();
+    double wall = 0, cpu = 0;
+    size_t allocated = 0;
+    for (int i = 0; i < NUM_PHASES; i++) {
+        wall += totals[i].wall;
+        cpu += totals[i].cpu;
+        allocated += totals[i].allocated;
+    }
+
+    fprintf(stderr, "\nTime report:\n");
+    fprintf(stderr, "  %-16s %10s %6s %10s %12s\n", "phase", "wall (ms)", "%", "cpu (ms)", "alloc (KiB)");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        fprintf(stderr, "  %-16s %10.2f %5.1f%% %10.2f %12.1f\n", phase_names[i], 1e3*totals[i].wall,
+                wall > 0 ? 100.*totals[i].wall/wall : 0., 1e3*totals[i].cpu, (double)totals[i].allocated/1024.);
+    }
+    fprintf(stderr, "  %-16s %10.2f %6s %10.2f %12.1f\n", "total", 1e3*wall, "", 1e3*cpu, (double)allocated/1024.);
+
+    fprintf(stderr, "\nCounts:\n");
+    fprintf(stderr, "  %-16s %10lu\n", "AST nodes", compile_counts.ast_nodes);
+    fprintf(stderr, "  %-16s %10lu\n", "functions", compile_counts.functions);
+    fprintf(stderr, "  %-16s %10lu\n", "GCC types", compile_counts.types);
+    fprintf(stderr, "  %-16s %10lu\n", "binding lookups", compile_counts.binding_lookups);
+    fprintf(stderr, "  %-16s %10lu (%lu cached)\n", "get_type() calls", compile_counts.type_checks, compile_counts.type_cache_hits);
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
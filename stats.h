@@ -0,0 +1,37 @@
+// stats.h - Phase timing and counters for `sss --time-report`
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    PHASE_OTHER = 0, PHASE_LOAD, PHASE_PARSE, PHASE_TYPECHECK, PHASE_LOWER, PHASE_GCC,
+    NUM_PHASES
+} compile_phase_t;
+
+typedef struct {
+    uint64_t ast_nodes, functions, types, binding_lookups, type_checks, type_cache_hits;
+} compile_counts_t;
+
+extern bool time_report;
+extern compile_counts_t compile_counts;
+
+void enable_time_report(void);
+void print_time_report(void);
+compile_phase_t _switch_phase(compile_phase_t phase);
+
+// Time is only charged to the innermost phase, so phases can nest freely:
+//     compile_phase_t prev = enter_phase(PHASE_PARSE);
+//     ...
+//     exit_phase(prev);
+static inline compile_phase_t enter_phase(compile_phase_t phase)
+{
+    return time_report ? _switch_phase(phase) : PHASE_OTHER;
+}
+
+static inline void exit_phase(compile_phase_t prev)
+{
+    if (time_report) (void)_switch_phase(prev);
+}
+
+// vim: ts=4 sw=0 et cino=L2,l1,(0,W4,m1,\:0
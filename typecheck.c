@@ -101,7 +101,6 @@ sss_type_t *parse_type_ast(env_t *env, ast_t *ast)
         auto struct_ = Match(ast, TypeStruct);
         NEW_LIST(const char*, member_names);
         NEW_LIST(sss_type_t*, member_types);
-        sss_type_t *t = Type(StructType, .field_names=member_names, .field_types=member_types, .field_defaults=struct_->members.defaults);
         for (int64_t i = 0, len = length(struct_->members.types); i < len; i++) {
             const char *member_name = ith(struct_->members.names, i);
             APPEND(member_names, member_name);
@@ -111,11 +110,12 @@ sss_type_t *parse_type_ast(env_t *env, ast_t *ast)
                 compiler_err(env, ith(struct_->members.types, i), "Structs can't have stack memory because the struct may outlive the stack frame.");
             APPEND(member_types, member_t);
         }
-        sss_type_t *memoized = hget(&tuple_types, type_to_string(t), sss_type_t*);
+        sss_type_t *t = Type(StructType, .field_names=member_names, .field_types=member_types, .field_defaults=struct_->members.defaults);
+        sss_type_t *memoized = hget(&tuple_types, canonical_type(t), sss_type_t*);
         if (memoized) {
             t = memoized;
         } else {
-            hset(&tuple_types, type_to_string(t), t);
+            hset(&tuple_types, canonical_type(t), t);
         }
         return t;
     }
@@ -336,6 +336,12 @@ sss_type_t *get_field_type(env_t *env, sss_type_t *t, const char *field_name)
         else if (streq(field_name, "__cord"))
             (void)get_cord_func(env, t); 
 
+        // `sort_by()` depends on its argument's type, so only its return type is known here
+        if (t->tag == ArrayType && streq(field_name, "sort_by"))
+            return Type(FunctionType, .arg_names=LIST(const char*, "array", "key"),
+                        .arg_types=LIST(sss_type_t*, Type(PointerType, .pointed=t, .is_stack=true), Type(UnknownType)),
+                        .ret=Type(VoidType));
+
         binding_t *b;
         if (t->tag == ArrayType)
             b = get_array_method(env, t, field_name);
@@ -372,7 +378,7 @@ static void bind_match_patterns(env_t *env, sss_type_t *t, ast_t *pattern)
         if (!name) return;
         binding_t *b = get_binding(env, name);
         if (!b)
-            hset(env->bindings, name, new(binding_t, .type=t));
+            set_binding(env->bindings, name, new(binding_t, .type=t));
         return;
     }
     case Var: {
@@ -441,7 +447,7 @@ static void bind_match_patterns(env_t *env, sss_type_t *t, ast_t *pattern)
     }
 }
 
-sss_type_t *get_type(env_t *env, ast_t *ast)
+static sss_type_t *_get_type(env_t *env, ast_t *ast)
 {
     switch (ast->tag) {
     case Nil: {
@@ -598,11 +604,11 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
         auto entry = Match(ast, TableEntry);
         sss_type_t *t = Type(StructType, .field_names=LIST(const char*, "key", "value"),
                             .field_types=LIST(sss_type_t*, get_type(env, entry->key), get_type(env, entry->value)));
-        sss_type_t *memoized = hget(&tuple_types, type_to_string(t), sss_type_t*);
+        sss_type_t *memoized = hget(&tuple_types, canonical_type(t), sss_type_t*);
         if (memoized) {
             t = memoized;
         } else {
-            hset(&tuple_types, type_to_string(t), t);
+            hset(&tuple_types, canonical_type(t), t);
         }
         return t;
     }
@@ -718,7 +724,7 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
             case Declare: {
                 auto decl = Match(stmt, Declare);
                 sss_type_t *t = get_type(env, decl->value);
-                hset(env->bindings, Match(decl->var, Var)->name, new(binding_t, .type=t, .visible_in_closures=decl->is_global));
+                set_binding(env->bindings, Match(decl->var, Var)->name, new(binding_t, .type=t, .visible_in_closures=decl->is_global));
                 break;
             }
             default:
@@ -937,7 +943,7 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
         // Include only global bindings:
         env_t *lambda_env = file_scope(env);
         for (int64_t i = 0; i < LIST_LEN(lambda->args.types); i++) {
-            hset(lambda_env->bindings, LIST_ITEM(arg_names, i), new(binding_t, .type=LIST_ITEM(arg_types, i)));
+            set_binding(lambda_env->bindings, LIST_ITEM(arg_names, i), new(binding_t, .type=LIST_ITEM(arg_types, i)));
         }
         sss_type_t *ret = get_type(lambda_env, lambda->body);
         if (has_stack_memory(ret))
@@ -954,12 +960,12 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
         // In order to allow default values to reference other arguments (e.g. `def foo(x:Foo, y=x)`)
         // we need to create scoped bindings for them here:
         env_t *default_arg_env = file_scope(env);
-        default_arg_env->bindings = new(sss_hashmap_t, .fallback=default_arg_env->bindings);
+        default_arg_env->bindings = new_bindings(default_arg_env->bindings);
         for (int64_t i = 0; i < LIST_LEN(def->args.types); i++) {
             ast_t *arg_type_def = LIST_ITEM(def->args.types, i);
             if (!arg_type_def) continue;
             sss_type_t *arg_type = parse_type_ast(env, arg_type_def);
-            hset(default_arg_env->bindings, LIST_ITEM(def->args.names, i), new(binding_t, .type=arg_type));
+            set_binding(default_arg_env->bindings, LIST_ITEM(def->args.names, i), new(binding_t, .type=arg_type));
         }
         
         for (int64_t i = 0; i < LIST_LEN(def->args.types); i++) {
@@ -976,7 +982,7 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
                 sss_type_t *arg_type = get_type(default_arg_env, default_val);
                 APPEND(arg_types, arg_type);
                 APPEND(arg_defaults, default_val);
-                hset(default_arg_env->bindings, LIST_ITEM(def->args.names, i), new(binding_t, .type=arg_type));
+                set_binding(default_arg_env->bindings, LIST_ITEM(def->args.names, i), new(binding_t, .type=arg_type));
             }
         }
 
@@ -1008,11 +1014,11 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
 
             sss_type_t *t = Type(StructType, .field_names=field_names, .field_types=field_types,
                                  .units=unit_derive(struct_->units, NULL, env->derived_units));
-            sss_type_t *memoized = hget(&tuple_types, type_to_string(t), sss_type_t*);
+            sss_type_t *memoized = hget(&tuple_types, canonical_type(t), sss_type_t*);
             if (memoized) {
                 t = memoized;
             } else {
-                hset(&tuple_types, type_to_string(t), t);
+                hset(&tuple_types, canonical_type(t), t);
             }
             return t;
         }
@@ -1040,7 +1046,7 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
         if (if_->subject->tag == Declare) {
             subject_t = get_type(env, Match(if_->subject, Declare)->value);
             env = fresh_scope(env);
-            hset(env->bindings, Match(Match(if_->subject, Declare)->var, Var)->name,
+            set_binding(env->bindings, Match(Match(if_->subject, Declare)->var, Var)->name,
                  new(binding_t, .type=subject_t));
         } else {
             subject_t = get_type(env, if_->subject);
@@ -1075,10 +1081,10 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
 
         env_t *loop_env = fresh_scope(env);
         if (for_loop->index) {
-            hset(loop_env->bindings, Match(for_loop->index, Var)->name, new(binding_t, .type=index_type));
+            set_binding(loop_env->bindings, Match(for_loop->index, Var)->name, new(binding_t, .type=index_type));
         }
         if (for_loop->value) {
-            hset(loop_env->bindings, Match(for_loop->value, Var)->name, new(binding_t, .type=value_type));
+            set_binding(loop_env->bindings, Match(for_loop->value, Var)->name, new(binding_t, .type=value_type));
         }
         
         if (for_loop->first)
@@ -1096,8 +1102,8 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
         env = fresh_scope(env);
         auto reduction = Match(ast, Reduction);
         sss_type_t *item_type = get_iter_type(env, reduction->iter);
-        hset(env->bindings, "x", new(binding_t, .type=item_type));
-        hset(env->bindings, "y", new(binding_t, .type=item_type));
+        set_binding(env->bindings, "x", new(binding_t, .type=item_type));
+        set_binding(env->bindings, "y", new(binding_t, .type=item_type));
         sss_type_t *combo_t = get_type(env, reduction->combination);
         if (!can_promote(item_type, combo_t))
             compiler_err(env, ast, "This reduction expression has type %T, but it's iterating over %T values, so I wouldn't know what to produce if there was only one value.",
@@ -1117,7 +1123,7 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
         auto with = Match(ast, With);
         if (with->var) {
             env = fresh_scope(env);
-            hset(env->bindings, Match(with->var, Var)->name, new(binding_t, .type=get_type(env, with->expr)));
+            set_binding(env->bindings, Match(with->var, Var)->name, new(binding_t, .type=get_type(env, with->expr)));
         }
         return get_type(env, with->body);
     }
@@ -1143,7 +1149,7 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
             }
             foreach (fields, field, _) {
                 ast_t *shim = WrapAST(*used, FieldAccess, .fielded=*used, .field=*field);
-                hset(env->bindings, *field, new(binding_t, .type=get_type(env, shim)));
+                set_binding(env->bindings, *field, new(binding_t, .type=get_type(env, shim)));
             }
         }
         return get_type(env, using->body);
@@ -1158,6 +1164,71 @@ sss_type_t *get_type(env_t *env, ast_t *ast)
     compiler_err(env, ast, "I can't figure out the type of: %s", ast_to_str(ast));
 }
 
+// The types of AST nodes are cached for each scope they're checked in. Each
+// bindings table records when it last changed, and a cached type is only used
+// if nothing in the scope's chain of tables (or any namespace) has changed
+// since it was cached. Scopes are often made fresh for each check (e.g. for
+// blocks), so only a few of the most recent entries are kept for each AST node.
+#define MAX_TYPE_CACHE_ENTRIES 8
+
+typedef struct type_cache_entry_s {
+    sss_hashmap_t *bindings;
+    derived_units_t *derived_units;
+    uint64_t generation;
+    sss_type_t *type;
+    struct type_cache_entry_s *next;
+} type_cache_entry_t;
+
+static bool is_valid(type_cache_entry_t *entry)
+{
+    if (entry->generation == bindings_generation)
+        return true;
+    if (!bindings_unchanged_since(entry->bindings, entry->generation))
+        return false;
+    // Nothing it depends on has changed, so it's still good now:
+    entry->generation = bindings_generation;
+    return true;
+}
+
+sss_type_t *get_type(env_t *env, ast_t *ast)
+{
+    ++compile_counts.type_checks;
+    type_cache_entry_t *cached = hget(&env->global->type_cache, ast, type_cache_entry_t*);
+    for (type_cache_entry_t *entry = cached; entry; entry = entry->next) {
+        if (entry->bindings == env->bindings && entry->derived_units == env->derived_units && is_valid(entry)) {
+            ++compile_counts.type_cache_hits;
+            return entry->type;
+        }
+    }
+
+    uint64_t generation = bindings_generation;
+    compile_phase_t prev_phase = enter_phase(PHASE_TYPECHECK);
+    sss_type_t *t = _get_type(env, ast);
+    exit_phase(prev_phase);
+    // If typechecking changed the bindings this depends on, the type might not
+    // be the same next time. (Bindings in new scopes made while checking don't
+    // matter, since those scopes are made again on each check.)
+    if (!bindings_unchanged_since(env->bindings, generation))
+        return t;
+
+    type_cache_entry_t *entry = new(type_cache_entry_t, .bindings=env->bindings, .derived_units=env->derived_units,
+                                    .generation=bindings_generation, .type=t, .next=cached);
+    int num_entries = 1;
+    for (type_cache_entry_t **next = &entry->next; *next; ) {
+        type_cache_entry_t *old = *next;
+        if (num_entries >= MAX_TYPE_CACHE_ENTRIES) {
+            *next = NULL;
+        } else if ((old->bindings == env->bindings && old->derived_units == env->derived_units) || !is_valid(old)) {
+            *next = old->next;
+        } else {
+            ++num_entries;
+            next = &old->next;
+        }
+    }
+    hset(&env->global->type_cache, ast, entry);
+    return t;
+}
+
 bool is_discardable(env_t *env, ast_t *ast)
 {
     switch (ast->tag) {
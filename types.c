@@ -213,11 +213,288 @@ const char* type_to_typeof_string(sss_type_t *t) {
     return CORD_to_char_star(type_to_cord(t, &expanded, DEFAULT));
 }
 
+static inline uint32_t hash_mix(uint32_t h, uint64_t x)
+{
+    x = (x ^ h) * 0x9E3779B97F4A7C15ull;
+    return (uint32_t)(x ^ (x >> 32));
+}
+
+static inline uint32_t hash_name(uint32_t h, const char *name)
+{
+    return hash_mix(h, name ? hash_str(&name) : 0);
+}
+
+static uint32_t hash_names(uint32_t h, List(const char*) names)
+{
+    if (!names) return hash_mix(h, 0);
+    h = hash_mix(h, (uint64_t)LIST_LEN(names) + 1);
+    for (int64_t i = 0; i < LIST_LEN(names); i++)
+        h = hash_name(h, LIST_ITEM(names, i));
+    return h;
+}
+
+// Hash a list of pointers by identity (types, ASTs)
+static uint32_t hash_pointers(uint32_t h, List(const void*) ptrs)
+{
+    if (!ptrs) return hash_mix(h, 0);
+    h = hash_mix(h, (uint64_t)LIST_LEN(ptrs) + 1);
+    for (int64_t i = 0; i < LIST_LEN(ptrs); i++)
+        h = hash_mix(h, (uint64_t)LIST_ITEM(ptrs, i));
+    return h;
+}
+
+static bool names_equal(List(const char*) a, List(const char*) b)
+{
+    if (a == b) return true;
+    if (!a || !b || LIST_LEN(a) != LIST_LEN(b)) return false;
+    for (int64_t i = 0; i < LIST_LEN(a); i++)
+        if (!streq(LIST_ITEM(a, i), LIST_ITEM(b, i))) return false;
+    return true;
+}
+
+static bool pointers_equal(List(const void*) a, List(const void*) b)
+{
+    if (a == b) return true;
+    if (!a || !b || LIST_LEN(a) != LIST_LEN(b)) return false;
+    for (int64_t i = 0; i < LIST_LEN(a); i++)
+        if (LIST_ITEM(a, i) != LIST_ITEM(b, i)) return false;
+    return true;
+}
+
+// Member types are compared by identity, since they've already been interned
+static uint32_t shallow_hash(sss_type_t *t)
+{
+    uint32_t h = hash_mix(0, t->tag);
+    switch (t->tag) {
+    case IntType: {
+        auto int_ = Match(t, IntType);
+        return hash_mix(hash_name(h, int_->units), (uint64_t)int_->bits << 1 | int_->is_unsigned);
+    }
+    case NumType: return hash_mix(hash_name(h, Match(t, NumType)->units), Match(t, NumType)->bits);
+    case TypeType: return hash_mix(h, (uint64_t)Match(t, TypeType)->type);
+    case ArrayType: return hash_mix(h, (uint64_t)Match(t, ArrayType)->item_type);
+    case TableType: return hash_mix(hash_mix(h, (uint64_t)Match(t, TableType)->key_type), (uint64_t)Match(t, TableType)->value_type);
+    case FunctionType: {
+        auto fn = Match(t, FunctionType);
+        h = hash_names(h, fn->arg_names);
+        h = hash_pointers(h, (List(const void*))fn->arg_types);
+        h = hash_pointers(h, (List(const void*))fn->arg_defaults);
+        return hash_mix(h, (uint64_t)fn->ret);
+    }
+    case PointerType: {
+        auto ptr = Match(t, PointerType);
+        return hash_mix(h, (uint64_t)ptr->pointed ^ ((uint64_t)ptr->is_optional | (uint64_t)ptr->is_stack << 1 | (uint64_t)ptr->is_readonly << 2));
+    }
+    case GeneratorType: return hash_mix(h, (uint64_t)Match(t, GeneratorType)->generated);
+    case StructType: {
+        auto struct_ = Match(t, StructType);
+        h = hash_names(h, struct_->field_names);
+        h = hash_pointers(h, (List(const void*))struct_->field_types);
+        h = hash_pointers(h, (List(const void*))struct_->field_defaults);
+        return hash_name(h, struct_->units);
+    }
+    case TaggedUnionType: {
+        auto tagged = Match(t, TaggedUnionType);
+        h = hash_mix(h, tagged->tag_bits);
+        for (int64_t i = 0; tagged->members && i < LIST_LEN(tagged->members); i++) {
+            auto member = LIST_ITEM(tagged->members, i);
+            h = hash_mix(hash_mix(hash_name(h, member.name), (uint64_t)member.tag_value), (uint64_t)member.type);
+        }
+        return h;
+    }
+    case ModuleType: return hash_name(h, Match(t, ModuleType)->path);
+    case VariantType: {
+        auto variant = Match(t, VariantType);
+        return hash_mix(hash_name(hash_name(h, variant->name), variant->filename), (uint64_t)variant->variant_of);
+    }
+    default: return h;
+    }
+}
+
+static bool shallow_eq(sss_type_t *a, sss_type_t *b)
+{
+    if (a->tag != b->tag) return false;
+    switch (a->tag) {
+    case IntType: {
+        auto x = Match(a, IntType); auto y = Match(b, IntType);
+        return x->bits == y->bits && x->is_unsigned == y->is_unsigned && streq(x->units, y->units);
+    }
+    case NumType: return Match(a, NumType)->bits == Match(b, NumType)->bits && streq(Match(a, NumType)->units, Match(b, NumType)->units);
+    case TypeType: return Match(a, TypeType)->type == Match(b, TypeType)->type;
+    case ArrayType: return Match(a, ArrayType)->item_type == Match(b, ArrayType)->item_type;
+    case TableType: return Match(a, TableType)->key_type == Match(b, TableType)->key_type
+                        && Match(a, TableType)->value_type == Match(b, TableType)->value_type;
+    case FunctionType: {
+        auto x = Match(a, FunctionType); auto y = Match(b, FunctionType);
+        // The environment isn't compared, since it's a new scope each time a
+        // function's type is computed. It's only used for evaluating default
+        // arguments, and function types with the same default argument ASTs
+        // come from the same definition.
+        return x->ret == y->ret && names_equal(x->arg_names, y->arg_names)
+            && pointers_equal((List(const void*))x->arg_types, (List(const void*))y->arg_types)
+            && pointers_equal((List(const void*))x->arg_defaults, (List(const void*))y->arg_defaults);
+    }
+    case PointerType: {
+        auto x = Match(a, PointerType); auto y = Match(b, PointerType);
+        return x->pointed == y->pointed && x->is_optional == y->is_optional
+            && x->is_stack == y->is_stack && x->is_readonly == y->is_readonly;
+    }
+    case GeneratorType: return Match(a, GeneratorType)->generated == Match(b, GeneratorType)->generated;
+    case StructType: {
+        auto x = Match(a, StructType); auto y = Match(b, StructType);
+        return streq(x->units, y->units) && names_equal(x->field_names, y->field_names)
+            && pointers_equal((List(const void*))x->field_types, (List(const void*))y->field_types)
+            && pointers_equal((List(const void*))x->field_defaults, (List(const void*))y->field_defaults);
+    }
+    case TaggedUnionType: {
+        auto x = Match(a, TaggedUnionType); auto y = Match(b, TaggedUnionType);
+        if (x->tag_bits != y->tag_bits) return false;
+        if (x->members == y->members) return true;
+        if (!x->members || !y->members || LIST_LEN(x->members) != LIST_LEN(y->members)) return false;
+        for (int64_t i = 0; i < LIST_LEN(x->members); i++) {
+            auto m1 = LIST_ITEM(x->members, i); auto m2 = LIST_ITEM(y->members, i);
+            if (!streq(m1.name, m2.name) || m1.tag_value != m2.tag_value || m1.type != m2.type)
+                return false;
+        }
+        return true;
+    }
+    case ModuleType: return streq(Match(a, ModuleType)->path, Match(b, ModuleType)->path);
+    case VariantType: {
+        auto x = Match(a, VariantType); auto y = Match(b, VariantType);
+        return x->variant_of == y->variant_of && streq(x->name, y->name) && streq(x->filename, y->filename);
+    }
+    default: return true;
+    }
+}
+
+static uint32_t hash_interned(const void *t) { return (*(sss_type_t**)t)->hash; }
+static int32_t compare_interned(const void *a, const void *b) { return shallow_eq(*(sss_type_t**)a, *(sss_type_t**)b) ? 0 : 1; }
+
+typedef struct {
+    sss_type_t *key, *value;
+} interned_entry_t;
+
+sss_type_t *intern_type(sss_type_t *t)
+{
+    static sss_hashmap_t interned = {0};
+    static uint32_t num_interned = 0;
+
+    struct sss_type_s key = *t;
+    key.hash = shallow_hash(t);
+    sss_type_t *key_ptr = &key;
+    sss_type_t **existing = sss_hashmap_get(&interned, hash_interned, compare_interned, sizeof(interned_entry_t),
+                                            &key_ptr, offsetof(interned_entry_t, value));
+    if (existing) return *existing;
+
+    key.id = ++num_interned;
+    sss_type_t *type = arena_new(sss_type_t);
+    memcpy((void*)type, &key, sizeof(key));
+    sss_hashmap_set(&interned, hash_interned, compare_interned, sizeof(interned_entry_t),
+                    &type, offsetof(interned_entry_t, value), &type);
+    return type;
+}
+
+static sss_type_t *canonical_member(sss_type_t *t, bool *stable)
+{
+    if (!t) return NULL;
+    sss_type_t *canonical = canonical_type(t);
+    if (!t->canonical) *stable = false;
+    return canonical;
+}
+
+static List(sss_type_t*) canonical_members(List(sss_type_t*) types, bool *stable)
+{
+    if (!types) return NULL;
+    NEW_LIST(sss_type_t*, canonical);
+    for (int64_t i = 0; i < LIST_LEN(types); i++)
+        APPEND(canonical, canonical_member(LIST_ITEM(types, i), stable));
+    return canonical;
+}
+
+// Get the representative of the set of types that are equal to this one
+// according to type_eq(), i.e. the types that have the same type_to_string()
+// representation. For example, function types only differ by their argument
+// types and return type, and variants by their names. This is cached, except
+// for types that depend on a mutable type, whose representative may change.
+sss_type_t *canonical_type(sss_type_t *t)
+{
+    if (t->canonical) return t->canonical;
+
+    bool stable = (t->id != 0);
+    struct sss_type_s erased = {.tag=t->tag};
+    switch (t->tag) {
+    case IntType: erased.__data.IntType = t->__data.IntType; break;
+    case NumType: {
+        auto num = Match(t, NumType);
+        erased.__data.NumType.units = num->units;
+        erased.__data.NumType.bits = num->bits == 64 ? 64 : 32;
+        break;
+    }
+    case TypeType: erased.__data.TypeType.type = canonical_member(Match(t, TypeType)->type, &stable); break;
+    case ArrayType: erased.__data.ArrayType.item_type = canonical_member(Match(t, ArrayType)->item_type, &stable); break;
+    case TableType: {
+        erased.__data.TableType.key_type = canonical_member(Match(t, TableType)->key_type, &stable);
+        erased.__data.TableType.value_type = canonical_member(Match(t, TableType)->value_type, &stable);
+        break;
+    }
+    case FunctionType: {
+        erased.__data.FunctionType.arg_types = canonical_members(Match(t, FunctionType)->arg_types, &stable);
+        erased.__data.FunctionType.ret = canonical_member(Match(t, FunctionType)->ret, &stable);
+        break;
+    }
+    case PointerType: {
+        auto ptr = Match(t, PointerType);
+        erased.__data.PointerType.pointed = canonical_member(ptr->pointed, &stable);
+        erased.__data.PointerType.is_stack = ptr->is_stack;
+        erased.__data.PointerType.is_optional = ptr->is_optional && !ptr->is_stack;
+        erased.__data.PointerType.is_readonly = ptr->is_readonly;
+        break;
+    }
+    case GeneratorType: erased.__data.GeneratorType.generated = canonical_member(Match(t, GeneratorType)->generated, &stable); break;
+    case StructType: {
+        auto struct_ = Match(t, StructType);
+        NEW_LIST(const char*, names);
+        for (int64_t i = 0; i < LIST_LEN(struct_->field_types); i++) {
+            const char *name = struct_->field_names ? LIST_ITEM(struct_->field_names, i) : NULL;
+            APPEND(names, (name && !streq(name, heap_strf("_%lu", i+1))) ? name : NULL);
+        }
+        erased.__data.StructType.field_names = names;
+        erased.__data.StructType.field_types = canonical_members(struct_->field_types, &stable);
+        erased.__data.StructType.units = struct_->units;
+        break;
+    }
+    case TaggedUnionType: {
+        auto tagged = Match(t, TaggedUnionType);
+        NEW_LIST(sss_tagged_union_member_t, members);
+        for (int64_t i = 0; tagged->members && i < LIST_LEN(tagged->members); i++) {
+            auto member = LIST_ITEM(tagged->members, i);
+            member.type = canonical_member(member.type, &stable);
+            APPEND_STRUCT(members, member);
+        }
+        erased.__data.TaggedUnionType.members = members;
+        break;
+    }
+    case ModuleType: erased.__data.ModuleType = t->__data.ModuleType; break;
+    case VariantType: {
+        // Variants are identified by name, not by what they're a variant of:
+        erased.__data.VariantType.name = Match(t, VariantType)->name;
+        erased.__data.VariantType.filename = Match(t, VariantType)->filename;
+        break;
+    }
+    default: break;
+    }
+
+    sss_type_t *canonical = intern_type(&erased);
+    if (stable)
+        ((struct sss_type_s*)t)->canonical = canonical;
+    return canonical;
+}
+
 bool type_eq(sss_type_t *a, sss_type_t *b)
 {
     if (a == b) return true;
     if (a->tag != b->tag) return false;
-    return streq(type_to_string(a), type_to_string(b));
+    return canonical_type(a) == canonical_type(b);
 }
 
 bool type_is_a(sss_type_t *t, sss_type_t *req)
@@ -595,17 +872,9 @@ bool can_have_cycles(sss_type_t *t)
 
 sss_type_t *table_entry_type(sss_type_t *table_t)
 {
-    static sss_hashmap_t cache = {0};
-    sss_type_t *t = Type(StructType, .field_names=LIST(const char*, "key", "value"),
-                        .field_types=LIST(sss_type_t*, Match(table_t, TableType)->key_type,
-                                          Match(table_t, TableType)->value_type));
-    sss_type_t *cached = hget(&cache, type_to_string(t), sss_type_t*);
-    if (cached) {
-        return cached;
-    } else {
-        hset(&cache, type_to_string(t), t);
-        return t;
-    }
+    return Type(StructType, .field_names=LIST(const char*, "key", "value"),
+                .field_types=LIST(sss_type_t*, Match(table_t, TableType)->key_type,
+                                  Match(table_t, TableType)->value_type));
 }
 
 sss_type_t *base_variant(sss_type_t *t)
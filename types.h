@@ -34,6 +34,12 @@ struct sss_type_s {
         VariantType,
     } tag;
 
+    // Types made with Type() are interned, so structurally identical types
+    // are the same object. These are set when a type is interned:
+    uint32_t hash, id;
+    // Cached representative of all the types that are type_eq() to this one:
+    sss_type_t *canonical;
+
     union {
         struct {
         } UnknownType, AbortType, VoidType, MemoryType, BoolType, CharType, CStringCharType;
@@ -90,7 +96,9 @@ struct sss_type_s {
     } __data;
 };
 
-#define Type(typetag, ...) new(sss_type_t, .tag=typetag, .__data.typetag={__VA_ARGS__})
+#define Type(typetag, ...) intern_type(&(sss_type_t){.tag=typetag, .__data.typetag={__VA_ARGS__}})
+// A type whose members will be filled in later (e.g. for recursive structs), which can't be interned:
+#define MutableType(typetag, ...) arena_new(sss_type_t, .tag=typetag, .__data.typetag={__VA_ARGS__})
 #define INT_TYPE Type(IntType, .bits=64)
 #define NUM_TYPE Type(NumType, .bits=64)
 
@@ -100,6 +108,8 @@ int printf_ast(FILE *stream, const struct printf_info *info, const void *const a
 const char* type_to_string_concise(sss_type_t *t);
 const char* type_to_typeof_string(sss_type_t *t);
 const char* type_to_string(sss_type_t *t);
+sss_type_t *intern_type(sss_type_t *t);
+sss_type_t *canonical_type(sss_type_t *t);
 bool type_eq(sss_type_t *a, sss_type_t *b);
 bool type_is_a(sss_type_t *t, sss_type_t *req);
 sss_type_t *type_or_type(sss_type_t *a, sss_type_t *b);